@@ -0,0 +1,31 @@
+//! V4-front compilation through the FFI
+//!
+//! ```bash
+//! cargo bench --bench compile
+//! ```
+
+use criterion::{BenchmarkId, Criterion, criterion_group, criterion_main};
+use std::hint::black_box;
+use v4_cli::v4front_ffi::{compile_source, free_bytecode};
+
+fn source(words: usize) -> String {
+    let mut src: String = (0..words)
+        .map(|i| format!(": W{} {} DUP + ;\n", i, i))
+        .collect();
+    src.push_str("1 2 + DROP\n");
+    src
+}
+
+fn bench_compile(c: &mut Criterion) {
+    let mut group = c.benchmark_group("compile_source");
+    for words in [1usize, 16, 256] {
+        let src = source(words);
+        group.bench_with_input(BenchmarkId::new("words", words), &src, |b, src| {
+            b.iter(|| free_bytecode(compile_source(black_box(src)).unwrap()))
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_compile);
+criterion_main!(benches);
@@ -0,0 +1,32 @@
+//! CRC-8 throughput: table-driven implementation vs. bitwise reference
+//!
+//! ```bash
+//! cargo bench --bench crc8
+//! ```
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use std::hint::black_box;
+use v4_cli::protocol::calc_crc8;
+use v4_cli::protocol::crc8::calc_crc8_bitwise;
+
+fn bench_crc8(c: &mut Criterion) {
+    let mut group = c.benchmark_group("crc8");
+
+    // PING frame, small EXEC, full default frame, negotiated large frame
+    for size in [3usize, 64, 512, 4096] {
+        let data: Vec<u8> = (0..size).map(|i| (i * 31 + 7) as u8).collect();
+        group.throughput(Throughput::Bytes(size as u64));
+
+        group.bench_with_input(BenchmarkId::new("table", size), &data, |b, data| {
+            b.iter(|| calc_crc8(black_box(data)))
+        });
+        group.bench_with_input(BenchmarkId::new("bitwise", size), &data, |b, data| {
+            b.iter(|| calc_crc8_bitwise(black_box(data)))
+        });
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_crc8);
+criterion_main!(benches);
@@ -0,0 +1,116 @@
+//! V4-link framing: encoding, response decoding and stream reassembly
+//!
+//! ```bash
+//! cargo bench --bench protocol
+//! ```
+
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use std::hint::black_box;
+use v4_cli::compress;
+use v4_cli::protocol::{Command, ErrorCode, Frame, FrameDecoder};
+
+/// PING-sized, small EXEC, default frame
+const SIZES: [usize; 3] = [3, 64, 512];
+
+fn payload(size: usize) -> Vec<u8> {
+    (0..size).map(|i| (i * 31 + 7) as u8).collect()
+}
+
+/// Response frame `[STX=0xA5][LEN][ERR=OK][data][CRC]`
+fn response_frame(data: &[u8]) -> Vec<u8> {
+    Frame::encode_response(ErrorCode::Ok, data)
+}
+
+fn bench_encode(c: &mut Criterion) {
+    let mut group = c.benchmark_group("encode");
+    for size in SIZES {
+        let data = payload(size);
+        group.throughput(Throughput::Bytes(size as u64));
+
+        group.bench_with_input(BenchmarkId::new("frame", size), &data, |b, data| {
+            b.iter(|| {
+                Frame::new(Command::Exec, black_box(data).clone())
+                    .unwrap()
+                    .encode()
+            })
+        });
+        let mut out = Vec::with_capacity(size + 5);
+        group.bench_with_input(BenchmarkId::new("encode_into", size), &data, |b, data| {
+            b.iter(|| Frame::encode_into(Command::Exec, black_box(data), &mut out))
+        });
+    }
+    group.finish();
+}
+
+fn bench_decode(c: &mut Criterion) {
+    let mut group = c.benchmark_group("decode");
+    for size in SIZES {
+        let frame = response_frame(&payload(size));
+        group.throughput(Throughput::Bytes(frame.len() as u64));
+
+        group.bench_with_input(BenchmarkId::new("response", size), &frame, |b, frame| {
+            b.iter(|| Frame::decode_response(black_box(frame)).unwrap())
+        });
+        group.bench_with_input(BenchmarkId::new("view", size), &frame, |b, frame| {
+            b.iter(|| Frame::decode_view(black_box(frame)).unwrap().error_code)
+        });
+    }
+    group.finish();
+}
+
+fn bench_decoder_stream(c: &mut Criterion) {
+    let mut group = c.benchmark_group("decoder_stream");
+    for size in SIZES {
+        // 64 back-to-back responses, fed in 64-byte reads like a UART
+        let stream: Vec<u8> = (0..64)
+            .flat_map(|_| response_frame(&payload(size)))
+            .collect();
+        group.throughput(Throughput::Bytes(stream.len() as u64));
+
+        group.bench_with_input(BenchmarkId::from_parameter(size), &stream, |b, stream| {
+            let mut decoder = FrameDecoder::new(512);
+            b.iter(|| {
+                let mut frames = 0;
+                for read in stream.chunks(64) {
+                    decoder.spare()[..read.len()].copy_from_slice(read);
+                    decoder.commit(read.len());
+                    while let Some(frame) = decoder.next_frame() {
+                        black_box(frame.unwrap());
+                        frames += 1;
+                    }
+                }
+                frames
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_compress(c: &mut Criterion) {
+    let mut group = c.benchmark_group("lzss");
+    // Word bodies: short opcode sequences repeated with small variations
+    let code: Vec<u8> = (0..64)
+        .flat_map(|i| [0x01, i as u8 & 0x0F, 0x00, 0x00, 0x00, 0x51, 0x20, 0x60])
+        .collect();
+    let mut packed = Vec::new();
+    compress::compress(&code, &mut packed);
+    group.throughput(Throughput::Bytes(code.len() as u64));
+
+    let mut out = Vec::new();
+    group.bench_function("compress", |b| {
+        b.iter(|| compress::compress(black_box(&code), &mut out))
+    });
+    group.bench_function("decompress", |b| {
+        b.iter(|| compress::decompress(black_box(&packed), code.len(), &mut out).unwrap())
+    });
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    bench_encode,
+    bench_decode,
+    bench_decoder_stream,
+    bench_compress
+);
+criterion_main!(benches);
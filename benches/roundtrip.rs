@@ -0,0 +1,62 @@
+//! Host-side cost of a command round trip, against an in-memory device
+//!
+//! The [`Loopback`] device answers instantly, so these numbers are the
+//! overhead the CLI adds on top of the wire time; the [`Simulator`] adds
+//! the device-side work of a push. Use `v4 bench --port` to measure a real
+//! board.
+//!
+//! ```bash
+//! cargo bench --bench roundtrip
+//! ```
+
+use criterion::{Criterion, Throughput, criterion_group, criterion_main};
+use std::hint::black_box;
+use std::time::Duration;
+use v4_cli::serial::{PushOptions, V4Serial};
+use v4_cli::sim::Simulator;
+use v4_cli::transport::Loopback;
+
+const TIMEOUT: Duration = Duration::from_secs(1);
+
+fn device() -> V4Serial {
+    V4Serial::from_transport(Box::new(Loopback::new()), 115_200)
+}
+
+fn bench_roundtrip(c: &mut Criterion) {
+    let mut group = c.benchmark_group("roundtrip");
+    let mut serial = device();
+
+    group.bench_function("ping", |b| b.iter(|| serial.ping(TIMEOUT).unwrap()));
+
+    let code: Vec<u8> = (0..serial.max_payload()).map(|i| i as u8).collect();
+    group.throughput(Throughput::Bytes(code.len() as u64));
+    group.bench_function("exec", |b| {
+        b.iter(|| serial.exec(black_box(&code), TIMEOUT).unwrap())
+    });
+
+    let image: Vec<u8> = (0..16 * 1024).map(|i| (i * 7) as u8).collect();
+    let opts = PushOptions {
+        timeout: TIMEOUT,
+        ..PushOptions::default()
+    };
+    group.throughput(Throughput::Bytes(image.len() as u64));
+    group.bench_function("push_chunked_16k", |b| {
+        b.iter(|| {
+            serial
+                .push_chunked(black_box(&image), &opts, |_| {})
+                .unwrap()
+        })
+    });
+
+    // The simulator reassembles, decompresses and CRC-checks every image
+    let mut sim = V4Serial::from_transport(Box::new(Simulator::new()), 115_200);
+    sim.negotiate(115_200, 4096, TIMEOUT).unwrap();
+    group.bench_function("push_chunked_16k_sim_compressed", |b| {
+        b.iter(|| sim.push_chunked(black_box(&image), &opts, |_| {}).unwrap())
+    });
+
+    group.finish();
+}
+
+criterion_group!(benches, bench_roundtrip);
+criterion_main!(benches);
@@ -0,0 +1,46 @@
+//! Process startup cost of the `v4` binary
+//!
+//! Health-check loops run `v4 ping` once a second across a fleet, so a
+//! cold start has to stay cheap: commands that do not compile never create
+//! the V4-front context.
+//!
+//! This is a report-only bench: it sets no budget and fails on no timing,
+//! so a regression shows up only when its numbers are compared. Compare
+//! `ping_sim` with `version` across changes (criterion prints the change
+//! against the previous run); the gap between them grows if the ping path
+//! starts doing work it does not need.
+//!
+//! ```bash
+//! cargo bench --bench startup
+//! ```
+
+use criterion::{Criterion, criterion_group, criterion_main};
+use std::process::{Command, Stdio};
+
+const V4: &str = env!("CARGO_BIN_EXE_v4");
+
+fn run(args: &[&str]) {
+    let status = Command::new(V4)
+        .args(args)
+        .env("V4_NO_DAEMON", "1")
+        .stdout(Stdio::null())
+        .stderr(Stdio::null())
+        .status()
+        .expect("failed to start v4");
+    assert!(status.success(), "v4 {:?} failed", args);
+}
+
+fn bench_startup(c: &mut Criterion) {
+    let mut group = c.benchmark_group("startup");
+    group.bench_function("version", |b| b.iter(|| run(&["--version"])));
+    group.bench_function("ping_sim", |b| {
+        b.iter(|| run(&["ping", "--port", "sim://"]))
+    });
+    group.bench_function("reset_sim", |b| {
+        b.iter(|| run(&["reset", "--port", "sim://"]))
+    });
+    group.finish();
+}
+
+criterion_group!(benches, bench_startup);
+criterion_main!(benches);
@@ -8,6 +8,13 @@ fn main() {
     let v4_path = manifest_dir.parent().unwrap().join("V4-engine");
     let v4front_path = manifest_dir.parent().unwrap().join("V4-front");
 
+    // Compiler version, part of the compile cache key
+    let v4front_cmake = v4front_path.join("CMakeLists.txt");
+    if let Some(version) = cmake_project_version(&v4front_cmake) {
+        println!("cargo:rustc-env=V4FRONT_VERSION={}", version);
+    }
+    println!("cargo:rerun-if-changed={}", v4front_cmake.display());
+
     // Build V4 VM library first
     let mut v4_config = Config::new(&v4_path);
     v4_config
@@ -140,3 +147,13 @@ fn main() {
     println!("cargo:rerun-if-changed={}/src", v4front_path.display());
     println!("cargo:rerun-if-changed={}/include", v4front_path.display());
 }
+
+/// Extract `VERSION` from the `project(...)` call of a CMakeLists.txt
+fn cmake_project_version(path: &std::path::Path) -> Option<String> {
+    let text = std::fs::read_to_string(path).ok()?;
+    let start = text.find("project(")? + "project(".len();
+    let args = &text[start..start + text[start..].find(')')?];
+    let mut tokens = args.split_whitespace();
+    tokens.find(|t| *t == "VERSION")?;
+    tokens.next().map(str::to_string)
+}
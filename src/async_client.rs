@@ -0,0 +1,361 @@
+//! Async V4-link client (`async` feature)
+//!
+//! [`AsyncV4Client`] speaks the same protocol as
+//! [`V4Serial`](crate::serial::V4Serial) over any tokio byte stream.
+//! Waiting for a response suspends the task instead of polling a blocking
+//! port, so one runtime can drive hundreds of devices with one task per
+//! connection rather than one thread.
+//!
+//! tokio has no serial port support of its own: [`AsyncV4Client::open`]
+//! reaches a serial port through the socket of the `v4 daemon` that owns it,
+//! and also accepts `tcp://HOST:PORT` and `sim://` like the blocking client.
+
+use crate::protocol::caps::{HOST_FEATURES, LinkCaps, MAX_LINK_MTU};
+use crate::protocol::frame::MAX_PAYLOAD_SIZE;
+use crate::protocol::{Command, ErrorCode, Frame, FrameDecoder, Response, ResponseView};
+use crate::trace::{self, Direction};
+use crate::transport::TCP_SCHEME;
+use crate::{Result, V4Error};
+use std::io;
+use std::time::Duration;
+use tokio::io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt};
+use tokio::time::Instant;
+
+/// Byte stream an [`AsyncV4Client`] can run over
+pub trait AsyncStream: AsyncRead + AsyncWrite + Unpin + Send {}
+
+impl<T: AsyncRead + AsyncWrite + Unpin + Send + ?Sized> AsyncStream for T {}
+
+/// Async V4-link connection
+pub struct AsyncV4Client<S = Box<dyn AsyncStream>> {
+    stream: S,
+    rx: FrameDecoder,
+    /// Encode buffer reused for every outgoing frame
+    tx: Vec<u8>,
+    caps: LinkCaps,
+}
+
+impl AsyncV4Client {
+    /// Connect to the device named by `port`
+    ///
+    /// `tcp://HOST:PORT` connects over TCP and `sim://` starts a simulated
+    /// device on the current runtime. Any other name is a serial port, which
+    /// must be served by a running `v4 daemon` (Unix only).
+    pub async fn open(port: &str) -> Result<Self> {
+        if let Some(addr) = port.strip_prefix(TCP_SCHEME) {
+            let stream = tokio::net::TcpStream::connect(addr).await?;
+            stream.set_nodelay(true)?;
+            return Ok(Self::new(Box::new(stream)));
+        }
+        if port.starts_with(crate::sim::SIM_SCHEME) {
+            return Ok(Self::new(Box::new(spawn_simulator())));
+        }
+        Self::open_daemon(port).await
+    }
+
+    #[cfg(unix)]
+    async fn open_daemon(port: &str) -> Result<Self> {
+        let path = crate::daemon::socket_path(port);
+        match tokio::net::UnixStream::connect(&path).await {
+            Ok(stream) => Ok(Self::new(Box::new(stream))),
+            Err(e) => Err(io::Error::new(
+                e.kind(),
+                format!(
+                    "No v4 daemon serves {} ({}); start `v4 daemon --port {}`",
+                    port,
+                    path.display(),
+                    port
+                ),
+            )
+            .into()),
+        }
+    }
+
+    #[cfg(not(unix))]
+    async fn open_daemon(port: &str) -> Result<Self> {
+        Err(V4Error::Cli(format!(
+            "Async serial connections need a v4 daemon, which is Unix only: {}",
+            port
+        )))
+    }
+}
+
+impl<S: AsyncStream> AsyncV4Client<S> {
+    /// Run the protocol over an already connected stream
+    pub fn new(stream: S) -> Self {
+        Self {
+            stream,
+            rx: FrameDecoder::default(),
+            tx: Vec::with_capacity(MAX_PAYLOAD_SIZE + 5),
+            caps: LinkCaps::baseline(crate::serial::DEFAULT_BAUD_RATE),
+        }
+    }
+
+    /// Capabilities currently in effect
+    pub fn caps(&self) -> &LinkCaps {
+        &self.caps
+    }
+
+    /// Maximum payload size of a single frame on this link
+    pub fn max_payload(&self) -> usize {
+        self.caps.mtu
+    }
+
+    /// Agree on maximum payload and features with the device
+    ///
+    /// The baud rate is left unchanged; the far end of a socket owns the
+    /// physical line.
+    pub async fn negotiate(&mut self, mtu: usize, timeout: Duration) -> Result<LinkCaps> {
+        let requested = LinkCaps {
+            baud: self.caps.baud,
+            mtu: mtu.clamp(MAX_PAYLOAD_SIZE, MAX_LINK_MTU),
+            features: HOST_FEATURES,
+        };
+        let response = self
+            .send_command(Command::Caps, &requested.encode(), timeout)
+            .await?;
+        if response.error_code != ErrorCode::Ok {
+            return Err(V4Error::Device(format!(
+                "Link negotiation rejected: {}",
+                response.error_code.name()
+            )));
+        }
+        let agreed = LinkCaps::parse(&response.data)
+            .ok_or_else(|| V4Error::Protocol("Malformed CAPS response".to_string()))?
+            .limit_to(&requested);
+        agreed.check()?;
+
+        if agreed.mtu != self.caps.mtu {
+            self.rx = FrameDecoder::new(agreed.mtu);
+        }
+        self.caps = agreed;
+        Ok(agreed)
+    }
+
+    /// Encode and send one command frame
+    pub async fn send_payload(&mut self, command: Command, payload: &[u8]) -> Result<()> {
+        if payload.len() > self.caps.mtu {
+            return Err(V4Error::Protocol(format!(
+                "Payload too large: {} bytes (max {})",
+                payload.len(),
+                self.caps.mtu
+            )));
+        }
+        Frame::encode_into(command, payload, &mut self.tx);
+        trace::frame(Direction::Tx, &self.tx);
+        self.stream.write_all(&self.tx).await?;
+        self.stream.flush().await?;
+        Ok(())
+    }
+
+    /// Receive one raw response frame (CRC already verified)
+    ///
+    /// Resolves as soon as a complete frame has arrived; fails with
+    /// [`V4Error::Timeout`] if none does within `timeout`.
+    pub async fn recv_frame(&mut self, timeout: Duration) -> Result<&[u8]> {
+        let deadline = Instant::now() + timeout;
+
+        loop {
+            if let Some(range) = self.rx.next_frame_range() {
+                let frame = self.rx.frame_at(range?);
+                trace::frame(Direction::Rx, frame);
+                return Ok(frame);
+            }
+
+            let read = self.stream.read(self.rx.spare());
+            let n = match tokio::time::timeout_at(deadline, read).await {
+                Ok(n) => n?,
+                Err(_) => return Err(V4Error::Timeout),
+            };
+            if n == 0 {
+                return Err(io::Error::from(io::ErrorKind::UnexpectedEof).into());
+            }
+            self.rx.commit(n);
+        }
+    }
+
+    /// Receive a response and decode it in place
+    pub async fn recv_view(&mut self, timeout: Duration) -> Result<ResponseView<'_>> {
+        let frame = self.recv_frame(timeout).await?;
+        Frame::decode_view(frame)
+    }
+
+    /// Discard buffered input and whatever the stream has ready
+    ///
+    /// Used after a timeout so that late responses are not matched to the
+    /// wrong request.
+    pub async fn clear_input(&mut self) -> Result<()> {
+        self.rx.clear();
+        loop {
+            let read = self.stream.read(self.rx.spare());
+            match tokio::time::timeout(Duration::ZERO, read).await {
+                Ok(Ok(n)) if n > 0 => {}
+                Ok(Err(e)) => return Err(e.into()),
+                _ => return Ok(()),
+            }
+        }
+    }
+
+    /// Send command and wait for response
+    pub async fn send_command(
+        &mut self,
+        command: Command,
+        payload: &[u8],
+        timeout: Duration,
+    ) -> Result<Response> {
+        self.send_payload(command, payload).await?;
+        let response = self.recv_view(timeout).await.map(Response::from);
+        if matches!(response, Err(V4Error::Timeout)) {
+            // Whatever part of the response did arrive would otherwise be
+            // taken as the answer to the next command
+            self.clear_input().await?;
+        }
+        response
+    }
+
+    /// Send PING command
+    pub async fn ping(&mut self, timeout: Duration) -> Result<ErrorCode> {
+        Ok(self
+            .send_command(Command::Ping, &[], timeout)
+            .await?
+            .error_code)
+    }
+
+    /// Send RESET command
+    pub async fn reset(&mut self, timeout: Duration) -> Result<ErrorCode> {
+        Ok(self
+            .send_command(Command::Reset, &[], timeout)
+            .await?
+            .error_code)
+    }
+
+    /// Send EXEC command with bytecode
+    pub async fn exec(&mut self, bytecode: &[u8], timeout: Duration) -> Result<Response> {
+        self.send_command(Command::Exec, bytecode, timeout).await
+    }
+
+    /// Query stack state
+    pub async fn query_stack(&mut self, timeout: Duration) -> Result<Response> {
+        self.send_command(Command::QueryStack, &[], timeout).await
+    }
+
+    /// Query memory dump at address
+    pub async fn query_memory(
+        &mut self,
+        addr: u32,
+        len: u16,
+        timeout: Duration,
+    ) -> Result<Response> {
+        let payload = crate::serial::memory_payload(addr, len);
+        self.send_command(Command::QueryMemory, &payload, timeout)
+            .await
+    }
+
+    /// Query word information
+    pub async fn query_word(&mut self, word_idx: u16, timeout: Duration) -> Result<Response> {
+        self.send_command(Command::QueryWord, &word_idx.to_le_bytes(), timeout)
+            .await
+    }
+}
+
+/// Run a [`Simulator`](crate::sim::Simulator) on its own task and return
+/// the client end of a stream connected to it
+fn spawn_simulator() -> tokio::io::DuplexStream {
+    use std::io::{Read, Write};
+
+    let (client, mut device_end) = tokio::io::duplex(MAX_LINK_MTU + 5);
+    tokio::spawn(async move {
+        let mut sim = crate::sim::Simulator::new();
+        let mut buf = vec![0u8; 4096];
+        loop {
+            match device_end.read(&mut buf).await {
+                Ok(0) | Err(_) => return,
+                Ok(n) => {
+                    sim.write_all(&buf[..n])
+                        .expect("simulator accepts all input");
+                }
+            }
+            // The simulator answers synchronously; forward everything queued
+            while let Ok(n) = sim.read(&mut buf) {
+                if device_end.write_all(&buf[..n]).await.is_err() {
+                    return;
+                }
+            }
+        }
+    });
+    client
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::bytecode;
+    use crate::repl::WordDef;
+
+    const TIMEOUT: Duration = Duration::from_secs(1);
+
+    fn block_on<F: std::future::Future>(future: F) -> F::Output {
+        tokio::runtime::Builder::new_current_thread()
+            .enable_all()
+            .build()
+            .unwrap()
+            .block_on(future)
+    }
+
+    #[test]
+    fn test_simulated_device() {
+        block_on(async {
+            let mut client = AsyncV4Client::open("sim://").await.unwrap();
+            assert_eq!(client.ping(TIMEOUT).await.unwrap(), ErrorCode::Ok);
+            assert_eq!(client.negotiate(2048, TIMEOUT).await.unwrap().mtu, 2048);
+
+            let words = vec![WordDef {
+                name: "SQ".to_string(),
+                bytecode: vec![0x30, 0x23, 0x51],
+            }];
+            let mut image = Vec::new();
+            bytecode::encode_words(&words, &mut image);
+            let response = client.exec(&image, TIMEOUT).await.unwrap();
+            assert_eq!(response.word_indices, vec![0]);
+
+            let response = client.query_word(0, TIMEOUT).await.unwrap();
+            assert_eq!(&response.data[..3], b"\x02SQ");
+        });
+    }
+
+    #[test]
+    fn test_many_clients_on_one_thread() {
+        block_on(async {
+            let tasks: Vec<_> = (0..64)
+                .map(|_| {
+                    tokio::spawn(async {
+                        let mut client = AsyncV4Client::open("sim://").await.unwrap();
+                        for _ in 0..10 {
+                            client.ping(TIMEOUT).await.unwrap();
+                        }
+                    })
+                })
+                .collect();
+            for task in tasks {
+                task.await.unwrap();
+            }
+        });
+    }
+
+    #[test]
+    fn test_timeout() {
+        block_on(async {
+            // Peer that only sends part of its answer in time
+            let (stream, mut peer) = tokio::io::duplex(64);
+            let mut client = AsyncV4Client::new(stream);
+            let response = Frame::encode_response(ErrorCode::Ok, &[]);
+            peer.write_all(&response[..2]).await.unwrap();
+            let result = client.ping(Duration::from_millis(20)).await;
+            assert!(matches!(result, Err(V4Error::Timeout)));
+
+            // The partial frame was dropped and does not corrupt the next one
+            peer.write_all(&response).await.unwrap();
+            assert_eq!(client.ping(TIMEOUT).await.unwrap(), ErrorCode::Ok);
+        });
+    }
+}
@@ -0,0 +1,702 @@
+//! V4 bytecode image (.v4b) format
+//!
+//! ```text
+//! [HEADER (16 bytes)][WORD_ENTRY...][MAIN_CODE...]
+//!
+//! HEADER:     "V4BC" [VER_MAJOR][VER_MINOR][FLAGS (u16)]
+//!             [CODE_SIZE (u32)][WORD_COUNT (u32)]        (little-endian)
+//! WORD_ENTRY: [NAME_LEN][NAME...][CODE_LEN (u16)][CODE...]
+//! ```
+//!
+//! Word entries use the same layout as the QueryWord response, so the
+//! device registers each word in order and returns its index in the EXEC
+//! response.
+//!
+//! Version 0.3 keeps the header and places the payload in sections, listed
+//! in a table after the header:
+//!
+//! ```text
+//! [HEADER (16 bytes)][SECTION_COUNT (u32)][SECTION_ENTRY...][SECTION...]
+//!
+//! SECTION_ENTRY: [KIND][CODEC][RESERVED (u16)][OFFSET (u32)]
+//!                [SIZE (u32)][RAW_SIZE (u32)][CRC32 (u32)]
+//! ```
+//!
+//! Sections start at 4-byte aligned offsets from the start of the image.
+//! `WORD_INDEX` holds the `u32` offset of every entry in `WORDS`, so word
+//! *n* is found without scanning; `WORDS` holds entries as in v0.2 and
+//! `MAIN` the main code. Each section carries a CRC-32 of its stored bytes
+//! and a codec byte for compressed sections. Sections of unknown kinds are
+//! checked and skipped.
+//!
+//! The device protocol carries v0.2 images; v0.3 files are converted when
+//! they are sent.
+
+use crate::protocol::calc_crc32;
+use crate::repl::WordDef;
+use crate::{Result, V4Error};
+use std::borrow::Cow;
+use std::ops::Range;
+use std::str::FromStr;
+
+/// Magic number at the start of every image
+pub const MAGIC: &[u8; 4] = b"V4BC";
+
+/// Size of the fixed image header
+pub const HEADER_SIZE: usize = 16;
+
+/// Size of one v0.3 section table entry
+pub const SECTION_ENTRY_SIZE: usize = 20;
+
+/// Alignment of v0.3 sections
+pub const SECTION_ALIGN: usize = 4;
+
+/// v0.3 section kinds
+pub mod section {
+    /// `u32` offset of each word entry within [`WORDS`]
+    pub const WORD_INDEX: u8 = 1;
+    /// Word entries
+    pub const WORDS: u8 = 2;
+    /// Main code
+    pub const MAIN: u8 = 3;
+}
+
+/// Section stored as is
+pub const CODEC_NONE: u8 = 0;
+
+/// Image header
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Header {
+    pub version_major: u8,
+    pub version_minor: u8,
+    pub flags: u16,
+    pub code_size: u32,
+    pub word_count: u32,
+}
+
+impl Header {
+    /// Header for a v0.2 image
+    pub fn v0_2(code_size: u32, word_count: u32) -> Self {
+        Self {
+            version_major: 0,
+            version_minor: 2,
+            flags: 0,
+            code_size,
+            word_count,
+        }
+    }
+
+    /// Header for a v0.3 image
+    pub fn v0_3(code_size: u32, word_count: u32) -> Self {
+        Self {
+            version_minor: 3,
+            ..Self::v0_2(code_size, word_count)
+        }
+    }
+
+    /// `(major, minor)` format version
+    pub fn version(&self) -> (u8, u8) {
+        (self.version_major, self.version_minor)
+    }
+
+    /// Parse and validate the header at the start of `data`
+    pub fn parse(data: &[u8]) -> Result<Self> {
+        if data.len() < HEADER_SIZE {
+            return Err(V4Error::Protocol(
+                "File too small to contain V4 bytecode header".to_string(),
+            ));
+        }
+        if &data[0..4] != MAGIC {
+            return Err(V4Error::Protocol(
+                "Invalid V4 bytecode file (missing V4BC magic number)".to_string(),
+            ));
+        }
+
+        Ok(Self {
+            version_major: data[4],
+            version_minor: data[5],
+            flags: u16::from_le_bytes([data[6], data[7]]),
+            code_size: u32::from_le_bytes([data[8], data[9], data[10], data[11]]),
+            word_count: u32::from_le_bytes([data[12], data[13], data[14], data[15]]),
+        })
+    }
+
+    /// Append the encoded header to `out`
+    pub fn write_into(&self, out: &mut Vec<u8>) {
+        out.extend_from_slice(MAGIC);
+        out.push(self.version_major);
+        out.push(self.version_minor);
+        out.extend_from_slice(&self.flags.to_le_bytes());
+        out.extend_from_slice(&self.code_size.to_le_bytes());
+        out.extend_from_slice(&self.word_count.to_le_bytes());
+    }
+}
+
+/// Encoded size of a word entry, or `None` if the word cannot be encoded
+/// (name longer than 255 bytes or code longer than 65535 bytes)
+pub fn word_entry_size(word: &WordDef) -> Option<usize> {
+    if word.name.len() > u8::MAX as usize || word.bytecode.len() > u16::MAX as usize {
+        return None;
+    }
+    Some(1 + word.name.len() + 2 + word.bytecode.len())
+}
+
+/// Encode word definitions as a v0.2 image without main code
+///
+/// `out` is cleared first so the buffer can be reused across batches.
+/// All words must satisfy [`word_entry_size`].
+pub fn encode_words(words: &[WordDef], out: &mut Vec<u8>) {
+    encode_image(words, &[], out);
+}
+
+/// Encode word definitions followed by main code as a v0.2 image
+///
+/// `out` is cleared first. All words must satisfy [`word_entry_size`].
+pub fn encode_image(words: &[WordDef], main: &[u8], out: &mut Vec<u8>) {
+    out.clear();
+    Header::v0_2(main.len() as u32, words.len() as u32).write_into(out);
+    for word in words {
+        out.push(word.name.len() as u8);
+        out.extend_from_slice(word.name.as_bytes());
+        out.extend_from_slice(&(word.bytecode.len() as u16).to_le_bytes());
+        out.extend_from_slice(&word.bytecode);
+    }
+    out.extend_from_slice(main);
+}
+
+/// Image format written by `v4 compile`
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub enum Format {
+    /// Header, word entries and main code
+    #[default]
+    V0_2,
+    /// Sectioned image with word index and section checksums
+    V0_3,
+}
+
+impl FromStr for Format {
+    type Err = String;
+
+    fn from_str(s: &str) -> std::result::Result<Self, String> {
+        match s.trim_start_matches('v') {
+            "0.2" => Ok(Format::V0_2),
+            "0.3" => Ok(Format::V0_3),
+            _ => Err(format!(
+                "Unknown image format: {} (expected v0.2 or v0.3)",
+                s
+            )),
+        }
+    }
+}
+
+/// Re-encode an image in `format`; borrows `data` if it already is
+pub fn convert(data: &[u8], format: Format) -> Result<Cow<'_, [u8]>> {
+    let target = match format {
+        Format::V0_2 => (0, 2),
+        Format::V0_3 => (0, 3),
+    };
+    let image = Image::parse(data)?;
+    if image.header.version() == target {
+        return Ok(Cow::Borrowed(data));
+    }
+    let mut out = Vec::with_capacity(data.len() + 64);
+    match format {
+        Format::V0_2 => encode_image(&image.words, image.main, &mut out),
+        Format::V0_3 => encode_sections(&image.words, image.main, &mut out)?,
+    }
+    Ok(Cow::Owned(out))
+}
+
+/// Decoded v0.2 or v0.3 image
+#[derive(Debug)]
+pub struct Image<'a> {
+    pub header: Header,
+    pub words: Vec<WordDef>,
+    pub main: &'a [u8],
+}
+
+impl<'a> Image<'a> {
+    /// Split an image into its word definitions and main code
+    pub fn parse(data: &'a [u8]) -> Result<Self> {
+        let header = Header::parse(data)?;
+        let (words, main) = match header.version() {
+            (0, 2) => {
+                let mut rest = &data[HEADER_SIZE..];
+                let mut words = Vec::with_capacity((header.word_count as usize).min(1024));
+                for _ in 0..header.word_count {
+                    let (word, tail) = split_word_entry(rest)?;
+                    words.push(word.to_word_def());
+                    rest = tail;
+                }
+                (words, rest)
+            }
+            (0, 3) => {
+                let sections = Sections::parse(data)?;
+                let words = sections
+                    .words()
+                    .map(|word| word.map(|w| w.to_word_def()))
+                    .collect::<Result<Vec<_>>>()?;
+                (words, sections.main())
+            }
+            (major, minor) => {
+                return Err(V4Error::Protocol(format!(
+                    "Unsupported bytecode version {}.{}",
+                    major, minor
+                )));
+            }
+        };
+
+        if main.len() != header.code_size as usize {
+            return Err(V4Error::Protocol(format!(
+                "Main code is {} bytes, header says {}",
+                main.len(),
+                header.code_size
+            )));
+        }
+        Ok(Self {
+            header,
+            words,
+            main,
+        })
+    }
+}
+
+/// Word entry borrowed from an image
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct WordRef<'a> {
+    pub name: &'a str,
+    pub bytecode: &'a [u8],
+}
+
+impl WordRef<'_> {
+    /// Owned copy of the word
+    pub fn to_word_def(&self) -> WordDef {
+        WordDef {
+            name: self.name.to_string(),
+            bytecode: self.bytecode.to_vec(),
+        }
+    }
+}
+
+/// Split the word entry at the start of `data` from the rest
+fn split_word_entry(data: &[u8]) -> Result<(WordRef<'_>, &[u8])> {
+    let malformed = || V4Error::Protocol("Truncated word entry in bytecode image".to_string());
+    let (&name_len, tail) = data.split_first().ok_or_else(malformed)?;
+    let name_len = name_len as usize;
+    if tail.len() < name_len + 2 {
+        return Err(malformed());
+    }
+    let name = std::str::from_utf8(&tail[..name_len])
+        .map_err(|_| V4Error::Protocol("Word name is not valid UTF-8".to_string()))?;
+    let code_len = u16::from_le_bytes([tail[name_len], tail[name_len + 1]]) as usize;
+    let tail = &tail[name_len + 2..];
+    if tail.len() < code_len {
+        return Err(malformed());
+    }
+    let word = WordRef {
+        name,
+        bytecode: &tail[..code_len],
+    };
+    Ok((word, &tail[code_len..]))
+}
+
+/// Section of a v0.3 image, borrowed from the image
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Section<'a> {
+    pub kind: u8,
+    pub codec: u8,
+    /// Size once decoded
+    pub raw_size: u32,
+    /// Byte offset of the section in the image
+    pub offset: u32,
+    /// Stored bytes
+    pub data: &'a [u8],
+}
+
+/// Validated section table of a v0.3 image
+///
+/// Parsing checks bounds, alignment and checksums of every section and the
+/// word index, but copies nothing.
+#[derive(Debug)]
+pub struct Sections<'a> {
+    pub header: Header,
+    sections: Vec<Section<'a>>,
+    index: &'a [u8],
+    words: &'a [u8],
+}
+
+impl<'a> Sections<'a> {
+    /// Parse and validate the section table of a v0.3 image
+    pub fn parse(data: &'a [u8]) -> Result<Self> {
+        let header = Header::parse(data)?;
+        if header.version() != (0, 3) {
+            return Err(V4Error::Protocol(format!(
+                "Expected a v0.3 image, found version {}.{}",
+                header.version_major, header.version_minor
+            )));
+        }
+        let invalid = |msg: String| V4Error::Protocol(format!("Invalid v0.3 image: {}", msg));
+
+        let count = read_u32(data, HEADER_SIZE)
+            .ok_or_else(|| invalid("truncated section table".to_string()))?
+            as usize;
+        let table = data
+            .get(HEADER_SIZE + 4..)
+            .and_then(|rest| rest.get(..count.checked_mul(SECTION_ENTRY_SIZE)?))
+            .ok_or_else(|| invalid("truncated section table".to_string()))?;
+
+        let mut sections = Vec::with_capacity(count);
+        for entry in table.chunks_exact(SECTION_ENTRY_SIZE) {
+            let field =
+                |at| u32::from_le_bytes([entry[at], entry[at + 1], entry[at + 2], entry[at + 3]]);
+            let (kind, codec) = (entry[0], entry[1]);
+            let (offset, size, raw_size, crc) = (field(4), field(8), field(12), field(16));
+
+            let bytes = (offset as usize)
+                .checked_add(size as usize)
+                .and_then(|end| data.get(offset as usize..end))
+                .ok_or_else(|| invalid(format!("section {} out of bounds", kind)))?;
+            if !(offset as usize).is_multiple_of(SECTION_ALIGN) {
+                return Err(invalid(format!("section {} is not aligned", kind)));
+            }
+            if calc_crc32(bytes) != crc {
+                return Err(invalid(format!("section {} fails its CRC check", kind)));
+            }
+            if codec == CODEC_NONE && raw_size != size {
+                return Err(invalid(format!("section {} size mismatch", kind)));
+            }
+            if codec != CODEC_NONE && kind <= section::MAIN {
+                return Err(invalid(format!(
+                    "unsupported codec {} in section {}",
+                    codec, kind
+                )));
+            }
+            if sections.iter().any(|s: &Section| s.kind == kind) {
+                return Err(invalid(format!("duplicate section {}", kind)));
+            }
+            sections.push(Section {
+                kind,
+                codec,
+                raw_size,
+                offset,
+                data: bytes,
+            });
+        }
+
+        let find = |kind| sections.iter().find(|s| s.kind == kind).map(|s| s.data);
+        let index = find(section::WORD_INDEX).unwrap_or_default();
+        let words = find(section::WORDS).unwrap_or_default();
+        if index.len() != header.word_count as usize * 4 {
+            return Err(invalid(format!(
+                "word index has {} bytes for {} words",
+                index.len(),
+                header.word_count
+            )));
+        }
+
+        let image = Self {
+            header,
+            sections,
+            index,
+            words,
+        };
+        // Every indexed entry must lie within WORDS and be well-formed
+        for word in image.words() {
+            word?;
+        }
+        Ok(image)
+    }
+
+    /// All sections in table order
+    pub fn sections(&self) -> &[Section<'a>] {
+        &self.sections
+    }
+
+    /// Section of the given kind
+    pub fn get(&self, kind: u8) -> Option<&Section<'a>> {
+        self.sections.iter().find(|s| s.kind == kind)
+    }
+
+    /// Main code
+    pub fn main(&self) -> &'a [u8] {
+        self.get(section::MAIN).map(|s| s.data).unwrap_or_default()
+    }
+
+    /// Number of words
+    pub fn word_count(&self) -> usize {
+        self.index.len() / 4
+    }
+
+    /// Word `n`, looked up through the word index
+    pub fn word(&self, n: usize) -> Result<WordRef<'a>> {
+        let offset = read_u32(self.index, n * 4).ok_or_else(|| {
+            V4Error::Protocol(format!(
+                "Word {} not in image ({} words)",
+                n,
+                self.word_count()
+            ))
+        })? as usize;
+        let entry = self.words.get(offset..).ok_or_else(|| {
+            V4Error::Protocol(format!(
+                "Word {} offset {} outside WORDS section",
+                n, offset
+            ))
+        })?;
+        split_word_entry(entry).map(|(word, _)| word)
+    }
+
+    /// Words in index order
+    pub fn words(&self) -> impl Iterator<Item = Result<WordRef<'a>>> + '_ {
+        (0..self.word_count()).map(|n| self.word(n))
+    }
+}
+
+fn read_u32(data: &[u8], at: usize) -> Option<u32> {
+    let b = data.get(at..at.checked_add(4)?)?;
+    Some(u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+}
+
+/// Encode word definitions followed by main code as a v0.3 image
+///
+/// `out` is cleared first. Fails if a word does not satisfy
+/// [`word_entry_size`] or a section outgrows its 32-bit size.
+pub fn encode_sections(words: &[WordDef], main: &[u8], out: &mut Vec<u8>) -> Result<()> {
+    const KINDS: [u8; 3] = [section::WORD_INDEX, section::WORDS, section::MAIN];
+
+    let mut offsets = Vec::with_capacity(words.len());
+    let mut offset = 0u32;
+    for word in words {
+        offsets.push(offset);
+        offset = word_entry_size(word)
+            .and_then(|size| u32::try_from(size).ok())
+            .and_then(|size| offset.checked_add(size))
+            .ok_or_else(|| {
+                V4Error::Protocol(format!(
+                    "Word {:?} cannot be encoded ({}-byte name, {} bytes of code)",
+                    word.name,
+                    word.name.len(),
+                    word.bytecode.len()
+                ))
+            })?;
+    }
+    let code_size = u32::try_from(main.len())
+        .map_err(|_| V4Error::Protocol(format!("Main code too large ({} bytes)", main.len())))?;
+
+    out.clear();
+    Header::v0_3(code_size, words.len() as u32).write_into(out);
+    out.extend_from_slice(&(KINDS.len() as u32).to_le_bytes());
+    let table = out.len();
+    out.resize(table + KINDS.len() * SECTION_ENTRY_SIZE, 0);
+
+    let mut ranges = [0..0, 0..0, 0..0];
+    for (range, kind) in ranges.iter_mut().zip(KINDS) {
+        out.resize(out.len().next_multiple_of(SECTION_ALIGN), 0);
+        let start = out.len();
+        match kind {
+            section::WORD_INDEX => {
+                for offset in &offsets {
+                    out.extend_from_slice(&offset.to_le_bytes());
+                }
+            }
+            section::WORDS => {
+                for word in words {
+                    out.push(word.name.len() as u8);
+                    out.extend_from_slice(word.name.as_bytes());
+                    out.extend_from_slice(&(word.bytecode.len() as u16).to_le_bytes());
+                    out.extend_from_slice(&word.bytecode);
+                }
+            }
+            _ => out.extend_from_slice(main),
+        }
+        *range = start..out.len();
+    }
+
+    for (i, (range, kind)) in ranges.into_iter().zip(KINDS).enumerate() {
+        let (Ok(start), Ok(size)) = (u32::try_from(range.start), u32::try_from(range.len())) else {
+            return Err(V4Error::Protocol("Image too large for v0.3".to_string()));
+        };
+        let crc = calc_crc32(&out[range.clone()]);
+        let entry = &mut out[table + i * SECTION_ENTRY_SIZE..][..SECTION_ENTRY_SIZE];
+        entry[0] = kind;
+        entry[1] = CODEC_NONE;
+        entry[4..8].copy_from_slice(&start.to_le_bytes());
+        entry[8..12].copy_from_slice(&size.to_le_bytes());
+        entry[12..16].copy_from_slice(&size.to_le_bytes());
+        entry[16..20].copy_from_slice(&crc.to_le_bytes());
+    }
+    Ok(())
+}
+
+/// Group consecutive words into images of at most `max_image` bytes
+///
+/// Returns index ranges into `words`, in order. A word that does not fit
+/// into an image on its own (or cannot be encoded) gets a range of its own
+/// and should be sent unbatched.
+pub fn plan_batches(words: &[WordDef], max_image: usize) -> Vec<Range<usize>> {
+    let mut batches = Vec::new();
+    let mut start = 0;
+    let mut size = HEADER_SIZE;
+
+    for (i, word) in words.iter().enumerate() {
+        let entry = word_entry_size(word).filter(|n| HEADER_SIZE + n <= max_image);
+        match entry {
+            Some(n) if size + n <= max_image => size += n,
+            Some(n) => {
+                if i > start {
+                    batches.push(start..i);
+                }
+                start = i;
+                size = HEADER_SIZE + n;
+            }
+            None => {
+                if i > start {
+                    batches.push(start..i);
+                }
+                batches.push(i..i + 1);
+                start = i + 1;
+                size = HEADER_SIZE;
+            }
+        }
+    }
+    if start < words.len() {
+        batches.push(start..words.len());
+    }
+    batches
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn word(name: &str, len: usize) -> WordDef {
+        WordDef {
+            name: name.to_string(),
+            bytecode: vec![0x51; len],
+        }
+    }
+
+    #[test]
+    fn test_header_roundtrip() {
+        let header = Header::v0_2(0x1234, 3);
+        let mut out = Vec::new();
+        header.write_into(&mut out);
+        assert_eq!(out.len(), HEADER_SIZE);
+        assert_eq!(Header::parse(&out).unwrap(), header);
+    }
+
+    #[test]
+    fn test_header_rejects_bad_magic() {
+        let data = [0u8; HEADER_SIZE];
+        assert!(matches!(Header::parse(&data), Err(V4Error::Protocol(_))));
+        assert!(Header::parse(b"V4BC").is_err());
+    }
+
+    #[test]
+    fn test_encode_words() {
+        let words = vec![word("A", 2), word("BC", 1)];
+        let mut out = vec![0xEE];
+        encode_words(&words, &mut out);
+
+        let header = Header::parse(&out).unwrap();
+        assert_eq!(header.word_count, 2);
+        assert_eq!(header.code_size, 0);
+        assert_eq!(
+            &out[HEADER_SIZE..],
+            &[1, b'A', 2, 0, 0x51, 0x51, 2, b'B', b'C', 1, 0, 0x51]
+        );
+    }
+
+    #[test]
+    fn test_image_roundtrip() {
+        let words = vec![word("A", 2), word("BC", 1)];
+        let mut out = Vec::new();
+        encode_image(&words, &[0x10, 0x20, 0x30], &mut out);
+
+        let image = Image::parse(&out).unwrap();
+        assert_eq!(image.header.code_size, 3);
+        assert_eq!(image.words.len(), 2);
+        assert_eq!(image.words[1].name, "BC");
+        assert_eq!(image.words[1].bytecode, vec![0x51]);
+        assert_eq!(image.main, &[0x10, 0x20, 0x30]);
+
+        assert!(Image::parse(&out[..out.len() - 1]).is_err());
+        assert!(Image::parse(&out[..HEADER_SIZE + 3]).is_err());
+    }
+
+    #[test]
+    fn test_sections_roundtrip() {
+        let words = vec![word("A", 2), word("BCD", 5), word("E", 0)];
+        let mut out = Vec::new();
+        encode_sections(&words, &[0x10, 0x20, 0x30], &mut out).unwrap();
+
+        let sections = Sections::parse(&out).unwrap();
+        assert_eq!(sections.header.version(), (0, 3));
+        assert_eq!(sections.sections().len(), 3);
+        assert!(sections.sections().iter().all(|s| s.offset % 4 == 0));
+        assert_eq!(sections.word_count(), 3);
+        assert_eq!(sections.word(1).unwrap().name, "BCD");
+        assert_eq!(sections.word(2).unwrap().bytecode, &[] as &[u8]);
+        assert!(sections.word(3).is_err());
+        assert_eq!(sections.main(), &[0x10, 0x20, 0x30]);
+
+        let image = Image::parse(&out).unwrap();
+        assert_eq!(image.words, words);
+        assert_eq!(image.main, &[0x10, 0x20, 0x30]);
+    }
+
+    #[test]
+    fn test_sections_reject_oversized_words() {
+        let mut out = Vec::new();
+        let long_name = WordDef {
+            name: "N".repeat(256),
+            bytecode: vec![0x51],
+        };
+        assert!(encode_sections(&[word("A", 2), long_name], &[], &mut out).is_err());
+        assert!(encode_sections(&[word("A", 65536)], &[], &mut out).is_err());
+        encode_sections(&[word("A", 65535)], &[], &mut out).unwrap();
+    }
+
+    #[test]
+    fn test_sections_reject_corruption() {
+        let mut out = Vec::new();
+        encode_sections(&[word("A", 2)], &[0x10], &mut out).unwrap();
+
+        let mut corrupt = out.clone();
+        *corrupt.last_mut().unwrap() ^= 0xFF;
+        assert!(Sections::parse(&corrupt).is_err());
+        assert!(Sections::parse(&out[..out.len() - 1]).is_err());
+        assert!(Sections::parse(&out[..HEADER_SIZE + 2]).is_err());
+    }
+
+    #[test]
+    fn test_convert_between_formats() {
+        let words = vec![word("A", 2), word("BC", 1)];
+        let mut v2 = Vec::new();
+        encode_image(&words, &[0x10], &mut v2);
+
+        assert!(matches!(
+            convert(&v2, Format::V0_2).unwrap(),
+            Cow::Borrowed(_)
+        ));
+        let v3 = convert(&v2, Format::V0_3).unwrap().into_owned();
+        assert_eq!(Header::parse(&v3).unwrap().version(), (0, 3));
+        assert_eq!(convert(&v3, Format::V0_2).unwrap().into_owned(), v2);
+        assert_eq!("v0.3".parse(), Ok(Format::V0_3));
+        assert!("0.4".parse::<Format>().is_err());
+    }
+
+    #[test]
+    fn test_plan_batches_packs_greedily() {
+        // Each entry: 1 + 1 + 2 + 10 = 14 bytes
+        let words: Vec<_> = (0..10).map(|_| word("W", 10)).collect();
+        let batches = plan_batches(&words, HEADER_SIZE + 14 * 4);
+        assert_eq!(batches, vec![0..4, 4..8, 8..10]);
+    }
+
+    #[test]
+    fn test_plan_batches_isolates_oversized_word() {
+        let words = vec![word("A", 4), word("BIG", 600), word("C", 4)];
+        let batches = plan_batches(&words, 512);
+        assert_eq!(batches, vec![0..1, 1..2, 2..3]);
+    }
+}
@@ -0,0 +1,360 @@
+//! Content-addressed compile cache
+//!
+//! Compiling the same source with the same compiler always gives the same
+//! output, so results are stored under a SHA-256 of the source, the cache
+//! kind, the compiler version and, for `v4 exec`, the device words the
+//! compiler was given. Entries live in `$V4_CACHE_DIR`, or
+//! `v4` under the platform cache directory (`$XDG_CACHE_HOME`,
+//! `~/.cache`, `%LOCALAPPDATA%`).
+//!
+//! Compile results depend on the words registered from the device (their
+//! indices are compiled into calls), so [`CompileCache::get_result`] is
+//! keyed on the restored [`ContextSnapshot`] as well. Failures to read or
+//! write the cache are never fatal; the caller just compiles.
+
+use crate::context::ContextSnapshot;
+use crate::repl::{CompileResult, WordDef};
+use crate::trace::Level;
+use sha2::{Digest, Sha256};
+use std::fs;
+use std::io;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// Environment variable overriding the cache directory
+pub const ENV_CACHE_DIR: &str = "V4_CACHE_DIR";
+
+/// Version of the linked V4-front compiler, part of every cache key
+///
+/// Set by the build script from V4-front's CMake project version.
+pub const V4FRONT_VERSION: &str = match option_env!("V4FRONT_VERSION") {
+    Some(v) => v,
+    None => "unknown",
+};
+
+/// Magic number of serialized [`CompileResult`] entries
+const RESULT_MAGIC: &[u8; 4] = b"V4CR";
+
+/// Kind of cached artefact
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Kind {
+    /// `.v4b` image as written by `v4 compile`
+    Image,
+    /// Words and main bytecode as used by `v4 exec`
+    Result,
+}
+
+impl Kind {
+    fn tag(self) -> &'static str {
+        match self {
+            Kind::Image => "v4b",
+            Kind::Result => "result",
+        }
+    }
+}
+
+/// On-disk compile cache
+#[derive(Debug, Clone)]
+pub struct CompileCache {
+    dir: PathBuf,
+}
+
+impl CompileCache {
+    /// Cache in the default directory, if one can be determined
+    pub fn open_default() -> Option<Self> {
+        default_dir().map(Self::at)
+    }
+
+    /// Cache rooted at `dir` (created on first store)
+    pub fn at(dir: impl Into<PathBuf>) -> Self {
+        Self { dir: dir.into() }
+    }
+
+    /// Cache directory
+    pub fn dir(&self) -> &Path {
+        &self.dir
+    }
+
+    /// Cache key of `source`: hex SHA-256 over kind, CLI and compiler
+    /// versions, compiler context (text form of a [`ContextSnapshot`], empty
+    /// for a fresh compiler) and source
+    pub fn key(kind: Kind, context: &str, source: &str) -> String {
+        let mut hasher = Sha256::new();
+        for part in [
+            kind.tag(),
+            env!("CARGO_PKG_VERSION"),
+            V4FRONT_VERSION,
+            context,
+        ] {
+            hasher.update(part.as_bytes());
+            hasher.update([0]);
+        }
+        hasher.update(source.as_bytes());
+        hasher
+            .finalize()
+            .iter()
+            .map(|b| format!("{:02x}", b))
+            .collect()
+    }
+
+    fn entry_path(&self, kind: Kind, context: &str, source: &str) -> PathBuf {
+        self.dir.join(format!(
+            "{}.{}",
+            Self::key(kind, context, source),
+            kind.tag()
+        ))
+    }
+
+    /// Cached `.v4b` image for `source`
+    pub fn get_image(&self, source: &str) -> Option<Vec<u8>> {
+        let data = fs::read(self.entry_path(Kind::Image, "", source)).ok()?;
+        crate::bytecode::Header::parse(&data).ok()?;
+        crate::trace!(Level::Info, "Compile cache hit ({} bytes)", data.len());
+        Some(data)
+    }
+
+    /// Store a `.v4b` image for `source`
+    pub fn put_image(&self, source: &str, image: &[u8]) {
+        self.store(Kind::Image, "", source, image);
+    }
+
+    /// Cached result of compiling `source` with the words of `context`
+    /// registered
+    pub fn get_result(&self, source: &str, context: &ContextSnapshot) -> Option<CompileResult> {
+        let path = self.entry_path(Kind::Result, &context.to_text(), source);
+        let data = fs::read(path).ok()?;
+        let result = decode_result(&data)?;
+        crate::trace!(
+            Level::Info,
+            "Compile cache hit ({} word(s), {} bytes main code)",
+            result.words.len(),
+            result.bytecode.len()
+        );
+        Some(result)
+    }
+
+    /// Store the result of compiling `source` with the words of `context`
+    /// registered
+    pub fn put_result(&self, source: &str, context: &ContextSnapshot, result: &CompileResult) {
+        let context = context.to_text();
+        self.store(Kind::Result, &context, source, &encode_result(result));
+    }
+
+    fn store(&self, kind: Kind, context: &str, source: &str, data: &[u8]) {
+        let path = self.entry_path(kind, context, source);
+        if let Err(e) = write_atomic(&path, data) {
+            crate::trace!(
+                Level::Info,
+                "Compile cache store to {} failed: {}",
+                path.display(),
+                e
+            );
+        }
+    }
+}
+
+fn default_dir() -> Option<PathBuf> {
+    let env = |name| std::env::var_os(name).filter(|v| !v.is_empty());
+    if let Some(dir) = env(ENV_CACHE_DIR) {
+        return Some(PathBuf::from(dir));
+    }
+    let base = if cfg!(windows) {
+        env("LOCALAPPDATA").map(PathBuf::from)
+    } else {
+        env("XDG_CACHE_HOME")
+            .map(PathBuf::from)
+            .or_else(|| env("HOME").map(|home| PathBuf::from(home).join(".cache")))
+    };
+    base.map(|dir| dir.join("v4"))
+}
+
+/// Write through a temporary file and rename, so readers never see a
+/// partial file
+pub(crate) fn write_atomic(path: &Path, data: &[u8]) -> io::Result<()> {
+    replace_with(path, |tmp| fs::write(tmp, data))
+}
+
+/// Create `path` by letting `write` produce a temporary file next to it,
+/// then renaming it into place
+///
+/// The parent directory is created if needed. On failure the temporary
+/// file is removed and `path` is left untouched.
+pub(crate) fn replace_with<F>(path: &Path, write: F) -> io::Result<()>
+where
+    F: FnOnce(&Path) -> io::Result<()>,
+{
+    if let Some(dir) = path.parent().filter(|d| !d.as_os_str().is_empty()) {
+        fs::create_dir_all(dir)?;
+    }
+    // Unique per process and call, so parallel workers never share one
+    static NEXT_TMP: AtomicU64 = AtomicU64::new(0);
+    let mut name = path.file_name().unwrap_or_default().to_os_string();
+    name.push(format!(
+        ".tmp{}.{}",
+        std::process::id(),
+        NEXT_TMP.fetch_add(1, Ordering::Relaxed)
+    ));
+    let tmp = path.with_file_name(name);
+
+    let result = write(&tmp).and_then(|()| fs::rename(&tmp, path));
+    if result.is_err() {
+        let _ = fs::remove_file(&tmp);
+    }
+    result
+}
+
+/// Serialize a compile result
+///
+/// `"V4CR" [WORD_COUNT u32] ([NAME_LEN u16][NAME][CODE_LEN u32][CODE])*
+/// [MAIN_LEN u32][MAIN]`, little-endian.
+fn encode_result(result: &CompileResult) -> Vec<u8> {
+    let mut out = Vec::new();
+    out.extend_from_slice(RESULT_MAGIC);
+    out.extend_from_slice(&(result.words.len() as u32).to_le_bytes());
+    for word in &result.words {
+        out.extend_from_slice(&(word.name.len() as u16).to_le_bytes());
+        out.extend_from_slice(word.name.as_bytes());
+        out.extend_from_slice(&(word.bytecode.len() as u32).to_le_bytes());
+        out.extend_from_slice(&word.bytecode);
+    }
+    out.extend_from_slice(&(result.bytecode.len() as u32).to_le_bytes());
+    out.extend_from_slice(&result.bytecode);
+    out
+}
+
+/// Parse a serialized compile result; `None` if it is malformed
+fn decode_result(data: &[u8]) -> Option<CompileResult> {
+    let mut reader = Reader { data };
+    if reader.take(4)? != RESULT_MAGIC {
+        return None;
+    }
+
+    let count = reader.u32()? as usize;
+    let mut words = Vec::with_capacity(count.min(1024));
+    for _ in 0..count {
+        let name_len = reader.u16()? as usize;
+        let name = std::str::from_utf8(reader.take(name_len)?)
+            .ok()?
+            .to_string();
+        let code_len = reader.u32()? as usize;
+        let bytecode = reader.take(code_len)?.to_vec();
+        words.push(WordDef { name, bytecode });
+    }
+
+    let main_len = reader.u32()? as usize;
+    let bytecode = reader.take(main_len)?.to_vec();
+    if !reader.data.is_empty() {
+        return None;
+    }
+    Some(CompileResult { words, bytecode })
+}
+
+struct Reader<'a> {
+    data: &'a [u8],
+}
+
+impl<'a> Reader<'a> {
+    fn take(&mut self, n: usize) -> Option<&'a [u8]> {
+        if self.data.len() < n {
+            return None;
+        }
+        let (head, tail) = self.data.split_at(n);
+        self.data = tail;
+        Some(head)
+    }
+
+    fn u16(&mut self) -> Option<u16> {
+        self.take(2).map(|b| u16::from_le_bytes([b[0], b[1]]))
+    }
+
+    fn u32(&mut self) -> Option<u32> {
+        self.take(4)
+            .map(|b| u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample() -> CompileResult {
+        CompileResult {
+            words: vec![
+                WordDef {
+                    name: "SQUARE".to_string(),
+                    bytecode: vec![0x01, 0x02, 0x03],
+                },
+                WordDef {
+                    name: "NOP".to_string(),
+                    bytecode: vec![],
+                },
+            ],
+            bytecode: vec![0x10, 0x20],
+        }
+    }
+
+    #[test]
+    fn test_result_roundtrip() {
+        let encoded = encode_result(&sample());
+        let decoded = decode_result(&encoded).unwrap();
+        assert_eq!(decoded.words.len(), 2);
+        assert_eq!(decoded.words[0].name, "SQUARE");
+        assert_eq!(decoded.words[0].bytecode, vec![0x01, 0x02, 0x03]);
+        assert!(decoded.words[1].bytecode.is_empty());
+        assert_eq!(decoded.bytecode, vec![0x10, 0x20]);
+
+        assert!(decode_result(&encoded[..encoded.len() - 1]).is_none());
+        assert!(decode_result(b"XXXX").is_none());
+    }
+
+    #[test]
+    fn test_key_depends_on_kind_context_and_source() {
+        let a = CompileCache::key(Kind::Image, "", ": A 1 ;");
+        assert_eq!(a.len(), 64);
+        assert_eq!(a, CompileCache::key(Kind::Image, "", ": A 1 ;"));
+        assert_ne!(a, CompileCache::key(Kind::Result, "", ": A 1 ;"));
+        assert_ne!(a, CompileCache::key(Kind::Image, "", ": A 2 ;"));
+        assert_ne!(a, CompileCache::key(Kind::Image, "0\tB\n", ": A 1 ;"));
+    }
+
+    #[test]
+    fn test_store_and_load() {
+        let dir = tempfile::tempdir().unwrap();
+        let cache = CompileCache::at(dir.path().join("v4"));
+        let source = ": SQUARE DUP * ;";
+
+        let fresh = ContextSnapshot::default();
+        assert!(cache.get_result(source, &fresh).is_none());
+        cache.put_result(source, &fresh, &sample());
+        assert_eq!(cache.get_result(source, &fresh).unwrap().words.len(), 2);
+        // Compiled against other device words
+        let context = ContextSnapshot::new([("DOUBLE", 0)]);
+        assert!(cache.get_result(source, &context).is_none());
+
+        let mut image = Vec::new();
+        crate::bytecode::Header::v0_2(0, 0).write_into(&mut image);
+        cache.put_image(source, &image);
+        assert_eq!(cache.get_image(source).unwrap(), image);
+        assert!(cache.get_image("1 2 +").is_none());
+    }
+
+    #[test]
+    fn test_write_atomic_from_threads() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("out.v4b");
+        std::thread::scope(|scope| {
+            for i in 0..8u8 {
+                let path = &path;
+                scope.spawn(move || {
+                    for _ in 0..20 {
+                        write_atomic(path, &[i; 256]).unwrap();
+                    }
+                });
+            }
+        });
+        // One writer's complete contents, and no temporary files left
+        let data = fs::read(&path).unwrap();
+        assert!(data.len() == 256 && data.iter().all(|&b| b == data[0]));
+        assert_eq!(fs::read_dir(dir.path()).unwrap().count(), 1);
+    }
+}
@@ -1,13 +1,26 @@
+pub mod batch;
+pub mod bench;
 pub mod compile;
+pub mod daemon;
+pub mod dump;
 pub mod exec;
 pub mod ping;
+pub mod profile;
 pub mod push;
 pub mod repl;
 pub mod reset;
+pub mod serve;
+pub mod stats;
 
-pub use compile::compile;
-pub use exec::exec;
+pub use bench::bench;
+pub use compile::{CompileOptions, compile};
+pub use daemon::daemon;
+pub use dump::dump;
+pub use exec::{ExecOptions, exec};
 pub use ping::ping;
+pub use profile::{ProfileOptions, profile};
 pub use push::push;
 pub use repl::run_repl;
 pub use reset::reset;
+pub use serve::serve;
+pub use stats::{StatsOptions, stats};
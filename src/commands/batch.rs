@@ -0,0 +1,376 @@
+//! Non-interactive REPL (`v4 repl --batch`)
+//!
+//! Reads Forth lines from a stream and runs them without per-line round
+//! trips: consecutive lines that define nothing are compiled together into
+//! one EXEC frame, frames are pipelined, and only failures are reported,
+//! with the line numbers they came from. Lines that define words are run on
+//! their own, since the indices the device returns are needed to compile
+//! the lines after them. Meta-commands behave as in the interactive REPL.
+
+use crate::commands::exec::{execute_on_device, save_context};
+use crate::commands::repl::handle_meta_command;
+use crate::protocol::stack::StackTracker;
+use crate::protocol::{Command, ErrorCode};
+use crate::repl::{CompileMemo, CompileResult, Compiler};
+use crate::serial::V4Serial;
+use crate::{Result, V4Error};
+use std::io::BufRead;
+use std::ops::RangeInclusive;
+use std::rc::Rc;
+use std::time::{Duration, Instant};
+
+/// Most lines compiled into one EXEC frame
+pub const GROUP_LINES: usize = 64;
+
+/// EXEC frames kept outstanding
+pub const WINDOW: usize = 8;
+
+/// Frames queued before they are pipelined to the device
+const QUEUE_FRAMES: usize = 64;
+
+/// Words after which a line is treated as a definition
+const DEFINING_WORDS: &[&str] = &[":", "VARIABLE", "CONSTANT", "CREATE", "VALUE"];
+
+/// Whether `line` may define a word
+pub fn is_defining(line: &str) -> bool {
+    line.split_whitespace()
+        .any(|token| DEFINING_WORDS.iter().any(|w| token.eq_ignore_ascii_case(w)))
+}
+
+/// Outcome of [`run_batch`]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct Report {
+    /// Forth lines read (blank lines excluded)
+    pub lines: usize,
+    /// Frames pipelined plus lines and definitions run on their own
+    pub frames: usize,
+    /// Lines or line ranges that failed
+    pub failures: usize,
+}
+
+/// Run every line of `input` on the device
+///
+/// Failures are printed to stderr as they are found and do not stop the
+/// run; `bye` ends it. Meta-commands run in order with the Forth lines,
+/// except the `--watch` modes, which would read the rest of the input. Link
+/// errors and timeouts abort the run and are returned.
+pub fn run_batch<R: BufRead>(
+    input: R,
+    serial: &mut V4Serial,
+    port: &str,
+    compiler: &mut Compiler,
+    timeout: Duration,
+) -> Result<Report> {
+    let mut batch = Batch {
+        serial,
+        port,
+        compiler,
+        memo: CompileMemo::default(),
+        stacks: StackTracker::default(),
+        timeout,
+        group: Vec::new(),
+        queue: Vec::new(),
+        report: Report::default(),
+    };
+
+    for (number, line) in (1..).zip(input.lines()) {
+        let line = line?;
+        let line = line.trim();
+        if line.is_empty() {
+            continue;
+        }
+        if line == "bye" || line == "quit" || line == ".exit" {
+            break;
+        }
+        batch.report.lines += 1;
+
+        if line.starts_with('.') {
+            batch.flush()?;
+            batch.meta_command(number, line)?;
+        } else if is_defining(line) {
+            batch.flush()?;
+            batch.define(number, line)?;
+        } else {
+            batch.group.push((number, line.to_string()));
+            if batch.group.len() >= GROUP_LINES {
+                batch.compile_group()?;
+            }
+        }
+    }
+    batch.flush()?;
+    Ok(batch.report)
+}
+
+/// Run a batch from stdin and print a summary
+///
+/// Fails if any line failed, so scripts can check the exit code.
+pub(crate) fn run_stdin(
+    serial: &mut V4Serial,
+    port: &str,
+    compiler: &mut Compiler,
+    timeout: Duration,
+) -> Result<()> {
+    let started = Instant::now();
+    let report = run_batch(std::io::stdin().lock(), serial, port, compiler, timeout)?;
+    eprintln!(
+        "{} line(s) in {} frame(s), {} failure(s), {:.2}s",
+        report.lines,
+        report.frames,
+        report.failures,
+        started.elapsed().as_secs_f64()
+    );
+    if report.failures > 0 {
+        return Err(V4Error::Repl(format!(
+            "{} failure(s) in batch",
+            report.failures
+        )));
+    }
+    Ok(())
+}
+
+/// EXEC frame waiting to be sent
+struct Queued {
+    lines: RangeInclusive<usize>,
+    result: Rc<CompileResult>,
+}
+
+struct Batch<'a> {
+    serial: &'a mut V4Serial,
+    port: &'a str,
+    compiler: &'a mut Compiler,
+    memo: CompileMemo,
+    stacks: StackTracker,
+    timeout: Duration,
+    /// `(line number, source)` of lines not compiled yet
+    group: Vec<(usize, String)>,
+    queue: Vec<Queued>,
+    report: Report,
+}
+
+impl Batch<'_> {
+    /// Report a failure of `lines`
+    fn fail(&mut self, lines: &RangeInclusive<usize>, error: &dyn std::fmt::Display) {
+        self.report.failures += 1;
+        if lines.start() == lines.end() {
+            eprintln!("line {}: {}", lines.start(), error);
+        } else {
+            eprintln!("lines {}-{}: {}", lines.start(), lines.end(), error);
+        }
+    }
+
+    /// Compile the pending group and queue the resulting frames
+    fn compile_group(&mut self) -> Result<()> {
+        let group = std::mem::take(&mut self.group);
+        self.compile_lines(&group)
+    }
+
+    /// Compile `lines` into one frame; halve the range until each part
+    /// compiles and fits a frame, so errors point at single lines
+    fn compile_lines(&mut self, lines: &[(usize, String)]) -> Result<()> {
+        let (Some(first), Some(last)) = (lines.first(), lines.last()) else {
+            return Ok(());
+        };
+        let range = first.0..=last.0;
+        let source = match lines {
+            [(_, line)] => line.clone(),
+            _ => lines
+                .iter()
+                .map(|(_, line)| line.as_str())
+                .collect::<Vec<_>>()
+                .join("\n"),
+        };
+
+        let split = match self.memo.compile(self.compiler, &source) {
+            Ok(result) if !result.words.is_empty() => {
+                // Defined something after all; its indices are needed now
+                self.flush()?;
+                self.run_now(&range, &result)?;
+                return Ok(());
+            }
+            Ok(result) if result.bytecode.len() <= self.serial.max_payload() => {
+                if !result.bytecode.is_empty() {
+                    self.queue.push(Queued {
+                        lines: range,
+                        result,
+                    });
+                    if self.queue.len() >= QUEUE_FRAMES {
+                        self.flush_queue()?;
+                    }
+                }
+                return Ok(());
+            }
+            Ok(result) => format!(
+                "Bytecode too large for one frame ({} bytes, max {})",
+                result.bytecode.len(),
+                self.serial.max_payload()
+            ),
+            Err(e) => e,
+        };
+
+        if lines.len() == 1 {
+            self.fail(&range, &split);
+            return Ok(());
+        }
+        let (head, tail) = lines.split_at(lines.len() / 2);
+        self.compile_lines(head)?;
+        self.compile_lines(tail)
+    }
+
+    /// Run a line that defines words
+    fn define(&mut self, number: usize, line: &str) -> Result<()> {
+        match self.memo.compile(self.compiler, line) {
+            Ok(result) => self.run_now(&(number..=number), &result),
+            Err(e) => {
+                self.fail(&(number..=number), &e);
+                Ok(())
+            }
+        }
+    }
+
+    /// Send `result` and wait for it, registering any words it defines
+    fn run_now(&mut self, lines: &RangeInclusive<usize>, result: &CompileResult) -> Result<()> {
+        self.report.frames += 1;
+        let outcome = execute_on_device(self.serial, result, self.compiler, self.timeout);
+        if !result.words.is_empty() {
+            save_context(self.port, self.compiler);
+        }
+        self.check(lines, outcome)
+    }
+
+    /// Run a meta-command as the interactive REPL does
+    fn meta_command(&mut self, number: usize, line: &str) -> Result<()> {
+        let lines = number..=number;
+        if line
+            .split_whitespace()
+            .any(|arg| arg == "--watch" || arg == "-w")
+        {
+            self.fail(
+                &lines,
+                &format!("--watch is not available in batch mode: {}", line),
+            );
+            return Ok(());
+        }
+        let outcome = handle_meta_command(
+            line,
+            self.port,
+            self.serial,
+            self.compiler,
+            &mut self.stacks,
+        );
+        self.check(&lines, outcome)
+    }
+
+    /// Report errors of `lines` that leave the link usable; return the rest
+    fn check(&mut self, lines: &RangeInclusive<usize>, outcome: Result<()>) -> Result<()> {
+        match outcome {
+            Ok(()) => Ok(()),
+            Err(
+                e @ (V4Error::Device(_)
+                | V4Error::Protocol(_)
+                | V4Error::Compilation(_)
+                | V4Error::Cli(_)),
+            ) => {
+                self.fail(lines, &e);
+                Ok(())
+            }
+            Err(e) => Err(e),
+        }
+    }
+
+    /// Compile the pending group and send every queued frame
+    fn flush(&mut self) -> Result<()> {
+        self.compile_group()?;
+        self.flush_queue()
+    }
+
+    fn flush_queue(&mut self) -> Result<()> {
+        if self.queue.is_empty() {
+            return Ok(());
+        }
+        let queue = std::mem::take(&mut self.queue);
+        let requests: Vec<(Command, &[u8])> = queue
+            .iter()
+            .map(|frame| (Command::Exec, &frame.result.bytecode[..]))
+            .collect();
+        let responses = self.serial.pipeline(&requests, WINDOW, self.timeout)?;
+        self.report.frames += queue.len();
+
+        for (frame, response) in queue.iter().zip(&responses) {
+            if response.error_code != ErrorCode::Ok {
+                self.fail(
+                    &frame.lines,
+                    &format!("Execution failed: {}", response.error_code.name()),
+                );
+            }
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::serial::DEFAULT_BAUD_RATE;
+
+    fn simulated() -> V4Serial {
+        V4Serial::from_transport(Box::new(crate::sim::Simulator::new()), DEFAULT_BAUD_RATE)
+    }
+
+    #[test]
+    fn test_run_batch_meta_commands() {
+        let mut serial = simulated();
+        let mut compiler = Compiler::new().unwrap();
+        let input = ".ping\n.stack\n\n.rstack\n.stats --watch\n.stack -w\n.see 7\nbye\n.ping\n";
+        let report = run_batch(
+            input.as_bytes(),
+            &mut serial,
+            "sim://",
+            &mut compiler,
+            Duration::from_secs(1),
+        )
+        .unwrap();
+        // `--watch` is refused and word 7 does not exist; nothing after bye
+        assert_eq!(
+            report,
+            Report {
+                lines: 6,
+                frames: 0,
+                failures: 3
+            }
+        );
+    }
+
+    #[test]
+    fn test_run_batch_groups_lines() {
+        let mut serial = simulated();
+        let mut compiler = Compiler::new().unwrap();
+        let report = run_batch(
+            "1 2 +\n3 4 *\n.stack\n5 6 -\n".as_bytes(),
+            &mut serial,
+            "sim://",
+            &mut compiler,
+            Duration::from_secs(1),
+        )
+        .unwrap();
+        // Grouped up to the meta-command, which runs in order
+        assert_eq!(
+            report,
+            Report {
+                lines: 4,
+                frames: 2,
+                failures: 0
+            }
+        );
+    }
+
+    #[test]
+    fn test_is_defining() {
+        assert!(is_defining(": SQUARE DUP * ;"));
+        assert!(is_defining("0 variable COUNTER"));
+        assert!(is_defining("42 CONSTANT ANSWER"));
+        assert!(!is_defining("1 2 + ."));
+        assert!(!is_defining("5 SQUARE"));
+        // Only whole tokens count
+        assert!(!is_defining("VARIABLES :X"));
+    }
+}
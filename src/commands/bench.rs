@@ -0,0 +1,138 @@
+use crate::Result;
+use crate::protocol::caps::FEATURE_SEQUENCED;
+use crate::protocol::{Command, ErrorCode};
+use crate::repl::Compiler;
+use crate::serial::{LinkOptions, V4Serial};
+use std::time::{Duration, Instant};
+
+/// Code repeated to fill an EXEC frame; leaves the stack untouched
+const FILLER: &str = "1 DROP ";
+
+/// Requests kept outstanding in the pipelined EXEC test
+const PIPELINE_WINDOW: usize = 8;
+
+/// Measure round-trip latency and EXEC throughput of a device
+///
+/// Sends `count` PINGs and reports latency percentiles, then `count` EXEC
+/// frames of harmless code sized to the link's frame payload, once
+/// stop-and-wait and once pipelined, and reports the achieved throughput.
+pub fn bench(port: &str, link: &LinkOptions, count: usize, timeout: Duration) -> Result<()> {
+    let mut serial = V4Serial::open_with(port, link)?;
+    let count = count.max(1);
+
+    println!("Benchmarking {} ({} round trips each)...", port, count);
+
+    let mut latencies = Vec::with_capacity(count);
+    for _ in 0..count {
+        let started = Instant::now();
+        check(serial.ping(timeout)?, "PING")?;
+        latencies.push(started.elapsed());
+    }
+    latencies.sort_unstable();
+
+    println!("\nPING latency:");
+    for (label, p) in [("min", 0.0), ("p50", 50.0), ("p90", 90.0), ("p99", 99.0)] {
+        println!("  {:<4} {:>8.3} ms", label, ms(percentile(&latencies, p)));
+    }
+    println!("  {:<4} {:>8.3} ms", "max", ms(latencies[count - 1]));
+
+    let code = filler_code(serial.max_payload())?;
+    let started = Instant::now();
+    for _ in 0..count {
+        check(serial.exec(&code, timeout)?.error_code, "EXEC")?;
+    }
+    let stop_and_wait = started.elapsed();
+
+    let requests = vec![(Command::Exec, &code[..]); count];
+    let started = Instant::now();
+    for response in serial.pipeline(&requests, PIPELINE_WINDOW, timeout)? {
+        check(response.error_code, "EXEC")?;
+    }
+    let pipelined = started.elapsed();
+
+    println!("\nEXEC throughput ({}-byte frames):", code.len());
+    print_throughput("stop-and-wait", count, code.len(), stop_and_wait);
+    let mode = if serial.caps().has(FEATURE_SEQUENCED) {
+        "sequenced"
+    } else {
+        "in order"
+    };
+    print_throughput(
+        &format!("window {} ({})", PIPELINE_WINDOW, mode),
+        count,
+        code.len(),
+        pipelined,
+    );
+    Ok(())
+}
+
+fn print_throughput(label: &str, frames: usize, frame_len: usize, elapsed: Duration) {
+    let secs = elapsed.as_secs_f64().max(f64::EPSILON);
+    println!(
+        "  {:<22} {:>8.1} frames/s {:>8.1} KB/s",
+        label,
+        frames as f64 / secs,
+        (frames * frame_len) as f64 / 1024.0 / secs
+    );
+}
+
+fn check(code: ErrorCode, command: &str) -> Result<()> {
+    if code == ErrorCode::Ok {
+        Ok(())
+    } else {
+        Err(crate::V4Error::Device(format!(
+            "{} returned error: {}",
+            command,
+            code.name()
+        )))
+    }
+}
+
+fn ms(d: Duration) -> f64 {
+    d.as_secs_f64() * 1000.0
+}
+
+/// Nearest-rank percentile `p` (0..=100) of sorted `samples`
+fn percentile(samples: &[Duration], p: f64) -> Duration {
+    let rank = (p / 100.0 * samples.len() as f64).ceil() as usize;
+    samples[rank.clamp(1, samples.len()) - 1]
+}
+
+/// Compile as many copies of [`FILLER`] as fit in `max` bytes of bytecode
+fn filler_code(max: usize) -> Result<Vec<u8>> {
+    let mut compiler = Compiler::new().map_err(crate::V4Error::Compilation)?;
+    // Probes only need the size, so the output is never copied
+    let mut size = |copies: usize| {
+        compiler
+            .compile_with(&FILLER.repeat(copies), |view| view.bytecode().len())
+            .map_err(crate::V4Error::Compilation)
+    };
+
+    // Code size is linear in the copy count: a fixed epilogue plus a
+    // constant per copy
+    let one = size(1)?;
+    let per_copy = size(2)?.saturating_sub(one).max(1);
+    let mut copies = (max.saturating_sub(one) / per_copy + 1).max(1);
+    while copies > 1 && size(copies)? > max {
+        copies -= 1;
+    }
+    compiler
+        .compile(&FILLER.repeat(copies))
+        .map(|result| result.bytecode)
+        .map_err(crate::V4Error::Compilation)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_percentile() {
+        let samples: Vec<Duration> = (1..=10).map(Duration::from_millis).collect();
+        assert_eq!(percentile(&samples, 0.0), Duration::from_millis(1));
+        assert_eq!(percentile(&samples, 50.0), Duration::from_millis(5));
+        assert_eq!(percentile(&samples, 90.0), Duration::from_millis(9));
+        assert_eq!(percentile(&samples, 99.0), Duration::from_millis(10));
+        assert_eq!(percentile(&samples[..1], 99.0), Duration::from_millis(1));
+    }
+}
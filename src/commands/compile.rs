@@ -1,49 +1,492 @@
-use crate::Result;
+use crate::bytecode::{self, Format};
+use crate::cache::{self, CompileCache};
 use crate::v4front_ffi;
+use crate::{Result, V4Error};
+use std::collections::HashSet;
 use std::fs;
-use std::path::Path;
-
-/// Compile Forth source to V4 bytecode
-pub fn compile(input: &str, output: Option<&str>) -> Result<()> {
-    // Read source file
-    let input_path = Path::new(input);
-    if !input_path.exists() {
-        return Err(crate::V4Error::Io(std::io::Error::new(
-            std::io::ErrorKind::NotFound,
-            format!("Source file not found: {}", input),
-        )));
-    }
+use std::io;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::Instant;
+
+/// File extensions picked up when a directory is given
+pub const SOURCE_EXTENSIONS: &[&str] = &["fs", "fth", "4th", "forth", "v4"];
+
+/// Options for [`compile`]
+#[derive(Debug, Clone, Default)]
+pub struct CompileOptions {
+    /// Output file (single input file only)
+    pub output: Option<PathBuf>,
+    /// Directory for outputs, mirroring the layout below each input
+    /// directory (default: next to each source file)
+    pub out_dir: Option<PathBuf>,
+    /// Worker threads (default: available parallelism)
+    pub jobs: Option<usize>,
+    /// Look up and store images in the compile cache
+    pub cache: bool,
+    /// Format of the written images
+    pub format: Format,
+    /// `v4` executable that compiles files in child processes when there
+    /// are several workers (`None`: compile in this process, where calls
+    /// into V4-front take turns)
+    pub worker: Option<PathBuf>,
+}
 
-    let source = fs::read_to_string(input_path)?;
-    println!("Compiling {} ({} bytes)...", input, source.len());
+/// One source file and where its image goes
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+struct Job {
+    source: PathBuf,
+    output: PathBuf,
+}
+
+/// Compile Forth source files to V4 bytecode
+///
+/// `inputs` are files or directories; directories are searched recursively
+/// for [`SOURCE_EXTENSIONS`]. Files are compiled on a pool of worker
+/// threads, and every image is written atomically. V4-front is not known
+/// to be reentrant, so with `opts.worker` each thread runs the compiler in
+/// a `v4 compile` child process of its own; otherwise the threads take
+/// turns in it. Compile errors are collected and reported together once
+/// all files have been processed.
+///
+/// With `opts.cache`, images compiled earlier from identical source by the
+/// same compiler version are copied from the compile cache.
+pub fn compile(inputs: &[String], opts: &CompileOptions) -> Result<()> {
+    let jobs = collect_jobs(inputs, opts)?;
 
-    // Determine output filename
-    let output_path = if let Some(out) = output {
-        Path::new(out).to_path_buf()
+    if let [job] = jobs.as_slice()
+        && !Path::new(&inputs[0]).is_dir()
+    {
+        return compile_single(job, opts);
+    }
+
+    let cache = if opts.cache {
+        CompileCache::open_default()
     } else {
-        // Default: replace .v4 extension with .v4b
-        let mut out = input_path.to_path_buf();
-        out.set_extension("v4b");
-        out
+        None
     };
+    let workers = opts
+        .jobs
+        .or_else(|| std::thread::available_parallelism().ok().map(|n| n.get()))
+        .unwrap_or(1)
+        .clamp(1, jobs.len().max(1));
+    let worker = opts.worker.as_deref().filter(|_| workers > 1);
+
+    println!(
+        "Compiling {} file(s) with {} worker(s)...",
+        jobs.len(),
+        workers
+    );
+    let started = Instant::now();
+    let next = AtomicUsize::new(0);
+
+    let mut results: Vec<(usize, Result<Compiled>)> = std::thread::scope(|scope| {
+        let handles: Vec<_> = (0..workers)
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut done = Vec::new();
+                    loop {
+                        let i = next.fetch_add(1, Ordering::Relaxed);
+                        let Some(job) = jobs.get(i) else {
+                            break done;
+                        };
+                        let result = compile_file(job, cache.as_ref(), opts.format, worker);
+                        if let Ok(compiled) = &result {
+                            println!(
+                                "  ✓ {} → {} ({} bytes{})",
+                                job.source.display(),
+                                job.output.display(),
+                                compiled.size,
+                                if compiled.cached { ", cached" } else { "" }
+                            );
+                        }
+                        done.push((i, result));
+                    }
+                })
+            })
+            .collect();
+        handles
+            .into_iter()
+            .flat_map(|h| h.join().expect("compile worker panicked"))
+            .collect()
+    });
+    results.sort_by_key(|(i, _)| *i);
+
+    let mut cached = 0;
+    let mut failures = Vec::new();
+    for (i, result) in &results {
+        match result {
+            Ok(compiled) => cached += compiled.cached as usize,
+            Err(e) => failures.push((&jobs[*i].source, e)),
+        }
+    }
 
-    // Compile source code
-    let buf = v4front_ffi::compile_source(&source).map_err(crate::V4Error::Protocol)?;
+    println!(
+        "Compiled {} of {} file(s) in {:.2}s ({} cached)",
+        jobs.len() - failures.len(),
+        jobs.len(),
+        started.elapsed().as_secs_f64(),
+        cached
+    );
 
-    println!("✓ Compilation successful");
+    if failures.is_empty() {
+        return Ok(());
+    }
+    eprintln!("\n{} file(s) failed:", failures.len());
+    for (source, e) in &failures {
+        eprintln!("  ✗ {}: {}", source.display(), e);
+    }
+    Err(V4Error::Compilation(format!(
+        "{} of {} file(s) failed to compile",
+        failures.len(),
+        jobs.len()
+    )))
+}
 
-    // Save bytecode to file
-    v4front_ffi::save_bytecode(&buf, &output_path).map_err(crate::V4Error::Protocol)?;
+/// Compile one file, reporting progress as before multi-file support
+fn compile_single(job: &Job, opts: &CompileOptions) -> Result<()> {
+    let cache = if opts.cache {
+        CompileCache::open_default()
+    } else {
+        None
+    };
 
-    // Free the buffer
-    v4front_ffi::free_bytecode(buf);
+    let size = fs::metadata(&job.source)?.len();
+    println!("Compiling {} ({} bytes)...", job.source.display(), size);
 
-    let output_size = fs::metadata(&output_path)?.len();
+    let compiled = compile_file(job, cache.as_ref(), opts.format, None)?;
+    if compiled.cached {
+        println!("✓ Compilation successful (cached)");
+    } else {
+        println!("✓ Compilation successful");
+    }
     println!(
         "✓ Bytecode saved to {} ({} bytes)",
-        output_path.display(),
-        output_size
+        job.output.display(),
+        compiled.size
     );
+    Ok(())
+}
+
+/// Output of one compiled file
+struct Compiled {
+    size: u64,
+    cached: bool,
+}
+
+/// Compile `job.source` and atomically write the image to `job.output`
+///
+/// With `worker`, V4-front runs in a child process instead of this one.
+fn compile_file(
+    job: &Job,
+    cache: Option<&CompileCache>,
+    format: Format,
+    worker: Option<&Path>,
+) -> Result<Compiled> {
+    let source = fs::read_to_string(&job.source)?;
+
+    // The cache holds images as V4-front writes them (v0.2)
+    if let Some(image) = cache.and_then(|c| c.get_image(&source)) {
+        let image = bytecode::convert(&image, format)?;
+        cache::write_atomic(&job.output, &image)?;
+        return Ok(Compiled {
+            size: image.len() as u64,
+            cached: true,
+        });
+    }
+
+    // Save bytecode next to the output, convert it, then move it into place
+    let mut compiled = Vec::new();
+    if let Some(program) = worker {
+        let mut failure = None;
+        let saved = cache::replace_with(&job.output, |tmp| {
+            failure = compile_in_worker(program, &job.source, tmp)?;
+            if failure.is_some() {
+                return Err(io::Error::other("compile worker failed"));
+            }
+            convert_saved(tmp, format, &mut compiled)
+        });
+        if let Some(message) = failure {
+            return Err(V4Error::Compilation(message));
+        }
+        saved?;
+    } else {
+        let buf = v4front_ffi::compile_source(&source).map_err(V4Error::Compilation)?;
+        let saved = cache::replace_with(&job.output, |tmp| {
+            v4front_ffi::save_bytecode(&buf, tmp).map_err(io::Error::other)?;
+            convert_saved(tmp, format, &mut compiled)
+        });
+
+        // Free the buffer
+        v4front_ffi::free_bytecode(buf);
+        saved?;
+    }
 
+    if let Some(cache) = cache {
+        cache.put_image(&source, &compiled);
+    }
+    Ok(Compiled {
+        size: fs::metadata(&job.output)?.len(),
+        cached: false,
+    })
+}
+
+/// Read the v0.2 image saved at `tmp` into `compiled` and rewrite it in
+/// `format`
+fn convert_saved(tmp: &Path, format: Format, compiled: &mut Vec<u8>) -> io::Result<()> {
+    *compiled = fs::read(tmp)?;
+    if format != Format::V0_2 {
+        fs::write(
+            tmp,
+            bytecode::convert(compiled, format).map_err(io::Error::other)?,
+        )?;
+    }
     Ok(())
 }
+
+/// Run `program compile` on `source`, saving the v0.2 image to `output`
+///
+/// Returns the child's error message if it failed to compile.
+fn compile_in_worker(program: &Path, source: &Path, output: &Path) -> io::Result<Option<String>> {
+    let child = Command::new(program)
+        .arg("compile")
+        .arg(source)
+        .arg("--output")
+        .arg(output)
+        .args(["--format", "v0.2", "--no-cache"])
+        .stdin(Stdio::null())
+        .output()?;
+    if child.status.success() {
+        return Ok(None);
+    }
+    let stderr = String::from_utf8_lossy(&child.stderr);
+    let message = stderr.lines().rfind(|l| !l.trim().is_empty()).unwrap_or("");
+    let message = message.strip_prefix("Error: ").unwrap_or(message);
+    let message = message
+        .strip_prefix("Compilation error: ")
+        .unwrap_or(message);
+    Ok(Some(if message.is_empty() {
+        format!("{} exited with {}", program.display(), child.status)
+    } else {
+        message.to_string()
+    }))
+}
+
+/// Expand inputs into compile jobs with their output paths
+fn collect_jobs(inputs: &[String], opts: &CompileOptions) -> Result<Vec<Job>> {
+    let mut jobs: Vec<Job> = Vec::new();
+
+    for input in inputs {
+        let input_path = Path::new(input);
+        if !input_path.exists() {
+            return Err(V4Error::Io(std::io::Error::new(
+                std::io::ErrorKind::NotFound,
+                format!("Source file not found: {}", input),
+            )));
+        }
+
+        if input_path.is_dir() {
+            let mut sources = Vec::new();
+            find_sources(input_path, &mut sources)?;
+            sources.sort();
+            for source in sources {
+                let relative = source.strip_prefix(input_path).unwrap_or(&source);
+                let output = output_path(&source, relative, opts);
+                jobs.push(Job { source, output });
+            }
+        } else {
+            let source = input_path.to_path_buf();
+            let output = match &opts.output {
+                Some(out) => out.clone(),
+                None => output_path(
+                    &source,
+                    Path::new(source.file_name().unwrap_or_default()),
+                    opts,
+                ),
+            };
+            jobs.push(Job { source, output });
+        }
+    }
+
+    // Inputs may name a file twice, e.g. directly and through its directory
+    let mut seen = HashSet::new();
+    jobs.retain(|job| seen.insert(job.clone()));
+    if jobs.is_empty() {
+        return Err(V4Error::Cli(format!(
+            "No Forth sources (.{}) found",
+            SOURCE_EXTENSIONS.join(", .")
+        )));
+    }
+    if opts.output.is_some() && jobs.len() > 1 {
+        return Err(V4Error::Cli(
+            "--output needs a single input file; use --out-dir for several".to_string(),
+        ));
+    }
+    for (i, job) in jobs.iter().enumerate() {
+        if let Some(other) = jobs[..i].iter().find(|j| j.output == job.output) {
+            return Err(V4Error::Cli(format!(
+                "{} and {} would both be written to {}",
+                other.source.display(),
+                job.source.display(),
+                job.output.display()
+            )));
+        }
+    }
+    Ok(jobs)
+}
+
+/// Image path for `source`; `relative` is its path below the input root
+fn output_path(source: &Path, relative: &Path, opts: &CompileOptions) -> PathBuf {
+    // Default: replace the source extension with .v4b
+    let mut out = match &opts.out_dir {
+        Some(dir) => dir.join(relative),
+        None => source.to_path_buf(),
+    };
+    out.set_extension("v4b");
+    out
+}
+
+fn find_sources(dir: &Path, out: &mut Vec<PathBuf>) -> Result<()> {
+    for entry in fs::read_dir(dir)? {
+        let path = entry?.path();
+        if path.is_dir() {
+            find_sources(&path, out)?;
+        } else if path
+            .extension()
+            .and_then(|e| e.to_str())
+            .is_some_and(|e| SOURCE_EXTENSIONS.contains(&e))
+        {
+            out.push(path);
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Executable script standing in for `v4` as a compile worker
+    #[cfg(unix)]
+    fn worker_script(dir: &Path, name: &str, body: &str) -> PathBuf {
+        use std::os::unix::fs::PermissionsExt;
+        let path = dir.join(name);
+        fs::write(&path, format!("#!/bin/sh\n{}\n", body)).unwrap();
+        fs::set_permissions(&path, fs::Permissions::from_mode(0o755)).unwrap();
+        path
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn test_compile_in_worker() {
+        let dir = tempfile::tempdir().unwrap();
+        // A v0.2 image as V4-front saves it
+        let mut expected = Vec::new();
+        let word = crate::repl::WordDef {
+            name: "X".to_string(),
+            bytecode: vec![0x51],
+        };
+        bytecode::encode_image(&[word], &[0x00, 0x51], &mut expected);
+        let image = dir.path().join("saved.v4b");
+        fs::write(&image, &expected).unwrap();
+        // Arguments: compile SOURCE --output OUTPUT ...
+        let worker = worker_script(
+            dir.path(),
+            "ok.sh",
+            &format!("cp '{}' \"$4\"", image.display()),
+        );
+        let job = Job {
+            source: dir.path().join("a.fs"),
+            output: dir.path().join("out/a.v4b"),
+        };
+        fs::write(&job.source, ": X ;").unwrap();
+
+        let compiled = compile_file(&job, None, Format::V0_3, Some(&worker)).unwrap();
+        let written = fs::read(&job.output).unwrap();
+        assert_eq!(compiled.size, written.len() as u64);
+        assert_eq!(
+            written[..],
+            bytecode::convert(&expected, Format::V0_3).unwrap()[..]
+        );
+
+        let failing = worker_script(
+            dir.path(),
+            "fail.sh",
+            "echo 'Error: Compilation error: Unknown word: Y' >&2; exit 1",
+        );
+        let result = compile_file(&job, None, Format::V0_2, Some(&failing));
+        assert!(matches!(result, Err(V4Error::Compilation(m)) if m == "Unknown word: Y"));
+        // The earlier image is left in place
+        assert_eq!(fs::read(&job.output).unwrap(), written);
+    }
+
+    #[test]
+    fn test_collect_jobs_from_directory() {
+        let dir = tempfile::tempdir().unwrap();
+        let root = dir.path().join("src");
+        fs::create_dir_all(root.join("lib")).unwrap();
+        for name in ["main.fs", "lib/math.fth", "notes.txt"] {
+            fs::write(root.join(name), ": X ;").unwrap();
+        }
+
+        let opts = CompileOptions {
+            out_dir: Some(dir.path().join("out")),
+            ..CompileOptions::default()
+        };
+        let jobs = collect_jobs(&[root.to_string_lossy().into_owned()], &opts).unwrap();
+
+        let outputs: Vec<_> = jobs
+            .iter()
+            .map(|j| j.output.strip_prefix(dir.path()).unwrap().to_path_buf())
+            .collect();
+        assert_eq!(
+            outputs,
+            vec![
+                PathBuf::from("out/lib/math.v4b"),
+                PathBuf::from("out/main.v4b")
+            ]
+        );
+    }
+
+    #[test]
+    fn test_collect_jobs_rejects_output_collisions() {
+        let dir = tempfile::tempdir().unwrap();
+        for name in ["a.fs", "a.fth"] {
+            fs::write(dir.path().join(name), "").unwrap();
+        }
+        let inputs: Vec<String> = ["a.fs", "a.fth"]
+            .iter()
+            .map(|n| dir.path().join(n).to_string_lossy().into_owned())
+            .collect();
+
+        let err = collect_jobs(&inputs, &CompileOptions::default()).unwrap_err();
+        assert!(matches!(err, V4Error::Cli(_)));
+
+        let single = CompileOptions {
+            output: Some(dir.path().join("x.v4b")),
+            ..CompileOptions::default()
+        };
+        assert!(collect_jobs(&inputs, &single).is_err());
+        let jobs = collect_jobs(&inputs[..1], &single).unwrap();
+        assert_eq!(jobs[0].output, dir.path().join("x.v4b"));
+    }
+
+    #[test]
+    fn test_collect_jobs_drops_repeated_inputs() {
+        let dir = tempfile::tempdir().unwrap();
+        for name in ["a.fs", "b.fs"] {
+            fs::write(dir.path().join(name), "").unwrap();
+        }
+        let file = |name: &str| dir.path().join(name).to_string_lossy().into_owned();
+        let opts = CompileOptions {
+            out_dir: Some(dir.path().join("out")),
+            ..CompileOptions::default()
+        };
+
+        // a.fs is named again after b.fs, not next to its first mention
+        let jobs = collect_jobs(&[file("a.fs"), file("b.fs"), file("a.fs")], &opts).unwrap();
+        let sources: Vec<_> = jobs.iter().map(|j| j.source.file_name().unwrap()).collect();
+        assert_eq!(sources, ["a.fs", "b.fs"]);
+    }
+}
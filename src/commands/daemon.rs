@@ -0,0 +1,82 @@
+use crate::serial::LinkOptions;
+use crate::{Result, V4Error};
+use std::path::Path;
+use std::time::Duration;
+
+/// Keep `port` open and serve it on a local socket
+///
+/// Other subcommands given the same `--port` connect to the socket instead
+/// of opening the port. Runs until interrupted.
+#[cfg(unix)]
+pub fn daemon(
+    port: &str,
+    link: &LinkOptions,
+    socket: Option<&Path>,
+    timeout: Duration,
+) -> Result<()> {
+    use crate::serial::V4Serial;
+    use std::os::unix::net::{UnixListener, UnixStream};
+    use std::sync::{Arc, Mutex};
+
+    let path = socket
+        .map(Path::to_path_buf)
+        .unwrap_or_else(|| crate::daemon::socket_path(port));
+
+    if path.exists() {
+        if UnixStream::connect(&path).is_ok() {
+            return Err(V4Error::Cli(format!(
+                "A daemon is already serving {} at {}",
+                port,
+                path.display()
+            )));
+        }
+        // Left behind by a daemon that did not shut down cleanly
+        std::fs::remove_file(&path)?;
+    }
+
+    let serial = V4Serial::open_direct(port, link)?;
+    let caps = *serial.caps();
+    let device = Arc::new(Mutex::new(serial));
+    let listener = UnixListener::bind(&path)?;
+
+    println!(
+        "Serving {} ({} baud, MTU {}) on {}",
+        port,
+        caps.baud,
+        caps.mtu,
+        path.display()
+    );
+    println!("Press Ctrl+C to stop");
+
+    for stream in listener.incoming() {
+        let mut stream = match stream {
+            Ok(stream) => stream,
+            Err(e) => {
+                eprintln!("Accept failed: {}", e);
+                continue;
+            }
+        };
+        let device = Arc::clone(&device);
+        std::thread::spawn(move || {
+            crate::trace!(crate::trace::Level::Info, "Client connected");
+            if let Err(e) = crate::daemon::forward(&mut stream, &device, timeout) {
+                eprintln!("Client error: {}", e);
+            }
+            crate::trace!(crate::trace::Level::Info, "Client disconnected");
+        });
+    }
+    Ok(())
+}
+
+/// Keep `port` open and serve it on a local socket
+#[cfg(not(unix))]
+pub fn daemon(
+    _port: &str,
+    _link: &LinkOptions,
+    _socket: Option<&Path>,
+    _timeout: Duration,
+) -> Result<()> {
+    Err(V4Error::Cli(
+        "v4 daemon requires Unix domain sockets and is not available on this platform".to_string(),
+    ))
+}
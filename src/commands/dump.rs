@@ -0,0 +1,295 @@
+use crate::Result;
+use crate::manifest;
+use crate::serial::{LinkOptions, ReadOptions, V4Serial};
+use crate::trace::Level;
+use indicatif::{ProgressBar, ProgressStyle};
+use std::collections::BTreeMap;
+use std::fs::{self, File};
+use std::io::{self, Seek, SeekFrom, Write};
+use std::path::{Path, PathBuf};
+use std::time::Instant;
+
+/// Bytes dumped when no length is given
+pub const DEFAULT_DUMP_LEN: u32 = 256;
+
+/// Dump device memory to a file, or print it as a hexdump
+///
+/// Without `addr` the dump continues where the previous dump of `port`
+/// ended, whether that was `v4 dump` or the REPL's `.dump`.
+pub fn dump(
+    port: &str,
+    link: &LinkOptions,
+    addr: Option<u32>,
+    len: u32,
+    output: Option<&Path>,
+    opts: &ReadOptions,
+) -> Result<()> {
+    let mut serial = V4Serial::open_with(port, link)?;
+    let addr = addr.unwrap_or_else(|| next_address(port));
+    dump_memory(&mut serial, port, addr, len, output, opts)
+}
+
+/// Read `len` bytes at `addr` and remember where the dump ended
+pub(crate) fn dump_memory(
+    serial: &mut V4Serial,
+    port: &str,
+    addr: u32,
+    len: u32,
+    output: Option<&Path>,
+    opts: &ReadOptions,
+) -> Result<()> {
+    let read = match output {
+        Some(path) => dump_to_file(serial, addr, len, path, opts)?,
+        None => {
+            println!("Memory dump at 0x{:08X} ({} bytes):\n", addr, len);
+            let mut hexdump = Hexdump::new(addr, io::stdout().lock());
+            let read = serial.read_memory(addr, len, opts, |block_addr, block| {
+                hexdump.write_block(block_addr, block)
+            })?;
+            hexdump.finish()?;
+            read
+        }
+    };
+
+    let next = addr.wrapping_add(read);
+    if read < len {
+        println!("End of readable memory at 0x{:08X}", next);
+    }
+    save_next_address(port, next);
+    Ok(())
+}
+
+/// Stream memory into `path`, writing each block at its offset as it
+/// arrives
+fn dump_to_file(
+    serial: &mut V4Serial,
+    addr: u32,
+    len: u32,
+    path: &Path,
+    opts: &ReadOptions,
+) -> Result<u32> {
+    let mut file = File::create(path)?;
+
+    let pb = ProgressBar::new(len as u64);
+    pb.set_style(
+        ProgressStyle::default_bar()
+            .template("[{elapsed_precise}] {bar:40.cyan/blue} {bytes}/{total_bytes} {msg}")
+            .unwrap()
+            .progress_chars("=>-"),
+    );
+
+    let started = Instant::now();
+    let read = serial.read_memory(addr, len, opts, |block_addr, block| {
+        file.seek(SeekFrom::Start(block_addr.wrapping_sub(addr) as u64))?;
+        file.write_all(block)?;
+        pb.inc(block.len() as u64);
+        Ok(())
+    });
+    pb.finish_and_clear();
+    let read = read?;
+    file.set_len(read as u64)?;
+
+    let elapsed = started.elapsed().as_secs_f64();
+    println!(
+        "✓ Dumped {} bytes at 0x{:08X} to {} in {:.2}s ({:.1} KB/s)",
+        read,
+        addr,
+        path.display(),
+        elapsed,
+        read as f64 / 1024.0 / elapsed.max(f64::EPSILON)
+    );
+    Ok(read)
+}
+
+/// Writes memory blocks as 16-byte hexdump rows while they arrive
+///
+/// Blocks may arrive out of address order (retransmissions); each is held
+/// only until the blocks before it came in, so memory stays bounded by the
+/// read window rather than the dump length.
+struct Hexdump<W: Write> {
+    out: W,
+    /// Address of the first byte of `row`
+    addr: u32,
+    /// Bytes of the row being filled
+    row: Vec<u8>,
+    /// Blocks that arrived ahead of `addr + row.len()`, by address
+    pending: BTreeMap<u32, Vec<u8>>,
+}
+
+impl<W: Write> Hexdump<W> {
+    fn new(addr: u32, out: W) -> Self {
+        Self {
+            out,
+            addr,
+            row: Vec::with_capacity(16),
+            pending: BTreeMap::new(),
+        }
+    }
+
+    fn next_addr(&self) -> u32 {
+        self.addr.wrapping_add(self.row.len() as u32)
+    }
+
+    fn write_block(&mut self, addr: u32, block: &[u8]) -> Result<()> {
+        if addr != self.next_addr() {
+            self.pending.insert(addr, block.to_vec());
+            return Ok(());
+        }
+        self.write_bytes(block)?;
+        while let Some(block) = self.pending.remove(&self.next_addr()) {
+            self.write_bytes(&block)?;
+        }
+        Ok(())
+    }
+
+    fn write_bytes(&mut self, mut bytes: &[u8]) -> Result<()> {
+        while !bytes.is_empty() {
+            let take = bytes.len().min(16 - self.row.len());
+            self.row.extend_from_slice(&bytes[..take]);
+            bytes = &bytes[take..];
+            if self.row.len() == 16 {
+                writeln!(self.out, "{}", hexdump_row(self.addr, &self.row))?;
+                self.addr = self.addr.wrapping_add(16);
+                self.row.clear();
+            }
+        }
+        Ok(())
+    }
+
+    /// Write the last, incomplete row
+    fn finish(mut self) -> Result<()> {
+        if !self.row.is_empty() {
+            writeln!(self.out, "{}", hexdump_row(self.addr, &self.row))?;
+        }
+        self.out.flush()?;
+        Ok(())
+    }
+}
+
+fn hexdump_row(offset: u32, chunk: &[u8]) -> String {
+    let mut row = format!("{:08X}  ", offset);
+
+    // Hex values, padded if the row is incomplete
+    for j in 0..16 {
+        match chunk.get(j) {
+            Some(byte) => row.push_str(&format!("{:02X} ", byte)),
+            None => row.push_str("   "),
+        }
+        if j == 7 {
+            row.push(' ');
+        }
+    }
+
+    // ASCII representation
+    row.push_str(" |");
+    row.extend(chunk.iter().map(|&byte| {
+        if (0x20..=0x7E).contains(&byte) {
+            byte as char
+        } else {
+            '.'
+        }
+    }));
+    row.push('|');
+    row
+}
+
+/// Parse an address or length: decimal, `0x` hex, optional `K`/`M` suffix
+pub fn parse_number(text: &str) -> std::result::Result<u32, String> {
+    let invalid = || format!("Invalid number: {}", text);
+    let (digits, scale) = if let Some(d) = text.strip_suffix(['k', 'K']) {
+        (d, 1024)
+    } else if let Some(d) = text.strip_suffix(['m', 'M']) {
+        (d, 1024 * 1024)
+    } else {
+        (text, 1)
+    };
+    let value = match digits
+        .strip_prefix("0x")
+        .or_else(|| digits.strip_prefix("0X"))
+    {
+        Some(hex) => u32::from_str_radix(hex, 16),
+        None => digits.parse(),
+    }
+    .map_err(|_| invalid())?;
+    value.checked_mul(scale).ok_or_else(invalid)
+}
+
+fn continuation_path(port: &str) -> Option<PathBuf> {
+    manifest::state_dir().map(|dir| dir.join(format!("{}.dump", crate::ports::file_stem(port))))
+}
+
+/// Address following the last dump of `port` (0 if there was none)
+pub(crate) fn next_address(port: &str) -> u32 {
+    continuation_path(port)
+        .and_then(|path| fs::read_to_string(path).ok())
+        .and_then(|text| parse_number(text.trim()).ok())
+        .unwrap_or(0)
+}
+
+fn save_next_address(port: &str, addr: u32) {
+    let Some(path) = continuation_path(port) else {
+        return;
+    };
+    if let Err(e) = crate::cache::write_atomic(&path, format!("0x{:08X}\n", addr).as_bytes()) {
+        crate::trace!(
+            Level::Info,
+            "Saving dump address to {} failed: {}",
+            path.display(),
+            e
+        );
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_number() {
+        assert_eq!(parse_number("4096"), Ok(4096));
+        assert_eq!(parse_number("0x2000"), Ok(0x2000));
+        assert_eq!(parse_number("0XfF"), Ok(255));
+        assert_eq!(parse_number("64K"), Ok(65536));
+        assert_eq!(parse_number("1m"), Ok(1 << 20));
+        assert!(parse_number("0x").is_err());
+        assert!(parse_number("-1").is_err());
+        assert!(parse_number("8M0").is_err());
+        assert!(parse_number("8192M").is_err());
+    }
+
+    #[test]
+    fn test_hexdump_reorders_blocks() {
+        let data: Vec<u8> = (0..70).collect();
+        let mut direct = Hexdump::new(0x100, Vec::new());
+        direct.write_block(0x100, &data).unwrap();
+        let expected = direct.out.clone();
+        direct.finish().unwrap();
+
+        let mut out = Vec::new();
+        let mut hexdump = Hexdump::new(0x100, &mut out);
+        hexdump.write_block(0x114, &data[20..40]).unwrap();
+        hexdump.write_block(0x13C, &data[60..]).unwrap();
+        hexdump.write_block(0x100, &data[..20]).unwrap();
+        hexdump.write_block(0x128, &data[40..60]).unwrap();
+        assert!(hexdump.pending.is_empty());
+        hexdump.finish().unwrap();
+
+        let text = String::from_utf8(out).unwrap();
+        assert!(text.starts_with(&String::from_utf8(expected).unwrap()));
+        assert_eq!(text.lines().count(), 5);
+        assert!(
+            text.lines()
+                .last()
+                .unwrap()
+                .starts_with("00000140  40 41 42 43 44 45")
+        );
+    }
+
+    #[test]
+    fn test_hexdump_row() {
+        assert_eq!(
+            hexdump_row(0x10, b"AB\x00"),
+            format!("00000010  41 42 00 {}  |AB.|", "   ".repeat(13))
+        );
+    }
+}
@@ -1,7 +1,13 @@
 use crate::Result;
+use crate::bytecode;
+use crate::cache::CompileCache;
+use crate::context::ContextSnapshot;
+use crate::manifest::Manifest;
 use crate::protocol::ErrorCode;
-use crate::repl::Compiler;
-use crate::serial::V4Serial;
+use crate::repl::{CompileMemo, CompileResult, Compiler, WordDef};
+use crate::serial::{LinkOptions, V4Serial};
+use crate::trace;
+use crate::trace::{Hex, Level};
 use rustyline::DefaultEditor;
 use rustyline::error::ReadlineError;
 use std::fs;
@@ -9,53 +15,99 @@ use std::time::Duration;
 
 const DEFAULT_TIMEOUT: Duration = Duration::from_secs(5);
 
+/// Options for [`exec`]
+#[derive(Debug, Clone, Copy)]
+pub struct ExecOptions {
+    /// Timeout for each device response
+    pub timeout: Duration,
+    /// Enter the REPL after execution
+    pub enter_repl: bool,
+    /// Pack word definitions into as few EXEC frames as possible instead of
+    /// one round trip per word
+    pub batch: bool,
+    /// Look up and store the compile result in the compile cache
+    pub cache: bool,
+    /// Send every word even if the device manifest says it is unchanged
+    pub full: bool,
+}
+
+impl Default for ExecOptions {
+    fn default() -> Self {
+        Self {
+            timeout: DEFAULT_TIMEOUT,
+            enter_repl: false,
+            batch: true,
+            cache: true,
+            full: false,
+        }
+    }
+}
+
 /// Execute Forth source file on device
-pub fn exec(file: &str, port: &str, timeout: Duration, enter_repl: bool) -> Result<()> {
+pub fn exec(file: &str, port: &str, link: &LinkOptions, opts: &ExecOptions) -> Result<()> {
+    let ExecOptions {
+        timeout,
+        enter_repl,
+        ..
+    } = *opts;
+
     // Read Forth source file
     let source = fs::read_to_string(file)?;
 
     // Open serial connection
-    let mut serial = V4Serial::open_default(port)?;
+    let mut serial = V4Serial::open_with(port, link)?;
 
-    // Create compiler
+    // Create compiler and register the words earlier sessions left on the
+    // device. `--full` compiles without them, but still drops a stale
+    // context so that it is not merged with this session's words.
     let mut compiler = Compiler::new().map_err(crate::V4Error::Compilation)?;
+    let mut context = load_context(&mut serial, port, timeout)?;
+    if opts.full {
+        context = ContextSnapshot::default();
+    }
+    compiler
+        .restore(&context)
+        .map_err(crate::V4Error::Compilation)?;
 
     println!("Compiling {}...", file);
 
-    // Compile Forth source
-    let compiled = compiler
-        .compile(&source)
-        .map_err(crate::V4Error::Compilation)?;
+    // The result only depends on the source and the restored words, so it
+    // can come from the cache
+    let cache = if opts.cache {
+        CompileCache::open_default()
+    } else {
+        None
+    };
+    let compiled = match cache.as_ref().and_then(|c| c.get_result(&source, &context)) {
+        Some(compiled) => compiled,
+        None => {
+            let compiled = compiler
+                .compile(&source)
+                .map_err(crate::V4Error::Compilation)?;
+            if let Some(cache) = &cache {
+                cache.put_result(&source, &context, &compiled);
+            }
+            compiled
+        }
+    };
 
     // Send word definitions first
     if !compiled.words.is_empty() {
         println!("Compiled {} word(s)", compiled.words.len());
 
-        for word in &compiled.words {
+        let delta = define_changed_words(&mut serial, port, &compiled.words, &mut compiler, opts)
+            .inspect_err(|e| eprintln!("  Error: {}", e))?;
+
+        if !delta.kept.is_empty() {
+            println!("  {} unchanged word(s) already on device", delta.kept.len());
+        }
+        for (pos, word_idx) in delta.registered {
             println!(
-                "  Sending word '{}'... ({} bytes)",
-                word.name,
-                word.bytecode.len()
+                "  Word '{}' registered at index {}",
+                compiled.words[pos].name, word_idx
             );
-
-            let response = serial.exec(&word.bytecode, timeout)?;
-
-            if response.error_code != ErrorCode::Ok {
-                eprintln!("  Error: {}", response.error_code.name());
-                return Err(crate::V4Error::Protocol(format!(
-                    "Device returned error: {}",
-                    response.error_code.name()
-                )));
-            }
-
-            // Register word in compiler context
-            if let Some(&word_idx) = response.word_indices.first() {
-                println!("  Word '{}' registered at index {}", word.name, word_idx);
-                compiler
-                    .register_word_index(&word.name, word_idx as i32)
-                    .map_err(crate::V4Error::Compilation)?;
-            }
         }
+        save_context(port, &compiler);
     }
 
     // Execute main bytecode if present
@@ -87,6 +139,7 @@ pub fn exec(file: &str, port: &str, timeout: Duration, enter_repl: bool) -> Resu
         println!("Type '.help' for help\n");
 
         let mut rl = DefaultEditor::new().map_err(|e| crate::V4Error::Repl(e.to_string()))?;
+        let mut memo = CompileMemo::default();
 
         // REPL loop
         loop {
@@ -112,14 +165,15 @@ pub fn exec(file: &str, port: &str, timeout: Duration, enter_repl: bool) -> Resu
 
                     // Check for meta-commands
                     if line.starts_with('.') {
-                        if let Err(e) = handle_meta_command(line, &mut serial, &mut compiler) {
+                        if let Err(e) = handle_meta_command(line, port, &mut serial, &mut compiler)
+                        {
                             eprintln!("Error: {}", e);
                         }
                         continue;
                     }
 
                     // Compile Forth code
-                    let compiled = match compiler.compile(line) {
+                    let compiled = match memo.compile(&mut compiler, line) {
                         Ok(c) => c,
                         Err(e) => {
                             eprintln!("Error: {}", e);
@@ -128,9 +182,11 @@ pub fn exec(file: &str, port: &str, timeout: Duration, enter_repl: bool) -> Resu
                     };
 
                     // Execute on device
-                    if let Err(e) =
-                        execute_on_device(&mut serial, &compiled, &mut compiler, timeout)
-                    {
+                    let result = execute_on_device(&mut serial, &compiled, &mut compiler, timeout);
+                    if !compiled.words.is_empty() {
+                        save_context(port, &compiler);
+                    }
+                    if let Err(e) = result {
                         eprintln!("Error: {}", e);
                         continue;
                     }
@@ -159,34 +215,221 @@ pub fn exec(file: &str, port: &str, timeout: Duration, enter_repl: bool) -> Resu
     Ok(())
 }
 
-/// Execute compiled bytecode on device
-fn execute_on_device(
+/// Outcome of [`define_changed_words`]
+pub(crate) struct Delta {
+    /// `(position, index)` of words sent and registered by the device
+    pub registered: Vec<(usize, u16)>,
+    /// `(position, index)` of words skipped because the device has them
+    pub kept: Vec<(usize, u16)>,
+}
+
+/// Send only the words that are new or changed since the last deploy to
+/// `port`, and update the port's manifest
+///
+/// Unchanged words are registered with the compiler at the index recorded
+/// in the manifest. `words` must have been compiled right after the words
+/// already registered with `compiler`. With `opts.full`, or when the device
+/// no longer matches the manifest, every word is sent.
+pub(crate) fn define_changed_words(
+    serial: &mut V4Serial,
+    port: &str,
+    words: &[WordDef],
+    compiler: &mut Compiler,
+    opts: &ExecOptions,
+) -> Result<Delta> {
+    let mut manifest = if opts.full {
+        Manifest::default()
+    } else {
+        Manifest::load(port)
+    };
+    let first_index = compiler.next_index();
+    let mut plan = manifest.plan(words, first_index);
+    if !plan.keep.is_empty() && !manifest.verify(serial, words, &plan, opts.timeout)? {
+        manifest = Manifest::default();
+        plan = manifest.plan(words, first_index);
+    }
+
+    for &(pos, word_idx) in &plan.keep {
+        compiler
+            .register_word_index(&words[pos].name, word_idx as i32)
+            .map_err(crate::V4Error::Compilation)?;
+    }
+
+    let changed: Vec<WordDef> = plan.send.iter().map(|&pos| words[pos].clone()).collect();
+    let mut registered = Vec::new();
+    if !changed.is_empty() {
+        let total: usize = changed.iter().map(|w| w.bytecode.len()).sum();
+        println!("  Sending word definitions... ({} bytes)", total);
+
+        registered = define_words(serial, &changed, compiler, opts.timeout, opts.batch)?;
+        for (pos, word_idx) in &mut registered {
+            *pos = plan.send[*pos];
+            manifest.record(&words[*pos].name, &words[*pos].bytecode, *word_idx);
+        }
+    }
+
+    if let Err(e) = manifest.save(port) {
+        trace!(Level::Info, "Could not save device manifest: {}", e);
+    }
+    Ok(Delta {
+        registered,
+        kept: plan.keep,
+    })
+}
+
+/// Send word definitions to the device and register the returned indices
+///
+/// With `batch` enabled, consecutive words are packed into as few EXEC frames
+/// as fit into the link MTU: each frame carries a v0.2 image and the
+/// device answers with one index per word. Single words (and words too
+/// large to pack) are sent as their own EXEC, as before.
+///
+/// Returns `(position in words, device index)` for every registered word.
+pub(crate) fn define_words(
     serial: &mut V4Serial,
-    compiled: &crate::repl::CompileResult,
+    words: &[WordDef],
     compiler: &mut Compiler,
     timeout: Duration,
-) -> Result<()> {
-    // Execute word definitions first
-    for word in &compiled.words {
-        let response = serial.exec(&word.bytecode, timeout)?;
+    batch: bool,
+) -> Result<Vec<(usize, u16)>> {
+    let max_payload = serial.max_payload();
+    let batches = if batch {
+        bytecode::plan_batches(words, max_payload)
+    } else {
+        (0..words.len()).map(|i| i..i + 1).collect()
+    };
+
+    let mut registered = Vec::with_capacity(words.len());
+    let mut image = Vec::with_capacity(max_payload);
+
+    for range in batches {
+        let group = &words[range.clone()];
+        let response = if group.len() > 1 {
+            bytecode::encode_words(group, &mut image);
+            trace!(
+                Level::Debug,
+                "Executing {} words in one frame ({} bytes)",
+                group.len(),
+                image.len()
+            );
+            serial.exec(&image, timeout)?
+        } else {
+            let word = &group[0];
+            trace!(
+                Level::Debug,
+                "Executing word '{}' ({} bytes): {}",
+                word.name,
+                word.bytecode.len(),
+                Hex(&word.bytecode)
+            );
+            serial.exec(&word.bytecode, timeout)?
+        };
+
         if response.error_code != ErrorCode::Ok {
+            let names: Vec<&str> = group.iter().map(|w| w.name.as_str()).collect();
             return Err(crate::V4Error::Device(format!(
                 "Failed to register word '{}': {}",
-                word.name,
+                names.join("', '"),
                 response.error_code.name()
             )));
         }
 
-        // Register word index returned from device
-        if let Some(&word_idx) = response.word_indices.first() {
+        if group.len() > 1 && response.word_indices.len() != group.len() {
+            return Err(crate::V4Error::Protocol(format!(
+                "Device registered {} of {} words",
+                response.word_indices.len(),
+                group.len()
+            )));
+        }
+
+        // Register word indices returned from device, in definition order
+        for (pos, &word_idx) in range.zip(&response.word_indices) {
+            trace!(
+                Level::Debug,
+                "Device registered word '{}' at index {}", words[pos].name, word_idx
+            );
             compiler
-                .register_word_index(&word.name, word_idx as i32)
+                .register_word_index(&words[pos].name, word_idx as i32)
                 .map_err(crate::V4Error::Compilation)?;
+            registered.push((pos, word_idx));
         }
     }
 
+    Ok(registered)
+}
+
+/// Register the compiler context saved by earlier sessions on `port`
+///
+/// The snapshot is checked against the device first and dropped if the
+/// device no longer holds its words. Returns the number of words restored.
+pub(crate) fn restore_context(
+    serial: &mut V4Serial,
+    port: &str,
+    compiler: &mut Compiler,
+    timeout: Duration,
+) -> Result<usize> {
+    let snapshot = load_context(serial, port, timeout)?;
+    if snapshot.is_empty() {
+        return Ok(0);
+    }
+    compiler
+        .restore(&snapshot)
+        .map_err(crate::V4Error::Compilation)?;
+    trace!(
+        Level::Info,
+        "Restored {} word(s) from compiler context",
+        snapshot.words().len()
+    );
+    Ok(snapshot.words().len())
+}
+
+/// Compiler context of `port`, or an empty one (and the saved one dropped)
+/// if the device no longer holds its words
+pub(crate) fn load_context(
+    serial: &mut V4Serial,
+    port: &str,
+    timeout: Duration,
+) -> Result<ContextSnapshot> {
+    let snapshot = ContextSnapshot::load(port);
+    if snapshot.is_empty() || snapshot.verify(serial, timeout)? {
+        return Ok(snapshot);
+    }
+    ContextSnapshot::clear(port)?;
+    Ok(ContextSnapshot::default())
+}
+
+/// Add the words registered with `compiler` to the context of `port`
+///
+/// Words of earlier sessions are kept (a compiler started with `--full`
+/// does not know them, but the device still does); the saved context is
+/// dropped whenever the VM is reset.
+pub(crate) fn save_context(port: &str, compiler: &Compiler) {
+    let mut snapshot = ContextSnapshot::load(port);
+    snapshot.merge(&compiler.snapshot());
+    if let Err(e) = snapshot.save(port) {
+        trace!(Level::Info, "Could not save compiler context: {}", e);
+    }
+}
+
+/// Execute compiled bytecode on device
+///
+/// Word definitions are sent first (batched), then the main bytecode.
+pub(crate) fn execute_on_device(
+    serial: &mut V4Serial,
+    compiled: &CompileResult,
+    compiler: &mut Compiler,
+    timeout: Duration,
+) -> Result<()> {
+    define_words(serial, &compiled.words, compiler, timeout, true)?;
+
     // Execute main bytecode
     if !compiled.bytecode.is_empty() {
+        trace!(
+            Level::Debug,
+            "Executing main bytecode ({} bytes): {}",
+            compiled.bytecode.len(),
+            Hex(&compiled.bytecode)
+        );
         let response = serial.exec(&compiled.bytecode, timeout)?;
         if response.error_code != ErrorCode::Ok {
             return Err(crate::V4Error::Device(format!(
@@ -200,7 +443,12 @@ fn execute_on_device(
 }
 
 /// Handle meta-commands (.help, .ping, etc.)
-fn handle_meta_command(line: &str, serial: &mut V4Serial, compiler: &mut Compiler) -> Result<()> {
+fn handle_meta_command(
+    line: &str,
+    port: &str,
+    serial: &mut V4Serial,
+    compiler: &mut Compiler,
+) -> Result<()> {
     let parts: Vec<&str> = line.split_whitespace().collect();
     let command = parts[0];
 
@@ -232,8 +480,9 @@ fn handle_meta_command(line: &str, serial: &mut V4Serial, compiler: &mut Compile
                 )));
             }
 
-            // Reset compiler context
+            // Reset compiler context and forget the device's words
             compiler.reset();
+            Manifest::clear(port)?;
 
             println!("VM and compiler context reset");
             Ok(())
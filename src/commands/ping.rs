@@ -1,11 +1,11 @@
 use crate::Result;
 use crate::protocol::ErrorCode;
-use crate::serial::V4Serial;
+use crate::serial::{LinkOptions, V4Serial};
 use std::time::Duration;
 
 /// Send PING command to device
-pub fn ping(port: &str, timeout: Duration) -> Result<()> {
-    let mut serial = V4Serial::open_default(port)?;
+pub fn ping(port: &str, link: &LinkOptions, timeout: Duration) -> Result<()> {
+    let mut serial = V4Serial::open_with(port, link)?;
 
     println!("Sending PING to {}...", port);
 
@@ -0,0 +1,212 @@
+use crate::Result;
+use crate::protocol::ErrorCode;
+use crate::serial::{LinkOptions, V4Serial};
+use crate::symbols::SymbolTable;
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+use std::path::Path;
+use std::time::{Duration, Instant};
+
+/// Frame name for return addresses outside every known word
+const UNKNOWN_FRAME: &str = "?";
+
+/// Stack of a sample taken while no word was being called
+const TOP_LEVEL_FRAME: &str = "(top level)";
+
+/// Options for [`profile`]
+#[derive(Debug, Clone, Copy)]
+pub struct ProfileOptions {
+    /// How long to sample
+    pub duration: Duration,
+    /// Samples per second; the link round trip bounds what is achieved
+    pub rate: u32,
+    /// Start of the dictionary in VM memory
+    pub code_base: u32,
+    /// Bytes of dictionary to search for word code
+    pub code_size: u32,
+    /// Timeout for each device response
+    pub timeout: Duration,
+}
+
+impl Default for ProfileOptions {
+    fn default() -> Self {
+        Self {
+            duration: Duration::from_secs(10),
+            rate: 100,
+            code_base: 0,
+            code_size: 64 * 1024,
+            timeout: Duration::from_secs(5),
+        }
+    }
+}
+
+/// Sample the return stack of the running device and write folded stacks
+///
+/// Every sample is one QUERY_STACK. Return addresses are mapped to the
+/// words whose code contains them and each distinct stack is written as
+/// `ROOT;...;CALLER COUNT`, the input format of flamegraph tools, to
+/// `output` or stdout.
+pub fn profile(
+    port: &str,
+    link: &LinkOptions,
+    output: Option<&Path>,
+    opts: &ProfileOptions,
+) -> Result<()> {
+    let mut serial = V4Serial::open_with(port, link)?;
+
+    let mut symbols = SymbolTable::from_device(&mut serial, opts.timeout)?;
+    let located =
+        symbols.locate_on_device(&mut serial, opts.code_base, opts.code_size, opts.timeout)?;
+    eprintln!(
+        "Located {} of {} word(s) in 0x{:08X}..0x{:08X}",
+        located,
+        symbols.symbols().len(),
+        opts.code_base,
+        opts.code_base.saturating_add(opts.code_size)
+    );
+
+    eprintln!(
+        "Sampling {} for {:.1}s at {} Hz...",
+        port,
+        opts.duration.as_secs_f64(),
+        opts.rate
+    );
+    let (stacks, samples, elapsed) = sample(&mut serial, &symbols, opts)?;
+
+    let mut out: Box<dyn Write> = match output {
+        Some(path) => Box::new(BufWriter::new(File::create(path)?)),
+        None => Box::new(io::stdout().lock()),
+    };
+    write_folded(&mut out, &stacks)?;
+    out.flush()?;
+
+    eprintln!(
+        "{} sample(s), {} distinct stack(s), {:.0} Hz achieved",
+        samples,
+        stacks.len(),
+        samples as f64 / elapsed.as_secs_f64().max(f64::EPSILON)
+    );
+    if let Some(path) = output {
+        eprintln!("Folded stacks written to {}", path.display());
+    }
+    Ok(())
+}
+
+/// Take samples for `opts.duration`; returns folded stack counts, the
+/// sample count and the time taken
+fn sample(
+    serial: &mut V4Serial,
+    symbols: &SymbolTable,
+    opts: &ProfileOptions,
+) -> Result<(HashMap<String, u64>, u64, Duration)> {
+    let interval = Duration::from_secs(1) / opts.rate.max(1);
+    let mut stacks: HashMap<String, u64> = HashMap::new();
+    let mut samples = 0;
+    let started = Instant::now();
+    let mut next = started;
+
+    while started.elapsed() < opts.duration {
+        let response = serial.query_stack(opts.timeout)?;
+        if response.error_code != ErrorCode::Ok {
+            return Err(crate::V4Error::Device(format!(
+                "Query stack failed: {}",
+                response.error_code.name()
+            )));
+        }
+        if let Some(stack) = return_stack(&response.data) {
+            *stacks.entry(fold(&stack, symbols)).or_default() += 1;
+            samples += 1;
+        }
+
+        // Keep the schedule; a slow link just samples as fast as it can
+        next += interval;
+        let now = Instant::now();
+        if next > now {
+            std::thread::sleep(next - now);
+        } else {
+            next = now;
+        }
+    }
+    Ok((stacks, samples, started.elapsed()))
+}
+
+/// Return stack from QUERY_STACK data, most recent entry first
+///
+/// Data layout: `[DS_DEPTH][DS (i32 LE)...][RS_DEPTH][RS (u32 LE)...]`.
+pub(crate) fn return_stack(data: &[u8]) -> Option<Vec<u32>> {
+    let ds_depth = *data.first()? as usize;
+    let at = 1 + ds_depth * 4;
+    let rs_depth = *data.get(at)? as usize;
+    let entries = data.get(at + 1..at + 1 + rs_depth * 4)?;
+    Some(
+        entries
+            .chunks_exact(4)
+            .map(|b| u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+            .collect(),
+    )
+}
+
+/// Folded form of a return stack: word names from the outermost caller in
+///
+/// A return address points past its call, which may be the first byte of
+/// the next word, so the byte before it is looked up.
+fn fold(stack: &[u32], symbols: &SymbolTable) -> String {
+    if stack.is_empty() {
+        return TOP_LEVEL_FRAME.to_string();
+    }
+    stack
+        .iter()
+        .rev()
+        .map(|&addr| {
+            symbols
+                .lookup(addr.saturating_sub(1))
+                .map_or(UNKNOWN_FRAME, |symbol| symbol.name.as_str())
+        })
+        .collect::<Vec<_>>()
+        .join(";")
+}
+
+/// Write `STACK COUNT` lines, sorted by stack
+fn write_folded(out: &mut impl Write, stacks: &HashMap<String, u64>) -> io::Result<()> {
+    let mut lines: Vec<_> = stacks.iter().collect();
+    lines.sort();
+    for (stack, count) in lines {
+        writeln!(out, "{} {}", stack, count)?;
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_return_stack() {
+        // One data stack cell, two return addresses
+        let data = [1, 0x2A, 0, 0, 0, 2, 0x05, 0x10, 0, 0, 0x01, 0x10, 0, 0];
+        assert_eq!(return_stack(&data), Some(vec![0x1005, 0x1001]));
+        assert_eq!(return_stack(&[0, 0]), Some(vec![]));
+        assert_eq!(return_stack(&data[..10]), None);
+    }
+
+    #[test]
+    fn test_folded_stacks() {
+        let mut symbols = SymbolTable::new([
+            ("MAIN".to_string(), vec![0x01, 0x02, 0x51]),
+            ("BLINK".to_string(), vec![0x03, 0x51]),
+        ]);
+        symbols.locate(&[0x01, 0x02, 0x51, 0x03, 0x51], 0x1000);
+
+        assert_eq!(fold(&[0x1004, 0x1002], &symbols), "MAIN;BLINK");
+        assert_eq!(fold(&[0x2000, 0x1002], &symbols), "MAIN;?");
+        // Returning past the last byte of MAIN, where BLINK starts
+        assert_eq!(fold(&[0x1003], &symbols), "MAIN");
+        assert_eq!(fold(&[], &symbols), "(top level)");
+
+        let stacks = HashMap::from([("MAIN;BLINK".to_string(), 3), ("MAIN".to_string(), 1)]);
+        let mut out = Vec::new();
+        write_folded(&mut out, &stacks).unwrap();
+        assert_eq!(String::from_utf8(out).unwrap(), "MAIN 1\nMAIN;BLINK 3\n");
+    }
+}
@@ -1,60 +1,135 @@
-use crate::Result;
-use crate::protocol::ErrorCode;
-use crate::serial::V4Serial;
-use indicatif::{ProgressBar, ProgressStyle};
-use std::fs;
+use crate::bytecode;
+use crate::manifest::Manifest;
+use crate::mmap::MappedFile;
+use crate::ports;
+use crate::protocol::chunk::CHUNK_HEADER_SIZE;
+use crate::protocol::{ErrorCode, Response};
+use crate::repl::WordDef;
+use crate::serial::{LinkOptions, LinkStats, PushOptions, TransferStats, V4Serial};
+use crate::trace::Level;
+use crate::{Result, V4Error};
+use indicatif::{MultiProgress, ProgressBar, ProgressStyle};
 use std::path::Path;
-use std::time::Duration;
+use std::sync::OnceLock;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::time::{Duration, Instant};
+
+/// Push bytecode to one or more devices
+///
+/// Images that fit into one frame are sent as a single EXEC; larger images
+/// use the segmented PUSH_BEGIN/PUSH_CHUNK/PUSH_END transfer. Frame sizes
+/// follow the link MTU negotiated through `link`.
+///
+/// `ports` may list several ports or globs (see [`ports::expand`]). With
+/// more than one port the image is deployed to all devices concurrently,
+/// one worker thread per port, and a per-device summary is printed at the
+/// end.
+///
+/// Words the device already holds with identical bytecode, according to
+/// the port's [`Manifest`], are left out of the transfer unless `full` is
+/// set.
+///
+/// Large files are memory-mapped (see [`MappedFile`]) and the image is
+/// validated and decoded once; all device workers read the same copy. The
+/// file must not be rewritten while the push runs.
+pub fn push(
+    file: &str,
+    ports: &[String],
+    link: &LinkOptions,
+    detach: bool,
+    full: bool,
+    opts: &PushOptions,
+) -> Result<()> {
+    let ports = ports::expand(ports)?;
 
-/// Push bytecode to device
-pub fn push(file: &str, port: &str, detach: bool, timeout: Duration) -> Result<()> {
     // Read bytecode file
     let path = Path::new(file);
     if !path.exists() {
-        return Err(crate::V4Error::Io(std::io::Error::new(
+        return Err(V4Error::Io(std::io::Error::new(
             std::io::ErrorKind::NotFound,
             format!("Bytecode file not found: {}", file),
         )));
     }
 
-    let file_data = fs::read(path)?;
-    let file_size = file_data.len();
+    // SAFETY: nothing in this process writes to or truncates the file
+    // while `file_data` lives. Another process still can, and nothing here
+    // can stop it: this caller accepts that a concurrent truncation kills
+    // the push with SIGBUS, and that a concurrent rewrite may send bytes
+    // other than the ones validated below. That is why `open` is unsafe.
+    let file_data = unsafe { MappedFile::open(path)? };
+    let prepared = Prepared::new(&file_data)?;
+    let size = file_data.len();
 
-    // .v4b files have a 16-byte header: "V4BC" + metadata
-    // V4-link expects raw bytecode only, so skip the header
-    const HEADER_SIZE: usize = 16;
+    println!("Loading bytecode from {} ({} bytes total)...", file, size);
 
-    if file_size < HEADER_SIZE {
-        return Err(crate::V4Error::Protocol(
-            "File too small to contain V4 bytecode header".to_string(),
-        ));
+    if let [port] = ports.as_slice() {
+        push_one(&prepared, port, link, detach, full, opts)
+    } else {
+        push_fleet(&prepared, &ports, link, detach, full, opts)
     }
+}
 
-    // Verify magic number "V4BC"
-    if &file_data[0..4] != b"V4BC" {
-        return Err(crate::V4Error::Protocol(
-            "Invalid V4 bytecode file (missing V4BC magic number)".to_string(),
-        ));
-    }
+/// Image validated and decoded once, shared by all device workers
+struct Prepared<'a> {
+    /// The whole .v4b file, header included
+    data: &'a [u8],
+    /// Words and main code; `None` for v0.2 images that do not decode, which
+    /// are sent as they are
+    parsed: Option<bytecode::Image<'a>>,
+    /// v0.2 encoding of a v0.3 image, made on first use
+    reencoded: OnceLock<Vec<u8>>,
+}
 
-    // Send entire .v4b file (including header)
-    // V4-link v0.2+ parses the header to extract word definitions
-    let bytecode = &file_data;
-    let size = bytecode.len();
+impl<'a> Prepared<'a> {
+    fn new(data: &'a [u8]) -> Result<Self> {
+        // .v4b files have a 16-byte header: "V4BC" + metadata
+        let header = bytecode::Header::parse(data)?;
+        if data.len() <= bytecode::HEADER_SIZE {
+            return Err(V4Error::Protocol("Bytecode file too small".to_string()));
+        }
 
-    println!(
-        "Loading bytecode from {} ({} bytes total)...",
-        file, size
-    );
+        // Check v0.3 section checksums before anything reaches a device
+        let parsed = match bytecode::Image::parse(data) {
+            Ok(parsed) => Some(parsed),
+            // The device does not read v0.3 images, so they must decode
+            Err(e) if header.version() == (0, 3) => return Err(e),
+            Err(_) => None,
+        };
+        Ok(Self {
+            data,
+            parsed,
+            reencoded: OnceLock::new(),
+        })
+    }
 
-    if size <= HEADER_SIZE {
-        return Err(crate::V4Error::Protocol(
-            "Bytecode file too small".to_string(),
-        ));
+    /// The complete image in the form the device reads
+    ///
+    /// V4-link v0.2+ parses the header to extract word definitions, so
+    /// v0.2 files are sent as they are. The device does not read v0.3
+    /// sections, so v0.3 files are re-encoded once and shared by all
+    /// devices.
+    fn full_image(&self) -> &[u8] {
+        match &self.parsed {
+            Some(parsed) if parsed.header.version() != (0, 2) => self.reencoded.get_or_init(|| {
+                let mut buf = Vec::with_capacity(self.data.len());
+                bytecode::encode_image(&parsed.words, parsed.main, &mut buf);
+                buf
+            }),
+            _ => self.data,
+        }
     }
+}
 
+fn push_one(
+    prepared: &Prepared,
+    port: &str,
+    link: &LinkOptions,
+    detach: bool,
+    full: bool,
+    opts: &PushOptions,
+) -> Result<()> {
     // Create progress bar
-    let pb = ProgressBar::new(size as u64);
+    let pb = ProgressBar::new(prepared.data.len() as u64);
     pb.set_style(
         ProgressStyle::default_bar()
             .template("[{elapsed_precise}] {bar:40.cyan/blue} {bytes}/{total_bytes} {msg}")
@@ -62,15 +137,21 @@ pub fn push(file: &str, port: &str, detach: bool, timeout: Duration) -> Result<(
             .progress_chars("=>-"),
     );
 
-    // Open serial port
-    let mut serial = V4Serial::open_default(port)?;
-
-    pb.set_message("Sending...");
-
-    // Send EXEC command
-    let response = serial.exec(bytecode, timeout)?;
-
-    pb.inc(size as u64);
+    let started = Instant::now();
+    let Deployed {
+        response,
+        kept,
+        stats,
+        link,
+    } = deploy(
+        prepared,
+        port,
+        link,
+        opts,
+        full,
+        |n| pb.inc(n as u64),
+        |msg| pb.set_message(msg),
+    )?;
 
     if detach {
         pb.finish_with_message("Sent (detached)");
@@ -81,17 +162,323 @@ pub fn push(file: &str, port: &str, detach: bool, timeout: Duration) -> Result<(
     pb.finish_with_message("Complete");
 
     println!("Response: {}", response.error_code.name());
+    if link.had_errors() {
+        println!(
+            "  Link: {} CRC error(s), {} timeout(s), {} retransmission(s)",
+            link.crc_errors, link.timeouts, link.retries
+        );
+    }
 
     if response.error_code == ErrorCode::Ok {
         println!("✓ Bytecode deployed successfully");
         if !response.word_indices.is_empty() {
             println!("  Registered {} word(s)", response.word_indices.len());
         }
+        if kept > 0 {
+            println!("  Skipped {} unchanged word(s)", kept);
+        }
+        if stats.wire_bytes < stats.image_bytes {
+            let elapsed = started.elapsed().as_secs_f64().max(f64::EPSILON);
+            println!(
+                "  Compressed {} → {} bytes ({:.0}%), {:.1} KB/s effective",
+                stats.image_bytes,
+                stats.wire_bytes,
+                stats.ratio() * 100.0,
+                stats.image_bytes as f64 / 1024.0 / elapsed
+            );
+        }
         Ok(())
     } else {
-        Err(crate::V4Error::Device(format!(
+        Err(V4Error::Device(format!(
             "Device returned error: {}",
             response.error_code.name()
         )))
     }
 }
+
+/// Outcome of deploying to one device of a fleet
+struct DeviceResult {
+    port: String,
+    result: Result<Deployed>,
+    elapsed: Duration,
+}
+
+fn push_fleet(
+    prepared: &Prepared,
+    ports: &[String],
+    link: &LinkOptions,
+    detach: bool,
+    full: bool,
+    opts: &PushOptions,
+) -> Result<()> {
+    let size = prepared.data.len() as u64;
+    let width = ports.iter().map(|p| p.len()).max().unwrap_or(0);
+
+    let multi = MultiProgress::new();
+    let style = ProgressStyle::default_bar()
+        .template("{prefix} [{elapsed_precise}] {bar:30.cyan/blue} {bytes}/{total_bytes} {msg}")
+        .unwrap()
+        .progress_chars("=>-");
+
+    let total = multi.add(ProgressBar::new(size * ports.len() as u64));
+    total.set_style(style.clone());
+    total.set_prefix(format!("{:>width$}", "total"));
+    total.set_message(format!("0/{} devices", ports.len()));
+
+    println!("Deploying to {} devices...", ports.len());
+    let started = Instant::now();
+    let done = AtomicUsize::new(0);
+
+    let results: Vec<DeviceResult> = std::thread::scope(|scope| {
+        let workers: Vec<_> = ports
+            .iter()
+            .map(|port| {
+                let pb = multi.insert_before(&total, ProgressBar::new(size));
+                pb.set_style(style.clone());
+                pb.set_prefix(format!("{:>width$}", port));
+
+                let (total, done) = (&total, &done);
+                scope.spawn(move || {
+                    let start = Instant::now();
+                    let result = deploy(
+                        prepared,
+                        port,
+                        link,
+                        opts,
+                        full,
+                        |n| {
+                            pb.inc(n as u64);
+                            total.inc(n as u64);
+                        },
+                        |msg| pb.set_message(msg),
+                    );
+                    match &result {
+                        Ok(_) if detach => pb.finish_with_message("Sent (detached)"),
+                        Ok(deployed) => pb.finish_with_message(deployed.response.error_code.name()),
+                        Err(e) => pb.abandon_with_message(format!("failed: {}", e)),
+                    }
+                    let n = done.fetch_add(1, Ordering::Relaxed) + 1;
+                    total.set_message(format!("{}/{} devices", n, ports.len()));
+                    DeviceResult {
+                        port: port.clone(),
+                        result,
+                        elapsed: start.elapsed(),
+                    }
+                })
+            })
+            .collect();
+
+        workers
+            .into_iter()
+            .zip(ports)
+            .map(|(worker, port)| {
+                worker.join().unwrap_or_else(|_| DeviceResult {
+                    port: port.clone(),
+                    result: Err(V4Error::Cli("Worker thread panicked".to_string())),
+                    elapsed: Duration::ZERO,
+                })
+            })
+            .collect()
+    });
+    total.finish();
+
+    println!();
+    let mut failed = 0;
+    for device in &results {
+        let status = match &device.result {
+            // Like a single detached push, the device's answer is not judged
+            Ok(_) if detach => "✓ sent (detached)".to_string(),
+            Ok(Deployed {
+                response,
+                kept,
+                stats,
+                link,
+            }) if response.error_code == ErrorCode::Ok => {
+                let mut status = format!(
+                    "✓ {} word(s), {} unchanged",
+                    response.word_indices.len(),
+                    kept
+                );
+                if stats.wire_bytes < stats.image_bytes {
+                    status.push_str(&format!(", {:.0}% on the wire", stats.ratio() * 100.0));
+                }
+                if link.had_errors() {
+                    status.push_str(&format!(
+                        ", {:.1}% link errors, {} retransmitted",
+                        link.error_rate() * 100.0,
+                        link.retries
+                    ));
+                }
+                status
+            }
+            Ok(Deployed { response, .. }) => {
+                failed += 1;
+                format!("✗ device error: {}", response.error_code.name())
+            }
+            Err(e) => {
+                failed += 1;
+                format!("✗ {}", e)
+            }
+        };
+        println!(
+            "  {:<width$}  {:>7.2}s  {}",
+            device.port,
+            device.elapsed.as_secs_f64(),
+            status
+        );
+    }
+    println!(
+        "Deployed to {}/{} devices in {:.2}s",
+        results.len() - failed,
+        results.len(),
+        started.elapsed().as_secs_f64()
+    );
+
+    if failed > 0 {
+        return Err(V4Error::Device(format!(
+            "{} of {} devices failed",
+            failed,
+            results.len()
+        )));
+    }
+    Ok(())
+}
+
+/// Result of deploying an image to one device
+struct Deployed {
+    response: Response,
+    /// Words skipped because the device manifest lists them as unchanged
+    kept: usize,
+    stats: TransferStats,
+    link: LinkStats,
+}
+
+/// Open `port` and transfer the image, reporting progress through the
+/// callbacks
+///
+/// Unless `full` is set, words the port's manifest lists as unchanged are
+/// dropped from the image first; their bytes count as progress right away.
+fn deploy<P, M>(
+    prepared: &Prepared,
+    port: &str,
+    link: &LinkOptions,
+    opts: &PushOptions,
+    full: bool,
+    mut on_progress: P,
+    on_message: M,
+) -> Result<Deployed>
+where
+    P: FnMut(usize),
+    M: Fn(String),
+{
+    // Open serial port
+    let mut serial = V4Serial::open_with(port, link)?;
+    let max_payload = serial.max_payload();
+
+    let Some(parsed) = &prepared.parsed else {
+        // Words cannot be matched to the indices the device returns
+        Manifest::clear(port)?;
+        let (response, stats) =
+            send_image(&mut serial, prepared.data, opts, on_progress, on_message)?;
+        return Ok(Deployed {
+            response,
+            kept: 0,
+            stats,
+            link: *serial.link_stats(),
+        });
+    };
+
+    let mut manifest = if full {
+        Manifest::default()
+    } else {
+        Manifest::load(port)
+    };
+    // Images are compiled for an empty VM
+    let mut plan = manifest.plan(&parsed.words, 0);
+    if !plan.keep.is_empty() && !manifest.verify(&mut serial, &parsed.words, &plan, opts.timeout)? {
+        manifest = Manifest::default();
+        plan = manifest.plan(&parsed.words, 0);
+    }
+
+    let changed = || plan.send.iter().map(|&pos| &parsed.words[pos]);
+    // Only a reduced image is encoded per device
+    let reduced;
+    let image = if plan.keep.is_empty() {
+        prepared.full_image()
+    } else {
+        let words: Vec<WordDef> = changed().cloned().collect();
+        let mut buf = Vec::with_capacity(max_payload);
+        bytecode::encode_image(&words, parsed.main, &mut buf);
+        reduced = buf;
+        &reduced[..]
+    };
+    on_progress(prepared.data.len().saturating_sub(image.len()));
+
+    let (response, stats) = if plan.send.is_empty() && parsed.main.is_empty() {
+        on_message("Up to date".to_string());
+        let response = Response {
+            error_code: ErrorCode::Ok,
+            word_indices: Vec::new(),
+            data: Vec::new(),
+        };
+        (response, TransferStats::default())
+    } else {
+        send_image(&mut serial, image, opts, on_progress, on_message)?
+    };
+
+    if response.error_code == ErrorCode::Ok {
+        if response.word_indices.len() == plan.send.len() {
+            for (word, &word_idx) in changed().zip(&response.word_indices) {
+                manifest.record(&word.name, &word.bytecode, word_idx);
+            }
+            if let Err(e) = manifest.save(port) {
+                crate::trace!(Level::Info, "Could not save device manifest: {}", e);
+            }
+        } else {
+            Manifest::clear(port)?;
+        }
+    }
+
+    Ok(Deployed {
+        response,
+        kept: plan.keep.len(),
+        stats,
+        link: *serial.link_stats(),
+    })
+}
+
+/// Send an image as one EXEC or as a segmented transfer
+fn send_image<P, M>(
+    serial: &mut V4Serial,
+    image: &[u8],
+    opts: &PushOptions,
+    mut on_progress: P,
+    on_message: M,
+) -> Result<(Response, TransferStats)>
+where
+    P: FnMut(usize),
+    M: Fn(String),
+{
+    let size = image.len();
+    let max_payload = serial.max_payload();
+
+    if size <= max_payload {
+        on_message("Sending...".to_string());
+
+        // Send EXEC command
+        let response = serial.exec(image, opts.timeout)?;
+        on_progress(size);
+        Ok((response, TransferStats::uncompressed(size)))
+    } else {
+        on_message(format!(
+            "Sending {} chunks...",
+            size.div_ceil(
+                opts.chunk_size
+                    .unwrap_or(max_payload)
+                    .clamp(1, max_payload - CHUNK_HEADER_SIZE)
+            )
+        ));
+
+        serial.push_chunked(image, opts, on_progress)
+    }
+}
@@ -1,21 +1,51 @@
 use crate::Result;
+use crate::commands::exec::{execute_on_device, restore_context, save_context};
+use crate::commands::stats::{self, StatsOptions, StopOnEnter};
+use crate::commands::{batch, dump};
+use crate::manifest::Manifest;
 use crate::protocol::ErrorCode;
-use crate::repl::{CompileResult, Compiler};
-use crate::serial::V4Serial;
+use crate::protocol::stack::{StackTracker, Stacks};
+use crate::repl::{CompileMemo, Compiler};
+use crate::serial::{LinkOptions, ReadOptions, V4Serial};
+use crate::trace;
+use crate::trace::Level;
 use rustyline::DefaultEditor;
 use rustyline::error::ReadlineError;
+use std::io::{self, IsTerminal, Write};
+use std::path::Path;
 use std::time::Duration;
 
 const DEFAULT_TIMEOUT: Duration = Duration::from_secs(5);
 
 /// Run interactive REPL session
-pub fn run_repl(port: &str, no_reset: bool) -> Result<()> {
+///
+/// With `batch`, or when stdin is not a terminal, lines are read from stdin
+/// and run without prompts (see [`batch`](crate::commands::batch)).
+pub fn run_repl(port: &str, link: &LinkOptions, no_reset: bool, batch: bool) -> Result<()> {
     // Open serial connection
-    let mut serial = V4Serial::open_default(port)?;
+    let mut serial = V4Serial::open_with(port, link)?;
 
     // Create compiler
     let mut compiler = Compiler::new().map_err(crate::V4Error::Compilation)?;
 
+    if batch || !io::stdin().is_terminal() {
+        if no_reset {
+            restore_context(&mut serial, port, &mut compiler, DEFAULT_TIMEOUT)?;
+        } else {
+            Manifest::clear(port)?;
+            let err_code = serial.reset(DEFAULT_TIMEOUT)?;
+            if err_code != ErrorCode::Ok {
+                return Err(crate::V4Error::Device(format!(
+                    "Reset failed: {}",
+                    err_code.name()
+                )));
+            }
+        }
+        return batch::run_stdin(&mut serial, port, &mut compiler, DEFAULT_TIMEOUT);
+    }
+    let mut memo = CompileMemo::default();
+    let mut stacks = StackTracker::default();
+
     // Create line editor
     let mut rl = DefaultEditor::new().map_err(|e| crate::V4Error::Repl(e.to_string()))?;
 
@@ -29,10 +59,19 @@ pub fn run_repl(port: &str, no_reset: bool) -> Result<()> {
     // Reset device (unless --no-reset is specified)
     if no_reset {
         println!("Skipping VM reset (--no-reset)\n");
-        println!("Warning: Compiler context is empty. Existing device words may not be callable.");
-        println!("Use '.reset' to reset both VM and compiler context.\n");
+        match restore_context(&mut serial, port, &mut compiler, DEFAULT_TIMEOUT) {
+            Ok(0) => {
+                println!(
+                    "Warning: No compiler context saved for this device. Existing device words may not be callable."
+                );
+                println!("Use '.reset' to reset both VM and compiler context.\n");
+            }
+            Ok(count) => println!("Restored {} word(s) from the last session\n", count),
+            Err(e) => println!("Warning: Could not restore compiler context: {}\n", e),
+        }
     } else {
         println!("Resetting device...");
+        Manifest::clear(port)?;
         match serial.reset(DEFAULT_TIMEOUT) {
             Ok(ErrorCode::Ok) => println!("Device ready\n"),
             Ok(err) => println!("Warning: Reset returned {}\n", err.name()),
@@ -64,14 +103,16 @@ pub fn run_repl(port: &str, no_reset: bool) -> Result<()> {
 
                 // Check for meta-commands
                 if line.starts_with('.') {
-                    if let Err(e) = handle_meta_command(line, &mut serial, &mut compiler) {
+                    if let Err(e) =
+                        handle_meta_command(line, port, &mut serial, &mut compiler, &mut stacks)
+                    {
                         eprintln!("Error: {}", e);
                     }
                     continue;
                 }
 
                 // Compile Forth code
-                let compiled = match compiler.compile(line) {
+                let compiled = match memo.compile(&mut compiler, line) {
                     Ok(c) => c,
                     Err(e) => {
                         eprintln!("Error: {}", e);
@@ -80,7 +121,12 @@ pub fn run_repl(port: &str, no_reset: bool) -> Result<()> {
                 };
 
                 // Execute on device
-                if let Err(e) = execute_on_device(&mut serial, &compiled, &mut compiler) {
+                let result =
+                    execute_on_device(&mut serial, &compiled, &mut compiler, DEFAULT_TIMEOUT);
+                if !compiled.words.is_empty() {
+                    save_context(port, &compiler);
+                }
+                if let Err(e) = result {
                     eprintln!("Error: {}", e);
                     continue;
                 }
@@ -108,62 +154,14 @@ pub fn run_repl(port: &str, no_reset: bool) -> Result<()> {
     Ok(())
 }
 
-/// Execute compiled bytecode on device
-fn execute_on_device(
+/// Handle meta-commands (.help, .ping, etc.)
+pub(crate) fn handle_meta_command(
+    line: &str,
+    port: &str,
     serial: &mut V4Serial,
-    compiled: &CompileResult,
     compiler: &mut Compiler,
+    stacks: &mut StackTracker,
 ) -> Result<()> {
-    // Execute word definitions first
-    for word in &compiled.words {
-        eprintln!(
-            "[DEBUG] Executing word '{}' ({} bytes): {:02x?}",
-            word.name,
-            word.bytecode.len(),
-            word.bytecode
-        );
-        let response = serial.exec(&word.bytecode, DEFAULT_TIMEOUT)?;
-        if response.error_code != ErrorCode::Ok {
-            return Err(crate::V4Error::Device(format!(
-                "Failed to register word '{}': {}",
-                word.name,
-                response.error_code.name()
-            )));
-        }
-
-        // Register word index returned from device
-        if let Some(&word_idx) = response.word_indices.first() {
-            eprintln!(
-                "[DEBUG] Device registered word '{}' at index {}",
-                word.name, word_idx
-            );
-            compiler
-                .register_word_index(&word.name, word_idx as i32)
-                .map_err(crate::V4Error::Compilation)?;
-        }
-    }
-
-    // Execute main bytecode
-    if !compiled.bytecode.is_empty() {
-        eprintln!(
-            "[DEBUG] Executing main bytecode ({} bytes): {:02x?}",
-            compiled.bytecode.len(),
-            compiled.bytecode
-        );
-        let response = serial.exec(&compiled.bytecode, DEFAULT_TIMEOUT)?;
-        if response.error_code != ErrorCode::Ok {
-            return Err(crate::V4Error::Device(format!(
-                "Execution failed: {}",
-                response.error_code.name()
-            )));
-        }
-    }
-
-    Ok(())
-}
-
-/// Handle meta-commands (.help, .ping, etc.)
-fn handle_meta_command(line: &str, serial: &mut V4Serial, compiler: &mut Compiler) -> Result<()> {
     let parts: Vec<&str> = line.split_whitespace().collect();
     let command = parts[0];
 
@@ -191,16 +189,19 @@ fn handle_meta_command(line: &str, serial: &mut V4Serial, compiler: &mut Compile
                 )));
             }
 
-            // Reset compiler context
+            // Reset compiler context and forget the device's words
             compiler.reset();
+            Manifest::clear(port)?;
+            stacks.invalidate();
 
             println!("VM and compiler context reset");
             Ok(())
         }
-        ".stack" => cmd_stack(serial),
+        ".stack" => cmd_stack(serial, stacks, &parts[1..]),
         ".rstack" => cmd_rstack(serial),
-        ".dump" => cmd_dump(serial, &parts[1..]),
-        ".see" => cmd_see(serial, &parts[1..]),
+        ".dump" => cmd_dump(serial, port, line[command.len()..].trim()),
+        ".see" => cmd_see(serial, port, compiler, &parts[1..]),
+        ".stats" => cmd_stats(serial, port, &parts[1..]),
         ".exit" => {
             // Handled in main loop
             Ok(())
@@ -218,10 +219,12 @@ fn print_help() {
     println!("  .help              - Show this help");
     println!("  .ping              - Check device connection");
     println!("  .reset             - Reset VM and compiler context");
-    println!("  .stack             - Show data and return stack contents");
+    println!("  .stack [--watch]   - Show data and return stack contents");
     println!("  .rstack            - Show return stack with call trace");
     println!("  .dump [addr] [len] - Hexdump memory (default: continue from last)");
-    println!("  .see <word_idx>    - Show word bytecode disassembly");
+    println!("  .dump addr len > f - Save memory to file f");
+    println!("  .see <name|idx>    - Show word bytecode disassembly");
+    println!("  .stats [--watch]   - Show VM counters and hot words (--reset zeroes)");
     println!("  .exit              - Exit REPL (same as 'bye')");
     println!("  bye                - Exit REPL");
     println!();
@@ -234,64 +237,62 @@ fn print_help() {
     println!("  ↑/↓      - Navigate command history");
 }
 
+/// Time between stack reads in `.stack --watch`
+const STACK_WATCH_INTERVAL: Duration = Duration::from_millis(250);
+
 /// Display data and return stacks
-fn cmd_stack(serial: &mut V4Serial) -> Result<()> {
-    let response = serial.query_stack(DEFAULT_TIMEOUT)?;
-    if response.error_code != ErrorCode::Ok {
-        return Err(crate::V4Error::Device(format!(
-            "Query stack failed: {}",
-            response.error_code.name()
-        )));
-    }
+///
+/// `.stack [--watch]`; with `--watch` the stacks are redrawn whenever they
+/// change, until Enter is pressed. Reads go through QUERY_STACK_DELTA, so
+/// repeated reads only transfer cells that changed.
+fn cmd_stack(serial: &mut V4Serial, tracker: &mut StackTracker, args: &[&str]) -> Result<()> {
+    let watch = match args {
+        [] => false,
+        ["--watch" | "-w"] => true,
+        _ => return Err(crate::V4Error::Cli("Usage: .stack [--watch]".to_string())),
+    };
 
-    let data = &response.data;
-    if data.is_empty() {
-        println!("No stack data received");
+    let mut out = io::stdout().lock();
+    let stacks = serial.query_stack_delta(tracker, DEFAULT_TIMEOUT)?;
+    print_stacks(&mut out, stacks)?;
+    if !watch {
         return Ok(());
     }
 
-    // Parse data stack
-    let ds_depth = data[0] as usize;
-    let mut pos = 1;
-
-    println!("Data Stack (depth: {} / 256):", ds_depth);
-    if ds_depth == 0 {
-        println!("  <empty>");
-    } else {
-        for i in 0..ds_depth {
-            if pos + 4 > data.len() {
-                break;
-            }
-            let value =
-                i32::from_le_bytes([data[pos], data[pos + 1], data[pos + 2], data[pos + 3]]);
-            println!("  [{}]: 0x{:08X} ({})", i, value as u32, value);
-            pos += 4;
+    let Some(stop) = StopOnEnter::new() else {
+        return Ok(());
+    };
+    writeln!(out, "\nWatching stacks (press Enter to stop)...")?;
+    let mut shown = stacks.clone();
+    while !stop.wait(STACK_WATCH_INTERVAL) {
+        let stacks = serial.query_stack_delta(tracker, DEFAULT_TIMEOUT)?;
+        if *stacks != shown {
+            // Clear the screen and redraw
+            write!(out, "\x1b[2J\x1b[H")?;
+            print_stacks(&mut out, stacks)?;
+            writeln!(out, "\nWatching stacks (press Enter to stop)...")?;
+            shown = stacks.clone();
         }
     }
+    Ok(())
+}
 
-    // Parse return stack
-    if pos >= data.len() {
-        return Ok(());
+fn print_stacks(out: &mut impl Write, stacks: &Stacks) -> io::Result<()> {
+    writeln!(out, "Data Stack (depth: {} / 256):", stacks.data.len())?;
+    if stacks.data.is_empty() {
+        writeln!(out, "  <empty>")?;
     }
-
-    let rs_depth = data[pos] as usize;
-    pos += 1;
-
-    println!("\nReturn Stack (depth: {} / 64):", rs_depth);
-    if rs_depth == 0 {
-        println!("  <empty>");
-    } else {
-        for i in 0..rs_depth {
-            if pos + 4 > data.len() {
-                break;
-            }
-            let value =
-                i32::from_le_bytes([data[pos], data[pos + 1], data[pos + 2], data[pos + 3]]);
-            println!("  [{}]: 0x{:08X}", i, value as u32);
-            pos += 4;
-        }
+    for (i, value) in stacks.data.iter().enumerate() {
+        writeln!(out, "  [{}]: 0x{:08X} ({})", i, *value as u32, value)?;
     }
 
+    writeln!(out, "\nReturn Stack (depth: {} / 64):", stacks.ret.len())?;
+    if stacks.ret.is_empty() {
+        writeln!(out, "  <empty>")?;
+    }
+    for (i, value) in stacks.ret.iter().enumerate() {
+        writeln!(out, "  [{}]: 0x{:08X}", i, value)?;
+    }
     Ok(())
 }
 
@@ -342,122 +343,147 @@ fn cmd_rstack(serial: &mut V4Serial) -> Result<()> {
     Ok(())
 }
 
-/// Hexdump memory at address
-fn cmd_dump(serial: &mut V4Serial, args: &[&str]) -> Result<()> {
-    // TODO: Track last dump address for continuation
-    let addr: u32 = if args.is_empty() {
-        0 // Default to address 0
-    } else {
-        args[0]
-            .parse()
-            .map_err(|_| crate::V4Error::Cli(format!("Invalid address: {}", args[0])))?
+/// Hexdump memory, or save it with `> FILE`
+///
+/// `.dump [addr] [len] [> file]`; without an address the dump continues
+/// where the last one ended.
+fn cmd_dump(serial: &mut V4Serial, port: &str, args: &str) -> Result<()> {
+    let (range, output) = match args.split_once('>') {
+        Some((range, file)) => {
+            let file = file.trim();
+            if file.is_empty() {
+                return Err(crate::V4Error::Cli(
+                    "Usage: .dump [addr] [len] > <file>".to_string(),
+                ));
+            }
+            (range, Some(Path::new(file)))
+        }
+        None => (args, None),
     };
+    let mut range = range.split_whitespace();
 
-    let len: u16 = if args.len() < 2 {
-        256 // Default to 256 bytes
-    } else {
-        args[1]
-            .parse::<u16>()
-            .map_err(|_| crate::V4Error::Cli(format!("Invalid length: {}", args[1])))?
-            .min(256)
+    let addr = match range.next() {
+        Some(text) => dump::parse_number(text).map_err(crate::V4Error::Cli)?,
+        None => dump::next_address(port),
+    };
+    let len = match range.next() {
+        Some(text) => dump::parse_number(text).map_err(crate::V4Error::Cli)?,
+        None => dump::DEFAULT_DUMP_LEN,
     };
 
-    let response = serial.query_memory(addr, len, DEFAULT_TIMEOUT)?;
-    if response.error_code != ErrorCode::Ok {
-        return Err(crate::V4Error::Device(format!(
-            "Query memory failed: {}",
-            response.error_code.name()
-        )));
-    }
-
-    let data = &response.data;
-    println!("Memory dump at 0x{:08X} ({} bytes):\n", addr, data.len());
-
-    // Display in 16-byte rows
-    for (i, chunk) in data.chunks(16).enumerate() {
-        let offset = addr + (i * 16) as u32;
-        print!("{:08X}  ", offset);
-
-        // Hex values
-        for (j, byte) in chunk.iter().enumerate() {
-            print!("{:02X} ", byte);
-            if j == 7 {
-                print!(" ");
-            }
-        }
+    let opts = ReadOptions {
+        timeout: DEFAULT_TIMEOUT,
+        ..ReadOptions::default()
+    };
+    dump::dump_memory(serial, port, addr, len, output, &opts)
+}
 
-        // Padding if last row is incomplete
-        for j in chunk.len()..16 {
-            print!("   ");
-            if j == 7 {
-                print!(" ");
+/// Show VM performance counters
+///
+/// `.stats [--watch] [--reset]`
+fn cmd_stats(serial: &mut V4Serial, port: &str, args: &[&str]) -> Result<()> {
+    let mut opts = StatsOptions {
+        timeout: DEFAULT_TIMEOUT,
+        ..StatsOptions::default()
+    };
+    for arg in args {
+        match *arg {
+            "--watch" | "-w" => opts.watch = true,
+            "--reset" => opts.reset = true,
+            _ => {
+                return Err(crate::V4Error::Cli(
+                    "Usage: .stats [--watch] [--reset]".to_string(),
+                ));
             }
         }
-
-        // ASCII representation
-        print!(" |");
-        for byte in chunk {
-            let c = if *byte >= 0x20 && *byte <= 0x7E {
-                *byte as char
-            } else {
-                '.'
-            };
-            print!("{}", c);
-        }
-        println!("|");
     }
-
-    Ok(())
+    stats::show_stats(serial, port, &opts)
 }
 
 /// Show word bytecode disassembly
-fn cmd_see(serial: &mut V4Serial, args: &[&str]) -> Result<()> {
-    if args.is_empty() {
-        return Err(crate::V4Error::Cli("Usage: .see <word_index>".to_string()));
-    }
-
-    let word_idx: u16 = args[0]
-        .parse()
-        .map_err(|_| crate::V4Error::Cli(format!("Invalid word index: {}", args[0])))?;
-
-    let response = serial.query_word(word_idx, DEFAULT_TIMEOUT)?;
-    if response.error_code != ErrorCode::Ok {
-        return Err(crate::V4Error::Device(format!(
-            "Query word failed: {}",
-            response.error_code.name()
-        )));
-    }
-
-    let data = &response.data;
-    if data.is_empty() {
-        println!("No word data received");
-        return Ok(());
-    }
-
-    // Parse response: [NAME_LEN][NAME...][CODE_LEN_L][CODE_LEN_H][CODE...]
-    let name_len = data[0] as usize;
-    let mut pos = 1;
-
-    let name = if name_len > 0 && pos + name_len <= data.len() {
-        String::from_utf8_lossy(&data[pos..pos + name_len]).to_string()
-    } else {
-        "<anonymous>".to_string()
+///
+/// `.see <name|index>`. Names resolve through the words registered with
+/// the compiler, then the device manifest. Bytecode comes from the
+/// compiler's own output or an earlier `.see` where possible; the device is
+/// only asked on a miss, or when the manifest records different bytecode
+/// for the index (another tool redeployed the word).
+fn cmd_see(
+    serial: &mut V4Serial,
+    port: &str,
+    compiler: &mut Compiler,
+    args: &[&str],
+) -> Result<()> {
+    let [word] = args else {
+        return Err(crate::V4Error::Cli(
+            "Usage: .see <word_name|word_index>".to_string(),
+        ));
     };
-    pos += name_len;
 
-    if pos + 2 > data.len() {
-        println!("Incomplete word data");
-        return Ok(());
-    }
+    let manifest = Manifest::load(port);
+    let recorded = |index: u16| manifest.entries().iter().find(|e| e.index == index);
+    let word_idx = match word.parse::<u16>() {
+        Ok(index) => index,
+        Err(_) => compiler
+            .word_index(word)
+            .or_else(|| {
+                manifest
+                    .entries()
+                    .iter()
+                    .rev()
+                    .find(|e| e.name == *word)
+                    .map(|e| e.index)
+            })
+            .ok_or_else(|| {
+                crate::V4Error::Cli(format!(
+                    "Unknown word: {} (use its index for words defined elsewhere)",
+                    word
+                ))
+            })?,
+    };
 
-    let code_len = u16::from_le_bytes([data[pos], data[pos + 1]]) as usize;
-    pos += 2;
+    let local = compiler.word_bytecode(word_idx).filter(|code| {
+        recorded(word_idx).is_none_or(|entry| entry.hash == crate::manifest::word_hash(code))
+    });
+    let (name, code) = match local {
+        Some(code) => {
+            let name = compiler
+                .word_name(word_idx)
+                .or_else(|| recorded(word_idx).map(|e| e.name.as_str()))
+                .unwrap_or(word);
+            trace!(
+                Level::Debug,
+                "Word {} served from the local symbol table", word_idx
+            );
+            (name.to_string(), code.to_vec())
+        }
+        None => {
+            let response = serial.query_word(word_idx, DEFAULT_TIMEOUT)?;
+            if response.error_code != ErrorCode::Ok {
+                return Err(crate::V4Error::Device(format!(
+                    "Query word failed: {}",
+                    response.error_code.name()
+                )));
+            }
+            // Response: [NAME_LEN][NAME...][CODE_LEN_L][CODE_LEN_H][CODE...]
+            let (name, code) = crate::manifest::parse_word_info(&response.data)
+                .ok_or_else(|| crate::V4Error::Protocol("Incomplete word data".to_string()))?;
+            compiler.remember_bytecode(word_idx, code);
+            (String::from_utf8_lossy(name).into_owned(), code.to_vec())
+        }
+    };
 
-    println!("Word: {}", name);
+    println!(
+        "Word: {}",
+        if name.is_empty() {
+            "<anonymous>"
+        } else {
+            &name
+        }
+    );
     println!("Index: {}", word_idx);
-    println!("Bytecode length: {} bytes\n", code_len);
+    println!("Bytecode length: {} bytes\n", code.len());
 
-    if code_len == 0 || pos >= data.len() {
+    if code.is_empty() {
         println!("No bytecode");
         return Ok(());
     }
@@ -466,7 +492,6 @@ fn cmd_see(serial: &mut V4Serial, args: &[&str]) -> Result<()> {
     println!("Offset  Bytes");
     println!("------  -------------------------");
 
-    let code = &data[pos..];
     for (i, chunk) in code.chunks(16).enumerate() {
         print!("{:04X}    ", i * 16);
         for byte in chunk {
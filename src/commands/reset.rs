@@ -1,14 +1,17 @@
 use crate::Result;
+use crate::manifest::Manifest;
 use crate::protocol::ErrorCode;
-use crate::serial::V4Serial;
+use crate::serial::{LinkOptions, V4Serial};
 use std::time::Duration;
 
 /// Send RESET command to device
-pub fn reset(port: &str, timeout: Duration) -> Result<()> {
-    let mut serial = V4Serial::open_default(port)?;
+pub fn reset(port: &str, link: &LinkOptions, timeout: Duration) -> Result<()> {
+    let mut serial = V4Serial::open_with(port, link)?;
 
     println!("Sending RESET to {}...", port);
 
+    // Whatever happens, the recorded word table can no longer be trusted
+    Manifest::clear(port)?;
     let err_code = serial.reset(timeout)?;
 
     println!("Response: {}", err_code.name());
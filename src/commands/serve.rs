@@ -0,0 +1,109 @@
+use crate::Result;
+use crate::serial::{LinkOptions, V4Serial};
+use std::net::TcpListener;
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+
+/// Share `port` with `tcp://` clients on the network
+///
+/// `listen` is `HOST:PORT`, or `:PORT` for all interfaces. Clients give
+/// `--port tcp://HOST:PORT` to any subcommand. Runs until interrupted.
+pub fn serve(port: &str, link: &LinkOptions, listen: &str, timeout: Duration) -> Result<()> {
+    let serial = V4Serial::open_with(port, link)?;
+    let caps = *serial.caps();
+    let listener = TcpListener::bind(listen_addr(listen))?;
+
+    println!(
+        "Serving {} ({} baud, MTU {}) on tcp://{}",
+        port,
+        caps.baud,
+        caps.mtu,
+        listener.local_addr()?
+    );
+    println!("Press Ctrl+C to stop");
+
+    accept(&listener, &Arc::new(Mutex::new(serial)), timeout);
+    Ok(())
+}
+
+/// Serve every client of `listener` on its own thread
+fn accept(listener: &TcpListener, device: &Arc<Mutex<V4Serial>>, timeout: Duration) {
+    for stream in listener.incoming() {
+        let mut stream = match stream {
+            Ok(stream) => stream,
+            Err(e) => {
+                eprintln!("Accept failed: {}", e);
+                continue;
+            }
+        };
+        // Responses are batched per window already; send them right away
+        if let Err(e) = stream.set_nodelay(true) {
+            eprintln!("Could not disable Nagle's algorithm: {}", e);
+        }
+        let peer = stream
+            .peer_addr()
+            .map(|addr| addr.to_string())
+            .unwrap_or_else(|_| "client".to_string());
+        let device = Arc::clone(device);
+        std::thread::spawn(move || {
+            crate::trace!(crate::trace::Level::Info, "{} connected", peer);
+            if let Err(e) = crate::daemon::forward(&mut stream, &device, timeout) {
+                eprintln!("{}: {}", peer, e);
+            }
+            crate::trace!(crate::trace::Level::Info, "{} disconnected", peer);
+        });
+    }
+}
+
+/// Socket address for `--listen`: `:7400` and `7400` listen on all
+/// interfaces
+fn listen_addr(listen: &str) -> String {
+    let port = listen.strip_prefix(':').unwrap_or(listen);
+    if port.parse::<u16>().is_ok() {
+        format!("0.0.0.0:{}", port)
+    } else {
+        listen.to_string()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::protocol::{ErrorCode, MAX_PAYLOAD_SIZE};
+    use crate::serial::{DEFAULT_BAUD_RATE, PushOptions};
+
+    #[test]
+    fn test_listen_addr() {
+        assert_eq!(listen_addr(":7400"), "0.0.0.0:7400");
+        assert_eq!(listen_addr("7400"), "0.0.0.0:7400");
+        assert_eq!(listen_addr("127.0.0.1:7400"), "127.0.0.1:7400");
+        assert_eq!(listen_addr("[::1]:7400"), "[::1]:7400");
+    }
+
+    #[test]
+    fn test_push_over_bridge() {
+        let device =
+            V4Serial::from_transport(Box::new(crate::sim::Simulator::new()), DEFAULT_BAUD_RATE);
+        let device = Arc::new(Mutex::new(device));
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let addr = listener.local_addr().unwrap();
+        std::thread::spawn(move || accept(&listener, &device, Duration::from_secs(1)));
+
+        let transport = crate::transport::open(&format!("tcp://{}", addr), DEFAULT_BAUD_RATE);
+        let mut serial = V4Serial::from_transport(transport.unwrap(), DEFAULT_BAUD_RATE);
+        let opts = PushOptions {
+            window: 8,
+            timeout: Duration::from_secs(1),
+            ..PushOptions::default()
+        };
+        serial
+            .negotiate(DEFAULT_BAUD_RATE, MAX_PAYLOAD_SIZE, opts.timeout)
+            .unwrap();
+        assert_eq!(serial.ping(opts.timeout).unwrap(), ErrorCode::Ok);
+
+        let image: Vec<u8> = (0..10_000u32).map(|i| (i * 7 % 253) as u8).collect();
+        let (response, _) = serial.push_chunked(&image, &opts, |_| {}).unwrap();
+        assert_eq!(response.error_code, ErrorCode::Ok);
+        assert!(!serial.link_stats().had_errors());
+    }
+}
@@ -0,0 +1,363 @@
+use crate::Result;
+use crate::context::ContextSnapshot;
+use crate::manifest::Manifest;
+use crate::protocol::stats::VmStats;
+use crate::serial::{LinkOptions, V4Serial};
+use std::collections::HashMap;
+use std::io::{self, IsTerminal, Write};
+#[cfg(not(unix))]
+use std::sync::Arc;
+#[cfg(not(unix))]
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::time::{Duration, Instant};
+
+/// Words listed in the table view; CSV output has all of them
+const HOT_WORDS_SHOWN: usize = 20;
+
+/// Options for [`stats`]
+#[derive(Debug, Clone, Copy)]
+pub struct StatsOptions {
+    /// Poll repeatedly and show what changed since the previous sample
+    pub watch: bool,
+    /// Time between samples in watch mode
+    pub interval: Duration,
+    /// Print per-word counters as CSV instead of tables
+    pub csv: bool,
+    /// Zero the device counters after reading them
+    pub reset: bool,
+    /// Timeout for each device response
+    pub timeout: Duration,
+}
+
+impl Default for StatsOptions {
+    fn default() -> Self {
+        Self {
+            watch: false,
+            interval: Duration::from_secs(1),
+            csv: false,
+            reset: false,
+            timeout: Duration::from_secs(5),
+        }
+    }
+}
+
+/// Show the VM performance counters of the device at `port`
+pub fn stats(port: &str, link: &LinkOptions, opts: &StatsOptions) -> Result<()> {
+    let mut serial = V4Serial::open_with(port, link)?;
+    show_stats(&mut serial, port, opts)
+}
+
+/// Read and print counters over an open connection
+///
+/// In watch mode every sample shows the increase since the previous one,
+/// until Enter is pressed (or forever if stdin is not a terminal). The
+/// counters keep running while they are read, so samples are approximate.
+pub(crate) fn show_stats(serial: &mut V4Serial, port: &str, opts: &StatsOptions) -> Result<()> {
+    let names = word_names(port);
+    let mut out = io::stdout().lock();
+    if opts.csv {
+        writeln!(out, "time_s,index,name,calls,cycles,cycles_per_call")?;
+    }
+
+    let started = Instant::now();
+    let mut previous = serial.query_stats(opts.reset, opts.timeout)?;
+    if !opts.watch {
+        if opts.csv {
+            write_csv(&mut out, 0.0, &previous, &names)?;
+        } else {
+            print_stats(&mut out, &previous, &names, None)?;
+        }
+        return Ok(());
+    }
+
+    let stop = StopOnEnter::new();
+    if !opts.csv && stop.is_some() {
+        println!("Watching {} (press Enter to stop)...", port);
+    }
+    let mut sampled = Instant::now();
+    loop {
+        match &stop {
+            Some(stop) if stop.wait(opts.interval) => break,
+            Some(_) => {}
+            None => std::thread::sleep(opts.interval),
+        }
+        let current = serial.query_stats(opts.reset, opts.timeout)?;
+        let elapsed = sampled.elapsed();
+        sampled = Instant::now();
+        // After a reset read, the new sample already is the increase
+        let delta = if opts.reset {
+            current.clone()
+        } else {
+            current.since(&previous)
+        };
+
+        if opts.csv {
+            write_csv(&mut out, started.elapsed().as_secs_f64(), &delta, &names)?;
+            out.flush()?;
+        } else {
+            // Clear the screen and redraw
+            write!(out, "\x1b[2J\x1b[H")?;
+            print_stats(&mut out, &delta, &names, Some(elapsed))?;
+        }
+        previous = current;
+    }
+    Ok(())
+}
+
+/// Device index → name for words the CLI has registered on `port`
+fn word_names(port: &str) -> HashMap<u16, String> {
+    let mut names: HashMap<u16, String> = Manifest::load(port)
+        .entries()
+        .iter()
+        .map(|e| (e.index, e.name.clone()))
+        .collect();
+    for (name, index) in ContextSnapshot::load(port).words() {
+        names.insert(*index, name.clone());
+    }
+    names
+}
+
+/// Ends a watch loop when Enter is pressed
+///
+/// On Unix stdin is polled while waiting, so nothing is left reading it
+/// once the loop ends, however it ends. Elsewhere a thread reads the line,
+/// and it ends with the next line typed.
+pub(crate) struct StopOnEnter {
+    #[cfg(not(unix))]
+    pressed: Arc<AtomicBool>,
+}
+
+impl StopOnEnter {
+    /// `None` if stdin is not a terminal
+    pub(crate) fn new() -> Option<Self> {
+        if !io::stdin().is_terminal() {
+            return None;
+        }
+        #[cfg(unix)]
+        {
+            Some(Self {})
+        }
+        #[cfg(not(unix))]
+        {
+            let pressed = Arc::new(AtomicBool::new(false));
+            let flag = Arc::clone(&pressed);
+            std::thread::spawn(move || {
+                let _ = io::stdin().read_line(&mut String::new());
+                flag.store(true, Ordering::Relaxed);
+            });
+            Some(Self { pressed })
+        }
+    }
+
+    /// Wait up to `timeout`; whether Enter was pressed
+    pub(crate) fn wait(&self, timeout: Duration) -> bool {
+        #[cfg(unix)]
+        {
+            sys::read_line_within(timeout)
+        }
+        #[cfg(not(unix))]
+        {
+            std::thread::sleep(timeout);
+            self.pressed.load(Ordering::Relaxed)
+        }
+    }
+}
+
+#[cfg(unix)]
+mod sys {
+    use std::time::Duration;
+
+    /// Consume a line typed on stdin within `timeout`, if there is one
+    pub fn read_line_within(timeout: Duration) -> bool {
+        let mut fd = libc::pollfd {
+            fd: libc::STDIN_FILENO,
+            events: libc::POLLIN,
+            revents: 0,
+        };
+        let ms = timeout.as_millis().min(libc::c_int::MAX as u128) as libc::c_int;
+        // SAFETY: polls one valid pollfd
+        if unsafe { libc::poll(&mut fd, 1, ms) } <= 0 {
+            return false;
+        }
+        // The terminal is in canonical mode, so a read returns the line
+        let mut line = [0u8; 256];
+        // SAFETY: reads at most `line.len()` bytes into `line`
+        unsafe { libc::read(libc::STDIN_FILENO, line.as_mut_ptr().cast(), line.len()) };
+        true
+    }
+}
+
+/// Print counters; `elapsed` turns totals into rates
+fn print_stats(
+    out: &mut impl Write,
+    stats: &VmStats,
+    names: &HashMap<u16, String>,
+    elapsed: Option<Duration>,
+) -> io::Result<()> {
+    let rate = |count: u64| match elapsed {
+        Some(elapsed) if !elapsed.is_zero() => {
+            format!(" ({:.0}/s)", count as f64 / elapsed.as_secs_f64())
+        }
+        _ => String::new(),
+    };
+
+    if elapsed.is_some() {
+        writeln!(out, "VM counters since the previous sample (approximate):")?;
+    } else {
+        writeln!(out, "VM counters:")?;
+    }
+    writeln!(
+        out,
+        "  Instructions  {:>14}{}",
+        stats.instructions,
+        rate(stats.instructions)
+    )?;
+    writeln!(
+        out,
+        "  Cycles        {:>14}{}",
+        stats.cycles,
+        rate(stats.cycles)
+    )?;
+    writeln!(
+        out,
+        "  EXEC queue    {:>14} (max {})",
+        stats.exec_queue, stats.exec_queue_max
+    )?;
+    writeln!(out, "  BUFFER_FULL   {:>14}", stats.buffer_full)?;
+    writeln!(out, "  RX overruns   {:>14}", stats.rx_overruns)?;
+
+    let hot: Vec<_> = stats
+        .hot_words()
+        .into_iter()
+        .filter(|w| w.calls > 0 || w.cycles > 0)
+        .collect();
+    writeln!(out)?;
+    if hot.is_empty() {
+        writeln!(out, "No word calls recorded")?;
+        return Ok(());
+    }
+    writeln!(
+        out,
+        "Hot words ({} of {}):",
+        hot.len().min(HOT_WORDS_SHOWN),
+        hot.len()
+    )?;
+    writeln!(
+        out,
+        "  {:>5}  {:<16} {:>10} {:>14} {:>7} {:>12}",
+        "Index", "Name", "Calls", "Cycles", "%", "Cycles/call"
+    )?;
+    for word in hot.iter().take(HOT_WORDS_SHOWN) {
+        let share = if stats.cycles > 0 {
+            word.cycles as f64 * 100.0 / stats.cycles as f64
+        } else {
+            0.0
+        };
+        writeln!(
+            out,
+            "  {:>5}  {:<16} {:>10} {:>14} {:>6.1}% {:>12.1}",
+            word.index,
+            names.get(&word.index).map_or("?", String::as_str),
+            word.calls,
+            word.cycles,
+            share,
+            cycles_per_call(word.cycles, word.calls)
+        )?;
+    }
+    Ok(())
+}
+
+/// One CSV row per word, most expensive first
+fn write_csv(
+    out: &mut impl Write,
+    time: f64,
+    stats: &VmStats,
+    names: &HashMap<u16, String>,
+) -> io::Result<()> {
+    for word in stats.hot_words() {
+        let name = names.get(&word.index).map_or("", String::as_str);
+        writeln!(
+            out,
+            "{:.3},{},{},{},{},{:.1}",
+            time,
+            word.index,
+            csv_field(name),
+            word.calls,
+            word.cycles,
+            cycles_per_call(word.cycles, word.calls)
+        )?;
+    }
+    Ok(())
+}
+
+fn cycles_per_call(cycles: u64, calls: u32) -> f64 {
+    if calls == 0 {
+        0.0
+    } else {
+        cycles as f64 / calls as f64
+    }
+}
+
+/// Quote a CSV field if it needs it
+fn csv_field(text: &str) -> String {
+    if text.contains([',', '"', '\n']) {
+        format!("\"{}\"", text.replace('"', "\"\""))
+    } else {
+        text.to_string()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::protocol::stats::WordStats;
+
+    fn sample() -> VmStats {
+        VmStats {
+            instructions: 1000,
+            cycles: 4000,
+            word_total: 2,
+            words: vec![
+                WordStats {
+                    index: 0,
+                    calls: 4,
+                    cycles: 1000,
+                },
+                WordStats {
+                    index: 1,
+                    calls: 1,
+                    cycles: 3000,
+                },
+            ],
+            ..VmStats::default()
+        }
+    }
+
+    #[test]
+    fn test_csv_output() {
+        let names = HashMap::from([(0, "SQUARE".to_string()), (1, "A,B".to_string())]);
+        let mut out = Vec::new();
+        write_csv(&mut out, 1.5, &sample(), &names).unwrap();
+        assert_eq!(
+            String::from_utf8(out).unwrap(),
+            "1.500,1,\"A,B\",1,3000,3000.0\n1.500,0,SQUARE,4,1000,250.0\n"
+        );
+    }
+
+    #[test]
+    fn test_table_output() {
+        let mut out = Vec::new();
+        print_stats(
+            &mut out,
+            &sample(),
+            &HashMap::new(),
+            Some(Duration::from_secs(2)),
+        )
+        .unwrap();
+        let text = String::from_utf8(out).unwrap();
+        assert!(text.contains("since the previous sample (approximate)"));
+        assert!(text.contains("Instructions            1000 (500/s)"));
+        assert!(text.contains("Hot words (2 of 2):"));
+        assert!(text.contains("75.0%"));
+    }
+}
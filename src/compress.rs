@@ -0,0 +1,240 @@
+//! LZSS compression for chunk transfers
+//!
+//! A byte-oriented LZSS small enough to decode on the device without any
+//! state beyond its receive buffer:
+//!
+//! ```text
+//! [FLAGS][ITEM x 8][FLAGS][ITEM x 8]...
+//!
+//! FLAGS: one bit per following item, LSB first; 1 = literal, 0 = match
+//! literal: [BYTE]
+//! match:   [DIST_LO][DIST_HI (4 bits) << 4 | LEN - 3 (4 bits)]
+//! ```
+//!
+//! A match copies `LEN` (3..=18) bytes from `DIST` (1..=4096) bytes back in
+//! the output; source and destination may overlap. Every chunk is
+//! compressed on its own, so back-references never leave the chunk and
+//! chunks stay independently retransmittable.
+
+use crate::{Result, V4Error};
+
+/// Largest back-reference distance
+pub const WINDOW_SIZE: usize = 4096;
+
+/// Shortest match worth encoding
+pub const MIN_MATCH: usize = 3;
+
+/// Longest match one item can encode
+pub const MAX_MATCH: usize = MIN_MATCH + 15;
+
+const HASH_BITS: u32 = 12;
+
+/// Candidates tried per position; bounds compression time on long runs
+const MAX_CHAIN: usize = 32;
+
+const NONE: u32 = u32::MAX;
+
+/// Compress `input` into `out`
+///
+/// `out` is cleared first. The output is at most `input.len() / 8 + 1`
+/// bytes larger than the input.
+pub fn compress(input: &[u8], out: &mut Vec<u8>) {
+    out.clear();
+    out.reserve(input.len() + input.len() / 8 + 1);
+
+    let mut matcher = Matcher::new(input);
+    let mut flags_at = 0;
+    let mut item = 8;
+    let mut pos = 0;
+
+    while pos < input.len() {
+        if item == 8 {
+            flags_at = out.len();
+            out.push(0);
+            item = 0;
+        }
+
+        let (len, dist) = matcher.longest_match(pos);
+        if len >= MIN_MATCH {
+            let code = (dist - 1) as u16;
+            out.push(code as u8);
+            out.push(((code >> 8) as u8) << 4 | (len - MIN_MATCH) as u8);
+            for p in pos..pos + len {
+                matcher.insert(p);
+            }
+            pos += len;
+        } else {
+            out[flags_at] |= 1 << item;
+            out.push(input[pos]);
+            matcher.insert(pos);
+            pos += 1;
+        }
+        item += 1;
+    }
+}
+
+/// Hash chains over 3-byte prefixes
+struct Matcher<'a> {
+    input: &'a [u8],
+    head: Vec<u32>,
+    prev: Vec<u32>,
+}
+
+impl<'a> Matcher<'a> {
+    fn new(input: &'a [u8]) -> Self {
+        Self {
+            input,
+            head: vec![NONE; 1 << HASH_BITS],
+            prev: vec![NONE; input.len()],
+        }
+    }
+
+    fn hash(&self, pos: usize) -> usize {
+        let b = &self.input[pos..pos + MIN_MATCH];
+        let v = u32::from_le_bytes([b[0], b[1], b[2], 0]);
+        (v.wrapping_mul(0x9E37_79B1) >> (32 - HASH_BITS)) as usize
+    }
+
+    fn insert(&mut self, pos: usize) {
+        if pos + MIN_MATCH <= self.input.len() {
+            let h = self.hash(pos);
+            self.prev[pos] = self.head[h];
+            self.head[h] = pos as u32;
+        }
+    }
+
+    /// Longest earlier match for `pos` as `(len, dist)`; `len` is 0 if
+    /// there is none
+    fn longest_match(&self, pos: usize) -> (usize, usize) {
+        if pos + MIN_MATCH > self.input.len() {
+            return (0, 0);
+        }
+        let limit = MAX_MATCH.min(self.input.len() - pos);
+        let target = &self.input[pos..pos + limit];
+        let mut best = (0, 0);
+        let mut candidate = self.head[self.hash(pos)];
+
+        for _ in 0..MAX_CHAIN {
+            if candidate == NONE || pos - candidate as usize > WINDOW_SIZE {
+                break;
+            }
+            let start = candidate as usize;
+            let len = self.input[start..]
+                .iter()
+                .zip(target)
+                .take_while(|(a, b)| a == b)
+                .count();
+            if len > best.0 {
+                best = (len, pos - start);
+                if len == limit {
+                    break;
+                }
+            }
+            candidate = self.prev[start];
+        }
+        best
+    }
+}
+
+/// Decompress `input`, which must expand to exactly `raw_len` bytes, into
+/// `out`
+///
+/// `out` is cleared first.
+pub fn decompress(input: &[u8], raw_len: usize, out: &mut Vec<u8>) -> Result<()> {
+    let corrupt = |what: &str| V4Error::Protocol(format!("Corrupt compressed data: {}", what));
+    out.clear();
+    out.reserve(raw_len);
+
+    let mut rest = input;
+    while out.len() < raw_len {
+        let (&flags, tail) = rest.split_first().ok_or_else(|| corrupt("truncated"))?;
+        rest = tail;
+        for item in 0..8 {
+            if out.len() == raw_len {
+                break;
+            }
+            if flags & (1 << item) != 0 {
+                let (&byte, tail) = rest.split_first().ok_or_else(|| corrupt("truncated"))?;
+                out.push(byte);
+                rest = tail;
+            } else {
+                let [lo, hi, ..] = *rest else {
+                    return Err(corrupt("truncated"));
+                };
+                rest = &rest[2..];
+                let dist = (((hi >> 4) as usize) << 8 | lo as usize) + 1;
+                let len = (hi & 0x0F) as usize + MIN_MATCH;
+                if dist > out.len() {
+                    return Err(corrupt("match before start of output"));
+                }
+                if out.len() + len > raw_len {
+                    return Err(corrupt("output longer than expected"));
+                }
+                let start = out.len() - dist;
+                for i in 0..len {
+                    out.push(out[start + i]);
+                }
+            }
+        }
+    }
+    if !rest.is_empty() {
+        return Err(corrupt("trailing bytes"));
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn roundtrip(input: &[u8]) -> usize {
+        let mut packed = Vec::new();
+        compress(input, &mut packed);
+        assert!(packed.len() <= input.len() + input.len() / 8 + 1);
+        let mut unpacked = Vec::new();
+        decompress(&packed, input.len(), &mut unpacked).unwrap();
+        assert_eq!(unpacked, input);
+        packed.len()
+    }
+
+    #[test]
+    fn test_roundtrip() {
+        assert_eq!(roundtrip(&[]), 0);
+        roundtrip(b"ab");
+        roundtrip(b"abcabcabcabcabcabcabcabcabcabc");
+
+        // Runs use overlapping matches
+        assert!(roundtrip(&[0x42; 1000]) < 150);
+
+        // Pseudo-random data barely expands
+        let mut x = 12345u32;
+        let noise: Vec<u8> = (0..5000)
+            .map(|_| {
+                x = x.wrapping_mul(1_103_515_245).wrapping_add(12345);
+                (x >> 16) as u8
+            })
+            .collect();
+        roundtrip(&noise);
+    }
+
+    #[test]
+    fn test_repetitive_bytecode_compresses() {
+        // Typical word bodies: short literal/opcode sequences repeated
+        let code: Vec<u8> = (0..200)
+            .flat_map(|i| [0x01, i as u8 & 0x0F, 0x00, 0x00, 0x00, 0x51, 0x20, 0x60])
+            .collect();
+        assert!(roundtrip(&code) < code.len() / 3);
+    }
+
+    #[test]
+    fn test_decompress_rejects_corrupt_input() {
+        let mut packed = Vec::new();
+        compress(b"hello hello hello", &mut packed);
+        let mut out = Vec::new();
+
+        assert!(decompress(&packed[..packed.len() - 1], 17, &mut out).is_err());
+        assert!(decompress(&packed, 16, &mut out).is_err());
+        // Match pointing before the start of the output
+        assert!(decompress(&[0x00, 0x05, 0x00], 3, &mut out).is_err());
+    }
+}
@@ -0,0 +1,233 @@
+//! Compiler context snapshots
+//!
+//! A [`Compiler`](crate::repl::Compiler) resolves calls to device words
+//! through the VM indices registered with it. A fresh compiler knows none,
+//! so a new session would have to recompile the source that defined them.
+//! After every session the CLI saves the registered word table per port;
+//! sessions that keep the device's words (`v4 exec`, `v4 repl --no-reset`)
+//! register it again instead of compiling anything.
+//!
+//! Snapshots live next to the device manifests (see
+//! [`manifest`](crate::manifest)), one file per port:
+//!
+//! ```text
+//! # v4 compiler context
+//! <INDEX>\t<NAME>
+//! ```
+//!
+//! A snapshot is dropped together with the manifest whenever the CLI resets
+//! the VM, and checked with [`ContextSnapshot::verify`] before it is used.
+
+use crate::Result;
+use crate::protocol::{Command, ErrorCode};
+use crate::serial::V4Serial;
+use crate::trace::Level;
+use std::fs;
+use std::io;
+use std::path::PathBuf;
+use std::time::Duration;
+
+const HEADER_LINE: &str = "# v4 compiler context";
+
+/// Word table of a compiler context: `(name, device index)` in index order
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub struct ContextSnapshot {
+    words: Vec<(String, u16)>,
+}
+
+impl ContextSnapshot {
+    /// Snapshot of the given `(name, device index)` registrations
+    ///
+    /// Later registrations of a name replace earlier ones.
+    pub fn new<'a>(registrations: impl IntoIterator<Item = (&'a str, u16)>) -> Self {
+        let mut words: Vec<(String, u16)> = Vec::new();
+        for (name, index) in registrations {
+            match words.iter_mut().find(|(n, _)| n == name) {
+                Some(existing) => existing.1 = index,
+                None => words.push((name.to_string(), index)),
+            }
+        }
+        words.sort_by_key(|&(_, index)| index);
+        Self { words }
+    }
+
+    /// Snapshot file for `port`, if a state directory can be determined
+    pub fn path_for(port: &str) -> Option<PathBuf> {
+        crate::manifest::state_dir()
+            .map(|dir| dir.join(format!("{}.context", crate::ports::file_stem(port))))
+    }
+
+    /// Load the snapshot for `port`; missing or unreadable snapshots are
+    /// empty
+    pub fn load(port: &str) -> Self {
+        Self::path_for(port)
+            .and_then(|path| fs::read_to_string(path).ok())
+            .map(|text| Self::parse(&text))
+            .unwrap_or_default()
+    }
+
+    /// Write the snapshot for `port`
+    pub fn save(&self, port: &str) -> io::Result<()> {
+        let Some(path) = Self::path_for(port) else {
+            return Ok(());
+        };
+        crate::cache::write_atomic(&path, self.to_text().as_bytes())
+    }
+
+    /// Drop the snapshot for `port`
+    pub fn clear(port: &str) -> io::Result<()> {
+        match Self::path_for(port).map(fs::remove_file) {
+            Some(Err(e)) if e.kind() != io::ErrorKind::NotFound => Err(e),
+            _ => Ok(()),
+        }
+    }
+
+    /// Parse the text form; malformed lines are ignored
+    pub fn parse(text: &str) -> Self {
+        Self::new(
+            text.lines()
+                .filter(|line| !line.starts_with('#'))
+                .filter_map(|line| {
+                    let (index, name) = line.split_once('\t')?;
+                    Some((name, index.parse().ok()?))
+                }),
+        )
+    }
+
+    /// Text form, one word per line in index order
+    pub fn to_text(&self) -> String {
+        let mut text = format!("{}\n", HEADER_LINE);
+        for (name, index) in &self.words {
+            text.push_str(&format!("{}\t{}\n", index, name));
+        }
+        text
+    }
+
+    /// Registered words as `(name, device index)`
+    pub fn words(&self) -> &[(String, u16)] {
+        &self.words
+    }
+
+    /// No words registered
+    pub fn is_empty(&self) -> bool {
+        self.words.is_empty()
+    }
+
+    /// Add the words of `other`; names already present take the index
+    /// `other` gives them
+    pub fn merge(&mut self, other: &ContextSnapshot) {
+        *self = Self::new(
+            self.words
+                .iter()
+                .chain(&other.words)
+                .map(|(name, index)| (name.as_str(), *index)),
+        );
+    }
+
+    /// Check that the device still holds the recorded words
+    ///
+    /// Like [`Manifest::verify`](crate::manifest::Manifest::verify), reads
+    /// back every word with pipelined QueryWords and compares the names.
+    pub fn verify(&self, serial: &mut V4Serial, timeout: Duration) -> Result<bool> {
+        let payloads: Vec<[u8; 2]> = self
+            .words
+            .iter()
+            .map(|(_, index)| index.to_le_bytes())
+            .collect();
+        let requests: Vec<(Command, &[u8])> = payloads
+            .iter()
+            .map(|p| (Command::QueryWord, &p[..]))
+            .collect();
+        let responses = serial.pipeline(&requests, crate::manifest::VERIFY_WINDOW, timeout)?;
+
+        for ((name, index), response) in self.words.iter().zip(&responses) {
+            let valid = response.error_code == ErrorCode::Ok
+                && crate::manifest::parse_word_info(&response.data)
+                    .is_some_and(|(found, _)| found == name.as_bytes());
+            if !valid {
+                crate::trace!(
+                    Level::Info,
+                    "Compiler context is stale (word {} at index {} not found)",
+                    name,
+                    index
+                );
+                return Ok(false);
+            }
+        }
+        Ok(true)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::repl::WordDef;
+
+    #[test]
+    fn test_text_roundtrip() {
+        let snapshot = ContextSnapshot::new([("SQUARE", 1), ("DOUBLE", 0), ("SQUARE", 2)]);
+        assert_eq!(
+            snapshot.words(),
+            &[("DOUBLE".to_string(), 0), ("SQUARE".to_string(), 2)]
+        );
+
+        let text = snapshot.to_text();
+        assert_eq!(text, "# v4 compiler context\n0\tDOUBLE\n2\tSQUARE\n");
+        assert_eq!(ContextSnapshot::parse(&text), snapshot);
+
+        // Malformed lines are skipped
+        let parsed = ContextSnapshot::parse("# v4 compiler context\nx\tBAD\n3\tOK\nnotab\n");
+        assert_eq!(parsed.words(), &[("OK".to_string(), 3)]);
+    }
+
+    #[test]
+    fn test_verify_against_device() {
+        let mut serial = V4Serial::from_transport(Box::new(crate::sim::Simulator::new()), 115_200);
+        let timeout = Duration::from_secs(1);
+        let snapshot = ContextSnapshot::new([("SQ", 0)]);
+
+        // The simulator starts without words
+        assert!(
+            ContextSnapshot::default()
+                .verify(&mut serial, timeout)
+                .unwrap()
+        );
+        assert!(!snapshot.verify(&mut serial, timeout).unwrap());
+
+        let words = [WordDef {
+            name: "SQ".to_string(),
+            bytecode: vec![0x30, 0x23, 0x51],
+        }];
+        let mut image = Vec::new();
+        crate::bytecode::encode_words(&words, &mut image);
+        serial.exec(&image, timeout).unwrap();
+        assert!(snapshot.verify(&mut serial, timeout).unwrap());
+        assert!(
+            !ContextSnapshot::new([("OTHER", 0)])
+                .verify(&mut serial, timeout)
+                .unwrap()
+        );
+
+        // Every word is checked, not just the last one (SQ is at 1 too)
+        serial.exec(&image, timeout).unwrap();
+        assert!(
+            !ContextSnapshot::new([("WRONG", 0), ("SQ", 1)])
+                .verify(&mut serial, timeout)
+                .unwrap()
+        );
+    }
+
+    #[test]
+    fn test_merge() {
+        let mut snapshot = ContextSnapshot::new([("A", 0), ("B", 1)]);
+        snapshot.merge(&ContextSnapshot::new([("B", 3), ("C", 2)]));
+        assert_eq!(
+            snapshot.words(),
+            &[
+                ("A".to_string(), 0),
+                ("C".to_string(), 2),
+                ("B".to_string(), 3)
+            ]
+        );
+    }
+}
@@ -0,0 +1,334 @@
+//! Persistent connection daemon and network bridge
+//!
+//! `v4 daemon` keeps the serial port open and serves V4-link frames on a
+//! Unix socket, so CLI calls neither reopen the port nor reboot boards that
+//! reset on DTR. `v4 serve` does the same on a TCP listener, so a lab
+//! machine can share its boards with `--port tcp://HOST:PORT` clients. Both
+//! carry the unchanged V4-link byte stream: clients send command frames and
+//! receive response frames, exactly as on the serial line.
+//!
+//! Clients are served concurrently, one thread each. Whatever complete
+//! frames a client has sent are forwarded to the device in one write while
+//! the port is locked, and the same number of responses is read back and
+//! returned in one write, so a client's pipelined window stays intact,
+//! responses are never handed to the wrong client, and a remote window
+//! costs one network round trip instead of one per frame.
+
+use crate::protocol::caps::{LinkCaps, MAX_LINK_MTU};
+use crate::protocol::frame::STX;
+use crate::protocol::{Command, ErrorCode, Frame, FrameDecoder, Request, calc_crc8};
+use crate::serial::V4Serial;
+use crate::{Result, V4Error};
+use std::io::{self, Read, Write};
+use std::ops::Range;
+#[cfg(unix)]
+use std::os::unix::net::UnixStream;
+use std::path::PathBuf;
+use std::sync::Mutex;
+use std::time::Duration;
+
+/// Environment variable that disables connecting through a daemon
+pub const ENV_NO_DAEMON: &str = "V4_NO_DAEMON";
+
+/// Socket path of the daemon serving `port`
+///
+/// Lives in `$XDG_RUNTIME_DIR` when set, otherwise the temp directory:
+/// `/dev/ttyACM0` → `$XDG_RUNTIME_DIR/v4-dev-ttyACM0.sock`.
+pub fn socket_path(port: &str) -> PathBuf {
+    let dir = std::env::var_os("XDG_RUNTIME_DIR")
+        .map(PathBuf::from)
+        .unwrap_or_else(std::env::temp_dir);
+    dir.join(format!("v4-{}.sock", crate::ports::file_stem(port)))
+}
+
+/// Connect to the daemon serving `port`, if one is running
+#[cfg(unix)]
+pub fn connect(port: &str) -> Option<UnixStream> {
+    if std::env::var_os(ENV_NO_DAEMON).is_some_and(|v| !v.is_empty() && v != "0") {
+        return None;
+    }
+    UnixStream::connect(socket_path(port)).ok()
+}
+
+/// Forward frames between one client and the device until the client
+/// disconnects
+///
+/// Replies go back in request order. A request that fails its CRC check
+/// is answered with INVALID_FRAME in its place, and a device response that
+/// times out or is corrupted is replaced by an error reply, so clients that
+/// match replies by position stay in step. `timeout` bounds the wait for
+/// each device response.
+///
+/// CAPS requests are answered here from the link parameters already in
+/// effect, limited to what the client asked for: the port is shared, so no
+/// client may change its baud rate or MTU for the others. The first CAPS
+/// request on a link that has not been negotiated runs one exchange with
+/// the device at the current baud rate.
+pub fn forward<S: Read + Write>(
+    client: &mut S,
+    device: &Mutex<V4Serial>,
+    timeout: Duration,
+) -> Result<()> {
+    let mut requests = FrameDecoder::for_requests(MAX_LINK_MTU);
+    let mut batch = Batch::default();
+    // Replies for the client, written in one go
+    let mut out: Vec<u8> = Vec::new();
+
+    loop {
+        let n = match client.read(requests.spare()) {
+            Ok(0) => return Ok(()),
+            Ok(n) => n,
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+            Err(e) => return Err(e.into()),
+        };
+        requests.commit(n);
+
+        let mut device = device.lock().unwrap_or_else(|e| e.into_inner());
+
+        out.clear();
+        while let Some(frame) = requests.next_frame() {
+            match frame {
+                Ok(frame) => {
+                    let request = Frame::parse_request(frame);
+                    if request.command == Command::Caps as u8 {
+                        // Earlier requests are answered first
+                        batch.exchange(&mut device, timeout, &mut out)?;
+                        answer_caps(&mut device, request, timeout, &mut out)?;
+                    } else {
+                        batch.push(frame, request.seq);
+                    }
+                }
+                Err(V4Error::CrcMismatch { .. }) => batch.slots.push(Slot::Corrupt),
+                Err(e) => return Err(e),
+            }
+        }
+        batch.exchange(&mut device, timeout, &mut out)?;
+
+        drop(device);
+        client.write_all(&out)?;
+        client.flush()?;
+    }
+}
+
+/// Reply owed to the client, in request order
+enum Slot {
+    /// Forwarded request with its sequence number
+    Device(Option<u8>),
+    /// Request that failed its CRC check; never reaches the device
+    Corrupt,
+}
+
+/// Requests of one client read, forwarded to the device in one write
+#[derive(Default)]
+struct Batch {
+    frames: Vec<u8>,
+    ranges: Vec<Range<usize>>,
+    slots: Vec<Slot>,
+}
+
+impl Batch {
+    fn push(&mut self, frame: &[u8], seq: Option<u8>) {
+        self.ranges
+            .push(self.frames.len()..self.frames.len() + frame.len());
+        self.frames.extend_from_slice(frame);
+        self.slots.push(Slot::Device(seq));
+    }
+
+    /// Send the batched frames and append one reply per slot to `out`
+    fn exchange(
+        &mut self,
+        device: &mut V4Serial,
+        timeout: Duration,
+        out: &mut Vec<u8>,
+    ) -> Result<()> {
+        if !self.ranges.is_empty() {
+            device.send_raw_batch(&self.frames, &self.ranges)?;
+        }
+        let mut timed_out = false;
+        for slot in self.slots.drain(..) {
+            match slot {
+                Slot::Corrupt => out.extend_from_slice(&error_response(ErrorCode::InvalidFrame)),
+                Slot::Device(seq) => match device.recv_frame(timeout) {
+                    Ok(frame) => out.extend_from_slice(frame),
+                    Err(V4Error::CrcMismatch { .. }) => {
+                        reply(seq, ErrorCode::InvalidFrame, &[], out)
+                    }
+                    Err(V4Error::Timeout) => {
+                        timed_out = true;
+                        reply(seq, ErrorCode::Error, &[], out);
+                    }
+                    Err(e) => return Err(e),
+                },
+            }
+        }
+        // Don't hand a late response to the next batch
+        if timed_out {
+            device.clear_input()?;
+        }
+        self.frames.clear();
+        self.ranges.clear();
+        Ok(())
+    }
+}
+
+/// Answer a client's CAPS request without touching the shared link
+fn answer_caps(
+    device: &mut V4Serial,
+    request: Request,
+    timeout: Duration,
+    out: &mut Vec<u8>,
+) -> Result<()> {
+    let Some(requested) = LinkCaps::parse(request.payload) else {
+        reply(request.seq, ErrorCode::InvalidFrame, &[], out);
+        return Ok(());
+    };
+    if !device.is_negotiated() {
+        let baud = device.caps().baud;
+        match device.negotiate(baud, MAX_LINK_MTU, timeout) {
+            Ok(_) => {}
+            Err(
+                e @ (V4Error::Device(_)
+                | V4Error::Protocol(_)
+                | V4Error::Timeout
+                | V4Error::CrcMismatch { .. }),
+            ) => {
+                crate::trace!(crate::trace::Level::Info, "Link negotiation failed: {}", e);
+                reply(request.seq, ErrorCode::Error, &[], out);
+                return Ok(());
+            }
+            Err(e) => return Err(e),
+        }
+    }
+    let agreed = device.caps().limit_to(&requested);
+    reply(request.seq, ErrorCode::Ok, &agreed.encode(), out);
+    Ok(())
+}
+
+/// Append a response frame, sequenced if the request was
+fn reply(seq: Option<u8>, code: ErrorCode, data: &[u8], out: &mut Vec<u8>) {
+    let mut frame = Vec::with_capacity(data.len() + 6);
+    Frame::encode_response_into(seq, code, data, &mut frame);
+    out.extend_from_slice(&frame);
+}
+
+/// Response frame without data: [STX][0x01][0x00][ERR_CODE][CRC8]
+fn error_response(code: ErrorCode) -> [u8; 5] {
+    let body = [0x01, 0x00, code as u8];
+    [STX, body[0], body[1], body[2], calc_crc8(&body)]
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_socket_path() {
+        let path = socket_path("/dev/ttyACM0");
+        assert_eq!(path.file_name().unwrap(), "v4-dev-ttyACM0.sock");
+    }
+
+    /// Client socket with scripted input that records what it receives
+    struct ScriptedClient {
+        input: io::Cursor<Vec<u8>>,
+        output: Vec<u8>,
+    }
+
+    impl Read for ScriptedClient {
+        fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+            self.input.read(buf)
+        }
+    }
+
+    impl Write for ScriptedClient {
+        fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+            self.output.write(buf)
+        }
+
+        fn flush(&mut self) -> io::Result<()> {
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn test_forward_pipelined_frames() {
+        let device = crate::transport::Loopback::new();
+        let device = Mutex::new(V4Serial::from_transport(Box::new(device), 115_200));
+
+        let mut input = Frame::new(Command::Ping, vec![]).unwrap().encode();
+        let mut corrupt = Frame::new(Command::Ping, vec![]).unwrap().encode();
+        *corrupt.last_mut().unwrap() ^= 0xFF;
+        input.extend(corrupt);
+        input.extend(Frame::new(Command::Exec, vec![1, 2, 3]).unwrap().encode());
+
+        let mut client = ScriptedClient {
+            input: io::Cursor::new(input),
+            output: Vec::new(),
+        };
+        forward(&mut client, &device, Duration::from_millis(10)).unwrap();
+
+        let mut responses = FrameDecoder::default();
+        responses.spare()[..client.output.len()].copy_from_slice(&client.output);
+        responses.commit(client.output.len());
+        let mut codes = Vec::new();
+        while let Some(frame) = responses.next_frame() {
+            codes.push(Frame::decode_response(frame.unwrap()).unwrap().error_code);
+        }
+        // The corrupt frame is answered in its place, without reaching the
+        // device
+        assert_eq!(
+            codes,
+            vec![ErrorCode::Ok, ErrorCode::InvalidFrame, ErrorCode::Ok]
+        );
+    }
+
+    #[test]
+    fn test_forward_answers_caps_locally() {
+        let device = crate::transport::Loopback::new();
+        let device = Mutex::new(V4Serial::from_transport(Box::new(device), 115_200));
+
+        let requested = LinkCaps {
+            baud: 921_600,
+            mtu: 1024,
+            features: crate::protocol::caps::HOST_FEATURES,
+        };
+        let mut input = Frame::new(Command::Ping, vec![]).unwrap().encode();
+        input.extend(
+            Frame::new(Command::Caps, requested.encode().to_vec())
+                .unwrap()
+                .encode(),
+        );
+        input.extend(Frame::new(Command::Ping, vec![]).unwrap().encode());
+        let mut client = ScriptedClient {
+            input: io::Cursor::new(input),
+            output: Vec::new(),
+        };
+        forward(&mut client, &device, Duration::from_millis(10)).unwrap();
+
+        let mut responses = FrameDecoder::default();
+        responses.spare()[..client.output.len()].copy_from_slice(&client.output);
+        responses.commit(client.output.len());
+        let mut replies = Vec::new();
+        while let Some(frame) = responses.next_frame() {
+            replies.push(Frame::decode_response(frame.unwrap()).unwrap());
+        }
+        assert_eq!(replies.len(), 3);
+        assert!(replies.iter().all(|r| r.error_code == ErrorCode::Ok));
+
+        // The shared port keeps its baud rate; the client gets the MTU it
+        // asked for
+        let agreed = LinkCaps::parse(&replies[1].data).unwrap();
+        assert_eq!((agreed.baud, agreed.mtu), (115_200, 1024));
+        let device = device.lock().unwrap();
+        assert!(device.is_negotiated());
+        assert_eq!(device.caps().baud, 115_200);
+        assert_eq!(device.caps().mtu, MAX_LINK_MTU);
+    }
+
+    #[test]
+    fn test_error_response_decodes() {
+        let frame = error_response(ErrorCode::InvalidFrame);
+        let response = Frame::decode_response(&frame).unwrap();
+        assert_eq!(response.error_code, ErrorCode::InvalidFrame);
+        assert!(response.data.is_empty());
+    }
+}
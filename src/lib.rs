@@ -1,8 +1,22 @@
+#[cfg(feature = "async")]
+pub mod async_client;
+pub mod bytecode;
+pub mod cache;
 pub mod commands;
+pub mod compress;
+pub mod context;
+pub mod daemon;
 pub mod error;
+pub mod manifest;
+pub mod mmap;
+pub mod ports;
 pub mod protocol;
 pub mod repl;
 pub mod serial;
+pub mod sim;
+pub mod symbols;
+pub mod trace;
+pub mod transport;
 pub mod v4front_ffi;
 
 pub use error::{Result, V4Error};
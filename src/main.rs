@@ -1,11 +1,36 @@
 use clap::{Parser, Subcommand};
+use std::path::PathBuf;
 use std::time::Duration;
-use v4_cli::commands;
+use v4_cli::bytecode::Format;
+use v4_cli::commands::dump::parse_number;
+use v4_cli::commands::{CompileOptions, ExecOptions, ProfileOptions, StatsOptions};
+use v4_cli::serial::{LinkOptions, PushOptions, ReadOptions};
+use v4_cli::{commands, trace};
 
 #[derive(Parser)]
 #[command(name = "v4")]
 #[command(version, about = "CLI tool for V4 VM bytecode deployment", long_about = None)]
 struct Cli {
+    /// Increase trace verbosity (-v info, -vv frames, -vvv hex dumps)
+    #[arg(short, long, action = clap::ArgAction::Count, global = true)]
+    verbose: u8,
+
+    /// Capture all V4-link frames to a pcap file
+    #[arg(long, global = true, value_name = "FILE")]
+    capture: Option<PathBuf>,
+
+    /// Negotiate this baud rate with the device after connecting
+    #[arg(long, global = true)]
+    baud: Option<u32>,
+
+    /// Negotiate this maximum frame payload (bytes) with the device
+    #[arg(long, global = true)]
+    mtu: Option<usize>,
+
+    /// Negotiate LZSS-compressed chunk transfers with the device
+    #[arg(long, global = true)]
+    compress: bool,
+
     #[command(subcommand)]
     command: Commands,
 }
@@ -17,9 +42,10 @@ enum Commands {
         /// Bytecode file path
         file: String,
 
-        /// Serial port path (e.g., /dev/ttyACM0)
-        #[arg(short, long)]
-        port: String,
+        /// Serial port path(s); repeat, comma-separate or use a glob
+        /// (e.g., /dev/ttyACM*) to deploy to several devices in parallel
+        #[arg(short, long, required = true, value_delimiter = ',')]
+        port: Vec<String>,
 
         /// Don't wait for response
         #[arg(long)]
@@ -28,6 +54,27 @@ enum Commands {
         /// Timeout in seconds
         #[arg(long, default_value = "5")]
         timeout: u64,
+
+        /// Bytes per frame for images larger than one frame (default: fit MTU)
+        #[arg(long)]
+        chunk_size: Option<usize>,
+
+        /// Number of chunk frames kept in flight
+        #[arg(long, default_value = "4")]
+        window: usize,
+
+        /// Let the window grow up to this many frames on a clean link
+        /// (default: --window)
+        #[arg(long)]
+        max_window: Option<usize>,
+
+        /// Keep chunk size and window fixed instead of adapting to link errors
+        #[arg(long)]
+        no_adapt: bool,
+
+        /// Send every word, ignoring what the device is known to hold
+        #[arg(long)]
+        full: bool,
     },
 
     /// Check connection to device
@@ -54,12 +101,30 @@ enum Commands {
 
     /// Compile Forth source to bytecode
     Compile {
-        /// Input Forth source file path
-        input: String,
+        /// Input Forth source files or directories (searched recursively)
+        #[arg(required = true)]
+        inputs: Vec<String>,
 
-        /// Output bytecode file path (default: input with .v4b extension)
-        #[arg(short, long)]
+        /// Output bytecode file path (default: input with .v4b extension;
+        /// single input file only)
+        #[arg(short, long, conflicts_with = "out_dir")]
         output: Option<String>,
+
+        /// Write outputs below this directory instead of next to the sources
+        #[arg(long)]
+        out_dir: Option<String>,
+
+        /// Number of files compiled in parallel (default: CPU count)
+        #[arg(short, long)]
+        jobs: Option<usize>,
+
+        /// Image format: v0.2, or v0.3 with word index and section CRCs
+        #[arg(long, default_value = "v0.2")]
+        format: Format,
+
+        /// Always run the compiler, bypassing the compile cache
+        #[arg(long)]
+        no_cache: bool,
     },
 
     /// Start interactive REPL session
@@ -71,6 +136,11 @@ enum Commands {
         /// Skip VM reset on startup (preserves existing words)
         #[arg(long)]
         no_reset: bool,
+
+        /// Run lines from stdin without prompts, coalescing and pipelining
+        /// EXEC frames (default when stdin is not a terminal)
+        #[arg(long)]
+        batch: bool,
     },
 
     /// Execute Forth source file on device
@@ -89,36 +159,347 @@ enum Commands {
         /// Enter REPL after execution
         #[arg(long)]
         repl: bool,
+
+        /// Send each word definition in its own EXEC frame
+        #[arg(long)]
+        no_batch: bool,
+
+        /// Always run the compiler, bypassing the compile cache
+        #[arg(long)]
+        no_cache: bool,
+
+        /// Send every word, ignoring what the device is known to hold
+        #[arg(long)]
+        full: bool,
+    },
+
+    /// Read device memory into a file or print it as a hexdump
+    Dump {
+        /// Serial port path (e.g., /dev/ttyACM0)
+        #[arg(short, long)]
+        port: String,
+
+        /// Start address, decimal or 0x hex (default: where the last dump
+        /// of this port ended)
+        #[arg(value_parser = parse_number)]
+        addr: Option<u32>,
+
+        /// Number of bytes; accepts K and M suffixes
+        #[arg(value_parser = parse_number, default_value = "256")]
+        len: u32,
+
+        /// Write raw memory to this file instead of printing a hexdump
+        #[arg(short, long)]
+        output: Option<PathBuf>,
+
+        /// Timeout in seconds for each response
+        #[arg(long, default_value = "5")]
+        timeout: u64,
+
+        /// Number of memory requests kept in flight
+        #[arg(long, default_value = "4")]
+        window: usize,
+    },
+
+    /// Measure PING latency and EXEC throughput of a device
+    Bench {
+        /// Serial port path (e.g., /dev/ttyACM0)
+        #[arg(short, long)]
+        port: String,
+
+        /// Round trips measured for each test
+        #[arg(short = 'n', long, default_value = "100")]
+        count: usize,
+
+        /// Timeout in seconds for each response
+        #[arg(long, default_value = "5")]
+        timeout: u64,
+    },
+
+    /// Show VM performance counters: instructions, cycles, hot words
+    Stats {
+        /// Serial port path (e.g., /dev/ttyACM0)
+        #[arg(short, long)]
+        port: String,
+
+        /// Poll until Enter is pressed, showing the increase per sample
+        #[arg(short, long)]
+        watch: bool,
+
+        /// Milliseconds between samples with --watch
+        #[arg(long, default_value = "1000")]
+        interval: u64,
+
+        /// Print per-word counters as CSV
+        #[arg(long)]
+        csv: bool,
+
+        /// Zero the device counters after reading them
+        #[arg(long)]
+        reset: bool,
+
+        /// Timeout in seconds for each response
+        #[arg(long, default_value = "5")]
+        timeout: u64,
+    },
+
+    /// Sample the return stack of the running device into folded stacks
+    Profile {
+        /// Serial port path (e.g., /dev/ttyACM0)
+        #[arg(short, long)]
+        port: String,
+
+        /// Seconds to sample
+        #[arg(short, long, default_value = "10")]
+        duration: f64,
+
+        /// Samples per second
+        #[arg(short, long, default_value = "100")]
+        rate: u32,
+
+        /// Write folded stacks to this file instead of stdout
+        #[arg(short, long)]
+        output: Option<PathBuf>,
+
+        /// Start of the dictionary in VM memory
+        #[arg(long, value_parser = parse_number, default_value = "0")]
+        code_base: u32,
+
+        /// Bytes of dictionary searched for word code; accepts K and M
+        #[arg(long, value_parser = parse_number, default_value = "64K")]
+        code_size: u32,
+
+        /// Timeout in seconds for each response
+        #[arg(long, default_value = "5")]
+        timeout: u64,
+    },
+
+    /// Keep a serial port open and share it with other v4 commands
+    ///
+    /// While it runs, commands given the same --port talk to the daemon over
+    /// a local socket instead of reopening (and resetting) the board. Set
+    /// V4_NO_DAEMON=1 to bypass it.
+    Daemon {
+        /// Serial port path (e.g., /dev/ttyACM0)
+        #[arg(short, long)]
+        port: String,
+
+        /// Socket path (default: derived from the port name)
+        #[arg(long)]
+        socket: Option<PathBuf>,
+
+        /// Timeout in seconds for each device response
+        #[arg(long, default_value = "5")]
+        timeout: u64,
+    },
+
+    /// Share a serial port with v4 commands on other machines over TCP
+    ///
+    /// Clients pass --port tcp://HOST:PORT to any subcommand. Goes through a
+    /// running v4 daemon for the same port.
+    Serve {
+        /// Serial port path (e.g., /dev/ttyACM0)
+        #[arg(short, long)]
+        port: String,
+
+        /// Address to listen on: HOST:PORT, or :PORT for all interfaces
+        #[arg(long, default_value = ":7400")]
+        listen: String,
+
+        /// Timeout in seconds for each device response
+        #[arg(long, default_value = "5")]
+        timeout: u64,
     },
 }
 
 fn main() {
     let cli = Cli::parse();
 
+    trace::init(cli.verbose);
+    if let Some(path) = &cli.capture
+        && let Err(e) = trace::start_capture(path)
+    {
+        eprintln!(
+            "Error: Failed to open capture file {}: {}",
+            path.display(),
+            e
+        );
+        std::process::exit(1);
+    }
+
+    let link = LinkOptions {
+        baud: cli.baud,
+        mtu: cli.mtu,
+        compress: cli.compress,
+    };
+
     let result = match cli.command {
         Commands::Push {
             file,
             port,
             detach,
             timeout,
-        } => commands::push(&file, &port, detach, Duration::from_secs(timeout)),
+            chunk_size,
+            window,
+            max_window,
+            no_adapt,
+            full,
+        } => commands::push(
+            &file,
+            &port,
+            &link,
+            detach,
+            full,
+            &PushOptions {
+                chunk_size,
+                window,
+                max_window,
+                timeout: Duration::from_secs(timeout),
+                adaptive: !no_adapt,
+                ..PushOptions::default()
+            },
+        ),
 
-        Commands::Ping { port, timeout } => commands::ping(&port, Duration::from_secs(timeout)),
+        Commands::Ping { port, timeout } => {
+            commands::ping(&port, &link, Duration::from_secs(timeout))
+        }
 
-        Commands::Reset { port, timeout } => commands::reset(&port, Duration::from_secs(timeout)),
+        Commands::Reset { port, timeout } => {
+            commands::reset(&port, &link, Duration::from_secs(timeout))
+        }
 
-        Commands::Compile { input, output } => commands::compile(&input, output.as_deref()),
+        Commands::Compile {
+            inputs,
+            output,
+            out_dir,
+            jobs,
+            format,
+            no_cache,
+        } => commands::compile(
+            &inputs,
+            &CompileOptions {
+                output: output.map(PathBuf::from),
+                out_dir: out_dir.map(PathBuf::from),
+                jobs,
+                cache: !no_cache,
+                format,
+                worker: std::env::current_exe().ok(),
+            },
+        ),
 
-        Commands::Repl { port, no_reset } => commands::run_repl(&port, no_reset),
+        Commands::Repl {
+            port,
+            no_reset,
+            batch,
+        } => commands::run_repl(&port, &link, no_reset, batch),
 
         Commands::Exec {
             file,
             port,
             timeout,
             repl,
-        } => commands::exec(&file, &port, Duration::from_secs(timeout), repl),
+            no_batch,
+            no_cache,
+            full,
+        } => commands::exec(
+            &file,
+            &port,
+            &link,
+            &ExecOptions {
+                timeout: Duration::from_secs(timeout),
+                enter_repl: repl,
+                batch: !no_batch,
+                cache: !no_cache,
+                full,
+            },
+        ),
+
+        Commands::Dump {
+            port,
+            addr,
+            len,
+            output,
+            timeout,
+            window,
+        } => commands::dump(
+            &port,
+            &link,
+            addr,
+            len,
+            output.as_deref(),
+            &ReadOptions {
+                window,
+                timeout: Duration::from_secs(timeout),
+                ..ReadOptions::default()
+            },
+        ),
+
+        Commands::Bench {
+            port,
+            count,
+            timeout,
+        } => commands::bench(&port, &link, count, Duration::from_secs(timeout)),
+
+        Commands::Stats {
+            port,
+            watch,
+            interval,
+            csv,
+            reset,
+            timeout,
+        } => commands::stats(
+            &port,
+            &link,
+            &StatsOptions {
+                watch,
+                interval: Duration::from_millis(interval),
+                csv,
+                reset,
+                timeout: Duration::from_secs(timeout),
+            },
+        ),
+
+        Commands::Profile {
+            port,
+            duration,
+            rate,
+            output,
+            code_base,
+            code_size,
+            timeout,
+        } => commands::profile(
+            &port,
+            &link,
+            output.as_deref(),
+            &ProfileOptions {
+                duration: Duration::from_secs_f64(duration.max(0.0)),
+                rate,
+                code_base,
+                code_size,
+                timeout: Duration::from_secs(timeout),
+            },
+        ),
+
+        Commands::Daemon {
+            port,
+            socket,
+            timeout,
+        } => commands::daemon(
+            &port,
+            &link,
+            socket.as_deref(),
+            Duration::from_secs(timeout),
+        ),
+
+        Commands::Serve {
+            port,
+            listen,
+            timeout,
+        } => commands::serve(&port, &link, &listen, Duration::from_secs(timeout)),
     };
 
+    let _ = trace::stop_capture();
+
     if let Err(e) = result {
         eprintln!("Error: {}", e);
         std::process::exit(1);
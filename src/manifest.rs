@@ -0,0 +1,400 @@
+//! Per-device word manifest for delta deploys
+//!
+//! After a deploy the CLI records, for every word the device registered,
+//! its name, a hash of its bytecode and the VM index the device returned.
+//! The next deploy to the same port can then skip words the device already
+//! holds.
+//!
+//! Words and main code call words by the index the compiler gave them,
+//! which only matches the device if words are registered in the order they
+//! were compiled. Dropping a word from the middle of an image would move
+//! every later word to a different index, so only a leading run of
+//! unchanged words is skipped, and only if the device holds exactly those
+//! words at exactly those indices; new words are appended where they were
+//! compiled to go. Any other change sends the whole image (see
+//! [`Manifest::plan`]).
+//!
+//! Manifests live in `$V4_STATE_DIR`, or `v4/devices` under the platform
+//! state directory (`$XDG_STATE_HOME`, `~/.local/state`, `%LOCALAPPDATA%`),
+//! one file per port:
+//!
+//! ```text
+//! # v4 device manifest
+//! <INDEX>\t<SHA-256 (128 bits, hex)>\t<NAME>
+//! ```
+//!
+//! A manifest is dropped whenever the CLI resets the VM. Resets it cannot
+//! see (power cycles, other tools) are caught by [`Manifest::verify`],
+//! which checks every skipped word against the device first.
+
+use crate::Result;
+use crate::protocol::{Command, ErrorCode};
+use crate::repl::WordDef;
+use crate::serial::V4Serial;
+use crate::trace::Level;
+use sha2::{Digest, Sha256};
+use std::fs;
+use std::io;
+use std::path::PathBuf;
+use std::time::Duration;
+
+/// Environment variable overriding the manifest directory
+pub const ENV_STATE_DIR: &str = "V4_STATE_DIR";
+
+const HEADER_LINE: &str = "# v4 device manifest";
+
+/// QueryWord requests in flight while verifying
+pub(crate) const VERIFY_WINDOW: usize = 8;
+
+/// Hash identifying a word's bytecode
+pub fn word_hash(bytecode: &[u8]) -> String {
+    Sha256::digest(bytecode)[..16]
+        .iter()
+        .map(|b| format!("{:02x}", b))
+        .collect()
+}
+
+/// Word known to be registered on the device
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Entry {
+    pub name: String,
+    pub hash: String,
+    pub index: u16,
+}
+
+/// Words to send and words already on the device
+#[derive(Debug, Default, PartialEq, Eq)]
+pub struct Plan {
+    /// Positions of new or changed words
+    pub send: Vec<usize>,
+    /// `(position, device index)` of words that are unchanged
+    pub keep: Vec<(usize, u16)>,
+}
+
+/// Record of the words registered on one device
+#[derive(Debug, Default, Clone)]
+pub struct Manifest {
+    entries: Vec<Entry>,
+}
+
+impl Manifest {
+    /// Manifest file for `port`, if a state directory can be determined
+    pub fn path_for(port: &str) -> Option<PathBuf> {
+        state_dir().map(|dir| dir.join(format!("{}.manifest", crate::ports::file_stem(port))))
+    }
+
+    /// Load the manifest for `port`; missing or unreadable manifests are
+    /// empty
+    pub fn load(port: &str) -> Self {
+        Self::path_for(port)
+            .and_then(|path| fs::read_to_string(path).ok())
+            .map(|text| Self::parse(&text))
+            .unwrap_or_default()
+    }
+
+    /// Write the manifest for `port`
+    pub fn save(&self, port: &str) -> io::Result<()> {
+        let Some(path) = Self::path_for(port) else {
+            return Ok(());
+        };
+        crate::cache::write_atomic(&path, self.to_text().as_bytes())
+    }
+
+    /// Forget what is registered on the device at `port`
+    ///
+    /// Drops the port's compiler context snapshot as well.
+    pub fn clear(port: &str) -> io::Result<()> {
+        crate::context::ContextSnapshot::clear(port)?;
+        match Self::path_for(port).map(fs::remove_file) {
+            Some(Err(e)) if e.kind() != io::ErrorKind::NotFound => Err(e),
+            _ => Ok(()),
+        }
+    }
+
+    /// Parse the text form; malformed lines are ignored
+    pub fn parse(text: &str) -> Self {
+        let entries = text
+            .lines()
+            .filter(|line| !line.starts_with('#'))
+            .filter_map(|line| {
+                let mut fields = line.splitn(3, '\t');
+                let index = fields.next()?.parse().ok()?;
+                let hash = fields.next()?.to_string();
+                let name = fields.next()?.to_string();
+                Some(Entry { name, hash, index })
+            })
+            .collect();
+        Self { entries }
+    }
+
+    /// Text form, one entry per line in index order
+    pub fn to_text(&self) -> String {
+        let mut text = format!("{}\n", HEADER_LINE);
+        for entry in &self.entries {
+            text.push_str(&format!(
+                "{}\t{}\t{}\n",
+                entry.index, entry.hash, entry.name
+            ));
+        }
+        text
+    }
+
+    /// Recorded words
+    pub fn entries(&self) -> &[Entry] {
+        &self.entries
+    }
+
+    /// No words recorded
+    pub fn is_empty(&self) -> bool {
+        self.entries.is_empty()
+    }
+
+    /// Entry for `name`
+    pub fn get(&self, name: &str) -> Option<&Entry> {
+        self.entries.iter().find(|e| e.name == name)
+    }
+
+    /// Record that the device registered `name` with `bytecode` at `index`
+    ///
+    /// Replaces an earlier entry for the same name.
+    pub fn record(&mut self, name: &str, bytecode: &[u8], index: u16) {
+        let entry = Entry {
+            name: name.to_string(),
+            hash: word_hash(bytecode),
+            index,
+        };
+        match self.entries.iter_mut().find(|e| e.name == name) {
+            Some(existing) => *existing = entry,
+            None => self.entries.push(entry),
+        }
+        self.entries.sort_by_key(|e| e.index);
+    }
+
+    /// Split `words` into those that must be sent and those the device
+    /// already has
+    ///
+    /// `first_index` is the index the compiler gave `words[0]`; the others
+    /// follow in order. Words are kept only as a leading run that the
+    /// manifest records, unchanged, at exactly their compiled index, with
+    /// no other word recorded after them, so the words sent are registered
+    /// at the indices they were compiled for. In every other case the plan
+    /// sends every word.
+    pub fn plan(&self, words: &[WordDef], first_index: u16) -> Plan {
+        let kept = words
+            .iter()
+            .enumerate()
+            .take_while(|(pos, word)| {
+                self.get(&word.name).is_some_and(|entry| {
+                    entry.hash == word_hash(&word.bytecode)
+                        && entry.index as usize == first_index as usize + pos
+                })
+            })
+            .count();
+        let next = self.next_index().unwrap_or(0);
+        if kept == 0 || next as usize != first_index as usize + kept {
+            return Plan {
+                send: (0..words.len()).collect(),
+                keep: Vec::new(),
+            };
+        }
+        Plan {
+            send: (kept..words.len()).collect(),
+            keep: (0..kept)
+                .map(|pos| (pos, first_index + pos as u16))
+                .collect(),
+        }
+    }
+
+    /// One past the highest recorded index
+    fn next_index(&self) -> Option<u16> {
+        self.entries.last().map(|e| e.index.saturating_add(1))
+    }
+
+    /// Check that the device still holds the recorded words
+    ///
+    /// Every kept word is read back with pipelined QueryWords and compared
+    /// by name and bytecode. If words are to be sent, the index after the
+    /// last recorded one must also be free, or they would not land at
+    /// their compiled indices (e.g. after REPL definitions the manifest did
+    /// not see).
+    pub fn verify(
+        &self,
+        serial: &mut V4Serial,
+        words: &[WordDef],
+        plan: &Plan,
+        timeout: Duration,
+    ) -> Result<bool> {
+        if plan.keep.is_empty() {
+            return Ok(true);
+        }
+        let probe = (!plan.send.is_empty()).then(|| self.next_index()).flatten();
+        let payloads: Vec<[u8; 2]> = plan
+            .keep
+            .iter()
+            .map(|&(_, index)| index)
+            .chain(probe)
+            .map(u16::to_le_bytes)
+            .collect();
+        let requests: Vec<(Command, &[u8])> = payloads
+            .iter()
+            .map(|p| (Command::QueryWord, &p[..]))
+            .collect();
+        let responses = serial.pipeline(&requests, VERIFY_WINDOW, timeout)?;
+
+        for (&(pos, index), response) in plan.keep.iter().zip(&responses) {
+            let word = &words[pos];
+            let valid = response.error_code == ErrorCode::Ok
+                && parse_word_info(&response.data).is_some_and(|(name, code)| {
+                    name == word.name.as_bytes() && code == word.bytecode.as_slice()
+                });
+            if !valid {
+                crate::trace!(
+                    Level::Info,
+                    "Device manifest is stale (word {} at index {} not found)",
+                    word.name,
+                    index
+                );
+                return Ok(false);
+            }
+        }
+        if let (Some(index), Some(response)) = (probe, responses.get(plan.keep.len()))
+            && response.error_code == ErrorCode::Ok
+        {
+            crate::trace!(
+                Level::Info,
+                "Device manifest is stale (unrecorded word at index {})",
+                index
+            );
+            return Ok(false);
+        }
+        Ok(true)
+    }
+}
+
+/// Split QueryWord response data: `[NAME_LEN][NAME][CODE_LEN (u16)][CODE]`
+pub(crate) fn parse_word_info(data: &[u8]) -> Option<(&[u8], &[u8])> {
+    let (&name_len, rest) = data.split_first()?;
+    let name = rest.get(..name_len as usize)?;
+    let rest = &rest[name_len as usize..];
+    let code_len = u16::from_le_bytes([*rest.first()?, *rest.get(1)?]) as usize;
+    let code = rest.get(2..2 + code_len)?;
+    Some((name, code))
+}
+
+/// Directory for per-device state (`$V4_STATE_DIR` or `v4/devices`)
+pub(crate) fn state_dir() -> Option<PathBuf> {
+    let env = |name| std::env::var_os(name).filter(|v| !v.is_empty());
+    if let Some(dir) = env(ENV_STATE_DIR) {
+        return Some(PathBuf::from(dir));
+    }
+    let base = if cfg!(windows) {
+        env("LOCALAPPDATA").map(PathBuf::from)
+    } else {
+        env("XDG_STATE_HOME")
+            .map(PathBuf::from)
+            .or_else(|| env("HOME").map(|home| PathBuf::from(home).join(".local/state")))
+    };
+    base.map(|dir| dir.join("v4").join("devices"))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn word(name: &str, code: &[u8]) -> WordDef {
+        WordDef {
+            name: name.to_string(),
+            bytecode: code.to_vec(),
+        }
+    }
+
+    #[test]
+    fn test_text_roundtrip() {
+        let mut manifest = Manifest::default();
+        manifest.record("SQUARE", &[1, 2], 1);
+        manifest.record("DOUBLE", &[3], 0);
+        manifest.record("WITH SPACE", &[], 2);
+
+        let parsed = Manifest::parse(&manifest.to_text());
+        assert_eq!(parsed.entries(), manifest.entries());
+        assert_eq!(parsed.entries()[0].name, "DOUBLE");
+        assert!(Manifest::parse("garbage\n1\tabc\n").is_empty());
+    }
+
+    #[test]
+    fn test_plan_keeps_indices_stable() {
+        let mut manifest = Manifest::default();
+        manifest.record("A", &[1], 0);
+        manifest.record("B", &[2], 1);
+
+        // New words are appended at the index they were compiled for
+        let words = vec![word("A", &[1]), word("B", &[2]), word("C", &[3])];
+        let plan = manifest.plan(&words, 0);
+        assert_eq!(plan.keep, vec![(0, 0), (1, 1)]);
+        assert_eq!(plan.send, vec![2]);
+
+        // Resending B would register it at index 2, not 1
+        let words = vec![word("A", &[1]), word("B", &[9]), word("C", &[3])];
+        let plan = manifest.plan(&words, 0);
+        assert!(plan.keep.is_empty());
+        assert_eq!(plan.send, vec![0, 1, 2]);
+
+        // Dropping A would renumber B; compiled after other words, nothing
+        // matches
+        assert!(manifest.plan(&words[1..2], 0).keep.is_empty());
+        assert!(manifest.plan(&words[..1], 5).keep.is_empty());
+
+        manifest.record("B", &[9], 3);
+        assert_eq!(manifest.get("B").unwrap().index, 3);
+        assert_eq!(manifest.entries().len(), 2);
+    }
+
+    #[test]
+    fn test_verify_against_device() {
+        let mut serial = V4Serial::from_transport(
+            Box::new(crate::sim::Simulator::new()),
+            crate::serial::DEFAULT_BAUD_RATE,
+        );
+        let timeout = Duration::from_millis(10);
+        let words = vec![word("A", &[1]), word("B", &[2]), word("C", &[3])];
+
+        let mut image = Vec::new();
+        crate::bytecode::encode_image(&words[..2], &[], &mut image);
+        serial.exec(&image, timeout).unwrap();
+        let mut manifest = Manifest::default();
+        manifest.record("A", &[1], 0);
+        manifest.record("B", &[2], 1);
+
+        let plan = manifest.plan(&words, 0);
+        assert!(
+            manifest
+                .verify(&mut serial, &words, &plan, timeout)
+                .unwrap()
+        );
+
+        // A kept word the device holds with other code
+        let mut stale = manifest.clone();
+        stale.record("A", &[7], 0);
+        let changed = vec![word("A", &[7]), words[1].clone(), words[2].clone()];
+        let plan = stale.plan(&changed, 0);
+        assert!(!stale.verify(&mut serial, &changed, &plan, timeout).unwrap());
+
+        // A word registered behind the manifest's back takes index 2
+        image.clear();
+        crate::bytecode::encode_image(&[word("X", &[4])], &[], &mut image);
+        serial.exec(&image, timeout).unwrap();
+        let plan = manifest.plan(&words, 0);
+        assert!(
+            !manifest
+                .verify(&mut serial, &words, &plan, timeout)
+                .unwrap()
+        );
+    }
+
+    #[test]
+    fn test_parse_word_info() {
+        let data = [2, b'D', b'P', 1, 0, 0x51];
+        assert_eq!(parse_word_info(&data), Some((&b"DP"[..], &[0x51][..])));
+        assert_eq!(parse_word_info(&data[..5]), None);
+    }
+}
@@ -0,0 +1,182 @@
+//! Read-only file contents, memory-mapped where possible
+//!
+//! On Unix a [`MappedFile`] of at least [`MAP_MIN_SIZE`] bytes maps the
+//! file privately and read-only, so multi-megabyte images are paged in as
+//! they are sent instead of being copied to the heap first, and every fleet
+//! worker reads the same pages. Smaller files, files that cannot be mapped
+//! (pipes) and all files on other platforms are read into memory instead.
+
+use std::fs;
+use std::io;
+use std::ops::Deref;
+use std::path::Path;
+
+/// Files smaller than this are read rather than mapped
+pub const MAP_MIN_SIZE: u64 = 1 << 20;
+
+/// Contents of a file, shared read-only
+pub struct MappedFile {
+    backing: Backing,
+}
+
+enum Backing {
+    #[cfg(unix)]
+    Mapped(sys::Map),
+    Read(Vec<u8>),
+}
+
+impl MappedFile {
+    /// Map `path`, or read it if it is small or cannot be mapped
+    ///
+    /// # Safety
+    ///
+    /// The file must not be truncated or written to, by this or any other
+    /// process, until the `MappedFile` is dropped. A mapped file that shrinks
+    /// makes reads past its new end fault, and one that is rewritten changes
+    /// bytes behind the `&[u8]` it derefs to.
+    pub unsafe fn open(path: &Path) -> io::Result<Self> {
+        #[cfg(unix)]
+        {
+            let file = fs::File::open(path)?;
+            let meta = file.metadata()?;
+            if meta.is_file()
+                && meta.len() >= MAP_MIN_SIZE
+                && let Ok(len) = usize::try_from(meta.len())
+                && let Ok(map) = sys::Map::new(&file, len)
+            {
+                return Ok(Self {
+                    backing: Backing::Mapped(map),
+                });
+            }
+        }
+        Ok(Self {
+            backing: Backing::Read(fs::read(path)?),
+        })
+    }
+
+    /// Whether the contents are memory-mapped rather than read
+    pub fn is_mapped(&self) -> bool {
+        match self.backing {
+            #[cfg(unix)]
+            Backing::Mapped(_) => true,
+            Backing::Read(_) => false,
+        }
+    }
+}
+
+impl Deref for MappedFile {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match &self.backing {
+            #[cfg(unix)]
+            Backing::Mapped(map) => map.as_slice(),
+            Backing::Read(data) => data,
+        }
+    }
+}
+
+impl AsRef<[u8]> for MappedFile {
+    fn as_ref(&self) -> &[u8] {
+        self
+    }
+}
+
+#[cfg(unix)]
+mod sys {
+    use std::fs::File;
+    use std::io;
+    use std::os::fd::AsRawFd;
+    use std::ptr;
+
+    /// Private read-only mapping of a whole file
+    pub struct Map {
+        ptr: *mut libc::c_void,
+        len: usize,
+    }
+
+    // The mapping is never written, so sharing it between threads is sound
+    unsafe impl Send for Map {}
+    unsafe impl Sync for Map {}
+
+    impl Map {
+        /// Map the first `len` bytes of `file`; `len` must not be zero, and
+        /// the file must stay unchanged while it is mapped
+        pub fn new(file: &File, len: usize) -> io::Result<Self> {
+            // SAFETY: a fresh read-only mapping of an open descriptor; the
+            // result is checked before use
+            let ptr = unsafe {
+                libc::mmap(
+                    ptr::null_mut(),
+                    len,
+                    libc::PROT_READ,
+                    libc::MAP_PRIVATE,
+                    file.as_raw_fd(),
+                    0,
+                )
+            };
+            if ptr == libc::MAP_FAILED {
+                return Err(io::Error::last_os_error());
+            }
+            // Images are read front to back; the hint is best effort
+            // SAFETY: `ptr..ptr + len` is the mapping just created
+            unsafe {
+                libc::madvise(ptr, len, libc::MADV_SEQUENTIAL);
+            }
+            Ok(Self { ptr, len })
+        }
+
+        pub fn as_slice(&self) -> &[u8] {
+            // SAFETY: the mapping is `len` readable bytes and lives as long
+            // as `self`
+            unsafe { std::slice::from_raw_parts(self.ptr as *const u8, self.len) }
+        }
+    }
+
+    impl Drop for Map {
+        fn drop(&mut self) {
+            // SAFETY: unmaps exactly the region mapped in `new`
+            unsafe {
+                libc::munmap(self.ptr, self.len);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::fs::File;
+    use std::io::Write;
+
+    #[test]
+    fn test_map_and_fallback() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("image.v4b");
+        let data: Vec<u8> = (0..MAP_MIN_SIZE as u32 + 1).map(|i| i as u8).collect();
+        File::create(&path).unwrap().write_all(&data).unwrap();
+
+        // SAFETY (all opens below): the files are not changed while open
+        let file = unsafe { MappedFile::open(&path) }.unwrap();
+        assert_eq!(&file[..], &data[..]);
+        assert_eq!(file.is_mapped(), cfg!(unix));
+
+        // Small and empty files are read instead
+        let small = dir.path().join("small.v4b");
+        File::create(&small)
+            .unwrap()
+            .write_all(&data[..100])
+            .unwrap();
+        let file = unsafe { MappedFile::open(&small) }.unwrap();
+        assert_eq!(&file[..], &data[..100]);
+        assert!(!file.is_mapped());
+
+        let empty = dir.path().join("empty.v4b");
+        File::create(&empty).unwrap();
+        let file = unsafe { MappedFile::open(&empty) }.unwrap();
+        assert!(file.is_empty());
+        assert!(!file.is_mapped());
+
+        assert!(unsafe { MappedFile::open(&dir.path().join("missing")) }.is_err());
+    }
+}
@@ -0,0 +1,164 @@
+//! Serial port selection for multi-device commands
+//!
+//! Port arguments are literal paths or globs whose last path component may
+//! contain `*` (any run of characters) and `?` (any single character), e.g.
+//! `/dev/ttyACM*`.
+
+use crate::{Result, V4Error};
+use std::fs;
+use std::path::Path;
+
+/// Expand port arguments into a list of port paths
+///
+/// Literal paths are kept as given. Globs expand to the matching entries of
+/// their directory in sorted order; a glob matching nothing is an error.
+/// Duplicates are dropped, keeping the first occurrence.
+pub fn expand(patterns: &[String]) -> Result<Vec<String>> {
+    let mut ports: Vec<String> = Vec::new();
+
+    for pattern in patterns {
+        let matches = if is_glob(pattern) {
+            expand_glob(pattern)?
+        } else {
+            vec![pattern.clone()]
+        };
+        for port in matches {
+            if !ports.contains(&port) {
+                ports.push(port);
+            }
+        }
+    }
+
+    if ports.is_empty() {
+        return Err(V4Error::Cli("No serial port given".to_string()));
+    }
+    Ok(ports)
+}
+
+/// File name component derived from a port path
+///
+/// `/dev/ttyACM0` → `dev-ttyACM0`, `COM3` → `COM3`. Used to name per-port
+/// files such as daemon sockets and device manifests.
+pub fn file_stem(port: &str) -> String {
+    let name: String = port
+        .chars()
+        .map(|c| if c.is_ascii_alphanumeric() { c } else { '-' })
+        .collect();
+    name.trim_matches('-').to_string()
+}
+
+fn is_glob(pattern: &str) -> bool {
+    pattern.contains(['*', '?'])
+}
+
+fn expand_glob(pattern: &str) -> Result<Vec<String>> {
+    let path = Path::new(pattern);
+    let name_pattern = path
+        .file_name()
+        .and_then(|n| n.to_str())
+        .ok_or_else(|| V4Error::Cli(format!("Invalid port pattern: {}", pattern)))?;
+    let dir = match path.parent() {
+        Some(dir) if !dir.as_os_str().is_empty() => dir,
+        _ => Path::new("."),
+    };
+    if is_glob(&dir.to_string_lossy()) {
+        return Err(V4Error::Cli(format!(
+            "Wildcards are only supported in the last path component: {}",
+            pattern
+        )));
+    }
+
+    let mut matches: Vec<String> = fs::read_dir(dir)?
+        .filter_map(|entry| entry.ok())
+        .filter_map(|entry| entry.file_name().into_string().ok())
+        .filter(|name| glob_match(name_pattern, name))
+        .map(|name| dir.join(name).to_string_lossy().into_owned())
+        .collect();
+    matches.sort();
+
+    if matches.is_empty() {
+        return Err(V4Error::Cli(format!("No serial ports match {}", pattern)));
+    }
+    Ok(matches)
+}
+
+/// Match `name` against a pattern with `*` and `?` wildcards
+pub fn glob_match(pattern: &str, name: &str) -> bool {
+    let pattern = pattern.as_bytes();
+    let name = name.as_bytes();
+    let (mut p, mut n) = (0, 0);
+    // Position after the last `*` and the name position it matched up to
+    let mut star: Option<(usize, usize)> = None;
+
+    while n < name.len() {
+        match pattern.get(p) {
+            Some(b'*') => {
+                star = Some((p + 1, n));
+                p += 1;
+            }
+            Some(&c) if c == b'?' || c == name[n] => {
+                p += 1;
+                n += 1;
+            }
+            _ => match star {
+                // Let the last `*` absorb one more character
+                Some((sp, sn)) => {
+                    p = sp;
+                    n = sn + 1;
+                    star = Some((sp, sn + 1));
+                }
+                None => return false,
+            },
+        }
+    }
+    pattern[p..].iter().all(|&c| c == b'*')
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_glob_match() {
+        assert!(glob_match("ttyACM*", "ttyACM0"));
+        assert!(glob_match("ttyACM*", "ttyACM"));
+        assert!(glob_match("tty?SB1", "ttyUSB1"));
+        assert!(glob_match("*USB*", "ttyUSB12"));
+        assert!(glob_match("cu.*-*", "cu.usbmodem-14101"));
+        assert!(!glob_match("ttyACM*", "ttyUSB0"));
+        assert!(!glob_match("tty?", "tty"));
+        assert!(!glob_match("ttyACM0", "ttyACM01"));
+    }
+
+    #[test]
+    fn test_file_stem() {
+        assert_eq!(file_stem("/dev/ttyACM0"), "dev-ttyACM0");
+        assert_eq!(file_stem("COM3"), "COM3");
+        assert_eq!(file_stem("/dev/cu.usbmodem-1"), "dev-cu-usbmodem-1");
+    }
+
+    #[test]
+    fn test_expand_literal_and_dedup() {
+        let ports = expand(&["COM3".to_string(), "COM4".to_string(), "COM3".to_string()]).unwrap();
+        assert_eq!(ports, vec!["COM3", "COM4"]);
+        assert!(expand(&[]).is_err());
+    }
+
+    #[test]
+    fn test_expand_glob() {
+        let tmp = tempfile::tempdir().unwrap();
+        let dir = tmp.path();
+        for name in ["ttyACM1", "ttyACM0", "ttyUSB0"] {
+            fs::write(dir.join(name), b"").unwrap();
+        }
+
+        let pattern = dir.join("ttyACM*").to_string_lossy().into_owned();
+        let ports = expand(&[pattern]).unwrap();
+
+        let names: Vec<_> = ports
+            .iter()
+            .map(|p| Path::new(p).file_name().unwrap().to_str().unwrap())
+            .collect();
+        assert_eq!(names, vec!["ttyACM0", "ttyACM1"]);
+    }
+}
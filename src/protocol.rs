@@ -1,7 +1,17 @@
+pub mod caps;
+pub mod chunk;
+pub mod crc32;
 pub mod crc8;
+pub mod decoder;
 pub mod frame;
+pub mod stack;
+pub mod stats;
 pub mod types;
 
 pub use crc8::calc_crc8;
-pub use frame::{Frame, FrameBuilder, Response};
+pub use crc32::calc_crc32;
+pub use decoder::FrameDecoder;
+pub use frame::{
+    Frame, FrameBuilder, MAX_PAYLOAD_SIZE, Request, Response, ResponseView, WordIndices,
+};
 pub use types::{Command, ErrorCode};
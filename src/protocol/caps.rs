@@ -0,0 +1,158 @@
+use super::frame::MAX_PAYLOAD_SIZE;
+use crate::{Result, V4Error};
+
+/// Largest payload a frame can describe (LEN is u16 and includes ERR_CODE
+/// in responses)
+pub const MAX_LINK_MTU: usize = u16::MAX as usize - 1;
+
+/// Device accepts PUSH_BEGIN/PUSH_CHUNK/PUSH_END
+pub const FEATURE_CHUNKED_PUSH: u16 = 1 << 0;
+
+/// Device accepts LZSS-compressed PUSH_CHUNK_Z frames (see
+/// [`crate::compress`])
+pub const FEATURE_COMPRESSED_CHUNK: u16 = 1 << 1;
+
+/// Device accepts sequenced frames and echoes their SEQ byte (see
+/// [`Frame::encode_seq_into`](super::Frame::encode_seq_into))
+pub const FEATURE_SEQUENCED: u16 = 1 << 2;
+
+/// Feature bits this host implementation understands
+pub const HOST_FEATURES: u16 = FEATURE_CHUNKED_PUSH | FEATURE_COMPRESSED_CHUNK | FEATURE_SEQUENCED;
+
+/// Link capabilities exchanged with the CAPS command
+///
+/// Request payload and response data share one layout:
+/// `[BAUD (u32 LE)][MTU (u16 LE)][FEATURES (u16 LE)]`. The host proposes its
+/// maximums; the device answers with the values both sides will use.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct LinkCaps {
+    pub baud: u32,
+    pub mtu: usize,
+    pub features: u16,
+}
+
+impl LinkCaps {
+    /// Capabilities every V4-link device supports without negotiation
+    pub fn baseline(baud: u32) -> Self {
+        Self {
+            baud,
+            mtu: MAX_PAYLOAD_SIZE,
+            features: 0,
+        }
+    }
+
+    /// Encode as CAPS payload
+    pub fn encode(&self) -> [u8; 8] {
+        let baud = self.baud.to_le_bytes();
+        let mtu = (self.mtu.min(MAX_LINK_MTU) as u16).to_le_bytes();
+        let features = self.features.to_le_bytes();
+        [
+            baud[0],
+            baud[1],
+            baud[2],
+            baud[3],
+            mtu[0],
+            mtu[1],
+            features[0],
+            features[1],
+        ]
+    }
+
+    /// Parse CAPS response data
+    ///
+    /// FEATURES is optional; devices that omit it advertise none.
+    pub fn parse(data: &[u8]) -> Option<Self> {
+        if data.len() < 6 {
+            return None;
+        }
+        let features = if data.len() >= 8 {
+            u16::from_le_bytes([data[6], data[7]])
+        } else {
+            0
+        };
+        Some(Self {
+            baud: u32::from_le_bytes([data[0], data[1], data[2], data[3]]),
+            mtu: u16::from_le_bytes([data[4], data[5]]) as usize,
+            features,
+        })
+    }
+
+    /// The agreement never exceeds what was requested
+    pub fn limit_to(&self, requested: &LinkCaps) -> Self {
+        Self {
+            baud: self.baud.min(requested.baud),
+            mtu: self.mtu.min(requested.mtu),
+            features: self.features & requested.features,
+        }
+    }
+
+    /// Fail unless the MTU is at least the baseline every device supports
+    ///
+    /// Chunk and request sizes are derived from the MTU, so a device
+    /// answering with a smaller one must not be taken at its word.
+    pub fn check(&self) -> Result<()> {
+        if self.mtu < MAX_PAYLOAD_SIZE {
+            return Err(V4Error::Protocol(format!(
+                "Device agreed on an MTU of {} bytes (minimum {})",
+                self.mtu, MAX_PAYLOAD_SIZE
+            )));
+        }
+        Ok(())
+    }
+
+    /// Check a feature bit
+    pub fn has(&self, feature: u16) -> bool {
+        self.features & feature != 0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_caps_roundtrip() {
+        let caps = LinkCaps {
+            baud: 921_600,
+            mtu: 4096,
+            features: HOST_FEATURES,
+        };
+        assert_eq!(LinkCaps::parse(&caps.encode()), Some(caps));
+    }
+
+    #[test]
+    fn test_caps_without_features() {
+        let data = [0x00, 0xC2, 0x01, 0x00, 0x00, 0x02];
+        let caps = LinkCaps::parse(&data).unwrap();
+        assert_eq!(caps.baud, 115_200);
+        assert_eq!(caps.mtu, 512);
+        assert_eq!(caps.features, 0);
+        assert!(LinkCaps::parse(&data[..5]).is_none());
+    }
+
+    #[test]
+    fn test_caps_limit() {
+        let requested = LinkCaps {
+            baud: 115_200,
+            mtu: 1024,
+            features: FEATURE_CHUNKED_PUSH,
+        };
+        let offered = LinkCaps {
+            baud: 921_600,
+            mtu: 8192,
+            features: 0xFFFF,
+        };
+        let agreed = offered.limit_to(&requested);
+        assert_eq!(agreed.baud, 115_200);
+        assert_eq!(agreed.mtu, 1024);
+        assert_eq!(agreed.features, FEATURE_CHUNKED_PUSH);
+        assert!(agreed.check().is_ok());
+        assert!(LinkCaps::baseline(115_200).check().is_ok());
+
+        let tiny = LinkCaps { mtu: 4, ..offered };
+        assert!(matches!(
+            tiny.limit_to(&requested).check(),
+            Err(V4Error::Protocol(_))
+        ));
+    }
+}
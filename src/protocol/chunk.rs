@@ -0,0 +1,123 @@
+use super::calc_crc8;
+use super::frame::MAX_PAYLOAD_SIZE;
+
+/// Size of the offset header in front of every PUSH_CHUNK payload
+pub const CHUNK_HEADER_SIZE: usize = 4;
+
+/// Largest image segment that fits into a PUSH_CHUNK frame at the default MTU
+pub const MAX_CHUNK_SIZE: usize = MAX_PAYLOAD_SIZE - CHUNK_HEADER_SIZE;
+
+/// Size of the header in front of every PUSH_CHUNK_Z payload
+pub const COMPRESSED_CHUNK_HEADER_SIZE: usize = 6;
+
+/// Segment of an image addressed by its byte offset
+///
+/// Chunks are idempotent: the device writes `data` at `offset` in its
+/// receive buffer, so a chunk can be retransmitted in any order.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Chunk<'a> {
+    pub offset: u32,
+    pub data: &'a [u8],
+}
+
+impl Chunk<'_> {
+    /// Encode PUSH_CHUNK payload: [OFFSET (u32 LE)][DATA...]
+    pub fn encode_into(&self, out: &mut Vec<u8>) {
+        out.clear();
+        out.extend_from_slice(&self.offset.to_le_bytes());
+        out.extend_from_slice(self.data);
+    }
+
+    /// Encode PUSH_CHUNK_Z payload: [OFFSET (u32 LE)][RAW_LEN (u16 LE)][LZSS...]
+    ///
+    /// Returns `false`, leaving `out` unspecified, if compression does not
+    /// make the payload smaller than [`Chunk::encode_into`]. `scratch` is
+    /// reused between calls.
+    pub fn encode_compressed_into(&self, out: &mut Vec<u8>, scratch: &mut Vec<u8>) -> bool {
+        if self.data.len() > u16::MAX as usize {
+            return false;
+        }
+        crate::compress::compress(self.data, scratch);
+        if COMPRESSED_CHUNK_HEADER_SIZE + scratch.len() >= CHUNK_HEADER_SIZE + self.data.len() {
+            return false;
+        }
+        out.clear();
+        out.extend_from_slice(&self.offset.to_le_bytes());
+        out.extend_from_slice(&(self.data.len() as u16).to_le_bytes());
+        out.extend_from_slice(scratch);
+        true
+    }
+}
+
+/// Split an image into chunks of at most `chunk_size` bytes
+///
+/// Callers size chunks to the link MTU minus [`CHUNK_HEADER_SIZE`].
+pub fn split(image: &[u8], chunk_size: usize) -> Vec<Chunk<'_>> {
+    let chunk_size = chunk_size.max(1);
+    image
+        .chunks(chunk_size)
+        .enumerate()
+        .map(|(i, data)| Chunk {
+            offset: (i * chunk_size) as u32,
+            data,
+        })
+        .collect()
+}
+
+/// Encode PUSH_BEGIN payload: [TOTAL_LEN (u32 LE)]
+pub fn begin_payload(image: &[u8]) -> [u8; 4] {
+    (image.len() as u32).to_le_bytes()
+}
+
+/// Encode PUSH_END payload: [TOTAL_LEN (u32 LE)][CRC8]
+///
+/// The CRC covers the whole image so the device can reject an image that
+/// was assembled from mismatched chunks before executing it.
+pub fn end_payload(image: &[u8]) -> [u8; 5] {
+    let len = (image.len() as u32).to_le_bytes();
+    [len[0], len[1], len[2], len[3], calc_crc8(image)]
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_split_exact_and_remainder() {
+        let image: Vec<u8> = (0..=9).collect();
+        let chunks = split(&image, 4);
+
+        assert_eq!(chunks.len(), 3);
+        assert_eq!(chunks[0].offset, 0);
+        assert_eq!(chunks[1].offset, 4);
+        assert_eq!(chunks[2].offset, 8);
+        assert_eq!(chunks[2].data, &[8, 9]);
+    }
+
+    #[test]
+    fn test_split_full_chunks() {
+        let image = vec![0u8; MAX_CHUNK_SIZE * 2];
+        let chunks = split(&image, MAX_CHUNK_SIZE);
+        assert_eq!(chunks.len(), 2);
+        assert!(chunks.iter().all(|c| c.data.len() == MAX_CHUNK_SIZE));
+        assert_eq!(split(&image, 0).len(), image.len());
+    }
+
+    #[test]
+    fn test_chunk_encoding() {
+        let chunk = Chunk {
+            offset: 0x0102_0304,
+            data: &[0xAA, 0xBB],
+        };
+        let mut out = vec![0xFF; 16];
+        chunk.encode_into(&mut out);
+        assert_eq!(out, vec![0x04, 0x03, 0x02, 0x01, 0xAA, 0xBB]);
+        assert!(out.len() <= MAX_PAYLOAD_SIZE);
+    }
+
+    #[test]
+    fn test_end_payload() {
+        let image = b"123456789";
+        assert_eq!(end_payload(image), [9, 0, 0, 0, 0xF4]);
+    }
+}
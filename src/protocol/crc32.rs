@@ -0,0 +1,61 @@
+/// CRC-32 polynomial (IEEE 802.3, reflected)
+const POLY: u32 = 0xEDB8_8320;
+
+/// Build the byte-wise lookup table at compile time
+const fn make_table() -> [u32; 256] {
+    let mut table = [0u32; 256];
+
+    let mut i = 0;
+    while i < 256 {
+        let mut crc = i as u32;
+        let mut bit = 0;
+        while bit < 8 {
+            crc = if crc & 1 != 0 {
+                (crc >> 1) ^ POLY
+            } else {
+                crc >> 1
+            };
+            bit += 1;
+        }
+        table[i] = crc;
+        i += 1;
+    }
+    table
+}
+
+static TABLE: [u32; 256] = make_table();
+
+/// Calculate CRC-32 checksum
+///
+/// Polynomial: 0x04C11DB7 (reflected)
+/// Initial value and final XOR: 0xFFFFFFFF
+///
+/// Used for .v4b section checksums, where sections are much larger than
+/// link frames.
+///
+/// # Examples
+///
+/// ```
+/// use v4_cli::protocol::calc_crc32;
+///
+/// assert_eq!(calc_crc32(b"123456789"), 0xCBF4_3926);
+/// ```
+pub fn calc_crc32(data: &[u8]) -> u32 {
+    let mut crc = !0u32;
+    for &byte in data {
+        crc = TABLE[((crc ^ byte as u32) & 0xFF) as usize] ^ (crc >> 8);
+    }
+    !crc
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_crc32_known_values() {
+        assert_eq!(calc_crc32(b""), 0);
+        assert_eq!(calc_crc32(b"123456789"), 0xCBF4_3926);
+        assert_eq!(calc_crc32(&[0u8; 32]), 0x190A_55AD);
+    }
+}
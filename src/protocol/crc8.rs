@@ -1,8 +1,52 @@
+/// CRC-8 polynomial (x^8 + x^2 + x + 1)
+const POLY: u8 = 0x07;
+
+/// Build the slice-by-8 lookup tables at compile time
+///
+/// `TABLES[0][b]` is the CRC of the single byte `b`; `TABLES[k][b]` is the
+/// CRC of `b` followed by `k` zero bytes.
+const fn make_tables() -> [[u8; 256]; 8] {
+    let mut tables = [[0u8; 256]; 8];
+
+    let mut i = 0;
+    while i < 256 {
+        let mut crc = i as u8;
+        let mut bit = 0;
+        while bit < 8 {
+            crc = if crc & 0x80 != 0 {
+                (crc << 1) ^ POLY
+            } else {
+                crc << 1
+            };
+            bit += 1;
+        }
+        tables[0][i] = crc;
+        i += 1;
+    }
+
+    let mut k = 1;
+    while k < 8 {
+        let mut i = 0;
+        while i < 256 {
+            tables[k][i] = tables[0][tables[k - 1][i] as usize];
+            i += 1;
+        }
+        k += 1;
+    }
+
+    tables
+}
+
+static TABLES: [[u8; 256]; 8] = make_tables();
+
 /// Calculate CRC-8 checksum
 ///
 /// Polynomial: 0x07
 /// Initial value: 0x00
 ///
+/// Processes eight bytes per step with slice-by-8 tables and finishes the
+/// tail with the single 256-entry table.
+///
 /// # Examples
 ///
 /// ```
@@ -13,11 +57,35 @@
 /// ```
 pub fn calc_crc8(data: &[u8]) -> u8 {
     let mut crc = 0u8;
+
+    let mut blocks = data.chunks_exact(8);
+    for b in &mut blocks {
+        crc = TABLES[7][(b[0] ^ crc) as usize]
+            ^ TABLES[6][b[1] as usize]
+            ^ TABLES[5][b[2] as usize]
+            ^ TABLES[4][b[3] as usize]
+            ^ TABLES[3][b[4] as usize]
+            ^ TABLES[2][b[5] as usize]
+            ^ TABLES[1][b[6] as usize]
+            ^ TABLES[0][b[7] as usize];
+    }
+
+    for &byte in blocks.remainder() {
+        crc = TABLES[0][(crc ^ byte) as usize];
+    }
+    crc
+}
+
+/// Bit-by-bit reference implementation of [`calc_crc8`]
+///
+/// Kept for tests and benchmarks.
+pub fn calc_crc8_bitwise(data: &[u8]) -> u8 {
+    let mut crc = 0u8;
     for &byte in data {
         crc ^= byte;
         for _ in 0..8 {
             if crc & 0x80 != 0 {
-                crc = (crc << 1) ^ 0x07;
+                crc = (crc << 1) ^ POLY;
             } else {
                 crc <<= 1;
             }
@@ -56,4 +124,22 @@ mod tests {
         let crc = calc_crc8(&frame_data);
         assert_eq!(crc, 0xE0);
     }
+
+    #[test]
+    fn test_crc8_matches_bitwise() {
+        // Deterministic pseudo-random data, every length across block edges
+        let mut state = 0x1234_5678u32;
+        let data: Vec<u8> = (0..1024)
+            .map(|_| {
+                state = state.wrapping_mul(1_103_515_245).wrapping_add(12_345);
+                (state >> 16) as u8
+            })
+            .collect();
+
+        for len in 0..=64 {
+            assert_eq!(calc_crc8(&data[..len]), calc_crc8_bitwise(&data[..len]));
+        }
+        assert_eq!(calc_crc8(&data), calc_crc8_bitwise(&data));
+        assert_eq!(calc_crc8(&data[3..1021]), calc_crc8_bitwise(&data[3..1021]));
+    }
 }
@@ -0,0 +1,319 @@
+use super::calc_crc8;
+use super::frame::{MAX_PAYLOAD_SIZE, STX, STX_SEQ};
+use crate::{Result, V4Error};
+use std::ops::Range;
+
+/// Response frame overhead: STX + LEN_L + LEN_H + CRC8 (LEN covers ERR_CODE)
+const FRAME_OVERHEAD: usize = 4;
+
+/// Request frame overhead: STX + LEN_L + LEN_H + CMD + CRC8 (LEN excludes CMD)
+const REQUEST_OVERHEAD: usize = 5;
+
+/// Receive state of the decoder
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum State {
+    /// Skipping bytes until STX
+    Hunt,
+    /// STX found, waiting for LEN_L and LEN_H
+    Length,
+    /// Waiting for the payload and CRC of a frame of the given total size
+    Body(usize),
+}
+
+/// Incremental V4-link frame decoder
+///
+/// Bytes are read straight into [`FrameDecoder::spare`] and committed with
+/// [`FrameDecoder::commit`]. The decoder owns one fixed buffer for the
+/// lifetime of the connection; consumed bytes are reclaimed by shifting the
+/// unread tail to the front, so bytes following a frame stay buffered for
+/// the next call.
+#[derive(Debug)]
+pub struct FrameDecoder {
+    buf: Box<[u8]>,
+    start: usize,
+    end: usize,
+    state: State,
+    /// Bytes outside LEN: [`FRAME_OVERHEAD`] or [`REQUEST_OVERHEAD`]
+    overhead: usize,
+    /// Largest LEN value accepted before resynchronising
+    max_len: usize,
+}
+
+impl Default for FrameDecoder {
+    fn default() -> Self {
+        Self::new(MAX_PAYLOAD_SIZE)
+    }
+}
+
+impl FrameDecoder {
+    /// Create a decoder for frames with up to `max_payload` payload bytes
+    pub fn new(max_payload: usize) -> Self {
+        // LEN counts ERR_CODE as well as the payload
+        Self::with_layout(FRAME_OVERHEAD, max_payload + 1)
+    }
+
+    /// Create a decoder for host → device command frames
+    ///
+    /// Used on the device side of a link, e.g. by the daemon that forwards
+    /// client frames to the serial port.
+    pub fn for_requests(max_payload: usize) -> Self {
+        Self::with_layout(REQUEST_OVERHEAD, max_payload)
+    }
+
+    fn with_layout(overhead: usize, max_len: usize) -> Self {
+        Self {
+            buf: vec![0u8; 2 * (max_len + overhead)].into_boxed_slice(),
+            start: 0,
+            end: 0,
+            state: State::Hunt,
+            overhead,
+            max_len,
+        }
+    }
+
+    /// Number of buffered bytes not yet consumed
+    pub fn buffered(&self) -> usize {
+        self.end - self.start
+    }
+
+    /// Writable space at the end of the buffer
+    pub fn spare(&mut self) -> &mut [u8] {
+        if self.start == self.end {
+            self.start = 0;
+            self.end = 0;
+        } else if self.start > 0 && self.buf.len() - self.end < self.buf.len() / 2 {
+            // Less than one maximum-size frame of room left: compact
+            self.buf.copy_within(self.start..self.end, 0);
+            self.end -= self.start;
+            self.start = 0;
+        }
+        &mut self.buf[self.end..]
+    }
+
+    /// Mark `n` bytes written into [`FrameDecoder::spare`] as received
+    pub fn commit(&mut self, n: usize) {
+        self.end = (self.end + n).min(self.buf.len());
+    }
+
+    /// Drop all buffered bytes and restart frame synchronisation
+    pub fn clear(&mut self) {
+        self.start = 0;
+        self.end = 0;
+        self.state = State::Hunt;
+    }
+
+    /// Bytes of a frame returned by [`next_frame_range`](Self::next_frame_range)
+    pub fn frame_at(&self, range: Range<usize>) -> &[u8] {
+        &self.buf[range]
+    }
+
+    /// Decode the next complete frame from the buffered bytes
+    ///
+    /// Returns `None` until a whole frame has been received. A frame with an
+    /// invalid CRC is consumed and reported as [`V4Error::CrcMismatch`] so
+    /// the stream stays in sync.
+    pub fn next_frame(&mut self) -> Option<Result<&[u8]>> {
+        let range = match self.next_frame_range()? {
+            Ok(range) => range,
+            Err(e) => return Some(Err(e)),
+        };
+        Some(Ok(&self.buf[range]))
+    }
+
+    /// Like [`next_frame`](Self::next_frame), but returns the frame's
+    /// position in the buffer
+    ///
+    /// Resolve it with [`frame_at`](Self::frame_at). The range stays valid
+    /// until the next call to [`spare`](Self::spare) or
+    /// [`clear`](Self::clear). Lets a caller hand out a borrowed frame from
+    /// a receive loop that also needs `&mut self`.
+    pub fn next_frame_range(&mut self) -> Option<Result<Range<usize>>> {
+        loop {
+            match self.state {
+                State::Hunt => {
+                    let pending = &self.buf[self.start..self.end];
+                    match pending.iter().position(|&b| b == STX || b == STX_SEQ) {
+                        Some(pos) => {
+                            self.start += pos;
+                            self.state = State::Length;
+                        }
+                        None => {
+                            self.start = 0;
+                            self.end = 0;
+                            return None;
+                        }
+                    }
+                }
+                State::Length => {
+                    if self.buffered() < 3 {
+                        return None;
+                    }
+                    let len =
+                        u16::from_le_bytes([self.buf[self.start + 1], self.buf[self.start + 2]])
+                            as usize;
+                    if len > self.max_len {
+                        // Not a real frame header: resync after this STX
+                        self.start += 1;
+                        self.state = State::Hunt;
+                        continue;
+                    }
+                    // Sequenced frames carry SEQ outside LEN
+                    let seq = (self.buf[self.start] == STX_SEQ) as usize;
+                    self.state = State::Body(self.overhead + seq + len);
+                }
+                State::Body(total) => {
+                    if self.buffered() < total {
+                        return None;
+                    }
+                    let frame = self.start..self.start + total;
+                    self.start += total;
+                    self.state = State::Hunt;
+
+                    let expected = calc_crc8(&self.buf[frame.start + 1..frame.end - 1]);
+                    let actual = self.buf[frame.end - 1];
+                    if expected != actual {
+                        return Some(Err(V4Error::CrcMismatch { expected, actual }));
+                    }
+                    return Some(Ok(frame));
+                }
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn ok_frame() -> Vec<u8> {
+        let body = [0x01, 0x00, 0x00];
+        let mut frame = vec![STX];
+        frame.extend_from_slice(&body);
+        frame.push(calc_crc8(&body));
+        frame
+    }
+
+    fn feed(decoder: &mut FrameDecoder, bytes: &[u8]) {
+        let spare = decoder.spare();
+        spare[..bytes.len()].copy_from_slice(bytes);
+        decoder.commit(bytes.len());
+    }
+
+    #[test]
+    fn test_decode_split_frame() {
+        let frame = ok_frame();
+        let mut decoder = FrameDecoder::default();
+
+        feed(&mut decoder, &frame[..2]);
+        assert!(decoder.next_frame().is_none());
+        feed(&mut decoder, &frame[2..]);
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), &frame[..]);
+        assert!(decoder.next_frame().is_none());
+    }
+
+    #[test]
+    fn test_request_frames() {
+        use crate::protocol::{Command, Frame};
+
+        let mut decoder = FrameDecoder::for_requests(MAX_PAYLOAD_SIZE);
+        let ping = Frame::new(Command::Ping, vec![]).unwrap().encode();
+        let exec = Frame::new(Command::Exec, vec![0x01, 0x02])
+            .unwrap()
+            .encode();
+        feed(&mut decoder, &ping);
+        feed(&mut decoder, &exec);
+
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), ping.as_slice());
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), exec.as_slice());
+        assert!(decoder.next_frame().is_none());
+    }
+
+    #[test]
+    fn test_sequenced_frames() {
+        use crate::protocol::{Command, ErrorCode, Frame};
+
+        let mut request = Vec::new();
+        Frame::encode_seq_into(3, Command::Ping, &[], &mut request);
+        let mut decoder = FrameDecoder::for_requests(MAX_PAYLOAD_SIZE);
+        feed(&mut decoder, &request);
+        feed(
+            &mut decoder,
+            &Frame::new(Command::Ping, vec![]).unwrap().encode(),
+        );
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), request.as_slice());
+        assert_eq!(decoder.next_frame().unwrap().unwrap()[0], STX);
+
+        let mut response = Vec::new();
+        Frame::encode_response_into(Some(200), ErrorCode::Ok, &[1, 2, 3], &mut response);
+        let mut decoder = FrameDecoder::default();
+        feed(&mut decoder, &response[..4]);
+        assert!(decoder.next_frame().is_none());
+        feed(&mut decoder, &response[4..]);
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), response.as_slice());
+    }
+
+    #[test]
+    fn test_frame_range() {
+        let mut decoder = FrameDecoder::default();
+        feed(&mut decoder, &ok_frame());
+
+        let range = decoder.next_frame_range().unwrap().unwrap();
+        assert_eq!(decoder.frame_at(range), ok_frame().as_slice());
+        assert!(decoder.next_frame_range().is_none());
+    }
+
+    #[test]
+    fn test_leftover_bytes_kept() {
+        let frame = ok_frame();
+        let mut decoder = FrameDecoder::default();
+
+        let mut stream = vec![0x00, 0x13];
+        stream.extend_from_slice(&frame);
+        stream.extend_from_slice(&frame[..3]);
+        feed(&mut decoder, &stream);
+
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), &frame[..]);
+        assert!(decoder.next_frame().is_none());
+        assert_eq!(decoder.buffered(), 3);
+
+        feed(&mut decoder, &frame[3..]);
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), &frame[..]);
+    }
+
+    #[test]
+    fn test_crc_mismatch_consumes_frame() {
+        let mut bad = ok_frame();
+        *bad.last_mut().unwrap() ^= 0xFF;
+        let good = ok_frame();
+        let mut decoder = FrameDecoder::default();
+
+        feed(&mut decoder, &bad);
+        feed(&mut decoder, &good);
+        assert!(matches!(
+            decoder.next_frame(),
+            Some(Err(V4Error::CrcMismatch { .. }))
+        ));
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), &good[..]);
+    }
+
+    #[test]
+    fn test_resync_on_bogus_length() {
+        let frame = ok_frame();
+        let mut decoder = FrameDecoder::new(16);
+
+        feed(&mut decoder, &[STX, 0xFF, 0xFF]);
+        feed(&mut decoder, &frame);
+        assert_eq!(decoder.next_frame().unwrap().unwrap(), &frame[..]);
+    }
+
+    #[test]
+    fn test_buffer_reused_after_compaction() {
+        let frame = ok_frame();
+        let mut decoder = FrameDecoder::new(8);
+
+        for _ in 0..100 {
+            feed(&mut decoder, &frame);
+            assert_eq!(decoder.next_frame().unwrap().unwrap(), &frame[..]);
+        }
+    }
+}
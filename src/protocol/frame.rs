@@ -3,10 +3,23 @@ use super::types::{Command, ErrorCode};
 use crate::{Result, V4Error};
 
 /// V4-link protocol start marker
-const STX: u8 = 0xA5;
+pub(crate) const STX: u8 = 0xA5;
+
+/// Start marker of a sequenced frame
+///
+/// Used once [`FEATURE_SEQUENCED`](super::caps::FEATURE_SEQUENCED) is
+/// agreed. A SEQ byte follows LEN and the device copies it into the
+/// response, so responses can be matched to requests:
+///
+/// - request: `[0xA6][LEN_L][LEN_H][SEQ][CMD][DATA...][CRC8]`
+/// - response: `[0xA6][LEN_L][LEN_H][SEQ][ERR_CODE][DATA...][CRC8]`
+///
+/// LEN does not count SEQ; the CRC covers everything except the marker,
+/// as in plain frames.
+pub(crate) const STX_SEQ: u8 = 0xA6;
 
 /// Maximum payload size (512 bytes)
-const MAX_PAYLOAD_SIZE: usize = 512;
+pub const MAX_PAYLOAD_SIZE: usize = 512;
 
 /// V4-link frame
 ///
@@ -33,11 +46,16 @@ pub struct Response {
 impl Frame {
     /// Create a new frame
     pub fn new(command: Command, payload: Vec<u8>) -> Result<Self> {
-        if payload.len() > MAX_PAYLOAD_SIZE {
+        Self::with_max_payload(command, payload, MAX_PAYLOAD_SIZE)
+    }
+
+    /// Create a new frame for a link with a negotiated maximum payload
+    pub fn with_max_payload(command: Command, payload: Vec<u8>, max: usize) -> Result<Self> {
+        if payload.len() > max {
             return Err(V4Error::Protocol(format!(
                 "Payload too large: {} bytes (max {})",
                 payload.len(),
-                MAX_PAYLOAD_SIZE
+                max
             )));
         }
         Ok(Self { command, payload })
@@ -45,27 +63,51 @@ impl Frame {
 
     /// Encode frame to bytes
     pub fn encode(&self) -> Vec<u8> {
-        let length = self.payload.len() as u16;
         let mut frame = Vec::with_capacity(5 + self.payload.len());
+        Self::encode_into(self.command, &self.payload, &mut frame);
+        frame
+    }
+
+    /// Encode a frame from a borrowed payload into a reusable buffer
+    ///
+    /// `out` is cleared first; its capacity is kept, so a connection can
+    /// encode every frame into the same buffer. The payload size is not
+    /// checked here.
+    pub fn encode_into(command: Command, payload: &[u8], out: &mut Vec<u8>) {
+        Self::encode_request_into(None, command as u8, payload, out);
+    }
+
+    /// Encode a sequenced frame (see [`STX_SEQ`]) into a reusable buffer
+    pub fn encode_seq_into(seq: u8, command: Command, payload: &[u8], out: &mut Vec<u8>) {
+        Self::encode_request_into(Some(seq), command as u8, payload, out);
+    }
+
+    fn encode_request_into(seq: Option<u8>, command: u8, payload: &[u8], out: &mut Vec<u8>) {
+        Self::encode_raw(seq, payload.len() as u16, command, payload, out);
+    }
+
+    /// `[STX][LEN][SEQ?][byte][DATA...][CRC8]` with `byte` being CMD or
+    /// ERR_CODE
+    fn encode_raw(seq: Option<u8>, length: u16, command: u8, payload: &[u8], out: &mut Vec<u8>) {
+        out.clear();
 
         // STX
-        frame.push(STX);
+        out.push(if seq.is_some() { STX_SEQ } else { STX });
 
         // Length (little-endian)
-        frame.push((length & 0xFF) as u8);
-        frame.push(((length >> 8) & 0xFF) as u8);
+        out.push((length & 0xFF) as u8);
+        out.push(((length >> 8) & 0xFF) as u8);
 
-        // Command
-        frame.push(self.command as u8);
+        // Sequence number and command
+        out.extend(seq);
+        out.push(command);
 
         // Payload
-        frame.extend_from_slice(&self.payload);
+        out.extend_from_slice(payload);
 
         // CRC8 over everything except STX
-        let crc = calc_crc8(&frame[1..]);
-        frame.push(crc);
-
-        frame
+        let crc = calc_crc8(&out[1..]);
+        out.push(crc);
     }
 
     /// Decode response frame
@@ -73,6 +115,13 @@ impl Frame {
     /// Standard response (PING, RESET): [STX][0x01][0x00][ERR_CODE][CRC8]
     /// EXEC response: [STX][LEN_L][LEN_H][ERR_CODE][WORD_COUNT][WORD_IDX...][CRC8]
     pub fn decode_response(data: &[u8]) -> Result<Response> {
+        Self::decode_view(data).map(Response::from)
+    }
+
+    /// Decode response frame without copying
+    ///
+    /// The returned view borrows its data from `data`.
+    pub fn decode_view(data: &[u8]) -> Result<ResponseView<'_>> {
         if data.len() < 5 {
             return Err(V4Error::Protocol(format!(
                 "Response too short: {} bytes (expected at least 5)",
@@ -80,15 +129,22 @@ impl Frame {
             )));
         }
 
-        if data[0] != STX {
-            return Err(V4Error::Protocol(format!(
-                "Invalid STX: {:#04x} (expected {:#04x})",
-                data[0], STX
-            )));
-        }
+        let seq = match data[0] {
+            STX => None,
+            STX_SEQ => Some(data[3]),
+            stx => {
+                return Err(V4Error::Protocol(format!(
+                    "Invalid STX: {:#04x} (expected {:#04x})",
+                    stx, STX
+                )));
+            }
+        };
+        // Sequenced frames carry SEQ in front of ERR_CODE
+        let header = 3 + seq.is_some() as usize;
 
         let length = u16::from_le_bytes([data[1], data[2]]) as usize;
-        let expected_frame_len = 4 + length; // STX(1) + LEN(2) + PAYLOAD(length) + CRC(1)
+        // STX(1) + LEN(2) + [SEQ(1)] + PAYLOAD(length) + CRC(1)
+        let expected_frame_len = header + length + 1;
 
         if data.len() < expected_frame_len {
             return Err(V4Error::Protocol(format!(
@@ -98,11 +154,14 @@ impl Frame {
             )));
         }
 
-        let err_code = data[3];
+        if length == 0 {
+            return Err(V4Error::Protocol("Response without error code".to_string()));
+        }
+        let err_code = data[header];
 
         // Extract payload (everything between error code and CRC)
-        let payload_start = 4;
-        let payload_end = 4 + length - 1; // -1 because length includes err_code
+        let payload_start = header + 1;
+        let payload_end = header + length; // length includes err_code
         let payload = &data[payload_start..payload_end];
 
         // Verify CRC
@@ -119,29 +178,112 @@ impl Frame {
         let err_code = ErrorCode::from_u8(err_code)
             .ok_or_else(|| V4Error::Protocol(format!("Unknown error code: {:#04x}", err_code)))?;
 
-        // Parse word indices if present
-        let word_indices = if !payload.is_empty() {
-            let word_count = payload[0] as usize;
-            let mut indices = Vec::with_capacity(word_count);
-
-            for i in 0..word_count {
-                let offset = 1 + i * 2;
-                if offset + 1 < payload.len() {
-                    let idx = u16::from_le_bytes([payload[offset], payload[offset + 1]]);
-                    indices.push(idx);
-                }
-            }
-            indices
-        } else {
-            Vec::new()
-        };
-
-        Ok(Response {
+        Ok(ResponseView {
             error_code: err_code,
-            word_indices,
-            data: payload.to_vec(),
+            seq,
+            data: payload,
         })
     }
+
+    /// Split a request frame returned by a
+    /// [`FrameDecoder::for_requests`](super::FrameDecoder::for_requests)
+    /// decoder into its fields
+    pub fn parse_request(frame: &[u8]) -> Request<'_> {
+        let (seq, header) = match frame[0] {
+            STX_SEQ => (Some(frame[3]), 4),
+            _ => (None, 3),
+        };
+        Request {
+            seq,
+            command: frame[header],
+            payload: &frame[header + 1..frame.len() - 1],
+        }
+    }
+
+    /// Encode an unsequenced response frame (device side)
+    pub fn encode_response(code: ErrorCode, data: &[u8]) -> Vec<u8> {
+        let mut frame = Vec::with_capacity(5 + data.len());
+        Self::encode_response_into(None, code, data, &mut frame);
+        frame
+    }
+
+    /// Encode a response frame into a reusable buffer
+    ///
+    /// Sequenced if `seq` is given, so a device answers in the format it
+    /// was asked in. `out` is cleared first.
+    pub fn encode_response_into(seq: Option<u8>, code: ErrorCode, data: &[u8], out: &mut Vec<u8>) {
+        // LEN counts ERR_CODE in responses
+        Self::encode_raw(seq, (data.len() + 1) as u16, code as u8, data, out);
+    }
+}
+
+/// Request frame borrowed from a receive buffer (device side)
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Request<'a> {
+    /// Sequence number of a sequenced frame
+    pub seq: Option<u8>,
+    /// Command byte; may be unknown to this implementation
+    pub command: u8,
+    pub payload: &'a [u8],
+}
+
+/// Response borrowed from a receive buffer
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct ResponseView<'a> {
+    pub error_code: ErrorCode,
+    /// Sequence number echoed in a sequenced response
+    pub seq: Option<u8>,
+    pub data: &'a [u8],
+}
+
+impl<'a> ResponseView<'a> {
+    /// Word indices registered by an EXEC, parsed lazily
+    ///
+    /// Layout: [WORD_COUNT][WORD_IDX_L][WORD_IDX_H]...
+    pub fn word_indices(&self) -> WordIndices<'a> {
+        let (count, pairs) = match self.data.split_first() {
+            Some((&count, rest)) => (count as usize, rest),
+            None => (0, &[][..]),
+        };
+        WordIndices {
+            pairs: pairs.chunks_exact(2),
+            remaining: count,
+        }
+    }
+}
+
+impl From<ResponseView<'_>> for Response {
+    fn from(view: ResponseView<'_>) -> Self {
+        Response {
+            error_code: view.error_code,
+            word_indices: view.word_indices().collect(),
+            data: view.data.to_vec(),
+        }
+    }
+}
+
+/// Iterator over the word indices of an EXEC response
+#[derive(Debug, Clone)]
+pub struct WordIndices<'a> {
+    pairs: std::slice::ChunksExact<'a, u8>,
+    remaining: usize,
+}
+
+impl Iterator for WordIndices<'_> {
+    type Item = u16;
+
+    fn next(&mut self) -> Option<u16> {
+        if self.remaining == 0 {
+            return None;
+        }
+        self.remaining -= 1;
+        self.pairs.next().map(|p| u16::from_le_bytes([p[0], p[1]]))
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        let n = self.remaining.min(self.pairs.len());
+        (0, Some(n))
+    }
 }
 
 /// Builder for creating frames
@@ -252,6 +394,76 @@ mod tests {
         assert_eq!(result.word_indices[0], 0);
     }
 
+    #[test]
+    fn test_response_view_word_indices() {
+        // [STX][0x06][0x00][ERR_OK][WORD_COUNT=2][0x03][0x00][0x04][0x01][CRC]
+        let response_data = vec![0x06, 0x00, 0x00, 0x02, 0x03, 0x00, 0x04, 0x01];
+        let crc = calc_crc8(&response_data);
+        let mut response = vec![0xA5];
+        response.extend_from_slice(&response_data);
+        response.push(crc);
+
+        let view = Frame::decode_view(&response).unwrap();
+        assert_eq!(view.error_code, ErrorCode::Ok);
+        assert_eq!(view.data, &response[4..9]);
+        assert_eq!(view.word_indices().collect::<Vec<_>>(), vec![3, 0x0104]);
+        assert_eq!(Response::from(view).word_indices, vec![3, 0x0104]);
+    }
+
+    #[test]
+    fn test_word_indices_truncated() {
+        // WORD_COUNT claims 3 but only one full index follows
+        let view = ResponseView {
+            error_code: ErrorCode::Ok,
+            seq: None,
+            data: &[0x03, 0x01, 0x00, 0x02],
+        };
+        assert_eq!(view.word_indices().collect::<Vec<_>>(), vec![1]);
+    }
+
+    #[test]
+    fn test_sequenced_frames() {
+        let mut out = Vec::new();
+        Frame::encode_seq_into(7, Command::Exec, &[0x42], &mut out);
+        assert_eq!(&out[..6], &[0xA6, 0x01, 0x00, 0x07, 0x10, 0x42]);
+        assert_eq!(out[6], calc_crc8(&out[1..6]));
+        assert_eq!(
+            Frame::parse_request(&out),
+            Request {
+                seq: Some(7),
+                command: Command::Exec as u8,
+                payload: &[0x42],
+            }
+        );
+
+        Frame::encode_response_into(Some(7), ErrorCode::Ok, &[0x01, 0x02], &mut out);
+        let view = Frame::decode_view(&out).unwrap();
+        assert_eq!(view.seq, Some(7));
+        assert_eq!(view.error_code, ErrorCode::Ok);
+        assert_eq!(view.data, &[0x01, 0x02]);
+
+        // Plain responses round-trip through the same encoder
+        Frame::encode_response_into(None, ErrorCode::BufferFull, &[], &mut out);
+        assert_eq!(out.len(), 5);
+        let view = Frame::decode_view(&out).unwrap();
+        assert_eq!((view.seq, view.error_code), (None, ErrorCode::BufferFull));
+    }
+
+    #[test]
+    fn test_encode_into_reuses_buffer() {
+        let mut out = Vec::with_capacity(64);
+        Frame::encode_into(Command::Exec, &[0x42, 0x43], &mut out);
+        let expected = Frame::new(Command::Exec, vec![0x42, 0x43])
+            .unwrap()
+            .encode();
+        assert_eq!(out, expected);
+
+        let capacity = out.capacity();
+        Frame::encode_into(Command::Ping, &[], &mut out);
+        assert_eq!(out.len(), 5);
+        assert_eq!(out.capacity(), capacity);
+    }
+
     #[test]
     fn test_response_decode_crc_mismatch() {
         // Invalid CRC
@@ -267,6 +479,15 @@ mod tests {
         assert!(matches!(result, Err(V4Error::Protocol(_))));
     }
 
+    #[test]
+    fn test_payload_within_negotiated_mtu() {
+        let payload = vec![0; 4096];
+        let frame = Frame::with_max_payload(Command::Exec, payload.clone(), 4096).unwrap();
+        let encoded = frame.encode();
+        assert_eq!(&encoded[1..3], &4096u16.to_le_bytes());
+        assert!(Frame::with_max_payload(Command::Exec, payload, 4095).is_err());
+    }
+
     #[test]
     fn test_frame_builder() {
         let frame = FrameBuilder::new(Command::Reset)
@@ -0,0 +1,276 @@
+//! Parsed stacks and the delta-encoded QUERY_STACK_DELTA response
+//!
+//! QUERY_STACK returns both stacks in full:
+//! `[DS_DEPTH][DS (i32 LE)...][RS_DEPTH][RS (u32 LE)...]`, top of stack
+//! first. QUERY_STACK_DELTA only sends what changed since a snapshot the
+//! host already holds, identified by a tag the device handed out with it.
+//!
+//! Request payload: `[TAG (u16 LE)]`, the tag of the host's snapshot, or 0
+//! for none. Response data:
+//!
+//! ```text
+//! [TAG (u16 LE)][FLAGS][DS_DEPTH][RS_DEPTH]
+//! FLAGS & STACK_FULL:  DS_DEPTH x [VALUE (i32 LE)]  RS_DEPTH x [VALUE (u32 LE)]
+//! otherwise:           [N] N x [POS][VALUE (i32 LE)]  [M] M x [POS][VALUE (u32 LE)]
+//! ```
+//!
+//! Full cells are listed top first like QUERY_STACK. Delta positions count
+//! from the bottom of the stack, so a push or pop leaves the positions of
+//! the cells below it unchanged; cells at or above the new depth are gone.
+//! The device answers in full whenever the request tag is not the one it
+//! issued last, and the host keeps the response's tag for its next request.
+
+/// FLAGS bit: the response carries both stacks in full
+pub const STACK_FULL: u8 = 1 << 0;
+
+/// Contents of the data and return stacks, top of stack first
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct Stacks {
+    pub data: Vec<i32>,
+    pub ret: Vec<u32>,
+}
+
+impl Stacks {
+    /// Parse QUERY_STACK response data
+    ///
+    /// A response without a return stack section has an empty one.
+    pub fn parse(data: &[u8]) -> Option<Self> {
+        let ds_depth = *data.first()? as usize;
+        let ds = data.get(1..1 + ds_depth * 4)?;
+        let rest = &data[1 + ds_depth * 4..];
+        let ret = match rest.split_first() {
+            Some((&rs_depth, cells)) => cells
+                .get(..rs_depth as usize * 4)?
+                .chunks_exact(4)
+                .map(|b| u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+                .collect(),
+            None => Vec::new(),
+        };
+        Some(Self {
+            data: ds
+                .chunks_exact(4)
+                .map(|b| i32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+                .collect(),
+            ret,
+        })
+    }
+
+    /// Append QUERY_STACK response data to `out`
+    pub fn encode(&self, out: &mut Vec<u8>) {
+        out.push(self.data.len() as u8);
+        for value in &self.data {
+            out.extend_from_slice(&value.to_le_bytes());
+        }
+        out.push(self.ret.len() as u8);
+        for value in &self.ret {
+            out.extend_from_slice(&value.to_le_bytes());
+        }
+    }
+
+    /// Append a QUERY_STACK_DELTA response to `out`: the change from
+    /// `previous`, or everything if there is none
+    pub fn encode_delta(&self, tag: u16, previous: Option<&Stacks>, out: &mut Vec<u8>) {
+        out.extend_from_slice(&tag.to_le_bytes());
+        out.push(if previous.is_some() { 0 } else { STACK_FULL });
+        out.push(self.data.len() as u8);
+        out.push(self.ret.len() as u8);
+        match previous {
+            None => {
+                for value in &self.data {
+                    out.extend_from_slice(&value.to_le_bytes());
+                }
+                for value in &self.ret {
+                    out.extend_from_slice(&value.to_le_bytes());
+                }
+            }
+            Some(previous) => {
+                encode_changes(&self.data, &previous.data, i32::to_le_bytes, out);
+                encode_changes(&self.ret, &previous.ret, u32::to_le_bytes, out);
+            }
+        }
+    }
+}
+
+/// `[N] N x [POS][VALUE]` for the cells of `now` that differ from `before`
+fn encode_changes<T: Copy + PartialEq>(
+    now: &[T],
+    before: &[T],
+    bytes: fn(T) -> [u8; 4],
+    out: &mut Vec<u8>,
+) {
+    let count_at = out.len();
+    out.push(0);
+    let mut count = 0u8;
+    for pos in 0..now.len() {
+        let value = now[now.len() - 1 - pos];
+        let old = before.len().checked_sub(1 + pos).map(|i| before[i]);
+        if old != Some(value) {
+            out.push(pos as u8);
+            out.extend_from_slice(&bytes(value));
+            count += 1;
+        }
+    }
+    out[count_at] = count;
+}
+
+/// Host side of QUERY_STACK_DELTA: the last snapshot and its tag
+#[derive(Debug, Clone, Default)]
+pub struct StackTracker {
+    tag: u16,
+    stacks: Stacks,
+    /// Whether the device answers QUERY_STACK_DELTA; unknown until tried
+    pub(crate) supported: Option<bool>,
+}
+
+impl StackTracker {
+    /// Request payload for the next query
+    pub fn request(&self) -> [u8; 2] {
+        self.tag.to_le_bytes()
+    }
+
+    /// Last known stacks
+    pub fn stacks(&self) -> &Stacks {
+        &self.stacks
+    }
+
+    /// Forget the snapshot; the next response will be a full one
+    pub fn invalidate(&mut self) {
+        self.tag = 0;
+    }
+
+    /// Replace the snapshot with a full QUERY_STACK result
+    pub fn set(&mut self, stacks: Stacks) {
+        self.tag = 0;
+        self.stacks = stacks;
+    }
+
+    /// Apply QUERY_STACK_DELTA response data
+    ///
+    /// Returns `None` (and drops the snapshot) if the data is malformed or
+    /// is a delta against a snapshot this tracker does not hold.
+    pub fn apply(&mut self, data: &[u8]) -> Option<&Stacks> {
+        let applied = self.try_apply(data);
+        if applied.is_none() {
+            self.invalidate();
+        }
+        applied?;
+        Some(&self.stacks)
+    }
+
+    fn try_apply(&mut self, data: &[u8]) -> Option<()> {
+        let [tag_lo, tag_hi, flags, ds_depth, rs_depth, ref body @ ..] = *data else {
+            return None;
+        };
+        let (ds_depth, rs_depth) = (ds_depth as usize, rs_depth as usize);
+
+        if flags & STACK_FULL != 0 {
+            let ds = body.get(..ds_depth * 4)?;
+            let rs = body.get(ds_depth * 4..(ds_depth + rs_depth) * 4)?;
+            self.stacks = Stacks {
+                data: ds
+                    .chunks_exact(4)
+                    .map(|b| i32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+                    .collect(),
+                ret: rs
+                    .chunks_exact(4)
+                    .map(|b| u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+                    .collect(),
+            };
+        } else {
+            if self.tag == 0 {
+                return None;
+            }
+            let rest = apply_changes(&mut self.stacks.data, ds_depth, body, i32::from_le_bytes)?;
+            apply_changes(&mut self.stacks.ret, rs_depth, rest, u32::from_le_bytes)?;
+        }
+        self.tag = u16::from_le_bytes([tag_lo, tag_hi]);
+        Some(())
+    }
+}
+
+/// Resize `cells` to `depth` and apply `[N] N x [POS][VALUE]`; returns the
+/// data after the list
+fn apply_changes<'a, T: Copy + Default>(
+    cells: &mut Vec<T>,
+    depth: usize,
+    data: &'a [u8],
+    value: fn([u8; 4]) -> T,
+) -> Option<&'a [u8]> {
+    let (&count, mut rest) = data.split_first()?;
+
+    // Work bottom first so positions index directly
+    cells.reverse();
+    cells.resize(depth, T::default());
+    for _ in 0..count {
+        let entry = rest.get(..5)?;
+        let pos = entry[0] as usize;
+        *cells.get_mut(pos)? = value([entry[1], entry[2], entry[3], entry[4]]);
+        rest = &rest[5..];
+    }
+    cells.reverse();
+    Some(rest)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn stacks(data: &[i32], ret: &[u32]) -> Stacks {
+        Stacks {
+            data: data.to_vec(),
+            ret: ret.to_vec(),
+        }
+    }
+
+    #[test]
+    fn test_parse_query_stack() {
+        let original = stacks(&[3, -1], &[0x1004]);
+        let mut data = Vec::new();
+        original.encode(&mut data);
+        assert_eq!(Stacks::parse(&data), Some(original));
+
+        assert_eq!(Stacks::parse(&[0]), Some(Stacks::default()));
+        assert!(Stacks::parse(&[2, 0, 0, 0, 0]).is_none());
+    }
+
+    #[test]
+    fn test_delta_roundtrip() {
+        let mut tracker = StackTracker::default();
+        let mut data = Vec::new();
+
+        // First answer is full
+        let first = stacks(&[30, 20, 10], &[0x1000]);
+        first.encode_delta(1, None, &mut data);
+        assert_eq!(tracker.apply(&data), Some(&first));
+        assert_eq!(tracker.request(), [1, 0]);
+
+        // Push one cell: only the new top is sent
+        let second = stacks(&[40, 30, 20, 10], &[0x1000]);
+        data.clear();
+        second.encode_delta(2, Some(&first), &mut data);
+        assert_eq!(data.len(), 5 + 1 + 5 + 1);
+        assert_eq!(tracker.apply(&data), Some(&second));
+
+        // Pop two and change the new top; return stack emptied
+        let third = stacks(&[99, 10], &[]);
+        data.clear();
+        third.encode_delta(3, Some(&second), &mut data);
+        assert_eq!(tracker.apply(&data), Some(&third));
+
+        // Nothing changed
+        data.clear();
+        third.encode_delta(4, Some(&third), &mut data);
+        assert_eq!(data, [4, 0, 0, 2, 0, 0, 0]);
+        assert_eq!(tracker.apply(&data), Some(&third));
+    }
+
+    #[test]
+    fn test_delta_without_snapshot_is_rejected() {
+        let mut data = Vec::new();
+        stacks(&[1], &[]).encode_delta(5, Some(&Stacks::default()), &mut data);
+        let mut tracker = StackTracker::default();
+        assert!(tracker.apply(&data).is_none());
+        assert!(tracker.apply(&data[..3]).is_none());
+        assert_eq!(tracker.request(), [0, 0]);
+    }
+}
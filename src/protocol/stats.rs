@@ -0,0 +1,226 @@
+//! VM performance counters read with QUERY_STATS
+//!
+//! Request payload: `[FLAGS][FIRST (u16 LE)]`. Per-word entries are
+//! returned from entry `FIRST` on, as many as fit one frame; with
+//! [`STATS_RESET`] the device zeroes all counters after answering.
+//!
+//! Response data (all little-endian):
+//!
+//! ```text
+//! [INSTRUCTIONS (u64)][CYCLES (u64)]
+//! [EXEC_QUEUE (u16)][EXEC_QUEUE_MAX (u16)]
+//! [BUFFER_FULL (u32)][RX_OVERRUNS (u32)]
+//! [WORD_TOTAL (u16)][COUNT (u16)]
+//! COUNT x [INDEX (u16)][CALLS (u32)][CYCLES (u64)]
+//! ```
+
+/// FLAGS bit: zero the counters once they have been read
+pub const STATS_RESET: u8 = 1 << 0;
+
+/// Size of the response before the per-word entries
+pub const STATS_HEADER_SIZE: usize = 32;
+
+/// Size of one per-word entry
+pub const WORD_STATS_SIZE: usize = 14;
+
+/// Counters of one word
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct WordStats {
+    /// Device word index
+    pub index: u16,
+    pub calls: u32,
+    /// Cycles spent in the word, callees included
+    pub cycles: u64,
+}
+
+/// VM counters since boot or the last reset
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct VmStats {
+    /// Instructions executed
+    pub instructions: u64,
+    /// VM cycles executed
+    pub cycles: u64,
+    /// EXEC frames waiting to run
+    pub exec_queue: u16,
+    /// Highest EXEC queue depth seen
+    pub exec_queue_max: u16,
+    /// Requests answered with BUFFER_FULL
+    pub buffer_full: u32,
+    /// Bytes lost to receive overruns
+    pub rx_overruns: u32,
+    /// Number of word entries the device keeps
+    pub word_total: u16,
+    /// Word entries, in entry order
+    pub words: Vec<WordStats>,
+}
+
+/// QUERY_STATS payload
+pub fn request(flags: u8, first: u16) -> [u8; 3] {
+    let first = first.to_le_bytes();
+    [flags, first[0], first[1]]
+}
+
+impl VmStats {
+    /// Parse QUERY_STATS response data
+    pub fn parse(data: &[u8]) -> Option<Self> {
+        if data.len() < STATS_HEADER_SIZE {
+            return None;
+        }
+        let u16_at = |at: usize| u16::from_le_bytes([data[at], data[at + 1]]);
+        let u32_at = |at: usize| u32::from_le_bytes(data[at..at + 4].try_into().unwrap());
+        let u64_at = |at: usize| u64::from_le_bytes(data[at..at + 8].try_into().unwrap());
+
+        let count = u16_at(30) as usize;
+        let entries = data.get(STATS_HEADER_SIZE..STATS_HEADER_SIZE + count * WORD_STATS_SIZE)?;
+        let words = entries
+            .chunks_exact(WORD_STATS_SIZE)
+            .map(|e| WordStats {
+                index: u16::from_le_bytes([e[0], e[1]]),
+                calls: u32::from_le_bytes(e[2..6].try_into().unwrap()),
+                cycles: u64::from_le_bytes(e[6..14].try_into().unwrap()),
+            })
+            .collect();
+
+        Some(Self {
+            instructions: u64_at(0),
+            cycles: u64_at(8),
+            exec_queue: u16_at(16),
+            exec_queue_max: u16_at(18),
+            buffer_full: u32_at(20),
+            rx_overruns: u32_at(24),
+            word_total: u16_at(28),
+            words,
+        })
+    }
+
+    /// Append the response data for `words` to `out`
+    pub fn encode(&self, words: &[WordStats], out: &mut Vec<u8>) {
+        out.extend_from_slice(&self.instructions.to_le_bytes());
+        out.extend_from_slice(&self.cycles.to_le_bytes());
+        out.extend_from_slice(&self.exec_queue.to_le_bytes());
+        out.extend_from_slice(&self.exec_queue_max.to_le_bytes());
+        out.extend_from_slice(&self.buffer_full.to_le_bytes());
+        out.extend_from_slice(&self.rx_overruns.to_le_bytes());
+        out.extend_from_slice(&self.word_total.to_le_bytes());
+        out.extend_from_slice(&(words.len() as u16).to_le_bytes());
+        for word in words {
+            out.extend_from_slice(&word.index.to_le_bytes());
+            out.extend_from_slice(&word.calls.to_le_bytes());
+            out.extend_from_slice(&word.cycles.to_le_bytes());
+        }
+    }
+
+    /// Word entries that fit one response of at most `mtu` bytes
+    pub fn words_per_frame(mtu: usize) -> usize {
+        mtu.saturating_sub(STATS_HEADER_SIZE) / WORD_STATS_SIZE
+    }
+
+    /// Counter increase from `earlier` to `self`
+    ///
+    /// Queue depths are gauges and are taken from `self`. Counters that went
+    /// down (the device was reset in between) count from zero.
+    pub fn since(&self, earlier: &VmStats) -> VmStats {
+        let words = self
+            .words
+            .iter()
+            .map(|word| {
+                let before = earlier
+                    .words
+                    .iter()
+                    .find(|w| w.index == word.index)
+                    .copied()
+                    .unwrap_or_default();
+                WordStats {
+                    index: word.index,
+                    calls: counter_delta(word.calls as u64, before.calls as u64) as u32,
+                    cycles: counter_delta(word.cycles, before.cycles),
+                }
+            })
+            .collect();
+        VmStats {
+            instructions: counter_delta(self.instructions, earlier.instructions),
+            cycles: counter_delta(self.cycles, earlier.cycles),
+            exec_queue: self.exec_queue,
+            exec_queue_max: self.exec_queue_max,
+            buffer_full: counter_delta(self.buffer_full as u64, earlier.buffer_full as u64) as u32,
+            rx_overruns: counter_delta(self.rx_overruns as u64, earlier.rx_overruns as u64) as u32,
+            word_total: self.word_total,
+            words,
+        }
+    }
+
+    /// Words sorted by cycles spent, most expensive first
+    pub fn hot_words(&self) -> Vec<WordStats> {
+        let mut words = self.words.clone();
+        words.sort_by(|a, b| b.cycles.cmp(&a.cycles).then(b.calls.cmp(&a.calls)));
+        words
+    }
+}
+
+fn counter_delta(now: u64, before: u64) -> u64 {
+    if now >= before { now - before } else { now }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample() -> VmStats {
+        VmStats {
+            instructions: 1_000_000,
+            cycles: 3_500_000,
+            exec_queue: 1,
+            exec_queue_max: 4,
+            buffer_full: 2,
+            rx_overruns: 0,
+            word_total: 2,
+            words: vec![
+                WordStats {
+                    index: 0,
+                    calls: 10,
+                    cycles: 500,
+                },
+                WordStats {
+                    index: 1,
+                    calls: 3,
+                    cycles: 9000,
+                },
+            ],
+        }
+    }
+
+    #[test]
+    fn test_stats_roundtrip() {
+        let stats = sample();
+        let mut data = Vec::new();
+        stats.encode(&stats.words, &mut data);
+        assert_eq!(data.len(), STATS_HEADER_SIZE + 2 * WORD_STATS_SIZE);
+        assert_eq!(VmStats::parse(&data), Some(stats));
+
+        // Truncated header or entries
+        assert!(VmStats::parse(&data[..STATS_HEADER_SIZE - 1]).is_none());
+        assert!(VmStats::parse(&data[..data.len() - 1]).is_none());
+        assert_eq!(VmStats::words_per_frame(512), 34);
+    }
+
+    #[test]
+    fn test_since_and_hot_words() {
+        let before = sample();
+        let mut after = sample();
+        after.instructions += 500;
+        after.words[0].calls += 5;
+        after.words[0].cycles += 20_000;
+
+        let delta = after.since(&before);
+        assert_eq!(delta.instructions, 500);
+        assert_eq!(delta.words[0].calls, 5);
+        assert_eq!(delta.words[1].calls, 0);
+        assert_eq!(delta.exec_queue_max, 4);
+
+        // Counters that went backwards restarted from zero
+        assert_eq!(before.since(&after).instructions, before.instructions);
+
+        assert_eq!(after.hot_words()[0].index, 0);
+        assert_eq!(before.hot_words()[0].index, 1);
+    }
+}
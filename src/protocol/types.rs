@@ -4,18 +4,54 @@
 pub enum Command {
     /// Execute bytecode
     Exec = 0x10,
+    /// Begin segmented transfer of an EXEC image
+    PushBegin = 0x11,
+    /// Segment of an EXEC image at a byte offset
+    PushChunk = 0x12,
+    /// Complete segmented transfer and execute the assembled image
+    PushEnd = 0x13,
+    /// LZSS-compressed segment of an EXEC image
+    PushChunkZ = 0x14,
     /// Connection check
     Ping = 0x20,
+    /// Negotiate baud rate, maximum payload and features
+    Caps = 0x21,
     /// Query stack state
     QueryStack = 0x30,
+    /// Query stack changes since a previous query
+    QueryStackDelta = 0x31,
     /// Query memory dump
     QueryMemory = 0x40,
     /// Query word information
     QueryWord = 0x50,
+    /// Query VM performance counters
+    QueryStats = 0x60,
     /// VM reset
     Reset = 0xFF,
 }
 
+impl Command {
+    /// Convert u8 to Command
+    pub fn from_u8(value: u8) -> Option<Self> {
+        match value {
+            0x10 => Some(Command::Exec),
+            0x11 => Some(Command::PushBegin),
+            0x12 => Some(Command::PushChunk),
+            0x13 => Some(Command::PushEnd),
+            0x14 => Some(Command::PushChunkZ),
+            0x20 => Some(Command::Ping),
+            0x21 => Some(Command::Caps),
+            0x30 => Some(Command::QueryStack),
+            0x31 => Some(Command::QueryStackDelta),
+            0x40 => Some(Command::QueryMemory),
+            0x50 => Some(Command::QueryWord),
+            0x60 => Some(Command::QueryStats),
+            0xFF => Some(Command::Reset),
+            _ => None,
+        }
+    }
+}
+
 /// V4-link protocol error codes
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 #[repr(u8)]
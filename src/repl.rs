@@ -3,8 +3,14 @@
 //! This module provides safe Rust wrappers around V4-front C API for
 //! compiling Forth source code to V4 bytecode.
 
+use crate::context::ContextSnapshot;
+use crate::trace::Level;
+use crate::v4front_ffi;
+use std::borrow::Cow;
+use std::collections::HashMap;
 use std::ffi::{CStr, CString, c_char, c_int};
 use std::ptr;
+use std::rc::Rc;
 use std::slice;
 
 // ============================================================================
@@ -55,7 +61,7 @@ unsafe extern "C" {
 // ============================================================================
 
 /// Compiled word definition
-#[derive(Debug, Clone)]
+#[derive(Debug, Clone, PartialEq, Eq)]
 pub struct WordDef {
     pub name: String,
     pub bytecode: Vec<u8>,
@@ -68,26 +74,170 @@ pub struct CompileResult {
     pub bytecode: Vec<u8>,
 }
 
+/// Output of one compilation, borrowed from the compiler's buffers
+///
+/// See [`Compiler::compile_with`].
+pub struct CompiledView<'a> {
+    words: &'a [V4FrontWord],
+    bytecode: &'a [u8],
+}
+
+impl<'a> CompiledView<'a> {
+    /// Main bytecode
+    pub fn bytecode(&self) -> &'a [u8] {
+        self.bytecode
+    }
+
+    /// Number of word definitions
+    pub fn word_count(&self) -> usize {
+        self.words.len()
+    }
+
+    /// Word definitions as `(name, bytecode)`
+    pub fn words(&self) -> impl Iterator<Item = (Cow<'a, str>, &'a [u8])> + 'a {
+        self.words.iter().map(|word| unsafe {
+            (
+                CStr::from_ptr(word.name).to_string_lossy(),
+                slice::from_raw_parts(word.code, word.code_len as usize),
+            )
+        })
+    }
+
+    /// Copy into an owned [`CompileResult`]
+    pub fn to_result(&self) -> CompileResult {
+        // Note: We don't register word indices here.
+        // The device will register each word and return its index,
+        // which we'll then register via register_word_index()
+        CompileResult {
+            words: self
+                .words()
+                .map(|(name, bytecode)| WordDef {
+                    name: name.into_owned(),
+                    bytecode: bytecode.to_vec(),
+                })
+                .collect(),
+            bytecode: self.bytecode.to_vec(),
+        }
+    }
+}
+
+/// Compile results of REPL lines, kept for one session
+///
+/// Scripted sessions send the same lines over and over; a line is only
+/// compiled again once the compiler context has changed (a word was
+/// defined, registered or the context reset). Only lines whose compilation
+/// left the context unchanged are memoized, so lines that define words
+/// never are.
+#[derive(Debug, Default)]
+pub struct CompileMemo {
+    /// Context generation the entries were compiled in
+    generation: u64,
+    entries: HashMap<String, Rc<CompileResult>>,
+}
+
+impl CompileMemo {
+    /// Lines kept before the memo starts over
+    pub const CAPACITY: usize = 1024;
+
+    /// Compile `line`, or return the result memoized for it in the current
+    /// context generation
+    pub fn compile(
+        &mut self,
+        compiler: &mut Compiler,
+        line: &str,
+    ) -> Result<Rc<CompileResult>, String> {
+        if self.generation != compiler.generation() {
+            self.entries.clear();
+            self.generation = compiler.generation();
+        }
+        if let Some(result) = self.entries.get(line) {
+            crate::trace!(Level::Debug, "Compile memo hit: {}", line);
+            return Ok(Rc::clone(result));
+        }
+
+        let result = compiler.compile_with(line, |view| Rc::new(view.to_result()))?;
+        // Defining or registering words bumps the generation
+        if compiler.generation() == self.generation {
+            if self.entries.len() >= Self::CAPACITY {
+                self.entries.clear();
+            }
+            self.entries.insert(line.to_string(), Rc::clone(&result));
+        }
+        Ok(result)
+    }
+
+    /// Number of memoized lines
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// No lines memoized
+    pub fn is_empty(&self) -> bool {
+        self.entries.is_empty()
+    }
+}
+
 /// Stateful Forth compiler for REPL
+///
+/// The V4-front context is only created by the first compilation, so
+/// commands that never compile do not pay for it. Words registered before
+/// then are kept in Rust and registered with the context once it exists.
 pub struct Compiler {
+    /// V4-front context; null until first needed
     ctx: *mut V4FrontContext,
     next_word_id: i32,
+    /// Words registered from the device; V4-front has no API to read its
+    /// word table back
+    registered: Vec<(String, u16)>,
+    /// Bytecode of words compiled but not yet registered, by name
+    pending: HashMap<String, Vec<u8>>,
+    /// Bytecode of registered words, by device index
+    bytecode: HashMap<u16, Vec<u8>>,
+    generation: u64,
+    /// NUL-terminated source handed to V4-front
+    source: Vec<u8>,
 }
 
 impl Compiler {
-    /// Create a new compiler context
+    /// Create a new compiler
+    ///
+    /// The V4-front context is created lazily; failing to create it is
+    /// reported by the first compilation.
     pub fn new() -> Result<Self, String> {
-        unsafe {
-            let ctx = v4front_context_create();
+        Ok(Compiler {
+            ctx: ptr::null_mut(),
+            next_word_id: 0,
+            registered: Vec::new(),
+            pending: HashMap::new(),
+            bytecode: HashMap::new(),
+            generation: 0,
+            source: Vec::new(),
+        })
+    }
+
+    /// Whether the V4-front context has been created yet
+    pub fn is_initialized(&self) -> bool {
+        !self.ctx.is_null()
+    }
+
+    /// V4-front context, created and given the words registered so far on
+    /// first use
+    fn context(&mut self) -> Result<*mut V4FrontContext, String> {
+        if self.ctx.is_null() {
+            crate::trace!(Level::Debug, "Creating V4-front compiler context");
+            let ctx = unsafe {
+                let _library = v4front_ffi::lock();
+                v4front_context_create()
+            };
             if ctx.is_null() {
                 return Err("Failed to create compiler context".to_string());
             }
-
-            Ok(Compiler {
-                ctx,
-                next_word_id: 0,
-            })
+            self.ctx = ctx;
+            for (name, index) in &self.registered {
+                register_with(ctx, name, *index as i32)?;
+            }
         }
+        Ok(self.ctx)
     }
 
     /// Compile Forth source code
@@ -95,8 +245,32 @@ impl Compiler {
     /// Returns compiled bytecode and any word definitions.
     /// Word definitions are automatically registered with the compiler context.
     pub fn compile(&mut self, source: &str) -> Result<CompileResult, String> {
+        self.compile_with(source, |view| view.to_result())
+    }
+
+    /// Compile Forth source code and pass the output to `f` without copying
+    /// it
+    ///
+    /// The view borrows the compiler's output buffers, which are released
+    /// when `f` returns.
+    pub fn compile_with<R>(
+        &mut self,
+        source: &str,
+        f: impl FnOnce(&CompiledView<'_>) -> R,
+    ) -> Result<R, String> {
+        if let Some(pos) = source.bytes().position(|b| b == 0) {
+            return Err(format!(
+                "nul byte found in provided data at position: {}",
+                pos
+            ));
+        }
+        // Reuse one NUL-terminated copy of the source across calls
+        self.source.clear();
+        self.source.extend_from_slice(source.as_bytes());
+        self.source.push(0);
+        let ctx = self.context()?;
+
         unsafe {
-            let c_source = CString::new(source).map_err(|e| e.to_string())?;
             let mut out_buf = V4FrontBuf {
                 words: ptr::null_mut(),
                 word_count: 0,
@@ -105,9 +279,10 @@ impl Compiler {
             };
             let mut err_buf = [0u8; 256];
 
+            let library = v4front_ffi::lock();
             let result = v4front_compile_with_context(
-                self.ctx,
-                c_source.as_ptr(),
+                ctx,
+                self.source.as_ptr() as *const c_char,
                 &mut out_buf,
                 err_buf.as_mut_ptr() as *mut c_char,
                 err_buf.len(),
@@ -118,6 +293,7 @@ impl Compiler {
                     .to_string_lossy()
                     .into_owned();
                 v4front_free(&mut out_buf);
+                drop(library);
                 return Err(if err_msg.is_empty() {
                     format!("Compilation failed (error code: {})", result)
                 } else {
@@ -125,73 +301,168 @@ impl Compiler {
                 });
             }
 
-            // Extract word definitions
-            let mut words = Vec::new();
-            if !out_buf.words.is_null() && out_buf.word_count > 0 {
-                let words_slice = slice::from_raw_parts(out_buf.words, out_buf.word_count as usize);
-
-                for word in words_slice {
-                    let name = CStr::from_ptr(word.name).to_string_lossy().into_owned();
-                    let bytecode = slice::from_raw_parts(word.code, word.code_len as usize);
-
-                    // Note: We don't register word index here.
-                    // The device will register the word and return its index,
-                    // which we'll then register via register_word_index()
-
-                    words.push(WordDef {
-                        name,
-                        bytecode: bytecode.to_vec(),
-                    });
+            let view = CompiledView {
+                words: if !out_buf.words.is_null() && out_buf.word_count > 0 {
+                    slice::from_raw_parts(out_buf.words, out_buf.word_count as usize)
+                } else {
+                    &[]
+                },
+                bytecode: if !out_buf.data.is_null() && out_buf.size > 0 {
+                    slice::from_raw_parts(out_buf.data, out_buf.size)
+                } else {
+                    &[]
+                },
+            };
+            // Defining a word changes what later lines compile to
+            if !view.words.is_empty() {
+                self.generation += 1;
+                for (name, code) in view.words() {
+                    self.pending.insert(name.into_owned(), code.to_vec());
                 }
             }
+            // `f` may compile again; don't hold the lock while it runs
+            drop(library);
+            let output = f(&view);
 
-            // Extract main bytecode
-            let bytecode = if !out_buf.data.is_null() && out_buf.size > 0 {
-                slice::from_raw_parts(out_buf.data, out_buf.size).to_vec()
-            } else {
-                Vec::new()
-            };
-
+            let _library = v4front_ffi::lock();
             v4front_free(&mut out_buf);
-
-            Ok(CompileResult { words, bytecode })
+            Ok(output)
         }
     }
 
+    /// Counter that changes whenever the compiler context does
+    ///
+    /// Bumped by word definitions, registrations and resets; equal
+    /// generations compile the same source to the same output.
+    pub fn generation(&self) -> u64 {
+        self.generation
+    }
+
     /// Reset compiler context (clear all registered words)
     pub fn reset(&mut self) {
-        unsafe {
-            v4front_context_reset(self.ctx);
-            self.next_word_id = 0;
+        if !self.ctx.is_null() {
+            let _library = v4front_ffi::lock();
+            unsafe {
+                v4front_context_reset(self.ctx);
+            }
         }
+        self.next_word_id = 0;
+        self.registered.clear();
+        self.pending.clear();
+        self.bytecode.clear();
+        self.generation += 1;
     }
 
     /// Register a word index from device
     ///
     /// Called after device executes bytecode and returns word index
     pub fn register_word_index(&mut self, name: &str, vm_word_idx: i32) -> Result<(), String> {
-        unsafe {
-            let c_name = CString::new(name).map_err(|e| e.to_string())?;
-            let result = v4front_context_register_word(self.ctx, c_name.as_ptr(), vm_word_idx);
-            if result < 0 {
-                return Err(format!(
-                    "Failed to register word '{}' with index {}",
-                    name, vm_word_idx
-                ));
+        // Device indices are u16; anything else cannot wait for the context
+        if !self.ctx.is_null() || u16::try_from(vm_word_idx).is_err() {
+            register_with(self.context()?, name, vm_word_idx)?;
+        } else if name.contains('\0') {
+            return Err(format!("Invalid word name: {:?}", name));
+        }
+        self.generation += 1;
+        if let Ok(index) = u16::try_from(vm_word_idx) {
+            match self.registered.iter_mut().find(|(n, _)| n == name) {
+                Some(existing) => existing.1 = index,
+                None => self.registered.push((name.to_string(), index)),
+            }
+            if let Some(code) = self.pending.remove(name) {
+                self.bytecode.insert(index, code);
             }
-            Ok(())
         }
+        Ok(())
+    }
+
+    /// Device index of a registered word
+    pub fn word_index(&self, name: &str) -> Option<u16> {
+        self.registered
+            .iter()
+            .find(|(n, _)| n == name)
+            .map(|(_, index)| *index)
+    }
+
+    /// Index the device gives the next word it registers, if the words
+    /// registered here are all it holds
+    pub fn next_index(&self) -> u16 {
+        self.registered
+            .iter()
+            .map(|&(_, index)| index.saturating_add(1))
+            .max()
+            .unwrap_or(0)
+    }
+
+    /// Name of the word registered at `index`
+    pub fn word_name(&self, index: u16) -> Option<&str> {
+        self.registered
+            .iter()
+            .find(|(_, i)| *i == index)
+            .map(|(name, _)| name.as_str())
+    }
+
+    /// Bytecode of the word at `index`, if this compiler produced it or it
+    /// was remembered with [`remember_bytecode`](Self::remember_bytecode)
+    ///
+    /// Words registered from a manifest or context snapshot have none until
+    /// read from the device.
+    pub fn word_bytecode(&self, index: u16) -> Option<&[u8]> {
+        self.bytecode.get(&index).map(Vec::as_slice)
+    }
+
+    /// Keep bytecode read from the device for the word at `index`
+    ///
+    /// Device indices are not reused until a reset, which forgets them.
+    pub fn remember_bytecode(&mut self, index: u16, bytecode: &[u8]) {
+        self.bytecode.insert(index, bytecode.to_vec());
+    }
+
+    /// Snapshot of the words registered from the device
+    pub fn snapshot(&self) -> ContextSnapshot {
+        ContextSnapshot::new(
+            self.registered
+                .iter()
+                .map(|(name, index)| (name.as_str(), *index)),
+        )
+    }
+
+    /// Register every word of `snapshot`, as if the device had just returned
+    /// their indices
+    pub fn restore(&mut self, snapshot: &ContextSnapshot) -> Result<(), String> {
+        for (name, index) in snapshot.words() {
+            self.register_word_index(name, *index as i32)?;
+        }
+        Ok(())
     }
 }
 
 impl Drop for Compiler {
     fn drop(&mut self) {
-        unsafe {
-            v4front_context_destroy(self.ctx);
+        if !self.ctx.is_null() {
+            let _library = v4front_ffi::lock();
+            unsafe {
+                v4front_context_destroy(self.ctx);
+            }
         }
     }
 }
 
+fn register_with(ctx: *mut V4FrontContext, name: &str, vm_word_idx: i32) -> Result<(), String> {
+    let c_name = CString::new(name).map_err(|e| e.to_string())?;
+    let result = {
+        let _library = v4front_ffi::lock();
+        unsafe { v4front_context_register_word(ctx, c_name.as_ptr(), vm_word_idx) }
+    };
+    if result < 0 {
+        return Err(format!(
+            "Failed to register word '{}' with index {}",
+            name, vm_word_idx
+        ));
+    }
+    Ok(())
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -241,6 +512,104 @@ mod tests {
         assert!(result2.is_ok());
     }
 
+    #[test]
+    fn test_snapshot_restore() {
+        let mut compiler = Compiler::new().unwrap();
+        compiler.compile(": SQUARE DUP * ;").unwrap();
+        compiler.register_word_index("SQUARE", 3).unwrap();
+
+        let snapshot = compiler.snapshot();
+        assert_eq!(snapshot.words(), &[("SQUARE".to_string(), 3)]);
+
+        // A new session calls the word without recompiling it
+        let mut restored = Compiler::new().unwrap();
+        restored.restore(&snapshot).unwrap();
+        assert!(restored.compile("5 SQUARE").is_ok());
+
+        restored.reset();
+        assert!(restored.snapshot().is_empty());
+    }
+
+    #[test]
+    fn test_word_bytecode() {
+        let mut compiler = Compiler::new().unwrap();
+        let compiled = compiler.compile(": SQUARE DUP * ;").unwrap();
+        assert!(compiler.word_index("SQUARE").is_none());
+        compiler.register_word_index("SQUARE", 3).unwrap();
+
+        assert_eq!(compiler.word_index("SQUARE"), Some(3));
+        assert_eq!(compiler.word_name(3), Some("SQUARE"));
+        assert_eq!(
+            compiler.word_bytecode(3),
+            Some(&compiled.words[0].bytecode[..])
+        );
+
+        // Restored words have no bytecode until it is read from the device
+        compiler.register_word_index("CUBE", 4).unwrap();
+        assert!(compiler.word_bytecode(4).is_none());
+        compiler.remember_bytecode(4, &[0x51]);
+        assert_eq!(compiler.word_bytecode(4), Some(&[0x51][..]));
+
+        compiler.reset();
+        assert!(compiler.word_bytecode(3).is_none());
+        assert!(compiler.word_index("SQUARE").is_none());
+    }
+
+    #[test]
+    fn test_lazy_context() {
+        let mut compiler = Compiler::new().unwrap();
+        compiler.register_word_index("SQUARE", 3).unwrap();
+        assert!(compiler.register_word_index("BAD\0", 4).is_err());
+        compiler.reset();
+        compiler.register_word_index("SQUARE", 3).unwrap();
+        assert!(!compiler.is_initialized());
+
+        // The first compilation creates the context with the word in it
+        assert!(compiler.compile("5 SQUARE").is_ok());
+        assert!(compiler.is_initialized());
+        assert_eq!(compiler.snapshot().words(), &[("SQUARE".to_string(), 3)]);
+    }
+
+    #[test]
+    fn test_compile_with_borrows_output() {
+        let mut compiler = Compiler::new().unwrap();
+        let owned = compiler.compile(": DOUBLE 2 * ; 3 DOUBLE").unwrap();
+        let (count, code) = compiler
+            .compile_with(": DOUBLE 2 * ; 3 DOUBLE", |view| {
+                (view.word_count(), view.bytecode().to_vec())
+            })
+            .unwrap();
+        assert_eq!(count, owned.words.len());
+        assert_eq!(code, owned.bytecode);
+        assert!(compiler.compile_with("1\0 2", |_| ()).is_err());
+    }
+
+    #[test]
+    fn test_compile_memo() {
+        let mut compiler = Compiler::new().unwrap();
+        let mut memo = CompileMemo::default();
+
+        let first = memo.compile(&mut compiler, "1 2 +").unwrap();
+        let again = memo.compile(&mut compiler, "1 2 +").unwrap();
+        assert!(Rc::ptr_eq(&first, &again));
+
+        // Definitions are not memoized and invalidate the memo
+        memo.compile(&mut compiler, ": SQUARE DUP * ;").unwrap();
+        let after = memo.compile(&mut compiler, "1 2 +").unwrap();
+        assert!(!Rc::ptr_eq(&first, &after));
+        assert_eq!(memo.len(), 1);
+
+        // So do registrations and resets
+        compiler.register_word_index("SQUARE", 0).unwrap();
+        assert!(!Rc::ptr_eq(
+            &after,
+            &memo.compile(&mut compiler, "1 2 +").unwrap()
+        ));
+        memo.compile(&mut compiler, "5 SQUARE").unwrap();
+        compiler.reset();
+        assert!(memo.compile(&mut compiler, "5 SQUARE").is_err());
+    }
+
     #[test]
     fn test_error_handling() {
         let mut compiler = Compiler::new().unwrap();
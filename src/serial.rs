@@ -1,24 +1,341 @@
-use crate::protocol::{Command, ErrorCode, Frame, Response};
+use crate::protocol::caps::{
+    FEATURE_CHUNKED_PUSH, FEATURE_COMPRESSED_CHUNK, FEATURE_SEQUENCED, HOST_FEATURES, LinkCaps,
+    MAX_LINK_MTU,
+};
+use crate::protocol::chunk::{self, Chunk};
+use crate::protocol::stack::{StackTracker, Stacks};
+use crate::protocol::stats::{self, VmStats};
+use crate::protocol::{
+    Command, ErrorCode, Frame, FrameDecoder, MAX_PAYLOAD_SIZE, Response, ResponseView,
+};
+use crate::trace::{self, Direction};
+use crate::transport::{self, Transport};
 use crate::{Result, V4Error};
-use serialport::SerialPort;
+use std::collections::{HashMap, VecDeque};
+use std::io;
+use std::ops::Range;
 use std::time::{Duration, Instant};
 
 /// Default baud rate for V4-link protocol
 pub const DEFAULT_BAUD_RATE: u32 = 115200;
 
-/// V4 Serial port wrapper
+/// Timeout for the CAPS exchange when opening a negotiated link
+const NEGOTIATE_TIMEOUT: Duration = Duration::from_secs(2);
+
+/// Smallest chunk an adaptive push shrinks to
+const MIN_ADAPTIVE_CHUNK: usize = 32;
+
+/// Link parameters requested by the user
+///
+/// When neither is set the link runs at the protocol defaults and no CAPS
+/// exchange takes place.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct LinkOptions {
+    /// Baud rate to switch to after negotiation
+    pub baud: Option<u32>,
+    /// Maximum payload size to negotiate
+    pub mtu: Option<usize>,
+    /// Negotiate even without `baud`/`mtu`, so that compressed chunk
+    /// transfers can be agreed on
+    pub compress: bool,
+}
+
+/// Byte counts of a finished image transfer
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct TransferStats {
+    /// Image bytes delivered
+    pub image_bytes: usize,
+    /// Payload bytes that carried them, after compression
+    pub wire_bytes: usize,
+}
+
+impl TransferStats {
+    /// Transfer with every image byte sent as is
+    pub fn uncompressed(image_bytes: usize) -> Self {
+        Self {
+            image_bytes,
+            wire_bytes: image_bytes,
+        }
+    }
+
+    /// Wire bytes per image byte (1.0 without compression)
+    pub fn ratio(&self) -> f64 {
+        if self.image_bytes == 0 {
+            1.0
+        } else {
+            self.wire_bytes as f64 / self.image_bytes as f64
+        }
+    }
+}
+
+/// Largest block the device returns for one QUERY_MEMORY
+pub const MEMORY_BLOCK_SIZE: usize = 256;
+
+/// Most sequenced requests [`V4Serial::pipeline`] keeps outstanding (one
+/// per SEQ value)
+pub const SEQ_WINDOW: usize = 256;
+
+/// Options for segmented (chunked) transfers
+///
+/// Used by [`V4Serial::push_chunked`].
+#[derive(Debug, Clone, Copy)]
+pub struct PushOptions {
+    /// Image bytes per PUSH_CHUNK frame (default: as many as fit the link MTU)
+    pub chunk_size: Option<usize>,
+    /// Number of frames kept in flight before waiting for a response
+    pub window: usize,
+    /// Deepest window an adaptive push grows to (default: `window`)
+    pub max_window: Option<usize>,
+    /// Retransmissions allowed per chunk before the transfer is aborted
+    pub max_retries: u32,
+    /// Timeout for each individual response
+    pub timeout: Duration,
+    /// Adapt chunk size and window to link quality during the transfer
+    /// (see [`V4Serial::push_chunked`]); `chunk_size` and `window` are
+    /// then the starting point
+    pub adaptive: bool,
+}
+
+impl Default for PushOptions {
+    fn default() -> Self {
+        Self {
+            chunk_size: None,
+            window: 4,
+            max_window: None,
+            max_retries: 8,
+            timeout: Duration::from_secs(5),
+            adaptive: true,
+        }
+    }
+}
+
+/// Options for [`V4Serial::read_memory`]
+#[derive(Debug, Clone, Copy)]
+pub struct ReadOptions {
+    /// Bytes per QUERY_MEMORY request (default and maximum:
+    /// [`MEMORY_BLOCK_SIZE`], or less if the link MTU is smaller)
+    pub block_size: Option<usize>,
+    /// Number of requests kept in flight before waiting for a response
+    pub window: usize,
+    /// Retransmissions allowed per block before the read is aborted
+    pub max_retries: u32,
+    /// Timeout for each individual response
+    pub timeout: Duration,
+}
+
+impl Default for ReadOptions {
+    fn default() -> Self {
+        Self {
+            block_size: None,
+            window: 4,
+            max_retries: 8,
+            timeout: Duration::from_secs(5),
+        }
+    }
+}
+
+/// Retries of idempotent commands whose response was corrupted or lost
+///
+/// Applies to [`V4Serial::send_command`] and the commands built on it.
+/// EXEC, PUSH_END, CAPS and resetting QUERY_STATS change device state and
+/// are never sent twice.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct RetryPolicy {
+    /// Attempts after the first one
+    pub max_retries: u32,
+    /// Wait before the first retry; doubled for each further one
+    pub backoff: Duration,
+    /// Longest wait between attempts
+    pub max_backoff: Duration,
+}
+
+impl Default for RetryPolicy {
+    fn default() -> Self {
+        Self {
+            max_retries: 2,
+            backoff: Duration::from_millis(10),
+            max_backoff: Duration::from_millis(200),
+        }
+    }
+}
+
+impl RetryPolicy {
+    /// Never retry
+    pub fn none() -> Self {
+        Self {
+            max_retries: 0,
+            ..Self::default()
+        }
+    }
+
+    /// Wait before retry number `attempt` (from 1)
+    pub fn delay(&self, attempt: u32) -> Duration {
+        self.backoff
+            .saturating_mul(1 << attempt.saturating_sub(1).min(16))
+            .min(self.max_backoff)
+    }
+}
+
+/// Link quality counters of a connection
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct LinkStats {
+    /// Frames written
+    pub frames_sent: u64,
+    /// Response frames received intact
+    pub frames_received: u64,
+    /// Responses that failed the CRC check
+    pub crc_errors: u64,
+    /// Responses that did not arrive in time
+    pub timeouts: u64,
+    /// Commands and chunks sent again
+    pub retries: u64,
+    /// Smoothed round-trip time of single commands
+    pub srtt: Option<Duration>,
+    /// Slowest round trip seen
+    pub max_rtt: Duration,
+}
+
+impl LinkStats {
+    /// Share of expected responses that were corrupted or lost
+    pub fn error_rate(&self) -> f64 {
+        let bad = self.crc_errors + self.timeouts;
+        let total = bad + self.frames_received;
+        if total == 0 {
+            0.0
+        } else {
+            bad as f64 / total as f64
+        }
+    }
+
+    /// Whether any response was corrupted or lost
+    pub fn had_errors(&self) -> bool {
+        self.crc_errors + self.timeouts > 0
+    }
+
+    fn record_rtt(&mut self, rtt: Duration) {
+        // Same 1/8 gain as TCP's SRTT
+        self.srtt = Some(match self.srtt {
+            Some(srtt) => (srtt * 7 + rtt) / 8,
+            None => rtt,
+        });
+        self.max_rtt = self.max_rtt.max(rtt);
+    }
+}
+
+/// Whether sending `command` twice leaves the device as sending it once
+fn is_idempotent(command: Command, payload: &[u8]) -> bool {
+    match command {
+        Command::Ping
+        | Command::Reset
+        | Command::QueryStack
+        | Command::QueryStackDelta
+        | Command::QueryMemory
+        | Command::QueryWord
+        | Command::PushBegin
+        | Command::PushChunk
+        | Command::PushChunkZ => true,
+        // A request without flags reads without resetting
+        Command::QueryStats => payload.first().is_none_or(|f| f & stats::STATS_RESET == 0),
+        Command::Exec | Command::PushEnd | Command::Caps => false,
+    }
+}
+
+/// AIMD control of chunk size and window depth during a segmented push
+///
+/// Corrupted frames halve the chunk size for chunks not yet cut; device
+/// back-pressure and lost frames halve the window. Each run of clean acks
+/// as long as the window grows both back additively, up to their limits.
+#[derive(Debug, Clone, Copy)]
+struct Aimd {
+    chunk: usize,
+    max_chunk: usize,
+    window: usize,
+    max_window: usize,
+    /// Clean acks since the last change
+    clean: usize,
+    adaptive: bool,
+}
+
+impl Aimd {
+    fn new(chunk: usize, window: usize, max_window: Option<usize>, adaptive: bool) -> Self {
+        let window = window.max(1);
+        Self {
+            chunk,
+            max_chunk: chunk,
+            window,
+            max_window: match max_window {
+                Some(max) if adaptive => max.max(window),
+                _ => window,
+            },
+            clean: 0,
+            adaptive,
+        }
+    }
+
+    fn on_ack(&mut self) {
+        if !self.adaptive {
+            return;
+        }
+        self.clean += 1;
+        if self.clean >= self.window {
+            self.clean = 0;
+            self.window = (self.window + 1).min(self.max_window);
+            self.chunk = (self.chunk + self.max_chunk.div_ceil(8)).min(self.max_chunk);
+        }
+    }
+
+    fn on_corrupt(&mut self) {
+        if self.adaptive {
+            self.clean = 0;
+            self.chunk = (self.chunk / 2).max(MIN_ADAPTIVE_CHUNK.min(self.max_chunk));
+        }
+    }
+
+    fn on_congestion(&mut self) {
+        if self.adaptive {
+            self.clean = 0;
+            self.window = (self.window / 2).max(1);
+        }
+    }
+}
+
+/// V4-link connection
+///
+/// Usually a serial port; see [`V4Serial::open_with`] for connections
+/// through a running `v4 daemon`.
 pub struct V4Serial {
-    port: Box<dyn SerialPort>,
+    port: Box<dyn Transport>,
+    rx: FrameDecoder,
+    /// Encode buffer reused for every outgoing frame
+    tx: Vec<u8>,
+    caps: LinkCaps,
+    /// Whether `caps` came from a CAPS exchange
+    negotiated: bool,
+    retry: RetryPolicy,
+    stats: LinkStats,
 }
 
 impl V4Serial {
-    /// Open a serial port
+    /// Open a serial port, TCP endpoint or simulator (see
+    /// [`transport::open`])
     pub fn open(path: &str, baud_rate: u32) -> Result<Self> {
-        let port = serialport::new(path, baud_rate)
-            .timeout(Duration::from_secs(5))
-            .open()?;
+        let port = transport::open(path, baud_rate)?;
+        Ok(Self::from_transport(port, baud_rate))
+    }
 
-        Ok(Self { port })
+    /// Run the protocol over an already connected transport
+    ///
+    /// `baud_rate` is only recorded in [`V4Serial::caps`].
+    pub fn from_transport(port: Box<dyn Transport>, baud_rate: u32) -> Self {
+        Self {
+            port,
+            rx: FrameDecoder::default(),
+            tx: Vec::with_capacity(MAX_PAYLOAD_SIZE + 5),
+            caps: LinkCaps::baseline(baud_rate),
+            negotiated: false,
+            retry: RetryPolicy::default(),
+            stats: LinkStats::default(),
+        }
     }
 
     /// Open with default baud rate
@@ -26,111 +343,395 @@ impl V4Serial {
         Self::open(path, DEFAULT_BAUD_RATE)
     }
 
+    /// Connect to the device at `path` and negotiate the requested link
+    /// parameters, if any
+    ///
+    /// If a `v4 daemon` owns the port, the connection goes through its
+    /// socket instead of reopening the port, which would toggle DTR and
+    /// reboot many USB-CDC boards. Set `V4_NO_DAEMON=1` to always open the
+    /// port directly.
+    pub fn open_with(path: &str, link: &LinkOptions) -> Result<Self> {
+        #[cfg(unix)]
+        if let Some(stream) = crate::daemon::connect(path) {
+            crate::trace!(trace::Level::Info, "Connected to {} via daemon", path);
+            let mut serial = Self::from_transport(Box::new(stream), DEFAULT_BAUD_RATE);
+            serial.negotiate_requested(link)?;
+            return Ok(serial);
+        }
+        Self::open_direct(path, link)
+    }
+
+    /// Open the port itself at the default baud rate, bypassing any daemon,
+    /// and negotiate the requested link parameters
+    pub fn open_direct(path: &str, link: &LinkOptions) -> Result<Self> {
+        let mut serial = Self::open_default(path)?;
+        serial.negotiate_requested(link)?;
+        Ok(serial)
+    }
+
+    fn negotiate_requested(&mut self, link: &LinkOptions) -> Result<()> {
+        if link.baud.is_some() || link.mtu.is_some() || link.compress {
+            self.negotiate(
+                link.baud.unwrap_or(DEFAULT_BAUD_RATE),
+                link.mtu.unwrap_or(MAX_PAYLOAD_SIZE),
+                NEGOTIATE_TIMEOUT,
+            )?;
+        }
+        Ok(())
+    }
+
+    /// Agree on baud rate, maximum payload and features with the device
+    ///
+    /// The CAPS exchange runs at the current baud rate. The device switches
+    /// after sending its answer; the host switches once it has received it.
+    pub fn negotiate(&mut self, baud: u32, mtu: usize, timeout: Duration) -> Result<LinkCaps> {
+        let requested = LinkCaps {
+            baud,
+            mtu: mtu.clamp(MAX_PAYLOAD_SIZE, MAX_LINK_MTU),
+            features: HOST_FEATURES,
+        };
+
+        let response = self.send_command(Command::Caps, &requested.encode(), timeout)?;
+        if response.error_code != ErrorCode::Ok {
+            return Err(V4Error::Device(format!(
+                "Link negotiation rejected: {}",
+                response.error_code.name()
+            )));
+        }
+        let agreed = LinkCaps::parse(&response.data)
+            .ok_or_else(|| V4Error::Protocol("Malformed CAPS response".to_string()))?
+            .limit_to(&requested);
+
+        self.apply_caps(agreed)?;
+
+        crate::trace!(
+            trace::Level::Info,
+            "Link negotiated: {} baud, MTU {} bytes, features {:#06x}",
+            agreed.baud,
+            agreed.mtu,
+            agreed.features
+        );
+        Ok(agreed)
+    }
+
+    /// Switch to capabilities agreed in a CAPS exchange
+    ///
+    /// Changes the local baud rate and resizes the receive buffer. Called
+    /// by [`V4Serial::negotiate`]. Capabilities with an MTU below
+    /// [`MAX_PAYLOAD_SIZE`] are rejected and leave the link unchanged.
+    pub fn apply_caps(&mut self, agreed: LinkCaps) -> Result<()> {
+        agreed.check()?;
+        if agreed.baud != self.caps.baud {
+            self.port.set_baud_rate(agreed.baud)?;
+            // Let the device finish switching before the next frame
+            std::thread::sleep(Duration::from_millis(10));
+            self.clear_input()?;
+        }
+        if agreed.mtu != self.caps.mtu {
+            self.rx = FrameDecoder::new(agreed.mtu);
+        }
+        self.caps = agreed;
+        self.negotiated = true;
+        Ok(())
+    }
+
+    /// Capabilities currently in effect
+    pub fn caps(&self) -> &LinkCaps {
+        &self.caps
+    }
+
+    /// Maximum payload size of a single frame on this link
+    pub fn max_payload(&self) -> usize {
+        self.caps.mtu
+    }
+
+    /// Whether the capabilities in effect came from a CAPS exchange
+    pub fn is_negotiated(&self) -> bool {
+        self.negotiated
+    }
+
+    /// Whether segmented pushes can be used
+    ///
+    /// Devices that were never asked with CAPS are assumed to accept them,
+    /// as before link negotiation existed.
+    pub fn chunked_push_supported(&self) -> bool {
+        !self.negotiated || self.caps.has(FEATURE_CHUNKED_PUSH)
+    }
+
+    /// Link quality counters since the connection was opened
+    pub fn link_stats(&self) -> &LinkStats {
+        &self.stats
+    }
+
+    /// Retry policy for idempotent commands
+    pub fn retry_policy(&self) -> &RetryPolicy {
+        &self.retry
+    }
+
+    /// Replace the retry policy
+    pub fn set_retry_policy(&mut self, retry: RetryPolicy) {
+        self.retry = retry;
+    }
+
     /// Send a frame
     pub fn send_frame(&mut self, frame: &Frame) -> Result<()> {
-        let encoded = frame.encode();
-        eprintln!("DEBUG: Sending frame ({} bytes): {:02X?}", encoded.len(), encoded);
-        self.port.write_all(&encoded)?;
+        self.send_payload(frame.command, &frame.payload)
+    }
+
+    /// Send a frame built from a borrowed payload
+    ///
+    /// The frame is encoded into the connection's write buffer, so no
+    /// allocation happens once the buffer has grown to the link MTU.
+    pub fn send_payload(&mut self, command: Command, payload: &[u8]) -> Result<()> {
+        self.check_payload(payload)?;
+        Frame::encode_into(command, payload, &mut self.tx);
+        trace::frame(Direction::Tx, &self.tx);
+        self.port.write_all(&self.tx)?;
         self.port.flush()?;
+        self.stats.frames_sent += 1;
+        Ok(())
+    }
+
+    /// Send a sequenced frame; the response carries the same `seq`
+    ///
+    /// Only valid once [`FEATURE_SEQUENCED`] has been agreed.
+    pub fn send_sequenced(&mut self, seq: u8, command: Command, payload: &[u8]) -> Result<()> {
+        self.check_payload(payload)?;
+        Frame::encode_seq_into(seq, command, payload, &mut self.tx);
+        trace::frame(Direction::Tx, &self.tx);
+        self.port.write_all(&self.tx)?;
+        self.port.flush()?;
+        self.stats.frames_sent += 1;
+        Ok(())
+    }
+
+    fn check_payload(&self, payload: &[u8]) -> Result<()> {
+        if payload.len() > self.caps.mtu {
+            return Err(V4Error::Protocol(format!(
+                "Payload too large: {} bytes (max {})",
+                payload.len(),
+                self.caps.mtu
+            )));
+        }
+        Ok(())
+    }
+
+    /// Send an already encoded frame unchanged
+    pub fn send_raw(&mut self, frame: &[u8]) -> Result<()> {
+        trace::frame(Direction::Tx, frame);
+        self.port.write_all(frame)?;
+        self.port.flush()?;
+        self.stats.frames_sent += 1;
+        Ok(())
+    }
+
+    /// Send already encoded frames, stored back to back in `frames` at
+    /// `ranges`, with a single write
+    pub fn send_raw_batch(&mut self, frames: &[u8], ranges: &[Range<usize>]) -> Result<()> {
+        for range in ranges {
+            trace::frame(Direction::Tx, &frames[range.clone()]);
+        }
+        self.port.write_all(frames)?;
+        self.port.flush()?;
+        self.stats.frames_sent += ranges.len() as u64;
         Ok(())
     }
 
     /// Receive response with timeout
+    ///
+    /// Blocks on the port until bytes arrive or the deadline passes, and
+    /// feeds them to the connection's [`FrameDecoder`]. Bytes read past the
+    /// end of the returned frame stay buffered for the next call, so
+    /// pipelined responses that arrive back to back are not lost.
     pub fn recv_response(&mut self, timeout: Duration) -> Result<Vec<u8>> {
-        const STX: u8 = 0xA5;
-        let start = Instant::now();
-        let mut buffer = Vec::new();
-
-        // Read bytes until we find STX or timeout
-        while start.elapsed() < timeout {
-            let available = self.port.bytes_to_read()? as usize;
-            if available > 0 {
-                let mut buf = vec![0u8; available];
-                let n = self.port.read(&mut buf)?;
-                buffer.extend_from_slice(&buf[..n]);
-
-                // Search for STX
-                if let Some(pos) = buffer.iter().position(|&b| b == STX) {
-                    // Found STX, need to read header first to get frame length
-                    let mut response = vec![STX];
-                    let mut remaining_start = pos + 1;
-
-                    // Read at least 4 bytes to get LEN field: STX + LEN_L + LEN_H + ERR_CODE
-                    while response.len() < 4 && start.elapsed() < timeout {
-                        if remaining_start < buffer.len() {
-                            let to_copy =
-                                std::cmp::min(4 - response.len(), buffer.len() - remaining_start);
-                            response.extend_from_slice(
-                                &buffer[remaining_start..remaining_start + to_copy],
-                            );
-                            remaining_start += to_copy;
-                        } else {
-                            // Need to read more data
-                            let available = self.port.bytes_to_read()? as usize;
-                            if available > 0 {
-                                let mut buf = vec![0u8; available];
-                                let n = self.port.read(&mut buf)?;
-                                buffer.extend_from_slice(&buf[..n]);
-                            } else {
-                                std::thread::sleep(Duration::from_millis(20));
-                            }
-                        }
-                    }
+        self.recv_frame(timeout).map(<[u8]>::to_vec)
+    }
+
+    /// Receive a response and decode it in place
+    ///
+    /// The view borrows the connection's receive buffer and is valid until
+    /// the next call on this connection.
+    pub fn recv_view(&mut self, timeout: Duration) -> Result<ResponseView<'_>> {
+        let frame = self.recv_frame(timeout)?;
+        Frame::decode_view(frame)
+    }
+
+    /// Receive one raw response frame (CRC already verified)
+    pub fn recv_frame(&mut self, timeout: Duration) -> Result<&[u8]> {
+        let deadline = Instant::now() + timeout;
 
-                    if response.len() >= 4 {
-                        // Parse length field to determine total frame size
-                        let payload_len = u16::from_le_bytes([response[1], response[2]]) as usize;
-                        let total_frame_len = 1 + 2 + payload_len + 1; // STX + LEN(2) + PAYLOAD + CRC
-
-                        // Continue reading until we have the complete frame
-                        while response.len() < total_frame_len && start.elapsed() < timeout {
-                            if remaining_start < buffer.len() {
-                                let to_copy = std::cmp::min(
-                                    total_frame_len - response.len(),
-                                    buffer.len() - remaining_start,
-                                );
-                                response.extend_from_slice(
-                                    &buffer[remaining_start..remaining_start + to_copy],
-                                );
-                                remaining_start += to_copy;
-                            } else {
-                                // Need to read more data
-                                let available = self.port.bytes_to_read()? as usize;
-                                if available > 0 {
-                                    let mut buf = vec![0u8; available];
-                                    let n = self.port.read(&mut buf)?;
-                                    buffer.extend_from_slice(&buf[..n]);
-                                } else {
-                                    std::thread::sleep(Duration::from_millis(20));
-                                }
-                            }
-                        }
-
-                        if response.len() == total_frame_len {
-                            eprintln!("DEBUG: Received complete frame ({} bytes): {:02X?}", response.len(), response);
-                            return Ok(response);
-                        }
+        loop {
+            if let Some(range) = self.rx.next_frame_range() {
+                let range = range.inspect_err(|e| {
+                    if matches!(e, V4Error::CrcMismatch { .. }) {
+                        self.stats.crc_errors += 1;
                     }
+                })?;
+                self.stats.frames_received += 1;
+                let frame = self.rx.frame_at(range);
+                trace::frame(Direction::Rx, frame);
+                return Ok(frame);
+            }
+
+            let remaining = deadline.saturating_duration_since(Instant::now());
+            if remaining.is_zero() {
+                self.stats.timeouts += 1;
+                return Err(V4Error::Timeout);
+            }
+
+            self.port.set_timeout(remaining)?;
+            let spare = self.rx.spare();
+            let wanted = spare.len();
+            match self.port.read(spare) {
+                // The far end closed the stream (TCP bridge, daemon socket)
+                Ok(0) if wanted > 0 => {
+                    return Err(io::Error::from(io::ErrorKind::UnexpectedEof).into());
                 }
+                Ok(n) => self.rx.commit(n),
+                Err(e)
+                    if matches!(
+                        e.kind(),
+                        io::ErrorKind::TimedOut
+                            | io::ErrorKind::WouldBlock
+                            | io::ErrorKind::Interrupted
+                    ) => {}
+                Err(e) => return Err(e.into()),
             }
-            std::thread::sleep(Duration::from_millis(20));
         }
+    }
 
-        Err(V4Error::Timeout)
+    /// Discard buffered and unread input
+    ///
+    /// Used after a timeout so that late responses are not matched to the
+    /// wrong request.
+    pub fn clear_input(&mut self) -> Result<()> {
+        self.rx.clear();
+        self.port.clear_input()?;
+        Ok(())
     }
 
     /// Send command and wait for response
+    ///
+    /// Idempotent commands whose response fails the CRC check or times out
+    /// are sent again according to the [`RetryPolicy`]; a device that does
+    /// not answer at all therefore takes `max_retries + 1` timeouts to
+    /// fail.
     pub fn send_command(
         &mut self,
         command: Command,
         payload: &[u8],
         timeout: Duration,
     ) -> Result<Response> {
-        let frame = Frame::new(command, payload.to_vec())?;
-        self.send_frame(&frame)?;
+        let mut attempt = 0;
+        loop {
+            let started = Instant::now();
+            match self
+                .send_view(command, payload, timeout)
+                .map(Response::from)
+            {
+                Ok(response) => {
+                    self.stats.record_rtt(started.elapsed());
+                    return Ok(response);
+                }
+                Err(e @ (V4Error::CrcMismatch { .. } | V4Error::Timeout))
+                    if attempt < self.retry.max_retries && is_idempotent(command, payload) =>
+                {
+                    attempt += 1;
+                    self.stats.retries += 1;
+                    crate::trace!(
+                        trace::Level::Info,
+                        "Retrying {:?} after {} (attempt {})",
+                        command,
+                        e,
+                        attempt
+                    );
+                    std::thread::sleep(self.retry.delay(attempt));
+                    self.clear_input()?;
+                }
+                Err(e) => return Err(e),
+            }
+        }
+    }
+
+    /// Send command and borrow the response from the receive buffer
+    pub fn send_view(
+        &mut self,
+        command: Command,
+        payload: &[u8],
+        timeout: Duration,
+    ) -> Result<ResponseView<'_>> {
+        self.send_payload(command, payload)?;
+        self.recv_view(timeout)
+    }
+
+    /// Send several commands with up to `window` outstanding and return
+    /// their responses in request order
+    ///
+    /// With [`FEATURE_SEQUENCED`] agreed, every request is sent as a
+    /// sequenced frame and responses are matched by SEQ: the device may
+    /// answer out of order, and stray or duplicate responses are dropped
+    /// instead of shifting every later match. Otherwise the device answers
+    /// in order and each response belongs to the oldest outstanding request.
+    ///
+    /// Requests are not retransmitted, since EXEC is not idempotent. If a
+    /// response does not arrive within `timeout`, input is cleared and the
+    /// pipeline fails with [`V4Error::Timeout`].
+    pub fn pipeline(
+        &mut self,
+        requests: &[(Command, &[u8])],
+        window: usize,
+        timeout: Duration,
+    ) -> Result<Vec<Response>> {
+        let sequenced = self.caps.has(FEATURE_SEQUENCED);
+        // SEQ is one byte; it must stay unique among outstanding requests
+        let window = if sequenced {
+            window.clamp(1, SEQ_WINDOW)
+        } else {
+            window.max(1)
+        };
+        let mut responses: Vec<Option<Response>> = vec![None; requests.len()];
+        let mut in_flight: VecDeque<usize> = VecDeque::with_capacity(window);
+        let mut next = 0;
+
+        while next < requests.len() || !in_flight.is_empty() {
+            while next < requests.len() && in_flight.len() < window {
+                let (command, payload) = requests[next];
+                if sequenced {
+                    self.send_sequenced(next as u8, command, payload)?;
+                } else {
+                    self.send_payload(command, payload)?;
+                }
+                in_flight.push_back(next);
+                next += 1;
+            }
+
+            let view = match self.recv_view(timeout) {
+                Ok(view) => view,
+                // Can't tell which request a corrupt sequenced response
+                // answered; its request runs into the timeout
+                Err(V4Error::CrcMismatch { .. }) if sequenced => continue,
+                Err(V4Error::Timeout) => {
+                    self.clear_input()?;
+                    return Err(V4Error::Timeout);
+                }
+                Err(e) => return Err(e),
+            };
+            let pos = if sequenced {
+                let seq = view.seq;
+                match in_flight.iter().position(|&i| Some(i as u8) == seq) {
+                    Some(pos) => pos,
+                    None => continue,
+                }
+            } else {
+                0
+            };
+            let response = Response::from(view);
+            if let Some(index) = in_flight.remove(pos) {
+                responses[index] = Some(response);
+            }
+        }
 
-        let response = self.recv_response(timeout)?;
-        Frame::decode_response(&response)
+        Ok(responses.into_iter().flatten().collect())
     }
 
     /// Send PING command
@@ -148,19 +749,364 @@ impl V4Serial {
         self.send_command(Command::Exec, bytecode, timeout)
     }
 
+    /// Send an image larger than one frame as a segmented transfer
+    ///
+    /// The image is announced with PUSH_BEGIN, streamed as PUSH_CHUNK frames
+    /// with up to `opts.window` frames in flight, and executed by PUSH_END.
+    /// The device answers chunks in order, so each response is matched to
+    /// the oldest outstanding chunk. Chunks rejected with BUFFER_FULL or
+    /// INVALID_FRAME, or whose ack fails the CRC check, are retransmitted
+    /// individually; a timeout retransmits everything still in flight.
+    ///
+    /// With `opts.adaptive`, chunk size and window follow the link (AIMD):
+    /// corrupted frames halve the size of chunks not cut yet, BUFFER_FULL
+    /// and lost frames halve the window, and clean acks grow both back, the
+    /// window up to `opts.max_window` (default: `opts.window`) frames.
+    /// Clean links run at full size throughout.
+    ///
+    /// If the device agreed to [`FEATURE_COMPRESSED_CHUNK`], every chunk
+    /// that gets smaller is sent LZSS-compressed as PUSH_CHUNK_Z. Each
+    /// chunk is compressed once, when it is cut.
+    ///
+    /// A device that answered CAPS without [`FEATURE_CHUNKED_PUSH`] gets
+    /// the image as one EXEC frame instead, if it fits.
+    ///
+    /// `on_progress` is called with the size of every acknowledged chunk.
+    pub fn push_chunked<F>(
+        &mut self,
+        image: &[u8],
+        opts: &PushOptions,
+        mut on_progress: F,
+    ) -> Result<(Response, TransferStats)>
+    where
+        F: FnMut(usize),
+    {
+        if !self.chunked_push_supported() {
+            if image.len() > self.caps.mtu {
+                return Err(V4Error::Device(format!(
+                    "Image of {} bytes exceeds one {}-byte frame and the device does not support segmented push",
+                    image.len(),
+                    self.caps.mtu
+                )));
+            }
+            let response = self.exec(image, opts.timeout)?;
+            on_progress(image.len());
+            return Ok((response, TransferStats::uncompressed(image.len())));
+        }
+
+        let begin = self.send_command(
+            Command::PushBegin,
+            &chunk::begin_payload(image),
+            opts.timeout,
+        )?;
+        if begin.error_code != ErrorCode::Ok {
+            return Err(V4Error::Device(format!(
+                "Segmented transfer rejected: {}",
+                begin.error_code.name()
+            )));
+        }
+
+        let max_chunk = self.caps.mtu - chunk::CHUNK_HEADER_SIZE;
+        let chunk_size = opts.chunk_size.unwrap_or(max_chunk).clamp(1, max_chunk);
+        let mut control = Aimd::new(chunk_size, opts.window, opts.max_window, opts.adaptive);
+        let compress = self.caps.has(FEATURE_COMPRESSED_CHUNK);
+
+        // Chunks are cut as they are first sent, at the size in effect then
+        let mut chunks: Vec<Chunk> = Vec::new();
+        let mut cut = 0;
+        let mut retries: Vec<u32> = Vec::new();
+        let mut in_flight: VecDeque<usize> = VecDeque::with_capacity(control.max_window);
+        let mut retransmit: VecDeque<usize> = VecDeque::new();
+        let mut payload = Vec::with_capacity(self.caps.mtu);
+        let mut scratch = Vec::new();
+        let mut acked = 0;
+
+        // Compressed payloads of the chunks that shrink, back to back
+        let mut packed = Vec::new();
+        let mut packed_at: Vec<Option<Range<usize>>> = Vec::new();
+        let mut stats = TransferStats {
+            image_bytes: image.len(),
+            wire_bytes: 0,
+        };
+
+        while acked < chunks.len() || cut < image.len() {
+            // Fill the window, retransmissions first
+            while in_flight.len() < control.window {
+                let idx = match retransmit.pop_front() {
+                    Some(idx) => idx,
+                    None if cut < image.len() => {
+                        let len = control.chunk.min(image.len() - cut);
+                        let chunk = Chunk {
+                            offset: cut as u32,
+                            data: &image[cut..cut + len],
+                        };
+                        cut += len;
+                        let range = (compress
+                            && chunk.encode_compressed_into(&mut payload, &mut scratch))
+                        .then(|| {
+                            packed.extend_from_slice(&payload);
+                            packed.len() - payload.len()..packed.len()
+                        });
+                        packed_at.push(range);
+                        chunks.push(chunk);
+                        retries.push(0);
+                        chunks.len() - 1
+                    }
+                    None => break,
+                };
+                match packed_at[idx].clone() {
+                    Some(range) => self.send_payload(Command::PushChunkZ, &packed[range])?,
+                    None => {
+                        chunks[idx].encode_into(&mut payload);
+                        self.send_payload(Command::PushChunk, &payload)?;
+                    }
+                }
+                in_flight.push_back(idx);
+            }
+
+            let idx = in_flight
+                .pop_front()
+                .expect("window holds at least one chunk while acks are pending");
+            let mut failed = Vec::new();
+
+            match self.recv_view(opts.timeout) {
+                Ok(response) if response.error_code == ErrorCode::Ok => {
+                    acked += 1;
+                    stats.wire_bytes += match &packed_at[idx] {
+                        Some(range) => range.len() - chunk::COMPRESSED_CHUNK_HEADER_SIZE,
+                        None => chunks[idx].data.len(),
+                    };
+                    on_progress(chunks[idx].data.len());
+                    control.on_ack();
+                }
+                Ok(response) if response.error_code == ErrorCode::BufferFull => {
+                    // Give the device time to drain its receive queue
+                    std::thread::sleep(Duration::from_millis(5));
+                    control.on_congestion();
+                    failed.push(idx);
+                }
+                Ok(response) if response.error_code == ErrorCode::InvalidFrame => {
+                    control.on_corrupt();
+                    failed.push(idx);
+                }
+                Ok(response) => {
+                    return Err(V4Error::Device(format!(
+                        "Chunk at offset {} failed: {}",
+                        chunks[idx].offset,
+                        response.error_code.name()
+                    )));
+                }
+                Err(V4Error::CrcMismatch { .. }) => {
+                    control.on_corrupt();
+                    failed.push(idx);
+                }
+                Err(V4Error::Timeout) => {
+                    // A frame or its ack was lost; acks for the rest of the
+                    // window can no longer be matched by position
+                    control.on_congestion();
+                    control.on_corrupt();
+                    failed.push(idx);
+                    failed.extend(in_flight.drain(..));
+                    self.clear_input()?;
+                }
+                Err(e) => return Err(e),
+            }
+
+            for idx in failed {
+                retries[idx] += 1;
+                self.stats.retries += 1;
+                if retries[idx] > opts.max_retries {
+                    return Err(V4Error::Protocol(format!(
+                        "Chunk at offset {} failed after {} retries",
+                        chunks[idx].offset, opts.max_retries
+                    )));
+                }
+                crate::trace!(
+                    trace::Level::Info,
+                    "Retransmitting chunk at offset {} (attempt {}); now {} byte chunks, window {}",
+                    chunks[idx].offset,
+                    retries[idx],
+                    control.chunk,
+                    control.window
+                );
+                retransmit.push_back(idx);
+            }
+        }
+
+        let response =
+            self.send_command(Command::PushEnd, &chunk::end_payload(image), opts.timeout)?;
+        Ok((response, stats))
+    }
+
     /// Query stack state (data stack + return stack)
     pub fn query_stack(&mut self, timeout: Duration) -> Result<Response> {
         self.send_command(Command::QueryStack, &[], timeout)
     }
 
+    /// Read both stacks with QUERY_STACK
+    pub fn stacks(&mut self, timeout: Duration) -> Result<Stacks> {
+        let response = self.query_stack(timeout)?;
+        if response.error_code != ErrorCode::Ok {
+            return Err(V4Error::Device(format!(
+                "Query stack failed: {}",
+                response.error_code.name()
+            )));
+        }
+        Stacks::parse(&response.data)
+            .ok_or_else(|| V4Error::Protocol("Malformed QUERY_STACK response".to_string()))
+    }
+
+    /// Read both stacks, transferring only the cells changed since
+    /// `tracker`'s last snapshot
+    ///
+    /// A device that rejects QUERY_STACK_DELTA is read with QUERY_STACK
+    /// instead, and `tracker` remembers not to try the delta query again.
+    pub fn query_stack_delta<'t>(
+        &mut self,
+        tracker: &'t mut StackTracker,
+        timeout: Duration,
+    ) -> Result<&'t Stacks> {
+        if tracker.supported != Some(false) {
+            let response =
+                self.send_command(Command::QueryStackDelta, &tracker.request(), timeout)?;
+            match response.error_code {
+                ErrorCode::Ok => {
+                    tracker.supported = Some(true);
+                    if tracker.apply(&response.data).is_none() {
+                        return Err(V4Error::Protocol(
+                            "Malformed QUERY_STACK_DELTA response".to_string(),
+                        ));
+                    }
+                    return Ok(tracker.stacks());
+                }
+                ErrorCode::InvalidFrame | ErrorCode::Error if tracker.supported.is_none() => {
+                    tracker.supported = Some(false);
+                }
+                code => {
+                    return Err(V4Error::Device(format!(
+                        "Query stack failed: {}",
+                        code.name()
+                    )));
+                }
+            }
+        }
+        let stacks = self.stacks(timeout)?;
+        tracker.set(stacks);
+        Ok(tracker.stacks())
+    }
+
     /// Query memory dump at address
     pub fn query_memory(&mut self, addr: u32, len: u16, timeout: Duration) -> Result<Response> {
-        let mut payload = Vec::with_capacity(6);
-        // Address (little-endian u32)
-        payload.extend_from_slice(&addr.to_le_bytes());
-        // Length (little-endian u16)
-        payload.extend_from_slice(&len.to_le_bytes());
-        self.send_command(Command::QueryMemory, &payload, timeout)
+        self.send_command(Command::QueryMemory, &memory_payload(addr, len), timeout)
+    }
+
+    /// Read `len` bytes of device memory starting at `addr`
+    ///
+    /// The range is split into QUERY_MEMORY requests of at most
+    /// [`MEMORY_BLOCK_SIZE`] bytes (`opts.block_size` to go smaller), with
+    /// up to `opts.window` requests in flight. Requests answered with
+    /// BUFFER_FULL or INVALID_FRAME, or whose response fails the CRC check,
+    /// are sent again, so `on_block` may see blocks out of address order.
+    ///
+    /// A block shorter than requested marks the end of readable memory:
+    /// nothing past it is requested. Returns the number of bytes read.
+    pub fn read_memory<F>(
+        &mut self,
+        addr: u32,
+        len: u32,
+        opts: &ReadOptions,
+        mut on_block: F,
+    ) -> Result<u32>
+    where
+        F: FnMut(u32, &[u8]) -> Result<()>,
+    {
+        let max_block = MEMORY_BLOCK_SIZE.min(self.caps.mtu);
+        let block = opts.block_size.unwrap_or(max_block).clamp(1, max_block) as u32;
+        let block_at = |idx: u32| {
+            let offset = idx * block;
+            (addr.wrapping_add(offset), block.min(len - offset) as u16)
+        };
+        let window = opts.window.max(1);
+        let mut end = len.div_ceil(block);
+        let mut retries: HashMap<u32, u32> = HashMap::new();
+        let mut in_flight: VecDeque<u32> = VecDeque::with_capacity(window);
+        let mut retransmit: VecDeque<u32> = VecDeque::new();
+        let mut next = 0;
+        let mut read = 0;
+
+        loop {
+            // Fill the window, retransmissions first
+            while in_flight.len() < window {
+                let idx = match retransmit.pop_front() {
+                    Some(idx) => idx,
+                    None if next < end => {
+                        next += 1;
+                        next - 1
+                    }
+                    None => break,
+                };
+                let (block_addr, block_len) = block_at(idx);
+                self.send_payload(Command::QueryMemory, &memory_payload(block_addr, block_len))?;
+                in_flight.push_back(idx);
+            }
+
+            let Some(idx) = in_flight.pop_front() else {
+                return Ok(read);
+            };
+            let (block_addr, block_len) = block_at(idx);
+            let mut failed = Vec::new();
+
+            match self.recv_view(opts.timeout) {
+                // Requested past a short block
+                Ok(_) if idx >= end => {}
+                Ok(response) if response.error_code == ErrorCode::Ok => {
+                    let data = &response.data[..response.data.len().min(block_len as usize)];
+                    on_block(block_addr, data)?;
+                    read += data.len() as u32;
+                    if data.len() < block_len as usize {
+                        end = idx + 1;
+                        retransmit.retain(|&i| i < end);
+                    }
+                }
+                Ok(response)
+                    if matches!(
+                        response.error_code,
+                        ErrorCode::BufferFull | ErrorCode::InvalidFrame
+                    ) =>
+                {
+                    failed.push(idx);
+                }
+                Ok(response) => {
+                    return Err(V4Error::Device(format!(
+                        "Memory read at 0x{:08X} failed: {}",
+                        block_addr,
+                        response.error_code.name()
+                    )));
+                }
+                Err(V4Error::CrcMismatch { .. }) => failed.push(idx),
+                Err(V4Error::Timeout) => {
+                    // Responses for the rest of the window can no longer be
+                    // matched by position
+                    failed.push(idx);
+                    failed.extend(in_flight.drain(..));
+                    self.clear_input()?;
+                }
+                Err(e) => return Err(e),
+            }
+
+            for idx in failed.into_iter().filter(|&i| i < end) {
+                let count = retries.entry(idx).or_default();
+                *count += 1;
+                if *count > opts.max_retries {
+                    return Err(V4Error::Protocol(format!(
+                        "Memory read at 0x{:08X} failed after {} retries",
+                        block_at(idx).0,
+                        opts.max_retries
+                    )));
+                }
+                retransmit.push_back(idx);
+            }
+        }
     }
 
     /// Query word information by index
@@ -168,14 +1114,410 @@ impl V4Serial {
         let payload = word_idx.to_le_bytes();
         self.send_command(Command::QueryWord, &payload, timeout)
     }
+
+    /// Read the VM performance counters
+    ///
+    /// Per-word entries that do not fit one response are fetched with
+    /// further requests; the global counters are taken from the first. With
+    /// `reset`, one more request past the last entry carries the reset, so
+    /// the counters are zeroed only once every entry has been read; its
+    /// answer supplies the global counters.
+    pub fn query_stats(&mut self, reset: bool, timeout: Duration) -> Result<VmStats> {
+        let mut stats = self.query_stats_page(0, 0, timeout)?;
+        while stats.words.len() < stats.word_total as usize {
+            let page = self.query_stats_page(0, stats.words.len() as u16, timeout)?;
+            if page.words.is_empty() {
+                break;
+            }
+            stats.words.extend(page.words);
+        }
+        if reset {
+            let mut last =
+                self.query_stats_page(stats::STATS_RESET, stats.words.len() as u16, timeout)?;
+            // Entries of words defined since the first page come back too
+            stats.words.append(&mut last.words);
+            last.words = stats.words;
+            stats = last;
+        }
+        Ok(stats)
+    }
+
+    fn query_stats_page(&mut self, flags: u8, first: u16, timeout: Duration) -> Result<VmStats> {
+        let response =
+            self.send_command(Command::QueryStats, &stats::request(flags, first), timeout)?;
+        if response.error_code != ErrorCode::Ok {
+            return Err(V4Error::Device(format!(
+                "Query stats failed: {}",
+                response.error_code.name()
+            )));
+        }
+        VmStats::parse(&response.data)
+            .ok_or_else(|| V4Error::Protocol("Malformed QUERY_STATS response".to_string()))
+    }
+}
+
+/// QUERY_MEMORY payload: [ADDR (u32 LE)][LEN (u16 LE)]
+pub(crate) fn memory_payload(addr: u32, len: u16) -> [u8; 6] {
+    let addr = addr.to_le_bytes();
+    let len = len.to_le_bytes();
+    [addr[0], addr[1], addr[2], addr[3], len[0], len[1]]
 }
 
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::protocol::Request;
+    use crate::transport::{Loopback, Responder};
 
     #[test]
     fn test_default_baud_rate() {
         assert_eq!(DEFAULT_BAUD_RATE, 115200);
     }
+
+    /// Device with `memory` at address 0x1000 that rejects its first
+    /// request with BUFFER_FULL
+    struct MemoryDevice {
+        memory: Vec<u8>,
+        rejected: bool,
+    }
+
+    impl Responder for MemoryDevice {
+        fn respond(&mut self, request: Option<Request<'_>>, out: &mut Vec<u8>) {
+            let Some(request) = request else { return };
+            let payload = request.payload;
+            let addr =
+                u32::from_le_bytes([payload[0], payload[1], payload[2], payload[3]]) as usize;
+            let len = u16::from_le_bytes([payload[4], payload[5]]) as usize;
+            if !self.rejected {
+                self.rejected = true;
+                Frame::encode_response_into(request.seq, ErrorCode::BufferFull, &[], out);
+                return;
+            }
+            let start = (addr - 0x1000).min(self.memory.len());
+            let end = (start + len).min(self.memory.len());
+            Frame::encode_response_into(request.seq, ErrorCode::Ok, &self.memory[start..end], out);
+        }
+    }
+
+    /// Device that assembles segmented pushes, compressed or not
+    #[derive(Default)]
+    struct PushDevice {
+        image: Vec<u8>,
+        compressed_chunks: usize,
+    }
+
+    impl Responder for PushDevice {
+        fn respond(&mut self, request: Option<Request<'_>>, out: &mut Vec<u8>) {
+            let Some(request) = request else { return };
+            let payload = request.payload;
+            let offset = || u32::from_le_bytes(payload[..4].try_into().unwrap()) as usize;
+            let mut data = &[][..];
+            let mut code = ErrorCode::Ok;
+            match Command::from_u8(request.command) {
+                Some(Command::Caps) => data = payload,
+                Some(Command::PushBegin) => self.image = vec![0; offset()],
+                Some(Command::PushChunk) => {
+                    let chunk = &payload[4..];
+                    self.image[offset()..offset() + chunk.len()].copy_from_slice(chunk);
+                }
+                Some(Command::PushChunkZ) => {
+                    let raw_len = u16::from_le_bytes([payload[4], payload[5]]) as usize;
+                    let mut chunk = Vec::new();
+                    crate::compress::decompress(&payload[6..], raw_len, &mut chunk).unwrap();
+                    self.image[offset()..offset() + raw_len].copy_from_slice(&chunk);
+                    self.compressed_chunks += 1;
+                }
+                // Reject an image that was assembled wrongly or sent without
+                // compression
+                Some(Command::PushEnd)
+                    if crate::protocol::calc_crc8(&self.image) != payload[4]
+                        || self.compressed_chunks == 0 =>
+                {
+                    code = ErrorCode::Error;
+                }
+                _ => {}
+            }
+            Frame::encode_response_into(request.seq, code, data, out);
+        }
+    }
+
+    #[test]
+    fn test_push_chunked_compressed() {
+        let image: Vec<u8> = (0..4000u32).map(|i| (i % 7) as u8).collect();
+        let device = Loopback::with_responder(PushDevice::default());
+        let mut serial = V4Serial::from_transport(Box::new(device), DEFAULT_BAUD_RATE);
+        // The device echoes the request, so every host feature is agreed
+        let caps = serial
+            .negotiate(
+                DEFAULT_BAUD_RATE,
+                MAX_PAYLOAD_SIZE,
+                Duration::from_millis(10),
+            )
+            .unwrap();
+        assert!(caps.has(FEATURE_COMPRESSED_CHUNK));
+
+        let (response, stats) = serial
+            .push_chunked(&image, &PushOptions::default(), |_| {})
+            .unwrap();
+        assert_eq!(response.error_code, ErrorCode::Ok);
+        assert_eq!(stats.image_bytes, image.len());
+        assert!(stats.ratio() < 0.2);
+    }
+
+    /// Sequenced device that answers requests in pairs, second one first,
+    /// echoing each payload
+    struct ReorderDevice {
+        held: Option<Vec<u8>>,
+    }
+
+    impl Responder for ReorderDevice {
+        fn respond(&mut self, request: Option<Request<'_>>, out: &mut Vec<u8>) {
+            let Some(request) = request else { return };
+            Frame::encode_response_into(request.seq, ErrorCode::Ok, request.payload, out);
+            if request.command == Command::Caps as u8 {
+                return;
+            }
+            match self.held.take() {
+                Some(first) => out.extend(first),
+                None => self.held = Some(std::mem::take(out)),
+            }
+        }
+    }
+
+    #[test]
+    fn test_pipeline_matches_sequence_numbers() {
+        let device = Loopback::with_responder(ReorderDevice { held: None });
+        let mut serial = V4Serial::from_transport(Box::new(device), DEFAULT_BAUD_RATE);
+        let timeout = Duration::from_millis(10);
+        let caps = serial
+            .negotiate(DEFAULT_BAUD_RATE, MAX_PAYLOAD_SIZE, timeout)
+            .unwrap();
+        assert!(caps.has(FEATURE_SEQUENCED));
+
+        let payloads: Vec<[u8; 2]> = (0..300u16).map(u16::to_le_bytes).collect();
+        let requests: Vec<(Command, &[u8])> = payloads
+            .iter()
+            .map(|p| (Command::QueryWord, &p[..]))
+            .collect();
+        let responses = serial.pipeline(&requests, 8, timeout).unwrap();
+        assert_eq!(responses.len(), 300);
+        for (response, payload) in responses.iter().zip(&payloads) {
+            assert_eq!(response.data, payload);
+        }
+
+        // An odd request count leaves the last response held: timeout
+        let result = serial.pipeline(&requests[..3], 8, timeout);
+        assert!(matches!(result, Err(V4Error::Timeout)));
+    }
+
+    #[test]
+    fn test_push_without_chunked_push_feature() {
+        let mut serial = V4Serial::from_transport(
+            Box::new(crate::transport::Loopback::new()),
+            DEFAULT_BAUD_RATE,
+        );
+        serial
+            .apply_caps(LinkCaps {
+                baud: DEFAULT_BAUD_RATE,
+                mtu: 1024,
+                features: 0,
+            })
+            .unwrap();
+        assert!(!serial.chunked_push_supported());
+
+        // Fits one frame: sent as EXEC
+        let opts = PushOptions {
+            timeout: Duration::from_millis(10),
+            ..PushOptions::default()
+        };
+        let (response, stats) = serial.push_chunked(&[0x51; 800], &opts, |_| {}).unwrap();
+        assert_eq!(response.error_code, ErrorCode::Ok);
+        assert_eq!(stats, TransferStats::uncompressed(800));
+        assert!(serial.push_chunked(&[0x51; 2000], &opts, |_| {}).is_err());
+    }
+
+    #[test]
+    fn test_pipeline_in_order_without_sequencing() {
+        let mut serial = V4Serial::from_transport(
+            Box::new(crate::transport::Loopback::new()),
+            DEFAULT_BAUD_RATE,
+        );
+        let code = [0x51u8; 16];
+        let requests = vec![(Command::Exec, &code[..]); 20];
+        let responses = serial
+            .pipeline(&requests, 4, Duration::from_millis(10))
+            .unwrap();
+        assert_eq!(responses.len(), 20);
+        assert!(responses.iter().all(|r| r.error_code == ErrorCode::Ok));
+    }
+
+    #[test]
+    fn test_read_memory_pipelined() {
+        let memory: Vec<u8> = (0..1000u32).map(|i| i as u8).collect();
+        let device = Loopback::with_responder(MemoryDevice {
+            memory: memory.clone(),
+            rejected: false,
+        });
+        let mut serial = V4Serial::from_transport(Box::new(device), DEFAULT_BAUD_RATE);
+        let opts = ReadOptions {
+            timeout: Duration::from_millis(10),
+            ..ReadOptions::default()
+        };
+
+        // Reads past the end stop at the first short block
+        let mut out = vec![0u8; 4096];
+        let read = serial
+            .read_memory(0x1000, 4096, &opts, |addr, data| {
+                let offset = (addr - 0x1000) as usize;
+                out[offset..offset + data.len()].copy_from_slice(data);
+                Ok(())
+            })
+            .unwrap();
+        assert_eq!(read, 1000);
+        assert_eq!(&out[..1000], &memory[..]);
+
+        let mut blocks = Vec::new();
+        serial
+            .read_memory(0x1010, 20, &opts, |addr, data| {
+                blocks.push((addr, data.len()));
+                Ok(())
+            })
+            .unwrap();
+        assert_eq!(blocks, vec![(0x1010, 20)]);
+    }
+
+    /// Simulated device that corrupts every `every`th response until
+    /// `corrupt` responses failed the CRC check
+    struct FlakyDevice {
+        device: crate::sim::Device,
+        corrupt: std::sync::Arc<std::sync::atomic::AtomicUsize>,
+        every: usize,
+        answered: usize,
+    }
+
+    impl Responder for FlakyDevice {
+        fn respond(&mut self, request: Option<Request<'_>>, out: &mut Vec<u8>) {
+            use std::sync::atomic::Ordering;
+            self.device.respond(request, out);
+            self.answered += 1;
+            if let Some(last) = out.last_mut()
+                && self.answered.is_multiple_of(self.every)
+                && self
+                    .corrupt
+                    .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |n| n.checked_sub(1))
+                    .is_ok()
+            {
+                *last ^= 0xFF;
+            }
+        }
+    }
+
+    fn flaky(every: usize) -> (V4Serial, std::sync::Arc<std::sync::atomic::AtomicUsize>) {
+        let corrupt = std::sync::Arc::default();
+        let device = Loopback::with_responder(FlakyDevice {
+            device: crate::sim::Device::new(),
+            corrupt: std::sync::Arc::clone(&corrupt),
+            every,
+            answered: 0,
+        });
+        let mut serial = V4Serial::from_transport(Box::new(device), DEFAULT_BAUD_RATE);
+        serial.set_retry_policy(RetryPolicy {
+            backoff: Duration::ZERO,
+            ..RetryPolicy::default()
+        });
+        (serial, corrupt)
+    }
+
+    #[test]
+    fn test_retry_idempotent_commands() {
+        use std::sync::atomic::Ordering;
+        let timeout = Duration::from_millis(10);
+        let (mut serial, corrupt) = flaky(1);
+
+        corrupt.store(1, Ordering::Relaxed);
+        assert_eq!(serial.ping(timeout).unwrap(), ErrorCode::Ok);
+        let link = serial.link_stats();
+        assert_eq!((link.crc_errors, link.retries), (1, 1));
+        assert!(link.srtt.is_some());
+
+        // EXEC may have run; it is not sent twice
+        corrupt.store(1, Ordering::Relaxed);
+        let result = serial.exec(&[0x51], timeout);
+        assert!(matches!(result, Err(V4Error::CrcMismatch { .. })));
+        assert_eq!(serial.link_stats().retries, 1);
+
+        serial.set_retry_policy(RetryPolicy::none());
+        corrupt.store(1, Ordering::Relaxed);
+        assert!(serial.ping(timeout).is_err());
+    }
+
+    #[test]
+    fn test_push_chunked_adapts_to_corruption() {
+        use std::sync::atomic::Ordering;
+        let (mut serial, corrupt) = flaky(5);
+        let opts = PushOptions {
+            timeout: Duration::from_millis(10),
+            ..PushOptions::default()
+        };
+        serial
+            .negotiate(DEFAULT_BAUD_RATE, MAX_PAYLOAD_SIZE, opts.timeout)
+            .unwrap();
+
+        let image: Vec<u8> = (0..20_000u32).map(|i| (i * 31 % 251) as u8).collect();
+        corrupt.store(3, Ordering::Relaxed);
+        let mut progress = 0;
+        let (response, stats) = serial
+            .push_chunked(&image, &opts, |n| progress += n)
+            .unwrap();
+        assert_eq!(response.error_code, ErrorCode::Ok);
+        assert_eq!((progress, stats.image_bytes), (image.len(), image.len()));
+        assert_eq!(serial.link_stats().crc_errors, 3);
+        assert!(serial.link_stats().retries >= 3);
+    }
+
+    #[test]
+    fn test_is_idempotent() {
+        assert!(is_idempotent(Command::QueryStats, &[]));
+        assert!(is_idempotent(Command::QueryStats, &stats::request(0, 0)));
+        assert!(!is_idempotent(
+            Command::QueryStats,
+            &stats::request(stats::STATS_RESET, 0)
+        ));
+        assert!(!is_idempotent(Command::Exec, &[0x51]));
+    }
+
+    #[test]
+    fn test_aimd() {
+        let mut control = Aimd::new(512, 4, Some(16), true);
+        control.on_corrupt();
+        control.on_corrupt();
+        assert_eq!(control.chunk, 128);
+        for _ in 0..4 {
+            control.on_corrupt();
+        }
+        assert_eq!(control.chunk, MIN_ADAPTIVE_CHUNK);
+        control.on_congestion();
+        assert_eq!(control.window, 2);
+
+        // Both grow back after a window of clean acks, never past the start
+        // chunk size or the window cap
+        for _ in 0..1000 {
+            control.on_ack();
+        }
+        assert_eq!(control.chunk, 512);
+        assert_eq!(control.window, 16);
+
+        // Without a cap the starting window is the ceiling
+        let mut capped = Aimd::new(512, 4, None, true);
+        capped.on_congestion();
+        for _ in 0..1000 {
+            capped.on_ack();
+        }
+        assert_eq!(capped.window, 4);
+
+        let mut fixed = Aimd::new(512, 4, Some(16), false);
+        fixed.on_corrupt();
+        fixed.on_congestion();
+        assert_eq!((fixed.chunk, fixed.window), (512, 4));
+    }
 }
@@ -0,0 +1,538 @@
+//! In-process simulated V4 device
+//!
+//! [`Simulator`] is a [`Transport`] that implements the device side of
+//! V4-link in memory (a [`Loopback`] answered by [`Device`]): CAPS
+//! negotiation, segmented and compressed pushes, word registration, and the
+//! stack, memory and word queries. Push, exec and the REPL run against it
+//! at memory speed, which makes it suitable for throughput and load tests
+//! without hardware (`--port sim://`).
+//!
+//! Bytecode is not interpreted. Images are parsed and their words placed in
+//! a simulated dictionary, so word indices, delta deploys and `QUERY_WORD`
+//! behave like on a board; main code and raw EXEC payloads are acknowledged
+//! without running them, and both stacks always read back empty (in full
+//! or as `QUERY_STACK_DELTA` changes).
+//! `QUERY_STATS` charges one instruction and one cycle per byte of main code
+//! accepted, and counts every raw EXEC as one call of each registered word
+//! costing a cycle per byte of its code.
+
+use crate::bytecode::{self, Image};
+use crate::compress;
+use crate::protocol::caps::MAX_LINK_MTU;
+use crate::protocol::caps::{
+    FEATURE_CHUNKED_PUSH, FEATURE_COMPRESSED_CHUNK, FEATURE_SEQUENCED, LinkCaps,
+};
+use crate::protocol::chunk::{CHUNK_HEADER_SIZE, COMPRESSED_CHUNK_HEADER_SIZE};
+use crate::protocol::stack::Stacks;
+use crate::protocol::stats::{STATS_RESET, VmStats, WordStats};
+use crate::protocol::{Command, ErrorCode, Frame, MAX_PAYLOAD_SIZE, Request, calc_crc8};
+use crate::repl::WordDef;
+use crate::transport::{Loopback, Responder, Transport};
+use std::io::{self, Read, Write};
+use std::time::Duration;
+
+/// Port name that selects the simulator
+pub const SIM_SCHEME: &str = "sim://";
+
+/// Size of the simulated RAM; also bounds segmented images
+pub const MEMORY_SIZE: usize = 64 * 1024;
+
+/// Features the simulated device offers in CAPS
+pub const SIM_FEATURES: u16 = FEATURE_CHUNKED_PUSH | FEATURE_COMPRESSED_CHUNK | FEATURE_SEQUENCED;
+
+/// Simulated device behind a V4-link byte stream
+///
+/// Every complete request frame is answered as soon as it is written, so
+/// reads never block; a read with nothing queued times out immediately.
+pub struct Simulator {
+    link: Loopback<Device>,
+}
+
+impl Simulator {
+    pub fn new() -> Self {
+        Self::with_device(Device::new())
+    }
+
+    /// Simulator answering with `device`
+    pub fn with_device(device: Device) -> Self {
+        Self {
+            link: Loopback::with_responder(device),
+        }
+    }
+
+    /// State of the simulated device
+    pub fn device(&self) -> &Device {
+        self.link.responder()
+    }
+}
+
+impl Default for Simulator {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Read for Simulator {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        self.link.read(buf)
+    }
+}
+
+impl Write for Simulator {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        self.link.write(buf)
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        self.link.flush()
+    }
+}
+
+impl Transport for Simulator {
+    fn set_timeout(&mut self, timeout: Duration) -> io::Result<()> {
+        self.link.set_timeout(timeout)
+    }
+
+    fn clear_input(&mut self) -> io::Result<()> {
+        self.link.clear_input()
+    }
+}
+
+/// Word table, RAM and transfer state of the simulated device
+#[derive(Debug)]
+pub struct Device {
+    words: Vec<WordDef>,
+    memory: Vec<u8>,
+    /// Next free byte of the dictionary in `memory`
+    here: usize,
+    /// Image being assembled by a segmented transfer
+    push: Option<Vec<u8>>,
+    /// Decompressed PUSH_CHUNK_Z payload, reused
+    scratch: Vec<u8>,
+    /// Response data, reused
+    data: Vec<u8>,
+    executed: u64,
+    /// Performance counters reported by QUERY_STATS
+    stats: VmStats,
+    /// Per-word counters, by device index; words past the end have none
+    word_stats: Vec<WordStats>,
+    /// Stack contents; nothing runs, so they stay empty
+    stacks: Stacks,
+    /// Tag and stacks of the last QUERY_STACK_DELTA answer
+    stack_sent: Option<(u16, Stacks)>,
+    /// Largest MTU offered in CAPS answers
+    mtu: usize,
+}
+
+impl Device {
+    pub fn new() -> Self {
+        Self {
+            words: Vec::new(),
+            memory: vec![0; MEMORY_SIZE],
+            here: 0,
+            push: None,
+            scratch: Vec::new(),
+            data: Vec::new(),
+            executed: 0,
+            stats: VmStats::default(),
+            word_stats: Vec::new(),
+            stacks: Stacks::default(),
+            stack_sent: None,
+            mtu: MAX_LINK_MTU,
+        }
+    }
+
+    /// Offer at most `mtu` bytes in CAPS answers, as a buggy device might
+    pub fn set_mtu(&mut self, mtu: usize) {
+        self.mtu = mtu;
+    }
+
+    /// Registered words, by device index
+    pub fn words(&self) -> &[WordDef] {
+        &self.words
+    }
+
+    /// Simulated RAM; word bytecode is stored from address 0 upwards
+    pub fn memory(&self) -> &[u8] {
+        &self.memory
+    }
+
+    /// Number of EXEC payloads and completed pushes accepted
+    pub fn executed(&self) -> u64 {
+        self.executed
+    }
+
+    /// Handle one request, appending response data to `out`
+    fn handle(&mut self, command: u8, payload: &[u8], out: &mut Vec<u8>) -> ErrorCode {
+        let code = self.dispatch(command, payload, out);
+        if code == ErrorCode::BufferFull {
+            self.stats.buffer_full += 1;
+        }
+        code
+    }
+
+    fn dispatch(&mut self, command: u8, payload: &[u8], out: &mut Vec<u8>) -> ErrorCode {
+        match Command::from_u8(command) {
+            Some(Command::Ping) => ErrorCode::Ok,
+            Some(Command::Caps) => match LinkCaps::parse(payload) {
+                Some(requested) => {
+                    let offered = LinkCaps {
+                        baud: requested.baud,
+                        mtu: self.mtu,
+                        features: SIM_FEATURES,
+                    };
+                    out.extend_from_slice(&offered.limit_to(&requested).encode());
+                    ErrorCode::Ok
+                }
+                None => ErrorCode::InvalidFrame,
+            },
+            Some(Command::Reset) => {
+                self.words.clear();
+                self.word_stats.clear();
+                self.memory.fill(0);
+                self.here = 0;
+                self.push = None;
+                ErrorCode::Ok
+            }
+            Some(Command::Exec) => self.exec(payload, out),
+            Some(Command::PushBegin) => {
+                let Some(len) = read_u32(payload, 0) else {
+                    return ErrorCode::InvalidFrame;
+                };
+                if len as usize > MEMORY_SIZE {
+                    return ErrorCode::BufferFull;
+                }
+                self.push = Some(vec![0; len as usize]);
+                ErrorCode::Ok
+            }
+            Some(Command::PushChunk) => match read_u32(payload, 0) {
+                Some(offset) => self.write_chunk(offset, CHUNK_HEADER_SIZE, payload, false),
+                None => ErrorCode::InvalidFrame,
+            },
+            Some(Command::PushChunkZ) => match read_u32(payload, 0) {
+                Some(offset) if payload.len() >= COMPRESSED_CHUNK_HEADER_SIZE => {
+                    self.write_chunk(offset, COMPRESSED_CHUNK_HEADER_SIZE, payload, true)
+                }
+                _ => ErrorCode::InvalidFrame,
+            },
+            Some(Command::PushEnd) => {
+                let Some(image) = self.push.take() else {
+                    return ErrorCode::Error;
+                };
+                if payload.len() < 5
+                    || read_u32(payload, 0) != Some(image.len() as u32)
+                    || payload[4] != calc_crc8(&image)
+                {
+                    return ErrorCode::InvalidFrame;
+                }
+                self.exec(&image, out)
+            }
+            Some(Command::QueryStack) => {
+                self.stacks.encode(out);
+                ErrorCode::Ok
+            }
+            Some(Command::QueryStackDelta) => {
+                let Some(tag) = payload.get(..2).map(|t| u16::from_le_bytes([t[0], t[1]])) else {
+                    return ErrorCode::InvalidFrame;
+                };
+                let previous = match &self.stack_sent {
+                    Some((sent, stacks)) if tag != 0 && *sent == tag => Some(stacks),
+                    _ => None,
+                };
+                let next = self.stack_sent.as_ref().map_or(0, |(sent, _)| *sent);
+                let next = next.wrapping_add(1).max(1);
+                self.stacks.encode_delta(next, previous, out);
+                self.stack_sent = Some((next, self.stacks.clone()));
+                ErrorCode::Ok
+            }
+            Some(Command::QueryMemory) => {
+                let (Some(addr), Some(len)) = (read_u32(payload, 0), payload.get(4..6)) else {
+                    return ErrorCode::InvalidFrame;
+                };
+                let len = u16::from_le_bytes([len[0], len[1]]) as usize;
+                let start = (addr as usize).min(MEMORY_SIZE);
+                let end = start.saturating_add(len).min(MEMORY_SIZE);
+                out.extend_from_slice(&self.memory[start..end]);
+                ErrorCode::Ok
+            }
+            Some(Command::QueryWord) => {
+                let Some(word) = payload.get(..2).and_then(|idx| {
+                    self.words
+                        .get(u16::from_le_bytes([idx[0], idx[1]]) as usize)
+                }) else {
+                    return ErrorCode::Error;
+                };
+                out.push(word.name.len() as u8);
+                out.extend_from_slice(word.name.as_bytes());
+                out.extend_from_slice(&(word.bytecode.len() as u16).to_le_bytes());
+                out.extend_from_slice(&word.bytecode);
+                ErrorCode::Ok
+            }
+            Some(Command::QueryStats) => {
+                let (Some(&flags), Some(first)) = (payload.first(), payload.get(1..3)) else {
+                    return ErrorCode::InvalidFrame;
+                };
+                let first = u16::from_le_bytes([first[0], first[1]]) as usize;
+                let words: Vec<WordStats> = (first..self.words.len())
+                    .take(VmStats::words_per_frame(MAX_PAYLOAD_SIZE))
+                    .map(|index| WordStats {
+                        index: index as u16,
+                        ..self.word_stats.get(index).copied().unwrap_or_default()
+                    })
+                    .collect();
+                self.stats.word_total = self.words.len() as u16;
+                self.stats.encode(&words, out);
+                if flags & STATS_RESET != 0 {
+                    self.stats = VmStats::default();
+                    self.word_stats.clear();
+                }
+                ErrorCode::Ok
+            }
+            None => ErrorCode::InvalidFrame,
+        }
+    }
+
+    /// Store chunk data behind a `header`-byte header into the push buffer
+    fn write_chunk(
+        &mut self,
+        offset: u32,
+        header: usize,
+        payload: &[u8],
+        compressed: bool,
+    ) -> ErrorCode {
+        let Some(image) = self.push.as_mut() else {
+            return ErrorCode::Error;
+        };
+        let data = if compressed {
+            let raw_len = u16::from_le_bytes([payload[4], payload[5]]) as usize;
+            if compress::decompress(&payload[header..], raw_len, &mut self.scratch).is_err() {
+                return ErrorCode::InvalidFrame;
+            }
+            &self.scratch[..]
+        } else {
+            &payload[header..]
+        };
+        let start = offset as usize;
+        match image.get_mut(start..start + data.len()) {
+            Some(dst) => {
+                dst.copy_from_slice(data);
+                ErrorCode::Ok
+            }
+            None => ErrorCode::InvalidFrame,
+        }
+    }
+
+    /// Accept an EXEC payload; images register their words and answer with
+    /// `[COUNT][INDEX (u16 LE)...]`
+    fn exec(&mut self, payload: &[u8], out: &mut Vec<u8>) -> ErrorCode {
+        self.executed += 1;
+        if !payload.starts_with(bytecode::MAGIC) {
+            self.stats.instructions += payload.len() as u64;
+            self.stats.cycles += payload.len() as u64;
+            self.word_stats
+                .resize(self.words.len(), WordStats::default());
+            for (word, stats) in self.words.iter().zip(&mut self.word_stats) {
+                stats.calls += 1;
+                stats.cycles += word.bytecode.len() as u64;
+            }
+            return ErrorCode::Ok;
+        }
+        let Ok(image) = Image::parse(payload) else {
+            return ErrorCode::InvalidFrame;
+        };
+        if image.words.len() > u8::MAX as usize
+            || self.words.len() + image.words.len() > u16::MAX as usize
+        {
+            return ErrorCode::BufferFull;
+        }
+        let code_size: usize = image.words.iter().map(|w| w.bytecode.len()).sum();
+        if self.here + code_size > MEMORY_SIZE {
+            return ErrorCode::BufferFull;
+        }
+
+        out.push(image.words.len() as u8);
+        for word in image.words {
+            out.extend_from_slice(&(self.words.len() as u16).to_le_bytes());
+            self.memory[self.here..self.here + word.bytecode.len()].copy_from_slice(&word.bytecode);
+            self.here += word.bytecode.len();
+            self.words.push(word);
+        }
+        ErrorCode::Ok
+    }
+}
+
+impl Default for Device {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Responder for Device {
+    fn respond(&mut self, request: Option<Request<'_>>, out: &mut Vec<u8>) {
+        // Answer in the format the request was sent in; a corrupt frame
+        // cannot be attributed and gets a plain INVALID_FRAME
+        let mut data = std::mem::take(&mut self.data);
+        data.clear();
+        let (seq, code) = match request {
+            Some(request) => (
+                request.seq,
+                self.handle(request.command, request.payload, &mut data),
+            ),
+            None => (None, ErrorCode::InvalidFrame),
+        };
+        Frame::encode_response_into(seq, code, &data, out);
+        self.data = data;
+    }
+}
+
+fn read_u32(data: &[u8], at: usize) -> Option<u32> {
+    let b = data.get(at..at + 4)?;
+    Some(u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::V4Error;
+    use crate::protocol::stack::{STACK_FULL, StackTracker};
+    use crate::serial::{PushOptions, ReadOptions, V4Serial};
+
+    const TIMEOUT: Duration = Duration::from_secs(1);
+
+    fn words(n: usize) -> Vec<WordDef> {
+        (0..n)
+            .map(|i| WordDef {
+                name: format!("W{}", i),
+                bytecode: vec![0x01, i as u8, 0x00, 0x00, 0x00, 0x51],
+            })
+            .collect()
+    }
+
+    #[test]
+    fn test_exec_registers_words() {
+        let mut serial = V4Serial::from_transport(Box::new(Simulator::new()), 115_200);
+        let mut image = Vec::new();
+        bytecode::encode_words(&words(3), &mut image);
+
+        let response = serial.exec(&image, TIMEOUT).unwrap();
+        assert_eq!(response.error_code, ErrorCode::Ok);
+        assert_eq!(response.word_indices, vec![0, 1, 2]);
+
+        let response = serial.query_word(2, TIMEOUT).unwrap();
+        assert_eq!(response.error_code, ErrorCode::Ok);
+        assert_eq!(&response.data[..3], b"\x02W2");
+        assert_eq!(
+            serial.query_word(3, TIMEOUT).unwrap().error_code,
+            ErrorCode::Error
+        );
+
+        let mut dump = Vec::new();
+        serial
+            .read_memory(0, 12, &ReadOptions::default(), |_, block| {
+                dump.extend_from_slice(block);
+                Ok(())
+            })
+            .unwrap();
+        assert_eq!(
+            dump,
+            [words(2)[0].bytecode.clone(), words(2)[1].bytecode.clone()].concat()
+        );
+
+        assert_eq!(serial.reset(TIMEOUT).unwrap(), ErrorCode::Ok);
+        assert_eq!(
+            serial.query_word(0, TIMEOUT).unwrap().error_code,
+            ErrorCode::Error
+        );
+    }
+
+    #[test]
+    fn test_negotiate_rejects_tiny_mtu() {
+        let mut device = Device::new();
+        device.set_mtu(0);
+        let mut serial =
+            V4Serial::from_transport(Box::new(Simulator::with_device(device)), 115_200);
+        assert!(matches!(
+            serial.negotiate(115_200, 4096, TIMEOUT),
+            Err(V4Error::Protocol(_))
+        ));
+
+        // The link stays at the baseline and keeps working
+        assert_eq!(serial.caps().mtu, MAX_PAYLOAD_SIZE);
+        assert_eq!(serial.ping(TIMEOUT).unwrap(), ErrorCode::Ok);
+    }
+
+    #[test]
+    fn test_query_stats() {
+        let mut serial = V4Serial::from_transport(Box::new(Simulator::new()), 115_200);
+        let mut image = Vec::new();
+        bytecode::encode_words(&words(40), &mut image);
+        serial
+            .push_chunked(&image, &PushOptions::default(), |_| {})
+            .unwrap();
+        serial.exec(&[0x00, 0x51], TIMEOUT).unwrap();
+
+        serial.exec(&[0x00, 0x51], TIMEOUT).unwrap();
+
+        // 40 entries take two responses, and all are read before the reset
+        let stats = serial.query_stats(true, TIMEOUT).unwrap();
+        assert_eq!(stats.word_total, 40);
+        assert_eq!(stats.words.len(), 40);
+        assert_eq!(stats.words[39].index, 39);
+        assert_eq!(stats.instructions, 4);
+        assert!(stats.words.iter().all(|w| w.calls == 2 && w.cycles == 12));
+
+        let stats = serial.query_stats(false, TIMEOUT).unwrap();
+        assert_eq!(stats.instructions, 0);
+        assert!(stats.words.iter().all(|w| w.calls == 0));
+
+        // Counts after a reset read are kept
+        serial.exec(&[0x00, 0x51, 0x51], TIMEOUT).unwrap();
+        let stats = serial.query_stats(false, TIMEOUT).unwrap();
+        assert_eq!(stats.instructions, 3);
+        assert!(stats.words.iter().all(|w| w.calls == 1));
+    }
+
+    #[test]
+    fn test_query_stack_delta() {
+        let mut serial = V4Serial::from_transport(Box::new(Simulator::new()), 115_200);
+        assert_eq!(serial.stacks(TIMEOUT).unwrap(), Stacks::default());
+
+        // Full answer first, then an empty delta against it
+        let mut tracker = StackTracker::default();
+        assert!(
+            serial
+                .query_stack_delta(&mut tracker, TIMEOUT)
+                .unwrap()
+                .data
+                .is_empty()
+        );
+        assert_ne!(tracker.request(), [0, 0]);
+        let response = serial
+            .send_command(Command::QueryStackDelta, &tracker.request(), TIMEOUT)
+            .unwrap();
+        assert_eq!(response.data.len(), 7);
+
+        // An unknown tag gets a full answer again
+        let mut stale = StackTracker::default();
+        stale.apply(&[9, 0, STACK_FULL, 0, 0]).unwrap();
+        assert!(serial.query_stack_delta(&mut stale, TIMEOUT).is_ok());
+        assert_eq!(tracker.supported, Some(true));
+    }
+
+    #[test]
+    fn test_compressed_push() {
+        let mut serial = V4Serial::from_transport(Box::new(Simulator::new()), 115_200);
+        let caps = serial.negotiate(115_200, 1024, TIMEOUT).unwrap();
+        assert!(caps.has(FEATURE_COMPRESSED_CHUNK));
+        assert_eq!(caps.mtu, 1024);
+
+        let mut image = Vec::new();
+        bytecode::encode_image(&words(200), &[0x51], &mut image);
+        let (response, stats) = serial
+            .push_chunked(&image, &PushOptions::default(), |_| {})
+            .unwrap();
+        assert_eq!(response.error_code, ErrorCode::Ok);
+        assert_eq!(response.word_indices.len(), 200);
+        assert!(stats.wire_bytes < stats.image_bytes);
+    }
+}
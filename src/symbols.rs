@@ -0,0 +1,230 @@
+//! Word symbol table of a device
+//!
+//! Maps VM addresses back to the words they belong to. Word names and
+//! bytecode come from QUERY_WORD; V4-link has no query for a word's
+//! address, so each word's code is located in a memory dump of the
+//! dictionary instead. Words are searched for in index order, each after
+//! the end of the previous one, since the dictionary only grows upwards.
+
+use crate::Result;
+use crate::protocol::{Command, ErrorCode};
+use crate::serial::{ReadOptions, V4Serial};
+use std::ops::Range;
+use std::time::Duration;
+
+/// QUERY_WORD requests kept in flight while reading the word table
+const QUERY_WINDOW: usize = 16;
+
+/// One device word
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Symbol {
+    pub index: u16,
+    pub name: String,
+    pub bytecode: Vec<u8>,
+    /// Address of the first byte of code, if it was found in memory
+    pub addr: Option<u32>,
+}
+
+impl Symbol {
+    /// Addresses covered by the word's code
+    pub fn range(&self) -> Option<Range<u32>> {
+        self.addr
+            .map(|addr| addr..addr + self.bytecode.len() as u32)
+    }
+}
+
+/// Words of a device, by index
+#[derive(Debug, Default, Clone)]
+pub struct SymbolTable {
+    symbols: Vec<Symbol>,
+    /// Positions in `symbols` of located words, by address
+    by_addr: Vec<usize>,
+}
+
+impl SymbolTable {
+    /// Table of `(name, bytecode)` words at indices 0, 1, ...
+    pub fn new(words: impl IntoIterator<Item = (String, Vec<u8>)>) -> Self {
+        let symbols = words
+            .into_iter()
+            .enumerate()
+            .map(|(index, (name, bytecode))| Symbol {
+                index: index as u16,
+                name,
+                bytecode,
+                addr: None,
+            })
+            .collect();
+        Self {
+            symbols,
+            by_addr: Vec::new(),
+        }
+    }
+
+    /// Read every word registered on the device
+    ///
+    /// Queries indices upwards, pipelined, until the device rejects one.
+    pub fn from_device(serial: &mut V4Serial, timeout: Duration) -> Result<Self> {
+        let mut words = Vec::new();
+        loop {
+            let first = words.len();
+            let payloads: Vec<[u8; 2]> = (first..first + QUERY_WINDOW)
+                .take_while(|&i| i <= u16::MAX as usize)
+                .map(|i| (i as u16).to_le_bytes())
+                .collect();
+            if payloads.is_empty() {
+                break;
+            }
+            let requests: Vec<(Command, &[u8])> = payloads
+                .iter()
+                .map(|p| (Command::QueryWord, &p[..]))
+                .collect();
+
+            let mut complete = true;
+            for response in serial.pipeline(&requests, QUERY_WINDOW, timeout)? {
+                let word = (response.error_code == ErrorCode::Ok)
+                    .then(|| crate::manifest::parse_word_info(&response.data))
+                    .flatten();
+                match word {
+                    Some((name, code)) if complete => {
+                        words.push((String::from_utf8_lossy(name).into_owned(), code.to_vec()))
+                    }
+                    _ => complete = false,
+                }
+            }
+            if !complete {
+                break;
+            }
+        }
+        Ok(Self::new(words))
+    }
+
+    /// Find every word's code in `memory`, which was read from `base`
+    ///
+    /// Returns the number of words located.
+    pub fn locate(&mut self, memory: &[u8], base: u32) -> usize {
+        let mut from = 0;
+        for symbol in &mut self.symbols {
+            symbol.addr = None;
+            let code = &symbol.bytecode;
+            if code.is_empty() || from >= memory.len() {
+                continue;
+            }
+            if let Some(pos) = memory[from..]
+                .windows(code.len())
+                .position(|window| window == &code[..])
+            {
+                symbol.addr = Some(base + (from + pos) as u32);
+                from += pos + code.len();
+            }
+        }
+
+        self.by_addr = (0..self.symbols.len())
+            .filter(|&i| self.symbols[i].addr.is_some())
+            .collect();
+        self.by_addr.sort_by_key(|&i| self.symbols[i].addr);
+        self.by_addr.len()
+    }
+
+    /// Read `len` bytes of dictionary from `base` and locate the words in
+    /// it
+    pub fn locate_on_device(
+        &mut self,
+        serial: &mut V4Serial,
+        base: u32,
+        len: u32,
+        timeout: Duration,
+    ) -> Result<usize> {
+        let mut memory = vec![0u8; len as usize];
+        let opts = ReadOptions {
+            timeout,
+            ..ReadOptions::default()
+        };
+        let read = serial.read_memory(base, len, &opts, |addr, block| {
+            let at = (addr - base) as usize;
+            memory[at..at + block.len()].copy_from_slice(block);
+            Ok(())
+        })?;
+        memory.truncate(read as usize);
+        Ok(self.locate(&memory, base))
+    }
+
+    /// Word whose code contains `addr`
+    pub fn lookup(&self, addr: u32) -> Option<&Symbol> {
+        let pos = self
+            .by_addr
+            .partition_point(|&i| self.symbols[i].addr.is_some_and(|a| a <= addr));
+        let symbol = &self.symbols[*self.by_addr.get(pos.checked_sub(1)?)?];
+        symbol
+            .range()
+            .is_some_and(|range| range.contains(&addr))
+            .then_some(symbol)
+    }
+
+    /// Word by name; the latest definition wins
+    pub fn get(&self, name: &str) -> Option<&Symbol> {
+        self.symbols.iter().rev().find(|s| s.name == name)
+    }
+
+    /// All words, by index
+    pub fn symbols(&self) -> &[Symbol] {
+        &self.symbols
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::bytecode;
+    use crate::repl::WordDef;
+
+    fn words() -> Vec<(String, Vec<u8>)> {
+        vec![
+            ("A".to_string(), vec![0x01, 0x02, 0x51]),
+            ("B".to_string(), vec![0x03, 0x51]),
+            // Same code as A; must not be matched to A's copy
+            ("C".to_string(), vec![0x01, 0x02, 0x51]),
+        ]
+    }
+
+    #[test]
+    fn test_locate_and_lookup() {
+        let mut table = SymbolTable::new(words());
+        let memory = [0x01, 0x02, 0x51, 0x03, 0x51, 0x01, 0x02, 0x51, 0x00];
+        assert_eq!(table.locate(&memory, 0x1000), 3);
+
+        assert_eq!(table.lookup(0x1000).unwrap().name, "A");
+        assert_eq!(table.lookup(0x1002).unwrap().name, "A");
+        assert_eq!(table.lookup(0x1004).unwrap().name, "B");
+        assert_eq!(table.lookup(0x1005).unwrap().name, "C");
+        assert!(table.lookup(0x1008).is_none());
+        assert!(table.lookup(0x0FFF).is_none());
+        assert_eq!(table.get("B").unwrap().index, 1);
+    }
+
+    #[test]
+    fn test_from_simulated_device() {
+        let mut serial = V4Serial::from_transport(Box::new(crate::sim::Simulator::new()), 115_200);
+        let timeout = Duration::from_secs(1);
+        let defs: Vec<WordDef> = (0..20)
+            .map(|i| WordDef {
+                name: format!("W{}", i),
+                bytecode: vec![0x01, i, 0x00, 0x00, 0x00, 0x51],
+            })
+            .collect();
+        let mut image = Vec::new();
+        bytecode::encode_words(&defs, &mut image);
+        serial.exec(&image, timeout).unwrap();
+
+        let mut table = SymbolTable::from_device(&mut serial, timeout).unwrap();
+        assert_eq!(table.symbols().len(), 20);
+        assert_eq!(table.symbols()[19].name, "W19");
+
+        assert_eq!(
+            table
+                .locate_on_device(&mut serial, 0, 1024, timeout)
+                .unwrap(),
+            20
+        );
+        assert_eq!(table.lookup(6 * 7 + 2).unwrap().name, "W7");
+    }
+}
@@ -0,0 +1,285 @@
+//! Tracing for the V4-link serial path
+//!
+//! The level is set once at startup from `-v` flags or the `V4_LOG`
+//! environment variable (`off`, `info`, `debug`, `trace`). Checks are a
+//! single relaxed atomic load, and frames are only hex-formatted when the
+//! `trace` level is enabled.
+//!
+//! Frames can additionally be captured to a pcap file (link type USER0).
+//! Each packet is prefixed with one direction byte: `0x00` host → device,
+//! `0x01` device → host.
+
+use std::fmt;
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+use std::path::Path;
+use std::sync::atomic::{AtomicBool, AtomicU8, Ordering};
+use std::sync::{Mutex, OnceLock};
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
+
+/// Environment variable overriding the `-v` verbosity
+pub const ENV_LOG: &str = "V4_LOG";
+
+/// pcap link type for private use (LINKTYPE_USER0)
+const PCAP_LINKTYPE_USER0: u32 = 147;
+
+/// Trace verbosity level
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+#[repr(u8)]
+pub enum Level {
+    /// No tracing
+    Off = 0,
+    /// High-level progress messages
+    Info = 1,
+    /// One summary line per frame
+    Debug = 2,
+    /// Full hex dump of every frame
+    Trace = 3,
+}
+
+impl Level {
+    /// Map a `-v` count to a level
+    pub fn from_verbosity(count: u8) -> Self {
+        match count {
+            0 => Level::Off,
+            1 => Level::Info,
+            2 => Level::Debug,
+            _ => Level::Trace,
+        }
+    }
+
+    /// Parse a level name as used in `V4_LOG`
+    pub fn parse(s: &str) -> Option<Self> {
+        match s.trim().to_ascii_lowercase().as_str() {
+            "off" | "0" => Some(Level::Off),
+            "info" | "1" => Some(Level::Info),
+            "debug" | "2" => Some(Level::Debug),
+            "trace" | "3" => Some(Level::Trace),
+            _ => None,
+        }
+    }
+
+    fn name(self) -> &'static str {
+        match self {
+            Level::Off => "OFF",
+            Level::Info => "INFO",
+            Level::Debug => "DEBUG",
+            Level::Trace => "TRACE",
+        }
+    }
+}
+
+/// Direction of a traced frame
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Direction {
+    /// Host → device
+    Tx,
+    /// Device → host
+    Rx,
+}
+
+impl Direction {
+    fn arrow(self) -> &'static str {
+        match self {
+            Direction::Tx => "->",
+            Direction::Rx => "<-",
+        }
+    }
+}
+
+/// Space-separated uppercase hex, formatted lazily
+pub struct Hex<'a>(pub &'a [u8]);
+
+impl fmt::Display for Hex<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        for (i, byte) in self.0.iter().enumerate() {
+            if i > 0 {
+                f.write_str(" ")?;
+            }
+            write!(f, "{:02X}", byte)?;
+        }
+        Ok(())
+    }
+}
+
+static LEVEL: AtomicU8 = AtomicU8::new(Level::Off as u8);
+static CAPTURING: AtomicBool = AtomicBool::new(false);
+static CAPTURE: Mutex<Option<BufWriter<File>>> = Mutex::new(None);
+static EPOCH: OnceLock<Instant> = OnceLock::new();
+
+/// Initialise tracing from the `-v` count, overridden by `V4_LOG`
+pub fn init(verbosity: u8) {
+    let level = std::env::var(ENV_LOG)
+        .ok()
+        .and_then(|s| Level::parse(&s))
+        .unwrap_or_else(|| Level::from_verbosity(verbosity));
+    set_level(level);
+}
+
+/// Set the active trace level
+pub fn set_level(level: Level) {
+    EPOCH.get_or_init(Instant::now);
+    LEVEL.store(level as u8, Ordering::Relaxed);
+}
+
+/// Check whether messages at `level` are emitted
+#[inline]
+pub fn enabled(level: Level) -> bool {
+    level != Level::Off && LEVEL.load(Ordering::Relaxed) >= level as u8
+}
+
+/// Time since tracing was initialised
+pub fn elapsed() -> Duration {
+    EPOCH.get_or_init(Instant::now).elapsed()
+}
+
+/// Write a timestamped message to stderr
+///
+/// Use the [`trace!`](crate::trace!) macro, which skips formatting when the
+/// level is disabled.
+pub fn log(level: Level, args: fmt::Arguments<'_>) {
+    let ts = elapsed();
+    eprintln!(
+        "[{:5}.{:06} {:5}] {}",
+        ts.as_secs(),
+        ts.subsec_micros(),
+        level.name(),
+        args
+    );
+}
+
+/// Emit a trace message if `level` is enabled
+#[macro_export]
+macro_rules! trace {
+    ($level:expr, $($arg:tt)*) => {
+        if $crate::trace::enabled($level) {
+            $crate::trace::log($level, format_args!($($arg)*));
+        }
+    };
+}
+
+/// Record a raw V4-link frame
+///
+/// Writes it to the capture file if one is open, logs a one-line summary at
+/// `debug` and a full hex dump at `trace`.
+#[inline]
+pub fn frame(dir: Direction, bytes: &[u8]) {
+    if CAPTURING.load(Ordering::Relaxed) {
+        capture_frame(dir, bytes);
+    }
+    if enabled(Level::Trace) {
+        log(
+            Level::Trace,
+            format_args!("{} {} bytes: {}", dir.arrow(), bytes.len(), Hex(bytes)),
+        );
+    } else if enabled(Level::Debug) {
+        let code = bytes.get(3).copied().unwrap_or(0);
+        log(
+            Level::Debug,
+            format_args!("{} {} bytes, code {:#04x}", dir.arrow(), bytes.len(), code),
+        );
+    }
+}
+
+/// Start capturing frames to a pcap file
+pub fn start_capture(path: &Path) -> io::Result<()> {
+    let mut writer = BufWriter::new(File::create(path)?);
+    write_pcap_header(&mut writer)?;
+
+    let mut capture = CAPTURE.lock().unwrap_or_else(|e| e.into_inner());
+    *capture = Some(writer);
+    CAPTURING.store(true, Ordering::Relaxed);
+    Ok(())
+}
+
+/// Flush and close the capture file
+pub fn stop_capture() -> io::Result<()> {
+    CAPTURING.store(false, Ordering::Relaxed);
+    let mut capture = CAPTURE.lock().unwrap_or_else(|e| e.into_inner());
+    match capture.take() {
+        Some(mut writer) => writer.flush(),
+        None => Ok(()),
+    }
+}
+
+fn capture_frame(dir: Direction, bytes: &[u8]) {
+    let now = SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .unwrap_or_default();
+    let mut capture = CAPTURE.lock().unwrap_or_else(|e| e.into_inner());
+    if let Some(writer) = capture.as_mut()
+        && write_pcap_record(writer, now, dir, bytes).is_err()
+    {
+        // Stop capturing rather than failing the transfer
+        *capture = None;
+        CAPTURING.store(false, Ordering::Relaxed);
+    }
+}
+
+/// Write the pcap global header (microsecond timestamps)
+fn write_pcap_header<W: Write>(w: &mut W) -> io::Result<()> {
+    w.write_all(&0xA1B2_C3D4u32.to_le_bytes())?; // magic
+    w.write_all(&2u16.to_le_bytes())?; // version major
+    w.write_all(&4u16.to_le_bytes())?; // version minor
+    w.write_all(&0i32.to_le_bytes())?; // thiszone
+    w.write_all(&0u32.to_le_bytes())?; // sigfigs
+    w.write_all(&65_535u32.to_le_bytes())?; // snaplen
+    w.write_all(&PCAP_LINKTYPE_USER0.to_le_bytes())
+}
+
+/// Write one pcap record: [TS_SEC][TS_USEC][INCL_LEN][ORIG_LEN][DIR][FRAME...]
+fn write_pcap_record<W: Write>(
+    w: &mut W,
+    ts: Duration,
+    dir: Direction,
+    bytes: &[u8],
+) -> io::Result<()> {
+    let len = (bytes.len() + 1) as u32;
+    w.write_all(&(ts.as_secs() as u32).to_le_bytes())?;
+    w.write_all(&ts.subsec_micros().to_le_bytes())?;
+    w.write_all(&len.to_le_bytes())?;
+    w.write_all(&len.to_le_bytes())?;
+    w.write_all(&[dir as u8])?;
+    w.write_all(bytes)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_level_parse() {
+        assert_eq!(Level::parse("debug"), Some(Level::Debug));
+        assert_eq!(Level::parse(" TRACE "), Some(Level::Trace));
+        assert_eq!(Level::parse("0"), Some(Level::Off));
+        assert_eq!(Level::parse("loud"), None);
+        assert_eq!(Level::from_verbosity(5), Level::Trace);
+    }
+
+    #[test]
+    fn test_hex_format() {
+        assert_eq!(Hex(&[0xA5, 0x01, 0x0F]).to_string(), "A5 01 0F");
+        assert_eq!(Hex(&[]).to_string(), "");
+    }
+
+    #[test]
+    fn test_pcap_layout() {
+        let mut out = Vec::new();
+        write_pcap_header(&mut out).unwrap();
+        assert_eq!(out.len(), 24);
+        assert_eq!(&out[0..4], &[0xD4, 0xC3, 0xB2, 0xA1]);
+
+        write_pcap_record(
+            &mut out,
+            Duration::new(2, 5_000),
+            Direction::Rx,
+            &[0xA5, 0x01],
+        )
+        .unwrap();
+        let record = &out[24..];
+        assert_eq!(&record[0..4], &2u32.to_le_bytes());
+        assert_eq!(&record[4..8], &5u32.to_le_bytes());
+        assert_eq!(&record[8..12], &3u32.to_le_bytes());
+        assert_eq!(&record[16..], &[0x01, 0xA5, 0x01]);
+    }
+}
@@ -0,0 +1,302 @@
+//! Byte streams a [`V4Serial`](crate::serial::V4Serial) connection can run
+//! over
+//!
+//! The V4-link protocol only needs a bidirectional byte stream with a read
+//! timeout. A serial port is the usual transport; a Unix socket connects to
+//! a running `v4 daemon` that owns the port, and TCP reaches network serial
+//! bridges. [`Simulator`](crate::sim::Simulator) runs a device in-process,
+//! and [`Loopback`] stands in for one in benchmarks and tests.
+//!
+//! [`open`] picks the transport from the port name.
+
+use crate::protocol::caps::MAX_LINK_MTU;
+use crate::protocol::{Command, ErrorCode, Frame, FrameDecoder, Request};
+use serialport::{ClearBuffer, SerialPort};
+use std::collections::VecDeque;
+use std::io::{self, Read, Write};
+use std::net::TcpStream;
+use std::time::Duration;
+
+/// Port name prefix for TCP endpoints (`tcp://HOST:PORT`)
+pub const TCP_SCHEME: &str = "tcp://";
+
+/// Open the transport named by `port`
+///
+/// `tcp://HOST:PORT` connects to a TCP endpoint, `sim://` starts an
+/// in-process simulated device, and anything else is a serial port opened
+/// at `baud_rate`.
+pub fn open(port: &str, baud_rate: u32) -> crate::Result<Box<dyn Transport>> {
+    if let Some(addr) = port.strip_prefix(TCP_SCHEME) {
+        let stream = TcpStream::connect(addr)?;
+        // Frames are written whole; don't hold them back for coalescing
+        stream.set_nodelay(true)?;
+        return Ok(Box::new(stream));
+    }
+    if port.starts_with(crate::sim::SIM_SCHEME) {
+        return Ok(Box::new(crate::sim::Simulator::new()));
+    }
+    let port = serialport::new(port, baud_rate)
+        .timeout(Duration::from_secs(5))
+        .open()?;
+    Ok(Box::new(port))
+}
+
+/// Bidirectional byte stream carrying V4-link frames
+pub trait Transport: Read + Write + Send {
+    /// Set the timeout for subsequent reads (never zero)
+    fn set_timeout(&mut self, timeout: Duration) -> io::Result<()>;
+
+    /// Discard input that has been received but not read
+    fn clear_input(&mut self) -> io::Result<()>;
+
+    /// Switch the line speed after a CAPS exchange
+    ///
+    /// Transports without a physical line ignore this; the far end applies
+    /// the change to its own port.
+    fn set_baud_rate(&mut self, _baud: u32) -> io::Result<()> {
+        Ok(())
+    }
+}
+
+impl Transport for Box<dyn SerialPort> {
+    fn set_timeout(&mut self, timeout: Duration) -> io::Result<()> {
+        SerialPort::set_timeout(self.as_mut(), timeout)?;
+        Ok(())
+    }
+
+    fn clear_input(&mut self) -> io::Result<()> {
+        self.clear(ClearBuffer::Input)?;
+        Ok(())
+    }
+
+    fn set_baud_rate(&mut self, baud: u32) -> io::Result<()> {
+        SerialPort::set_baud_rate(self.as_mut(), baud)?;
+        Ok(())
+    }
+}
+
+#[cfg(unix)]
+impl Transport for std::os::unix::net::UnixStream {
+    fn set_timeout(&mut self, timeout: Duration) -> io::Result<()> {
+        self.set_read_timeout(Some(timeout))
+    }
+
+    fn clear_input(&mut self) -> io::Result<()> {
+        drain_nonblocking(self, Self::set_nonblocking)
+    }
+}
+
+impl Transport for TcpStream {
+    fn set_timeout(&mut self, timeout: Duration) -> io::Result<()> {
+        self.set_read_timeout(Some(timeout))
+    }
+
+    fn clear_input(&mut self) -> io::Result<()> {
+        drain_nonblocking(self, Self::set_nonblocking)
+    }
+}
+
+/// Read and drop whatever is already queued on a socket
+fn drain_nonblocking<S: Read>(
+    stream: &mut S,
+    set_nonblocking: fn(&S, bool) -> io::Result<()>,
+) -> io::Result<()> {
+    set_nonblocking(stream, true)?;
+    let mut scratch = [0u8; 512];
+    let result = loop {
+        match stream.read(&mut scratch) {
+            Ok(0) => break Ok(()),
+            Ok(_) => {}
+            Err(e) if e.kind() == io::ErrorKind::WouldBlock => break Ok(()),
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => {}
+            Err(e) => break Err(e),
+        }
+    };
+    set_nonblocking(stream, false)?;
+    result
+}
+
+/// Device side of a [`Loopback`]
+pub trait Responder: Send {
+    /// Write the response to one request frame (`None` if it was corrupt)
+    /// into `out`, which is empty
+    ///
+    /// Writing nothing leaves the request unanswered; several frames may be
+    /// written at once.
+    fn respond(&mut self, request: Option<Request<'_>>, out: &mut Vec<u8>);
+}
+
+/// [`Responder`] that answers every command frame with OK
+///
+/// CAPS requests are echoed back, so negotiation agrees on whatever the
+/// host asks for; every other response carries no data. Corrupt frames get
+/// INVALID_FRAME.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct Echo;
+
+impl Responder for Echo {
+    fn respond(&mut self, request: Option<Request<'_>>, out: &mut Vec<u8>) {
+        let (seq, code, data) = match request {
+            Some(request) if request.command == Command::Caps as u8 => {
+                (request.seq, ErrorCode::Ok, request.payload)
+            }
+            Some(request) => (request.seq, ErrorCode::Ok, &[][..]),
+            None => (None, ErrorCode::InvalidFrame, &[][..]),
+        };
+        Frame::encode_response_into(seq, code, data, out);
+    }
+}
+
+/// In-memory device that answers each request frame as soon as it has
+/// been written
+///
+/// Responses come from a [`Responder`], [`Echo`] by default. Sequenced
+/// requests get sequenced responses. Reads with nothing queued time out
+/// immediately.
+pub struct Loopback<R = Echo> {
+    requests: FrameDecoder,
+    responses: VecDeque<u8>,
+    /// Response bytes being built, reused
+    frame: Vec<u8>,
+    responder: R,
+}
+
+impl Loopback {
+    pub fn new() -> Self {
+        Self::with_responder(Echo)
+    }
+}
+
+impl Default for Loopback {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<R: Responder> Loopback<R> {
+    pub fn with_responder(responder: R) -> Self {
+        Self {
+            requests: FrameDecoder::for_requests(MAX_LINK_MTU),
+            responses: VecDeque::new(),
+            frame: Vec::new(),
+            responder,
+        }
+    }
+
+    pub fn responder(&self) -> &R {
+        &self.responder
+    }
+
+    pub fn responder_mut(&mut self) -> &mut R {
+        &mut self.responder
+    }
+}
+
+impl<R: Responder> Read for Loopback<R> {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        if self.responses.is_empty() {
+            return Err(io::ErrorKind::TimedOut.into());
+        }
+        let n = buf.len().min(self.responses.len());
+        for (dst, src) in buf.iter_mut().zip(self.responses.drain(..n)) {
+            *dst = src;
+        }
+        Ok(n)
+    }
+}
+
+impl<R: Responder> Write for Loopback<R> {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        let mut rest = buf;
+        while !rest.is_empty() {
+            let spare = self.requests.spare();
+            let n = spare.len().min(rest.len());
+            spare[..n].copy_from_slice(&rest[..n]);
+            self.requests.commit(n);
+            rest = &rest[n..];
+
+            while let Some(range) = self.requests.next_frame_range() {
+                let request = range
+                    .ok()
+                    .map(|range| Frame::parse_request(self.requests.frame_at(range)));
+                self.frame.clear();
+                self.responder.respond(request, &mut self.frame);
+                self.responses.extend(&self.frame);
+            }
+        }
+        Ok(buf.len())
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        Ok(())
+    }
+}
+
+impl<R: Responder> Transport for Loopback<R> {
+    fn set_timeout(&mut self, _timeout: Duration) -> io::Result<()> {
+        Ok(())
+    }
+
+    fn clear_input(&mut self) -> io::Result<()> {
+        self.responses.clear();
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::serial::V4Serial;
+    use std::net::TcpListener;
+
+    #[test]
+    fn test_tcp_transport() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let port = format!("{}{}", TCP_SCHEME, listener.local_addr().unwrap());
+
+        // Bridge one connection to an in-memory device, a whole request
+        // frame at a time: `[STX][LEN u16]` then CMD, LEN payload bytes, CRC
+        let bridge = std::thread::spawn(move || {
+            let (mut stream, _) = listener.accept().unwrap();
+            let mut device = Loopback::new();
+            let mut frame = vec![0u8; 3];
+            let mut buf = [0u8; 512];
+            while stream.read_exact(&mut frame[..3]).is_ok() {
+                let len = u16::from_le_bytes([frame[1], frame[2]]) as usize;
+                frame.resize(3 + len + 2, 0);
+                stream.read_exact(&mut frame[3..]).unwrap();
+                device.write_all(&frame).unwrap();
+                while let Ok(n) = device.read(&mut buf) {
+                    stream.write_all(&buf[..n]).unwrap();
+                }
+            }
+        });
+
+        let mut serial = V4Serial::open(&port, 115_200).unwrap();
+        let timeout = Duration::from_secs(5);
+        assert_eq!(serial.ping(timeout).unwrap(), ErrorCode::Ok);
+        assert_eq!(
+            serial.exec(&[0x51; 64], timeout).unwrap().error_code,
+            ErrorCode::Ok
+        );
+        drop(serial);
+        bridge.join().unwrap();
+    }
+
+    #[test]
+    fn test_tcp_transport_closed() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let port = format!("{}{}", TCP_SCHEME, listener.local_addr().unwrap());
+        let bridge = std::thread::spawn(move || drop(listener.accept().unwrap()));
+
+        let mut serial = V4Serial::open(&port, 115_200).unwrap();
+        bridge.join().unwrap();
+        // Fails at once instead of spinning until the timeout
+        let started = std::time::Instant::now();
+        match serial.recv_frame(Duration::from_secs(5)) {
+            Err(crate::V4Error::Io(e)) => assert_eq!(e.kind(), io::ErrorKind::UnexpectedEof),
+            other => panic!("expected EOF, got {:?}", other),
+        }
+        assert!(started.elapsed() < Duration::from_secs(1));
+    }
+}
@@ -2,6 +2,17 @@
 #![allow(non_camel_case_types)]
 
 use std::os::raw::{c_char, c_int};
+use std::sync::{Mutex, MutexGuard};
+
+// Held around every call into V4-front. The library makes no reentrancy
+// guarantees, so threads of one process take turns inside it; `v4 compile`
+// runs parallel compiles in child processes instead.
+static LIBRARY: Mutex<()> = Mutex::new(());
+
+/// Take the lock that serializes calls into V4-front
+pub fn lock() -> MutexGuard<'static, ()> {
+    LIBRARY.lock().unwrap_or_else(|e| e.into_inner())
+}
 
 // V4-front error codes (from v4front/errors.h)
 pub type v4front_err = c_int;
@@ -67,6 +78,7 @@ pub fn compile_source(source: &str) -> Result<V4FrontBuf, String> {
     };
     let mut err_buf = vec![0u8; 256];
 
+    let _library = lock();
     let result = unsafe {
         v4front_compile(
             c_source.as_ptr(),
@@ -99,7 +111,10 @@ pub fn save_bytecode(buf: &V4FrontBuf, path: &std::path::Path) -> Result<(), Str
     let path_str = path.to_str().ok_or("Invalid path")?;
     let c_path = CString::new(path_str).map_err(|_| "Invalid path string")?;
 
-    let result = unsafe { v4front_save_bytecode(buf as *const V4FrontBuf, c_path.as_ptr()) };
+    let result = {
+        let _library = lock();
+        unsafe { v4front_save_bytecode(buf as *const V4FrontBuf, c_path.as_ptr()) }
+    };
 
     if result != 0 {
         Err(format!("Failed to save bytecode (error code {})", result))
@@ -109,6 +124,7 @@ pub fn save_bytecode(buf: &V4FrontBuf, path: &std::path::Path) -> Result<(), Str
 }
 
 pub fn free_bytecode(mut buf: V4FrontBuf) {
+    let _library = lock();
     unsafe {
         v4front_free(&mut buf as *mut V4FrontBuf);
     }